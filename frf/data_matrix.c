@@ -11,6 +11,7 @@
 #include "data_matrix.h"
 
 #include <stdlib.h>
+#include <math.h>
 
 
 
@@ -390,6 +391,7 @@ DataMatrix * DataMatrix_new(PyObject * obj, int * max)
   this->weights = weights;
   this->blocks = fbc;
   this->max = (int*)((char*)this + sizeof(DataMatrix) + fbc*sizeof(FeatureBlock));
+  this->bins = NULL;
   
   if (this->weights!=NULL)
   {
@@ -462,6 +464,22 @@ void DataMatrix_delete(DataMatrix * this)
   {
    FeatureBlock_deinit(this->block + i); 
   }
+  
+ // Free any quantile bins...
+  if (this->bins!=NULL)
+  {
+   for (i=0; i<this->features; i++)
+   {
+    if (this->bins[i]!=NULL)
+    {
+     free(this->bins[i]->bin);
+     free(this->bins[i]->top);
+     free(this->bins[i]->split);
+     free(this->bins[i]);
+    }
+   }
+   free(this->bins);
+  }
    
  // Terminate left leg with prejudice...
   free(this);
@@ -559,6 +577,103 @@ int DataMatrix_Max(DataMatrix * this, int feature)
   return this->max[feature];
 }
 
+void DataMatrix_Prime(DataMatrix * this)
+{
+ int i;
+ for (i=0; i<this->features; i++)
+ {
+  if (DataMatrix_Type(this, i)==DISCRETE) DataMatrix_Max(this, i);
+ }
+}
+
+
+
+// Helper for below...
+static int compare_float(const void * a, const void * b)
+{
+ float va = *(const float*)a;
+ float vb = *(const float*)b;
+ 
+ if (va<vb) return -1;
+ if (va>vb) return 1;
+ return 0;
+}
+
+QuantileBins * DataMatrix_Bins(DataMatrix * this, int feature)
+{
+ int i;
+ 
+ // Check the cache...
+  if (this->bins==NULL)
+  {
+   this->bins = (QuantileBins**)malloc(this->features * sizeof(QuantileBins*));
+   for (i=0; i<this->features; i++) this->bins[i] = NULL;
+  }
+  
+  if (this->bins[feature]!=NULL) return this->bins[feature];
+ 
+ // Extract the values and sort a copy of them...
+  int n = this->exemplars;
+  float * value = (float*)malloc(n * sizeof(float));
+  float * sorted = (float*)malloc(n * sizeof(float));
+  
+  for (i=0; i<n; i++)
+  {
+   value[i] = DataMatrix_GetContinuous(this, i, feature);
+   sorted[i] = value[i];
+  }
+  
+  qsort(sorted, n, sizeof(float), compare_float);
+ 
+ // Choose the boundaries at evenly spaced quantiles, skipping repeats so every bin gets at least one distinct value...
+  QuantileBins * qb = (QuantileBins*)malloc(sizeof(QuantileBins));
+  qb->split = (float*)malloc((QUANTILE_BINS-1) * sizeof(float));
+  qb->bins = 1;
+  
+  if (n>0)
+  {
+   float prev = sorted[0];
+   for (i=1; i<QUANTILE_BINS; i++)
+   {
+    float v = sorted[((long long)i * n) / QUANTILE_BINS];
+    if (v>prev)
+    {
+     qb->split[qb->bins-1] = v;
+     qb->bins += 1;
+     prev = v;
+    }
+   }
+  }
+  
+ // Assign each exemplar to a bin with a binary search, recording the largest value in each bin as we go...
+  qb->top = (float*)malloc(qb->bins * sizeof(float));
+  qb->bin = (unsigned char*)malloc(n * sizeof(unsigned char));
+  
+  for (i=0; i<qb->bins; i++) qb->top[i] = -HUGE_VALF;
+  
+  for (i=0; i<n; i++)
+  {
+   int low = 0;
+   int high = qb->bins - 1;
+   while (low<high)
+   {
+    int half = (low + high) / 2;
+    if (value[i]<qb->split[half]) high = half;
+                             else low = half + 1;
+   }
+   
+   qb->bin[i] = low;
+   if (value[i]>qb->top[low]) qb->top[low] = value[i];
+  }
+ 
+ // Clean up, store and return...
+  free(sorted);
+  free(value);
+  
+  this->bins[feature] = qb;
+  return qb;
+}
+
 
 
 void Setup_DataMatrix(void)
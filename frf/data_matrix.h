@@ -73,6 +73,21 @@ float FeatureBlock_GetContinuous(FeatureBlock * this, int exemplar, int feature)
 
 
 
+// Quantile binning of a continuous feature, as used by the histogram learner - the values are split into at most QUANTILE_BINS bins holding roughly equal numbers of exemplars (fewer bins if the feature has fewer distinct values, in which case every distinct value gets its own bin)...
+#define QUANTILE_BINS 256
+
+typedef struct QuantileBins QuantileBins;
+
+struct QuantileBins
+{
+ int bins; // Number of bins.
+ float * split; // bins-1 increasing boundaries - bin b contains the values in [split[b-1], split[b]).
+ float * top; // Largest value that landed in each bin, so a threshold can be placed between bins rather than on a boundary.
+ unsigned char * bin; // Bin of each exemplar.
+};
+
+
+
 // A DataMatrix object - just a data matrix, except it accepts both continuous and discrete entrys, and can be initialised using a list of arrays to get this feature. Can also use arrays with not enough exemplars in, which will be accessed modulus their length...
 typedef struct DataMatrix DataMatrix;
 
@@ -85,6 +100,9 @@ struct DataMatrix
  // Maximum values, for making categorical distributions...
   int * max;
   
+ // Quantile bins of continuous features, indexed by feature, with NULL for those not yet requested - the array itself is NULL until the first request...
+  QuantileBins ** bins;
+  
  // Weights...
   PyArrayObject * weights;
   ToContinuous weights_continuous;
@@ -107,9 +125,17 @@ float DataMatrix_GetContinuous(DataMatrix * this, int exemplar, int feature);
 
 float DataMatrix_GetWeight(DataMatrix * this, int exemplar);
 
-// Returns the maximum value of a discrete feature, noting that it always includes zero and can be fixed in construction if the user wants space for extra values/to ignore values past a fixed point - its basically how big to make categorical distributions from the data...
+// Returns the maximum value of a discrete feature, noting that it always includes zero and can be fixed in construction if the user wants space for extra values/to ignore values past a fixed point - its basically how big to make categorical distributions from the data. Calculated the first time it is requested and cached in the DataMatrix without a lock, so the first call for each feature must not happen when other threads are using it...
 int DataMatrix_Max(DataMatrix * this, int feature);
 
+// Fills in the lazy caches that training reads from many threads at once - calls DataMatrix_Max for every discrete feature, as the summaries created inside the training threads ask for it. Must be called on both data matrices before the training threads start (the quantile bins are filled in by the learners on creation, which also happens before)...
+void DataMatrix_Prime(DataMatrix * this);
+
+
+
+// Returns the quantile bins of a continuous feature, calculating them the first time they are requested and caching them in the DataMatrix, so every learner created from it (e.g. one per training thread) shares them. Like DataMatrix_Max this writes to the DataMatrix, so the first call for each feature must not happen when other threads are using it - the learners call it on creation...
+QuantileBins * DataMatrix_Bins(DataMatrix * this, int feature);
+
 
 
 // Setup this module - for internal use only...
@@ -9,6 +9,7 @@
 
 
 import bz2
+import mmap
 
 
 
@@ -24,9 +25,11 @@ from frf_c import *
 
 
 
-def save_forest(fn, forest):
-  """Saves a forest - the actual Forest interface is fairly flexible, so this is just one way of doing it - streams the Forest header followed by each Tree into a bzip2 compressed file. Suggested extension is '.rf'. The code for this is in Python, and forms a good reference if you need to write your own i/o for this module."""
-  f = bz2.BZ2File(fn, 'w')
+def save_forest(fn, forest, compress = True):
+  """Saves a forest - the actual Forest interface is fairly flexible, so this is just one way of doing it - streams the Forest header followed by each Tree into a bzip2 compressed file. Suggested extension is '.rf'. If compress is False the file is not compressed, which makes it bigger but allows load_forest to memory map it. The code for this is in Python, and forms a good reference if you need to write your own i/o for this module."""
+  if compress: f = bz2.BZ2File(fn, 'w')
+  else: f = open(fn, 'wb')
+  
   f.write(forest.save())
   
   for i in xrange(len(forest)):
@@ -36,11 +39,38 @@ def save_forest(fn, forest):
 
   
   
-def load_forest(fn):
-  """Loads a forest that was previous saved using the save_forest function. The code for this is in Python, and forms a good reference if you need to write your own i/o for this module."""
+def load_forest(fn, mapped = False):
+  """Loads a forest that was previous saved using the save_forest function, compressed or not. If mapped is True, which requires an uncompressed file, the file is memory mapped, read only, and the trees are views of the mapping rather than copies - loading is then almost instant and takes no memory of its own, and processes that load the same file share its pages. You will probably want to set the flatten variable of the returned Forest to False in that case, as the flattened trees are a private copy. The code for this is in Python, and forms a good reference if you need to write your own i/o for this module."""
   # Prepare...
   ret = Forest()
-  f = bz2.BZ2File(fn, 'r')
+  
+  f = open(fn, 'rb')
+  compressed = f.read(4)!='FRFF'
+  f.seek(0)
+  
+  if mapped:
+    if compressed: raise ValueError('Only uncompressed forests can be memory mapped - see save_forest')
+    
+    data = mmap.mmap(f.fileno(), 0, access=mmap.ACCESS_READ)
+    f.close() # The mapping remains valid.
+    
+    # The Forest header...
+    head_size = Forest.size_from_initial(data[:Forest.initial_size()])
+    trees = ret.load(data[:head_size])
+    
+    # Each tree in return, as a view of the mapping (which they keep alive)...
+    offset = head_size
+    for _ in xrange(trees):
+      tree = Tree.view(data, offset)
+      offset += Tree.size_from_head(data[offset:offset+Tree.head_size()])
+      
+      ret.append(tree)
+    
+    return ret
+  
+  if compressed:
+    f.close()
+    f = bz2.BZ2File(fn, 'r')
   
   # The Forest header, which comes with a fixed size initial part and then a variable size second part...
   initial_head = f.read(Forest.initial_size())
@@ -63,3 +93,4 @@ def load_forest(fn):
   # Cleanup and return...
   f.close()
   return ret
+
@@ -15,6 +15,8 @@
 #include <numpy/arrayobject.h>
 
 #include <limits.h>
+#include <unistd.h>
+#include <pthread.h>
 
 
 #include "summary.h"
@@ -39,14 +41,27 @@ void TreeBuffer_new(TreeBuffer * this, size_t size)
 {
  this->size = size;
  this->tree = malloc(size);
+ this->owner = NULL;
  
- this->ready = 0;
+ this->index = NULL;
+ this->flat = NULL;
+ this->flat_failed = 0;
 }
 
 void TreeBuffer_dealloc(TreeBuffer * this)
 {
- if (this->ready!=0) Tree_deinit(this->tree);
- free(this->tree);
+ if (this->flat!=NULL) FlatTree_delete(this->flat);
+ free(this->index);
+ 
+ if (this->owner!=NULL) Py_DECREF(this->owner);
+                   else free(this->tree);
+}
+
+// Returns the index of the tree, building it if this is the first request - returns NULL with a Python error set if the tree is corrupt...
+size_t * TreeBuffer_index(TreeBuffer * this)
+{
+ if (this->index==NULL) this->index = Tree_index(this->tree);
+ return this->index;
 }
 
 
@@ -73,6 +88,52 @@ static void TreeBuffer_dealloc_py(TreeBuffer * self)
 }
 
 
+static PyObject * TreeBuffer_view_py(PyObject * ignored, PyObject * args)
+{
+ // Extract the parameters...
+  PyObject * owner;
+  Py_ssize_t offset = 0;
+  if (!PyArg_ParseTuple(args, "O|n", &owner, &offset)) return NULL;
+  
+ // Get at the memory of the object...
+  const void * data;
+  Py_ssize_t data_size;
+  if (PyObject_AsReadBuffer(owner, &data, &data_size)!=0) return NULL;
+  
+ // Check there is a tree at the offset, that fits...
+  if ((offset<0)||((offset+(Py_ssize_t)Tree_head_size())>data_size))
+  {
+   PyErr_SetString(PyExc_ValueError, "Offset does not leave enough space for a Tree header.");
+   return NULL;
+  }
+  
+  Tree * tree = (Tree*)((char*)data + offset);
+  if (Tree_safe(tree)==0) return NULL;
+  
+  if ((offset+(Py_ssize_t)Tree_size(tree))>data_size)
+  {
+   PyErr_SetString(PyExc_ValueError, "Tree extends past the end of the buffer.");
+   return NULL;
+  }
+ 
+ // Allocate the object, and point it at the memory...
+  TreeBuffer * self = (TreeBuffer*)TreeBufferType.tp_alloc(&TreeBufferType, 0);
+  if (self==NULL) return NULL;
+  
+  self->size = Tree_size(tree);
+  self->tree = tree;
+  self->owner = owner;
+  Py_INCREF(owner);
+  
+  self->index = NULL;
+  self->flat = NULL;
+  self->flat_failed = 0;
+  
+ // Return the new object...
+  return (PyObject*)self;
+}
+
+
 
 static PyObject * TreeBuffer_head_size_py(Forest * self, PyObject * args)
 {
@@ -120,15 +181,21 @@ static PyObject * TreeBuffer_trained_py(TreeBuffer * self, PyObject * args)
 
 static PyObject * TreeBuffer_human_py(TreeBuffer * self, PyObject * args)
 {
- return Tree_human(self->tree);
+ size_t * index = TreeBuffer_index(self);
+ if (index==NULL) return NULL;
+ 
+ return Tree_human(self->tree, index);
 }
 
 
 static PyObject * TreeBuffer_importance_py(TreeBuffer * self, PyObject * args)
 {
  // Get the data...
+  size_t * index = TreeBuffer_index(self);
+  if (index==NULL) return NULL;
+  
   int length;
-  const float * importance = Tree_importance(self->tree, &length);
+  const float * importance = Tree_importance(self->tree, index, &length);
  
  // Create a numpy array...
   npy_intp dim = length;
@@ -159,6 +226,17 @@ static Py_ssize_t TreeBuffer_buffer_get(TreeBuffer * self, Py_ssize_t index, con
  return self->size;
 }
 
+static Py_ssize_t TreeBuffer_buffer_write(TreeBuffer * self, Py_ssize_t index, const void **ptr)
+{
+ if (self->owner!=NULL)
+ {
+  PyErr_SetString(PyExc_TypeError, "Tree is a view of memory it does not own, and is read only");
+  return -1;
+ }
+ 
+ return TreeBuffer_buffer_get(self, index, ptr);
+}
+
 static Py_ssize_t TreeBuffer_buffer_segs(TreeBuffer * self, Py_ssize_t * lenp)
 {
  if (lenp!=NULL) *lenp = self->size;
@@ -168,7 +246,7 @@ static Py_ssize_t TreeBuffer_buffer_segs(TreeBuffer * self, Py_ssize_t * lenp)
 static int TreeBuffer_buffer_acquire(TreeBuffer * self, Py_buffer * view, int flags)
 {
  if (view == NULL) return 0;
- return PyBuffer_FillInfo(view, (PyObject*)self, (void*)self->tree, self->size, 0, flags);
+ return PyBuffer_FillInfo(view, (PyObject*)self, (void*)self->tree, self->size, (self->owner!=NULL) ? 1 : 0, flags);
 }
 
 static void TreeBuffer_buffer_release(TreeBuffer * self, Py_buffer * view)
@@ -180,7 +258,7 @@ static void TreeBuffer_buffer_release(TreeBuffer * self, Py_buffer * view)
 static PyBufferProcs TreeBuffer_as_buffer =
 {
  (readbufferproc)TreeBuffer_buffer_get,
- (writebufferproc)TreeBuffer_buffer_get,
+ (writebufferproc)TreeBuffer_buffer_write,
  (segcountproc)TreeBuffer_buffer_segs,
  NULL,
  (getbufferproc)TreeBuffer_buffer_acquire,
@@ -201,6 +279,7 @@ static PyMethodDef TreeBuffer_methods[] =
 {
  {"head_size", (PyCFunction)TreeBuffer_head_size_py, METH_NOARGS | METH_STATIC, "Returns how many bytes are in the header of a Tree, so you can read the entire header from a stream."},
  {"size_from_head", (PyCFunction)TreeBuffer_size_from_head_py, METH_VARARGS | METH_STATIC, "Given the head, as a read-only buffer compatible object (string, return value of read(), numpy array.) this returns the size of the associated tree, or throws an error if there is something wrong."},
+ {"view", (PyCFunction)TreeBuffer_view_py, METH_VARARGS | METH_STATIC, "Given an object that provides a read-only buffer (e.g. an mmap of a file) and an optional offset into it, in bytes, returns a Tree that uses the memory of that object rather than a copy, keeping a reference to it. The Tree is read only - the memoryview interface will not allow writes. Used by load_forest to memory map forests, so processes loading the same file share its pages."},
  {"nodes", (PyCFunction)TreeBuffer_nodes_py, METH_NOARGS, "Returns how many nodes are in the tree."},
  {"trained", (PyCFunction)TreeBuffer_trained_py, METH_NOARGS, "Returns how many exemplars were used to train this tree."},
  {"human", (PyCFunction)TreeBuffer_human_py, METH_NOARGS, "Returns a human understandable representation of the tree - horribly inefficient data structure and of no use beyond human consumption, so for testing/diagnostics/curiosity only. Each leaf node is represented by a string giving the distributions assigned to the output variables, each test by a string. Non-leaf nodes are then represented by dictionaries, containing 'test', 'pass' and 'fail'."},
@@ -233,7 +312,7 @@ static PyTypeObject TreeBufferType =
  0,                                /*tp_setattro*/
  &TreeBuffer_as_buffer,            /*tp_as_buffer*/
  Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE | Py_TPFLAGS_HAVE_NEWBUFFER, /*tp_flags*/
- "A tree within the Forest, but it provides no functionality - its only useful when attached to a Forest. Exists for loading Trees from a seperate source, such as a file or another Forest object (with a compatible configuration). Constructed with a size, in bytes, and impliments the memoryview(tree) interface, so you can extract/set the data within. The contents is entirly streamable, and therefore safe to be dumped to disk/socket etc. - file.write(my_tree) works, as does file.readinto(my_tree). It does have some static methods that provide useful information for loading a tree from a stream - size of the header, and header to total size.", /* tp_doc */
+ "A tree within the Forest, but it provides no functionality - its only useful when attached to a Forest. Exists for loading Trees from a seperate source, such as a file or another Forest object (with a compatible configuration). Constructed with a size, in bytes, and impliments the memoryview(tree) interface, so you can extract/set the data within. The contents is entirly streamable, and therefore safe to be dumped to disk/socket etc. - file.write(my_tree) works, as does file.readinto(my_tree). Can alternatively be a read only view of memory belonging to another object, via the static view method. It does have some static methods that provide useful information for loading a tree from a stream - size of the header, and header to total size.", /* tp_doc */
  0,                                /* tp_traverse */
  0,                                /* tp_clear */
  0,                                /* tp_richcompare */
@@ -283,6 +362,8 @@ void Forest_new(Forest * this)
  
  this->info_ratios = NULL;
  
+ this->flatten = 1;
+ 
  this->trees = 0;
  this->tree = NULL;
  
@@ -863,6 +944,8 @@ static PyObject * Forest_clone_py(Forest * self, PyObject * args)
   ret->info_ratios = self->info_ratios;
   Py_XINCREF(ret->info_ratios);
   
+  ret->flatten = self->flatten;
+  
   ret->trees = 0;
   ret->tree = NULL;
   
@@ -983,25 +1066,115 @@ struct CallbackData
  int report_gap;
 };
 
+
+
+// Support for training trees in parallel - each thread gets a TrainWorker, containing its own LearnerSet, InfoSet and IndexSet, so the only things that are shared are the data matrices, which are only read (their lazy caches are primed before the threads start), and the job, which hands out trees one at a time under a lock. Every tree gets its own block of the random number sequence (the Forests key with the tree number added to the second most significant word), so the trees learnt do not depend on the number of threads. Out of bag leaves are written straight into the Forests ss array, where each tree has its own slots...
+typedef struct TrainJob TrainJob;
+typedef struct TrainWorker TrainWorker;
+
+struct TrainJob
+{
+ Forest * self;
+ DataMatrix * x;
+ DataMatrix * y;
+ 
+ int create; // Number of trees to learn.
+ Tree ** out; // Where each tree goes, indexed by tree number.
+ size_t ** index; // Index of each tree, as built by Tree_index.
+ unsigned int key[4]; // Base of the random number sequence - see above.
+ 
+ int next; // Next tree to hand out.
+ pthread_mutex_t lock; // Protects next and the callback data.
+ 
+ CallbackData * cd;
+ PyThreadState * save; // State of the calling thread whilst the GIL is released - progress reports only come from that thread, which takes the GIL back to make them.
+};
+
+struct TrainWorker
+{
+ TrainJob * job;
+ int caller; // Non-zero if this is the worker that runs in the calling thread.
+ 
+ TreeParam tp;
+ IndexSet * indices;
+ unsigned int key[4];
+};
+
+
 void CallbackReport(int count, void * ptr)
 {
- CallbackData * this = (CallbackData*)ptr;
+ TrainWorker * worker = (TrainWorker*)ptr;
+ TrainJob * job = worker->job;
+ CallbackData * this = job->cd;
  
- this->done += count;
- if ((this->last_report+this->report_gap)<this->done)
- {
-  this->last_report = this->done;
-  if (this->callback!=NULL)
+ pthread_mutex_lock(&job->lock);
+  this->done += count;
+  int done = this->done;
+  
+  int report = 0;
+  if ((worker->caller!=0)&&((this->last_report+this->report_gap)<this->done))
   {
-   
-   PyObject * args = Py_BuildValue("ii", this->done, this->total);
+   this->last_report = this->done;
+   report = 1;
+  }
+ pthread_mutex_unlock(&job->lock);
+ 
+ if ((report!=0)&&(this->callback!=NULL))
+ {
+  PyEval_RestoreThread(job->save);
+  
+   PyObject * args = Py_BuildValue("ii", done, this->total);
    PyObject * result = PyObject_CallObject(this->callback, args);
    Py_DECREF(args);
    
    if (result==NULL) PyErr_Clear();
              else Py_DECREF(result);
-  }
+  
+  job->save = PyEval_SaveThread();
+ }
+}
+
+
+void * TrainWorker_run(void * ptr)
+{
+ TrainWorker * this = (TrainWorker*)ptr;
+ TrainJob * job = this->job;
+ Forest * self = job->self;
+ 
+ while (1)
+ {
+  // Grab the next tree...
+   pthread_mutex_lock(&job->lock);
+    int t = job->next;
+    job->next += 1;
+   pthread_mutex_unlock(&job->lock);
+   
+   if (t>=job->create) break;
+  
+  // Setup this trees block of the random number sequence...
+   int i;
+   for (i=0; i<4; i++) this->key[i] = job->key[i];
+   this->key[1] += t;
+   
+  // Prepare for the learning...
+   if (self->bootstrap==0) IndexSet_init_all(this->indices);
+                      else IndexSet_init_bootstrap(this->indices, this->key);
+
+  // Learn a new tree - this is going to take a while...
+   Tree * tree = Tree_learn(&this->tp, this->indices, CallbackReport, this);
+   job->out[t] = tree;
+   job->index[t] = Tree_index(tree);
+   
+  // If needed record the leaf nodes into which the oob exemplars land...
+   if (self->bootstrap!=0)
+   {
+    IndexSet * oob = IndexSet_new_reflect(this->indices);
+    Tree_run_many(tree, job->index[t], job->x, oob, self->ss + t, job->create);
+    IndexSet_delete(oob);
+   }
  }
+ 
+ return NULL;
 }
 
 
@@ -1014,137 +1187,184 @@ static PyObject * Forest_train_py(Forest * self, PyObject * args)
   PyObject * x_obj;
   PyObject * y_obj;
   int create = 1;
+  int threads = 1;
   CallbackData cd;
   cd.callback = NULL;
-  if (!PyArg_ParseTuple(args, "OO|iO", &x_obj, &y_obj, &create, &cd.callback)) return NULL;
+  if (!PyArg_ParseTuple(args, "OO|iOi", &x_obj, &y_obj, &create, &cd.callback, &threads)) return NULL;
+  if (cd.callback==Py_None) cd.callback = NULL;
+  
+  if (threads<1) threads = sysconf(_SC_NPROCESSORS_ONLN);
+  if (threads>create) threads = create;
+  if (threads<1) threads = 1;
 
  // Create all the required objects, with lots of error checking/rollback requirements...
-  TreeParam tp;
-  tp.x = NULL;
-  tp.y = NULL;
-  tp.ls = NULL;
-  tp.is = NULL;
-  tp.summary_codes = self->summary_codes;
-  tp.key = self->key;
-  tp.opt_features = self->opt_features;
-  tp.min_exemplars = self->min_exemplars;
-  tp.max_splits = self->max_splits;
-  
-  tp.x = DataMatrix_new(x_obj, self->x_max);
-  if (tp.x==NULL) return NULL;
-  if (tp.x->features!=self->x_feat)
-  {
-   DataMatrix_delete(tp.x);
+  TrainJob job;
+  job.self = self;
+  job.create = create;
+  job.next = 0;
+  job.cd = &cd;
+  for (i=0; i<4; i++) job.key[i] = self->key[i];
+  
+  job.x = DataMatrix_new(x_obj, self->x_max);
+  if (job.x==NULL) return NULL;
+  if (job.x->features!=self->x_feat)
+  {
+   DataMatrix_delete(job.x);
    PyErr_SetString(PyExc_ValueError, "X datamatrix has wrong number features.");
    return NULL; 
   }
   
-  tp.y = DataMatrix_new(y_obj, self->y_max);
-  if (tp.y==NULL)
+  job.y = DataMatrix_new(y_obj, self->y_max);
+  if (job.y==NULL)
   {
-   DataMatrix_delete(tp.x);
+   DataMatrix_delete(job.x);
    return NULL; 
   }
-  if (tp.y->features!=self->y_feat)
+  if (job.y->features!=self->y_feat)
   {
    PyErr_SetString(PyExc_ValueError, "Y datamatrix has wrong number features.");
-   DataMatrix_delete(tp.y);
-   DataMatrix_delete(tp.x);
+   DataMatrix_delete(job.y);
+   DataMatrix_delete(job.x);
    return NULL; 
   }
   
-  if (tp.x->exemplars!=tp.y->exemplars)
+  if (job.x->exemplars!=job.y->exemplars)
   {
    PyErr_SetString(PyExc_ValueError, "Data matrices must have the same number of exemplars.");
-   DataMatrix_delete(tp.y);
-   DataMatrix_delete(tp.x);
+   DataMatrix_delete(job.y);
+   DataMatrix_delete(job.x);
    return NULL; 
   }
-    
-  tp.ls = LearnerSet_new(tp.x, self->learn_codes);
-  if (tp.ls==NULL)
-  {
-   DataMatrix_delete(tp.y);
-   DataMatrix_delete(tp.x);
-   return NULL;  
-  }
   
-  tp.is = InfoSet_new(tp.y, self->info_codes, self->info_ratios);
-  if (tp.is==NULL)
+ // Fill in the lazy caches of the data matrices now, as the workers only read them...
+  DataMatrix_Prime(job.x);
+  DataMatrix_Prime(job.y);
+  
+ // Create the workers, each with its own scratch objects...
+  TrainWorker * worker = (TrainWorker*)malloc(threads * sizeof(TrainWorker));
+  
+  for (i=0; i<threads; i++)
   {
-   LearnerSet_delete(tp.ls);
-   DataMatrix_delete(tp.y);
-   DataMatrix_delete(tp.x);
-   return NULL; 
+   TrainWorker * targ = worker + i;
+   targ->job = &job;
+   targ->caller = (i==0) ? 1 : 0;
+   
+   targ->tp.x = job.x;
+   targ->tp.y = job.y;
+   targ->tp.summary_codes = self->summary_codes;
+   targ->tp.key = targ->key;
+   targ->tp.opt_features = self->opt_features;
+   targ->tp.min_exemplars = self->min_exemplars;
+   targ->tp.max_splits = self->max_splits;
+   
+   targ->tp.ls = LearnerSet_new(job.x, self->learn_codes);
+   targ->tp.is = NULL;
+   if (targ->tp.ls!=NULL) targ->tp.is = InfoSet_new(job.y, self->info_codes, self->info_ratios);
+   
+   if (targ->tp.is==NULL)
+   {
+    if (targ->tp.ls!=NULL) LearnerSet_delete(targ->tp.ls);
+    
+    int j;
+    for (j=0; j<i; j++)
+    {
+     IndexSet_delete(worker[j].indices);
+     InfoSet_delete(worker[j].tp.is);
+     LearnerSet_delete(worker[j].tp.ls);
+    }
+    free(worker);
+    
+    DataMatrix_delete(job.y);
+    DataMatrix_delete(job.x);
+    return NULL; 
+   }
+   
+   targ->indices = IndexSet_new(job.x->exemplars);
   }
-  
-  IndexSet * indices = IndexSet_new(tp.x->exemplars);
 
  // If we are doing oob prepare...
   if (self->bootstrap!=0)
   {
-   if (self->ss_size<create*tp.x->exemplars)
+   if (self->ss_size<create*job.x->exemplars)
    {
-    self->ss_size = create*tp.x->exemplars;
+    self->ss_size = create*job.x->exemplars;
     self->ss = realloc(self->ss, self->ss_size * sizeof(SummarySet*));
    }
    
-   for (i=0; i<create*tp.x->exemplars; i++)
+   for (i=0; i<create*job.x->exemplars; i++)
    {
     self->ss[i] = NULL;
    }
   }
   
- // Enlarge tree array...
+ // Enlarge tree array, and create the output for the workers...
   self->tree = (TreeBuffer**)realloc(self->tree, (self->trees+create)*sizeof(TreeBuffer*));
+  job.out = (Tree**)malloc(create * sizeof(Tree*));
+  job.index = (size_t**)malloc(create * sizeof(size_t*));
   
  // Prepare callback structure...
   cd.done = 0;
-  cd.total = tp.x->exemplars * create;
+  cd.total = job.x->exemplars * create;
   cd.report_gap = (cd.total / 1000) + 1;
   cd.last_report = -cd.report_gap;
   
+ // Learn the trees, releasing the GIL - the extra threads are started, noting that a failure to create one just means the others do more work, and this thread does its share...
+  pthread_mutex_init(&job.lock, NULL);
+  job.save = PyEval_SaveThread();
   
- // Loop and create each tree in turn...
+   pthread_t * handle = (pthread_t*)malloc(threads * sizeof(pthread_t));
+   int started = 1;
+   for (i=1; i<threads; i++)
+   {
+    if (pthread_create(handle + started, NULL, TrainWorker_run, worker + i)!=0) break;
+    started += 1;
+   }
+  
+   TrainWorker_run(worker);
+  
+   for (i=1; i<started; i++) pthread_join(handle[i], NULL);
+   free(handle);
+  
+  PyEval_RestoreThread(job.save);
+  pthread_mutex_destroy(&job.lock);
+  
+ // Move the key on past the blocks of the random number sequence that have been used...
+  self->key[1] += create;
+  
+ // Create a tree buffer for each new tree and dump it into the right position...
   for (i=0; i<create; i++)
   {
-   // Prepare for the learning...
-    if (self->bootstrap==0) IndexSet_init_all(indices);
-                       else IndexSet_init_bootstrap(indices, self->key);
-
-   // Learn a new tree - this is going to take a while...
-    Tree * tree = Tree_learn(&tp, indices, CallbackReport, &cd);
-   
-   // Create a tree buffer and dump it into the right position...
-    TreeBuffer * tb = (TreeBuffer*)TreeBufferType.tp_alloc(&TreeBufferType, 0);
-    tb->size = Tree_size(tree);
-    tb->tree = tree;
-    tb->ready = 1;
+   TreeBuffer * tb = (TreeBuffer*)TreeBufferType.tp_alloc(&TreeBufferType, 0);
+   tb->size = Tree_size(job.out[i]);
+   tb->tree = job.out[i];
+   tb->owner = NULL;
+   tb->index = job.index[i];
+   tb->flat = NULL;
+   tb->flat_failed = 0;
    
-    self->tree[self->trees+i] = tb;
-    
-   // If needed record the leaf nodes into which the oob exemplars land...
-    if (self->bootstrap!=0)
-    {
-     IndexSet * oob = IndexSet_new_reflect(indices);
-     Tree_run_many(tree, tp.x, oob, self->ss+i, create);
-     IndexSet_delete(oob);
-    }
+   self->tree[self->trees+i] = tb;
   }
   
   self->trees += create;
  
  // Clean up (mostly)...
-  IndexSet_delete(indices);
- 
-  InfoSet_delete(tp.is);
-  LearnerSet_delete(tp.ls);
-  DataMatrix_delete(tp.x);
+  free(job.out);
+  free(job.index);
+  
+  for (i=0; i<threads; i++)
+  {
+   IndexSet_delete(worker[i].indices);
+   InfoSet_delete(worker[i].tp.is);
+   LearnerSet_delete(worker[i].tp.ls);
+  }
+  free(worker);
+  
+  DataMatrix_delete(job.x);
   
  // Return, either None or construct and return a vector of oob errors...  
   if (self->bootstrap==0)
   {
-   DataMatrix_delete(tp.y);
+   DataMatrix_delete(job.y);
    Py_INCREF(Py_None);
    return Py_None;
   }
@@ -1159,7 +1379,7 @@ static PyObject * Forest_train_py(Forest * self, PyObject * args)
 
    // Iterate the exemplars and sum their error into the output...
     float total = 0.0;
-    for (i=0; i<tp.y->exemplars; i++)
+    for (i=0; i<job.y->exemplars; i++)
     {
      SummarySet ** base = self->ss + create*i;
      int count = 0;
@@ -1176,12 +1396,12 @@ static PyObject * Forest_train_py(Forest * self, PyObject * args)
      
      if (count!=0)
      {
-      SummarySet_error(count, base, tp.y, i, out);
-      total += DataMatrix_GetWeight(tp.y, i);
+      SummarySet_error(count, base, job.y, i, out);
+      total += DataMatrix_GetWeight(job.y, i);
      }
     }
     
-    DataMatrix_delete(tp.y);
+    DataMatrix_delete(job.y);
    
    // Divide through by the exemplar count and return...
     if (total!=0) // User is being an idiot check!
@@ -1195,6 +1415,67 @@ static PyObject * Forest_train_py(Forest * self, PyObject * args)
 
 
 
+// Fills self->ss with the leaf every tree sends each exemplar in [start, start+exemplars) to, indexed [exemplar - start][tree] - self->ss must already be large enough. Builds the index of the trees, and their flattened versions, as needed. Returns zero, with a Python error set, if a tree is corrupt, non-zero on success...
+static int Forest_run(Forest * self, DataMatrix * x, int start, int exemplars)
+{
+ int i;
+ 
+ // Make sure every tree is indexed, and flattened if requested...
+  FlatTree ** flat = (FlatTree**)malloc(self->trees * sizeof(FlatTree*));
+  
+  for (i=0; i<self->trees; i++)
+  {
+   TreeBuffer * tb = self->tree[i];
+   if (TreeBuffer_index(tb)==NULL)
+   {
+    free(flat);
+    return 0;
+   }
+   
+   if ((self->flatten!=0)&&(tb->flat==NULL)&&(tb->flat_failed==0))
+   {
+    tb->flat = FlatTree_new(tb->tree, tb->index);
+    if (tb->flat==NULL) tb->flat_failed = 1;
+   }
+   flat[i] = (self->flatten!=0) ? tb->flat : NULL;
+  }
+ 
+ // Run the flattened trees...
+  FlatTree_run_many(self->trees, flat, x, start, exemplars, self->ss);
+ 
+ // Run the rest directly...
+  IndexSet * is = NULL;
+  
+  for (i=0; i<self->trees; i++)
+  {
+   if (flat[i]!=NULL) continue;
+   
+   if ((start==0)&&(exemplars==x->exemplars))
+   {
+    if (is==NULL) is = IndexSet_new(x->exemplars);
+    IndexSet_init_all(is);
+    
+    Tree_run_many(self->tree[i]->tree, self->tree[i]->index, x, is, self->ss + i, self->trees);
+   }
+   else
+   {
+    int j;
+    for (j=0; j<exemplars; j++)
+    {
+     self->ss[j * self->trees + i] = Tree_run(self->tree[i]->tree, self->tree[i]->index, x, start + j);
+    }
+   }
+  }
+ 
+ // Clean up...
+  if (is!=NULL) IndexSet_delete(is);
+  free(flat);
+  
+ return 1;
+}
+
+
+
 static PyObject * Forest_predict_py(Forest * self, PyObject * args)
 {
  // Handle the parameters...
@@ -1231,16 +1512,10 @@ static PyObject * Forest_predict_py(Forest * self, PyObject * args)
     }
    
    // Find the leaves the exemplar falls into...
-    int i;
-    for (i=0; i<self->trees; i++)
+    if (Forest_run(self, x, exemplar, 1)==0)
     {
-     if (self->tree[i]->ready==0)
-     {
-      Tree_init(self->tree[i]->tree);
-      self->tree[i]->ready = 1; 
-     }
-     
-     self->ss[i] = Tree_run(self->tree[i]->tree, x, exemplar);
+     DataMatrix_delete(x);
+     return NULL;
     }
     
    // Convert into a return value...
@@ -1254,8 +1529,6 @@ static PyObject * Forest_predict_py(Forest * self, PyObject * args)
   {
    // All exemplars...
    // Create required objects...
-    IndexSet * is = IndexSet_new(x->exemplars);
-    
     if (self->ss_size<self->trees*x->exemplars)
     {
      self->ss_size = self->trees*x->exemplars;
@@ -1263,25 +1536,16 @@ static PyObject * Forest_predict_py(Forest * self, PyObject * args)
     }
    
    // Find the leaves the exemplars fall into...
-    int i;
-    for (i=0; i<self->trees; i++)
+    if (Forest_run(self, x, 0, x->exemplars)==0)
     {
-     if (self->tree[i]->ready==0)
-     {
-      Tree_init(self->tree[i]->tree);
-      self->tree[i]->ready = 1; 
-     }
-     
-     IndexSet_init_all(is);
-     
-     Tree_run_many(self->tree[i]->tree, x, is, self->ss + i, self->trees);
+     DataMatrix_delete(x);
+     return NULL;
     }
    
    // Convert into a return value...
     PyObject * ret = SummarySet_merge_many_py(x->exemplars, self->trees, self->ss);
    
    // Clean up and return...
-    IndexSet_delete(is);
     DataMatrix_delete(x);
     return ret;
   }
@@ -1328,8 +1592,6 @@ static PyObject * Forest_error_py(Forest * self, PyObject * args)
   }
   
  // Create support structures...
-  IndexSet * is = IndexSet_new(x->exemplars);
-  
   if (self->ss_size<self->trees*x->exemplars)
   {
    self->ss_size = self->trees*x->exemplars;
@@ -1337,20 +1599,15 @@ static PyObject * Forest_error_py(Forest * self, PyObject * args)
   }
  
  // Find the leaves the exemplars fall into...
-  int i;
-  for (i=0; i<self->trees; i++)
+  if (Forest_run(self, x, 0, x->exemplars)==0)
   {
-   if (self->tree[i]->ready==0)
-   {
-    Tree_init(self->tree[i]->tree);
-    self->tree[i]->ready = 1; 
-   }
-     
-   IndexSet_init_all(is);
-     
-   Tree_run_many(self->tree[i]->tree, x, is, self->ss + i, self->trees);
+   DataMatrix_delete(y);
+   DataMatrix_delete(x);
+   return NULL;
   }
   
+  int i;
+  
  // Create the output array and sum the error into it...
   npy_intp dims = self->y_feat;
   PyArrayObject * ret = (PyArrayObject*)PyArray_SimpleNew(1, &dims, NPY_FLOAT32);
@@ -1373,7 +1630,6 @@ static PyObject * Forest_error_py(Forest * self, PyObject * args)
   }
  
  // Clean up and return...
-  IndexSet_delete(is);
   DataMatrix_delete(y);
   DataMatrix_delete(x);
   
@@ -1406,7 +1662,14 @@ static PyObject * Forest_importance_py(Forest * self, PyObject * args)
   int t;
   for (t=0; t<self->trees; t++)
   {
-   const float * importance = Tree_importance(self->tree[t]->tree, NULL);
+   size_t * index = TreeBuffer_index(self->tree[t]);
+   if (index==NULL)
+   {
+    Py_DECREF(ret);
+    return NULL;
+   }
+   
+   const float * importance = Tree_importance(self->tree[t]->tree, index, NULL);
    
    float div = self->tree[t]->tree->trained * self->trees;
    for (f=0; f<self->x_feat; f++)
@@ -1535,6 +1798,8 @@ static PyMemberDef Forest_members[] =
  
  {"info_ratios", T_OBJECT, offsetof(Forest, info_ratios), READONLY, "Returns the information ratios numpy array, if it has been set. A 2D array, indexed by depth in the first dimension, by y-feature in the second (First dimension accessed modulus). Returns the weight of the entropy from that feature when summing them together, so you can control the objective of the tree."},
  
+ {"flatten", T_BOOL, offsetof(Forest, flatten), 0, "True to run trees using a flattened copy, built the first time each tree is used for prediction, which is much faster (The default). False to run them directly from their stored form, which saves the memory of the copy. Not saved with the forest. Makes no difference to the answers."},
+ 
  {"trees", T_INT, offsetof(Forest, trees), READONLY, "Number of trees in the forest."},
  {NULL}
 };
@@ -1563,7 +1828,7 @@ static PyMethodDef Forest_methods[] =
  {"clear", (PyCFunction)Forest_clear_py, METH_NOARGS, "Removes all trees from the forest. Note that because you can't snipe individual trees if you want to be selective you can use the list interface to get all of them, clear the forest then append each tree that you want to keep."},
  {"append", (PyCFunction)Forest_append_py, METH_VARARGS, "Appends a Tree to the Forest, that has presumably been trained in another Forest and is now to be merged. Note that the Forest must be compatible (identical type codes given to configure), and this is not checked. Break this and expect the fan to get very brown."},
 
- {"train", (PyCFunction)Forest_train_py, METH_VARARGS, "Trains and appends more trees to this Forest - first parameter is the x/input data matrix, second is the y/output data matrix, third is the number of trees, which defaults to 1. Data matrices can be either a numpy array (exemplars X features) or a list of numpy arrays that are implicity joined to make the final data matrix - good when you want both continuous and discrete types. When a list contains 1D arrays they are assumed to be indexed by exemplar. The list can also contain a tuple, ('w', 1D vector), which will contain a weight for each exemplar, as in how many exemplars it counts as - good for imbalanced data. Note that only a weight in y matters - a weighted x is silently ignored. If boostrap is true this returns the out of bag error - an array indexed by output feature of how much error exists in that channel - note that they are independent calculations and its upto the user to combine them as desired if an overall error measure is required. A fourth optional parameter is a callback function, used to report progress - it will be called as func(# of work units done, total # of work units). Note that any errors it throws will be silently ignored, including not accepting those parameters."},
+ {"train", (PyCFunction)Forest_train_py, METH_VARARGS, "Trains and appends more trees to this Forest - first parameter is the x/input data matrix, second is the y/output data matrix, third is the number of trees, which defaults to 1. Data matrices can be either a numpy array (exemplars X features) or a list of numpy arrays that are implicity joined to make the final data matrix - good when you want both continuous and discrete types. When a list contains 1D arrays they are assumed to be indexed by exemplar. The list can also contain a tuple, ('w', 1D vector), which will contain a weight for each exemplar, as in how many exemplars it counts as - good for imbalanced data. Note that only a weight in y matters - a weighted x is silently ignored. If boostrap is true this returns the out of bag error - an array indexed by output feature of how much error exists in that channel - note that they are independent calculations and its upto the user to combine them as desired if an overall error measure is required. A fourth optional parameter is a callback function, used to report progress - it will be called as func(# of work units done, total # of work units). Note that any errors it throws will be silently ignored, including not accepting those parameters. A fifth optional parameter is the number of threads to train the trees with - defaults to 1, 0 means one per core. The GIL is released whilst the trees are learnt, the data matrices are shared between the threads rather than copied, and each tree uses its own block of the random number sequence, so the trees learnt are the same whatever the thread count. The Forest must not be used by another Python thread whilst it is training."},
  
  {"predict", (PyCFunction)Forest_predict_py, METH_VARARGS, "Given an x/input data matrix (With support for a tuple of matrices identical to train.) returns what it knows about the output data matrix. Return will be a list indexed by feature, with the contents defined by the summary codes (Typically a dictionary of arrays, often of things like 'prob' or 'mean'). You can provide a second parameter as in exemplar index if you want to just do one item from the data matrix, but note that this is very inefficient compared to doing everything at once in a single data matrix (Or several large data matrices if that is unreasonable)."},
  {"error", (PyCFunction)Forest_error_py, METH_VARARGS, "Given a x/input data matrix and a y/output data matrix of true answers (Same as train) this returns an array, indexed by output feature, of how much error exists in that channel. Same as the oob calculation, but using all trees and therefore for a hold out set etc. If you want a weighted output then it should be provided in the y data matrix - any weights in x will be ignored."},
@@ -1598,7 +1863,7 @@ static PyTypeObject ForestType =
  0,                                /*tp_setattro*/
  0,                                /*tp_as_buffer*/
  Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE, /*tp_flags*/
- "A random forest implimentation, designed with speed in mind, as well as I/O that doesn't suck (almost - should be 32/64 bit safe, but not endian change safe.) so it can actually be saved/loaded to disk. Remains fairly modular so it can be customised to specific use cases. Supports both classification and regression, as well as multivariate output (Including mixed classification/regression!). Input feature vectors can contain both discrete and continuous variables; kinda supports unknown values for discrete features. Provides the sequence interface, to access the individual Tree objects contained within. Note that is not thread safe - use multiprocessing if parallism is required, for which it has good support.", /* tp_doc */
+ "A random forest implimentation, designed with speed in mind, as well as I/O that doesn't suck (almost - should be 32/64 bit safe, but not endian change safe.) so it can actually be saved/loaded to disk. Remains fairly modular so it can be customised to specific use cases. Supports both classification and regression, as well as multivariate output (Including mixed classification/regression!). Input feature vectors can contain both discrete and continuous variables; kinda supports unknown values for discrete features. Provides the sequence interface, to access the individual Tree objects contained within. Note that is not thread safe, but train can use multiple threads internally; multiprocessing is also well supported if parallelism is required elsewhere.", /* tp_doc */
  0,                                /* tp_traverse */
  0,                                /* tp_clear */
  0,                                /* tp_richcompare */
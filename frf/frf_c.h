@@ -59,8 +59,11 @@ struct TreeBuffer
  
  size_t size;
  Tree * tree;
+ PyObject * owner; // NULL if tree is a malloc-ed block that belongs to this object, otherwise the object whose memory it is within (e.g. a memory mapped file), which a reference is kept to - the tree is then read only.
  
- char ready; // 1 if its ready to be used (init has been called), 0 if not.
+ size_t * index; // Offset of each object within the tree, as returned by Tree_index - NULL until its first needed.
+ FlatTree * flat; // Flattened version of the tree, for fast inference - built on first use, NULL if it hasn't been or the tree can't be flattened.
+ int flat_failed; // Non-zero if flattening has been tried and failed, so it is not tried again on every prediction.
 };
 
 
@@ -94,6 +97,9 @@ struct Forest
   
   PyArrayObject * info_ratios; // 2D array indexed by depth (modulus) then feature, of weight to assign to information of feature when optimising at that depth.
   
+ // Runtime options, that are not saved...
+  char flatten; // Non-zero to run trees using their flattened version.
+  
  // Store the trees as a straight array of pointers (The cost of loading a tree, let alone learning one, compared to a realloc means doing anything more complicated is pointless.)...
   int trees;
   TreeBuffer ** tree;
@@ -70,6 +70,18 @@ void Learner_fetch(Learner this, void * out)
  return type->fetch(this, out);
 }
 
+void Learner_root(Learner this, IndexView * view)
+{
+ const LearnerType * type = *(const LearnerType **)this;
+ if (type->root!=NULL) type->root(this, view);
+}
+
+void Learner_split(Learner this, IndexView * view, const char * side, void * scratch)
+{
+ const LearnerType * type = *(const LearnerType **)this;
+ if (type->split!=NULL) type->split(this, view, side, scratch);
+}
+
 
 
 // Structs for the test types...
@@ -132,6 +144,8 @@ const LearnerType IdiotLearner =
  NULL,
  NULL,
  NULL,
+ NULL,
+ NULL,
 };
 
 
@@ -167,10 +181,10 @@ static void Split_delete(Learner this)
  free(this); 
 }
 
-// Helper for below - try not to think too much about what that static variable is for, or what it means for thread safety...
+// Helper for below - try not to think too much about what that static variable is for. It is thread local, so trees can be learnt in parallel...
 int sort_for_split(const void * a, const void * b)
 {
- static const Split * this = NULL;
+ static __thread const Split * this = NULL;
  if (b==NULL)
  {
   this = (const Split*)a;
@@ -258,6 +272,8 @@ const LearnerType SplitLearner =
  Split_entropy,
  Split_size,
  Split_fetch,
+ NULL,
+ NULL,
 };
 
 
@@ -366,6 +382,344 @@ const LearnerType OneCatLearner =
  OneCat_entropy,
  OneCat_size,
  OneCat_fetch,
+ NULL,
+ NULL,
+};
+
+
+
+// The histogram learner - the feature is binned once (the bins are cached in the DataMatrix), then at each node the view is grouped by bin with a counting sort, so only the split points between bins are considered. Makes finding a split O(n + bins) instead of O(n log n)...
+typedef struct Histogram Histogram;
+
+struct Histogram
+{
+ const LearnerType * type;
+ 
+ DataMatrix * dm;
+ int feature;
+ QuantileBins * qb;
+ 
+ int temp_size; // Size of below.
+ int * temp; // For the counting sort.
+ int count[QUANTILE_BINS+1];
+ 
+ float entropy;
+ float split;
+};
+
+
+Learner Histogram_new(DataMatrix * dm, int feature)
+{
+ Histogram * this = (Histogram*)malloc(sizeof(Histogram));
+ this->type = &HistogramLearner;
+ 
+ this->dm = dm;
+ this->feature = feature;
+ this->qb = DataMatrix_Bins(dm, feature);
+ 
+ this->temp_size = 0;
+ this->temp = NULL;
+ 
+ return this;
+}
+
+static void Histogram_delete(Learner self)
+{
+ Histogram * this = (Histogram*)self;
+ free(this->temp);
+ free(this);
+}
+
+static int Histogram_optimise(Learner self, InfoSet * info, IndexView * view, int depth, float improve, unsigned int key[4])
+{
+ Histogram * this = (Histogram*)self;
+ QuantileBins * qb = this->qb;
+ int i, b;
+ 
+ if (view->size<2) return 0;
+ 
+ // Counting sort of the view by bin...
+  if (this->temp_size<view->size)
+  {
+   this->temp_size = view->size;
+   this->temp = (int*)realloc(this->temp, this->temp_size * sizeof(int));
+  }
+  
+  for (b=0; b<=qb->bins; b++) this->count[b] = 0;
+  for (i=0; i<view->size; i++) this->count[qb->bin[view->vals[i]] + 1] += 1;
+  for (b=1; b<=qb->bins; b++) this->count[b] += this->count[b-1];
+  
+  for (i=0; i<view->size; i++)
+  {
+   int exemplar = view->vals[i];
+   int bin = qb->bin[exemplar];
+   this->temp[this->count[bin]] = exemplar;
+   this->count[bin] += 1;
+  }
+  
+  memcpy(view->vals, this->temp, view->size * sizeof(int));
+  
+ // Reset the InfoSet and fill in the pass half with all of the items...
+  InfoSet_reset(info);
+  for (i=0; i<view->size; i++)
+  {
+   InfoSet_pass_add(info, view->vals[i]); 
+  }
+ 
+ // Move a bin at a time into the fail half, checking the entropy at every boundary where both halves have something in - count[b] is now the end of bin b...
+  int success = 0;
+  this->entropy = improve;
+  
+  i = 0;
+  for (b=0; b<qb->bins-1; b++)
+  {
+   if (i==this->count[b]) continue; // Empty bin - nothing changes.
+   
+   for (; i<this->count[b]; i++)
+   {
+    InfoSet_pass_remove(info, view->vals[i]);
+    InfoSet_fail_add(info, view->vals[i]);
+   }
+   
+   if (i==view->size) break;
+   
+   float e = InfoSet_entropy(info, depth);
+   
+   if (e<this->entropy)
+   {
+    this->entropy = e;
+    
+    // Halfway between the largest value of this bin and the boundary, being careful that rounding doesn't put it on the wrong side...
+     this->split = 0.5 * (qb->top[b] + qb->split[b]);
+     if (this->split<=qb->top[b]) this->split = qb->split[b];
+    
+    success = 1;
+   }
+  }
+  
+ return success;
+}
+
+static float Histogram_entropy(Learner self)
+{
+ Histogram * this = (Histogram*)self;
+ return this->entropy;
+}
+
+static void Histogram_fetch(Learner self, void * out)
+{
+ Histogram * this = (Histogram*)self;
+ ContinuousSplit * dest = (ContinuousSplit*)out;
+ 
+ dest->feature = this->feature;
+ dest->split = this->split;
+}
+
+
+const LearnerType HistogramLearner =
+{
+ 'H',
+ 'C',
+ "Histogram",
+ "Split learner for continuous features that bins each feature into (at most) 256 quantiles, once, and only considers splits between the bins - much faster than Split for large data sets, as it avoids sorting at every node, but the split points are less exact. The bins are shared by all trees trained on the same data matrix, and take one byte per exemplar for each feature that uses this learner.",
+ Histogram_new,
+ Histogram_delete,
+ Histogram_optimise,
+ Histogram_entropy,
+ Split_size,
+ Histogram_fetch,
+ NULL,
+ NULL,
+};
+
+
+
+// The presorted learner - finds the same splits as the split learner (exactly the same when there are no tied values; with ties the split learner also considers positions between equal values, which no threshold can realise, whilst this one skips them), but instead of sorting at every node it keeps a list of (value, exemplar) pairs for its feature, sorted once at the root of each tree, and stable partitions it whenever a node is created, so every node's exemplars sit in a contiguous range of it, still in sorted order (as in SLIQ/SPRINT). Each node then costs O(n) rather than O(n log n), at the price of 8 bytes per exemplar and partitioning the list at every node, whether or not the feature was selected for optimisation there...
+typedef struct SortedEntry SortedEntry;
+
+struct SortedEntry
+{
+ float value;
+ int exemplar;
+};
+
+
+typedef struct Presorted Presorted;
+
+struct Presorted
+{
+ const LearnerType * type;
+ 
+ DataMatrix * dm;
+ int feature;
+ 
+ const int * base; // vals of the root view - a views offset from this is its offset into sorted.
+ int size; // Size of sorted.
+ SortedEntry * sorted;
+ 
+ float entropy;
+ float split;
+};
+
+
+Learner Presorted_new(DataMatrix * dm, int feature)
+{
+ Presorted * this = (Presorted*)malloc(sizeof(Presorted));
+ this->type = &PresortedLearner;
+ 
+ this->dm = dm;
+ this->feature = feature;
+ 
+ this->base = NULL;
+ this->size = 0;
+ this->sorted = NULL;
+ 
+ return this;
+}
+
+static void Presorted_delete(Learner self)
+{
+ Presorted * this = (Presorted*)self;
+ free(this->sorted);
+ free(this);
+}
+
+// Helper for below - ties are broken by exemplar so the order does not depend on the sort implementation...
+static int compare_sorted_entry(const void * a, const void * b)
+{
+ const SortedEntry * sa = (const SortedEntry*)a;
+ const SortedEntry * sb = (const SortedEntry*)b;
+ 
+ if (sa->value<sb->value) return -1;
+ if (sa->value>sb->value) return 1;
+ return sa->exemplar - sb->exemplar;
+}
+
+static int Presorted_optimise(Learner self, InfoSet * info, IndexView * view, int depth, float improve, unsigned int key[4])
+{
+ Presorted * this = (Presorted*)self;
+ int i;
+ 
+ if (view->size<2) return 0;
+ 
+ SortedEntry * sorted = this->sorted + (view->vals - this->base);
+ 
+ // Reset the InfoSet and fill in the pass half with all of the items...
+  InfoSet_reset(info);
+  for (i=0; i<view->size; i++)
+  {
+   InfoSet_pass_add(info, sorted[i].exemplar); 
+  }
+  
+ // Iterate moving one item at a time into the fail half, only considering positions between distinct values as only they can be split...
+  int success = 0;
+  this->entropy = improve;
+  
+  for (i=0; i<view->size-1; i++)
+  {
+   InfoSet_pass_remove(info, sorted[i].exemplar);
+   InfoSet_fail_add(info, sorted[i].exemplar);
+   
+   if (sorted[i].value==sorted[i+1].value) continue;
+   
+   float e = InfoSet_entropy(info, depth);
+   
+   if (e<this->entropy)
+   {
+    this->entropy = e;
+    this->split = 0.5 * (sorted[i].value + sorted[i+1].value);
+    if (this->split<=sorted[i].value) this->split = sorted[i+1].value; // Rounding.
+    success = 1;
+   }
+  }
+  
+ return success;
+}
+
+static float Presorted_entropy(Learner self)
+{
+ Presorted * this = (Presorted*)self;
+ return this->entropy;
+}
+
+static void Presorted_fetch(Learner self, void * out)
+{
+ Presorted * this = (Presorted*)self;
+ ContinuousSplit * dest = (ContinuousSplit*)out;
+ 
+ dest->feature = this->feature;
+ dest->split = this->split;
+}
+
+static void Presorted_root(Learner self, IndexView * view)
+{
+ Presorted * this = (Presorted*)self;
+ int i;
+ 
+ if (this->size<view->size)
+ {
+  this->size = view->size;
+  this->sorted = (SortedEntry*)realloc(this->sorted, this->size * sizeof(SortedEntry));
+ }
+ this->base = view->vals;
+ 
+ for (i=0; i<view->size; i++)
+ {
+  this->sorted[i].value = DataMatrix_GetContinuous(this->dm, view->vals[i], this->feature);
+  this->sorted[i].exemplar = view->vals[i];
+ }
+ 
+ qsort(this->sorted, view->size, sizeof(SortedEntry), compare_sorted_entry);
+}
+
+static void Presorted_split(Learner self, IndexView * view, const char * side, void * scratch)
+{
+ Presorted * this = (Presorted*)self;
+ SortedEntry * sorted = this->sorted + (view->vals - this->base);
+ SortedEntry * temp = (SortedEntry*)scratch;
+ 
+ // Stable partition, failures first, via the scratch space...
+  int i;
+  int fail = 0;
+  for (i=0; i<view->size; i++)
+  {
+   if (side[sorted[i].exemplar]==0) fail += 1;
+  }
+  
+  int f = 0;
+  int p = fail;
+  for (i=0; i<view->size; i++)
+  {
+   if (side[sorted[i].exemplar]==0)
+   {
+    temp[f] = sorted[i];
+    f += 1;
+   }
+   else
+   {
+    temp[p] = sorted[i];
+    p += 1;
+   }
+  }
+  
+  memcpy(sorted, temp, view->size * sizeof(SortedEntry));
+}
+
+
+const LearnerType PresortedLearner =
+{
+ 'P',
+ 'C',
+ "Presorted",
+ "Exact split learner for continuous features, that finds the same splits as Split (bar the handling of tied values, which this does correctly) but is faster for large data sets and deep trees - rather than sorting the exemplars at every node it sorts each feature once per tree and then partitions the sorted lists as the tree is built, so each node is a linear scan. Costs 8 bytes per training exemplar for each feature that uses it.",
+ Presorted_new,
+ Presorted_delete,
+ Presorted_optimise,
+ Presorted_entropy,
+ Split_size,
+ Presorted_fetch,
+ Presorted_root,
+ Presorted_split,
 };
 
 
@@ -376,6 +730,8 @@ const LearnerType * ListLearner[] =
  &IdiotLearner,
  &SplitLearner,
  &OneCatLearner,
+ &HistogramLearner,
+ &PresortedLearner,
  NULL
 };
 
@@ -438,6 +794,19 @@ LearnerSet * LearnerSet_new(DataMatrix * dm, const char * codes)
   {
    this->feat[i] = i; 
   }
+  
+ // Prepare for any learners that need to follow the tree structure...
+  this->splitters = 0;
+  for (i=0; i<this->features; i++)
+  {
+   const LearnerType * type = *(const LearnerType **)this->learn[i];
+   if (type->split!=NULL) this->splitters += 1;
+  }
+  
+  this->exemplars = dm->exemplars;
+  this->side = NULL;
+  this->scratch_size = 0;
+  this->scratch = NULL;
  
  // Return this...
  return this;
@@ -450,9 +819,36 @@ void LearnerSet_delete(LearnerSet * this)
  {
   Learner_delete(this->learn[i]); 
  }
+ free(this->scratch);
+ free(this->side);
  free(this);
 }
 
+void LearnerSet_root(LearnerSet * this, IndexView * view)
+{
+ int i;
+ for (i=0; i<this->features; i++)
+ {
+  this->feat[i] = i; 
+ }
+ 
+ if (this->splitters!=0)
+ {
+  if (this->side==NULL) this->side = (char*)malloc(this->exemplars * sizeof(char));
+  
+  if (this->scratch_size<view->size)
+  {
+   this->scratch_size = view->size;
+   this->scratch = realloc(this->scratch, this->scratch_size * sizeof(SortedEntry));
+  }
+  
+  for (i=0; i<this->features; i++)
+  {
+   Learner_root(this->learn[i], view);
+  }
+ }
+}
+
 int LearnerSet_optimise(LearnerSet * this, InfoSet * info, IndexView * view, int features, int depth, unsigned int key[4])
 {
  int i;
@@ -531,6 +927,20 @@ void LearnerSet_fetch(LearnerSet * this, void * out)
  Learner_fetch(this->learn[this->best], out); 
 }
 
+void LearnerSet_split(LearnerSet * this, IndexView * view, IndexView * pass, IndexView * fail)
+{
+ if (this->splitters==0) return;
+ 
+ int i;
+ for (i=0; i<fail->size; i++) this->side[fail->vals[i]] = 0;
+ for (i=0; i<pass->size; i++) this->side[pass->vals[i]] = 1;
+ 
+ for (i=0; i<this->features; i++)
+ {
+  Learner_split(this->learn[i], view, this->side, this->scratch);
+ }
+}
+
 
 
 // Code to do the tests...
@@ -560,6 +970,15 @@ static PyObject * StringContinuousSplit(const void * test)
  return ret;
 }
 
+static void FlatContinuousSplit(const void * test, int * feature, TestValue * value, int * discrete)
+{
+ const ContinuousSplit * this = test;
+ 
+ *feature = this->feature;
+ value->real = this->split;
+ *discrete = 0;
+}
+
 static int DoDiscreteSelect(const void * test, DataMatrix * dm, int exemplar)
 {
  const DiscreteSelect * this = test;
@@ -583,10 +1002,22 @@ static PyObject * StringDiscreteSelect(const void * test)
 
 
 
+static void FlatDiscreteSelect(const void * test, int * feature, TestValue * value, int * discrete)
+{
+ const DiscreteSelect * this = test;
+ 
+ *feature = this->feature;
+ value->cat = this->accept;
+ *discrete = 1;
+}
+
+
+
 // Test calling management code...
 DoTest     CodeToTest[256];
 TestSize   CodeToSize[256];
 TestString CodeToString[256];
+TestFlat   CodeToFlat[256];
 
 
 int Test(char code, const void * test, DataMatrix * dm, int exemplar)
@@ -604,6 +1035,15 @@ PyObject * Test_string(char code, const void * test)
  return CodeToString[(unsigned char)code](test);
 }
 
+int Test_flat(char code, const void * test, int * feature, TestValue * value, int * discrete)
+{
+ TestFlat func = CodeToFlat[(unsigned char)code];
+ if (func==NULL) return 0;
+ 
+ func(test, feature, value, discrete);
+ return 1;
+}
+
 
 
 void Setup_Learner(void)
@@ -614,6 +1054,7 @@ void Setup_Learner(void)
   CodeToTest[i] = NULL;
   CodeToSize[i] = NULL;
   CodeToString[i] = NULL;
+  CodeToFlat[i] = NULL;
  }
  
  CodeToTest['C'] = DoContinuousSplit;
@@ -625,5 +1066,8 @@ void Setup_Learner(void)
  CodeToString['C'] = StringContinuousSplit;
  CodeToString['D'] = StringDiscreteSelect;
  
+ CodeToFlat['C'] = FlatContinuousSplit;
+ CodeToFlat['D'] = FlatDiscreteSelect;
+ 
  import_array();
 }
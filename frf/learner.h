@@ -49,6 +49,12 @@ typedef size_t (*LearnerSize)(Learner this);
 // If the learner has just done a successful optimisation then this will write the test into the given bytes (Does not include the test code)...
 typedef void (*LearnerFetch)(Learner this, void * out);
 
+// Optional (can be NULL) - called at the start of learning each tree with the view of every exemplar the tree is being trained on; every later view passed to the learner will be a part of this one. For learners that keep their own structure in step with the tree...
+typedef void (*LearnerRoot)(Learner this, IndexView * view);
+
+// Optional (can be NULL) - called when a node is created by splitting view into fail, which will be the first fail->size entries, and pass, which will be the rest. side is indexed by exemplar and contains 0 for those that failed and 1 for those that passed, whilst scratch is temporary storage, with space for an int and a float for every exemplar in the root view...
+typedef void (*LearnerSplit)(Learner this, IndexView * view, const char * side, void * scratch);
+
 
 
 // Define the learner type...
@@ -69,6 +75,9 @@ struct LearnerType
  LearnerEntropy entropy;
  LearnerSize size;
  LearnerFetch fetch;
+ 
+ LearnerRoot root;
+ LearnerSplit split;
 };
 
 
@@ -84,6 +93,9 @@ float Learner_entropy(Learner this);
 size_t Learner_size(Learner this);
 void Learner_fetch(Learner this, void * out);
 
+void Learner_root(Learner this, IndexView * view);
+void Learner_split(Learner this, IndexView * view, const char * side, void * scratch);
+
 
 
 // The various learner types in the system...
@@ -96,6 +108,12 @@ const LearnerType SplitLearner; // Code = S.
 // The default learner for discrete data - one discrete value passes, all other fail...
 const LearnerType OneCatLearner; // Code = O.
 
+// Alternative to the split learner for large data sets - only considers splits between quantile bins, which it finds with a counting sort rather than a full sort...
+const LearnerType HistogramLearner; // Code = H.
+
+// Exact alternative to the split learner - sorts once per tree and keeps the sorted list in step with the tree, rather than sorting at every node...
+const LearnerType PresortedLearner; // Code = P.
+
 
 
 // List of learner types, for automatic detection...
@@ -111,6 +129,12 @@ struct LearnerSet
  int best; // Index of best, negative if none.
  int * feat; // Buffer of feature indices - to avoid allocating memory each time it shuffles them. (Actually stored after the learn array...)
  
+ int splitters; // Number of learners with a split method - if zero LearnerSet_split does nothing.
+ int exemplars; // Exemplars in the data matrix, the length of side.
+ char * side; // Passed to the split methods of the learners, NULL until first needed.
+ int scratch_size; // Number of exemplars scratch has space for.
+ void * scratch; // Passed to the split methods of the learners.
+ 
  int features;
  Learner learn[0];
 };
@@ -125,6 +149,9 @@ LearnerSet * LearnerSet_new(DataMatrix * dm, const char * codes);
 // Terminate a LearnerSet, with extreme prejudice...
 void LearnerSet_delete(LearnerSet * this);
 
+// Prepares for learning a new tree from the given view of its exemplars - puts the order in which features are randomly selected back to how it was on creation (the selection shuffles it in place, so without this a tree would depend on what the LearnerSet was previously used for, as well as its key) and calls the root method of any learners that have one...
+void LearnerSet_root(LearnerSet * this, IndexView * view);
+
 // Optimises the split for the data in the given IndexView with the metric in the InfoSet; IndexView will be super jumbled by the process. features is how many randomly selected features to try optimising (without replacement - if greater than # features it just does them all), depth is the depth this is being done at, as required by the InfoView. key is for the random number generator, and will be incrimented as/if its used. Returns non-zero if its found something, zero if it failed...
 int LearnerSet_optimise(LearnerSet * this, InfoSet * info, IndexView * view, int features, int depth, unsigned int key[4]);
 
@@ -143,6 +170,9 @@ size_t LearnerSet_size(LearnerSet * this);
 // If the learner has just done a successful optimisation then this will write the test into the given bytes (Does not include the test code)...
 void LearnerSet_fetch(LearnerSet * this, void * out);
 
+// Must be called when a node is created, after IndexView_split has divided view into pass and fail, so learners that follow the tree structure can follow it...
+void LearnerSet_split(LearnerSet * this, IndexView * view, IndexView * pass, IndexView * fail);
+
 
 
 // Function to run a test - takes a DataMatrix and an exemplar, returns non-zero if it passed, zero if it failed...
@@ -164,6 +194,22 @@ typedef PyObject * (*TestString)(const void * test);
 extern TestString CodeToString[256];
 
 
+// The value a flattened test compares against - a continuous test is a threshold on a float, a discrete test equality with an int...
+typedef union TestValue TestValue;
+
+union TestValue
+{
+ float real;
+ int cat;
+};
+
+// Function that converts a test into the fixed size form used by the flattened trees of tree.h - outputs the feature, the value and if its a discrete equality test (non-zero) or a continuous threshold test (zero)...
+typedef void (*TestFlat)(const void * test, int * feature, TestValue * value, int * discrete);
+
+// Test code to flatten function - can be NULL, for test types that have no fixed size form...
+extern TestFlat CodeToFlat[256];
+
+
 // Helper function - uses the above table to perform a test - given the tests code and test data, as generated by a Learner, then a DataMatrix and exemplar to perform the test on - returns non-zero if it passed, zero if it failed...
 int Test(char code, const void * test, DataMatrix * dm, int exemplar);
 
@@ -173,6 +219,9 @@ size_t Test_size(char code, const void * test);
 // This time for string...
 PyObject * Test_string(char code, const void * test);
 
+// And for flattening - returns zero if the test type can not be flattened, in which case the outputs are untouched...
+int Test_flat(char code, const void * test, int * feature, TestValue * value, int * discrete);
+
 
 
 // Setup this module - for internal use only...
@@ -0,0 +1,74 @@
+#! /usr/bin/env python
+
+# Copyright 2014 Tom SF Haines
+
+# Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except in compliance with the License. You may obtain a copy of the License at
+
+#   http://www.apache.org/licenses/LICENSE-2.0
+
+# Unless required by applicable law or agreed to in writing, software distributed under the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the License for the specific language governing permissions and limitations under the License.
+
+
+
+import time
+import frf
+import numpy
+
+
+
+# Parameters...
+dims = 6
+cats = 5
+train = 50000
+test = 100000
+trees = 16
+
+
+
+# Generate a classification problem with both real features and a discrete one, so both test types are used - the discrete feature is stored as a float, and some real values are nan...
+def generate(count):
+  x = numpy.random.random(size=(count, dims+1)).astype(numpy.float32)
+  x[:,dims] = numpy.random.randint(cats, size=count)
+  x[numpy.random.random(size=count) < 0.01, 0] = numpy.nan
+
+  s = (x[:,:dims] * numpy.arange(1, dims+1)[numpy.newaxis,:]).sum(axis=1) + 0.5 * numpy.random.normal(size=count)
+  y = (s > 0.25 * dims * (dims+1)).astype(numpy.int32) + (x[:,dims]==2).astype(numpy.int32)
+  return x, y
+
+train_x, train_y = generate(train)
+test_x, test_y = generate(test)
+
+
+
+# Train a forest...
+forest = frf.Forest()
+forest.configure('C', 'C', 'S' * dims + 'O')
+forest.min_exemplars = 2
+
+forest.train(train_x, train_y, trees)
+
+
+
+# Predict with the stored trees and then the flattened trees (twice, as the first call builds them) - answers should be identical...
+results = []
+for flatten in [False, True, True]:
+  forest.flatten = flatten
+
+  start = time.time()
+  res = forest.predict(test_x)[0]['prob']
+  end = time.time()
+
+  print 'flatten = %s: predicted %i exemplars in %.3f seconds; test error = %.4f' % (flatten, test, end - start, (res.argmax(axis=1)!=test_y).mean())
+  results.append(res)
+
+assert(numpy.all(results[0]==results[1]))
+assert(numpy.all(results[0]==results[2]))
+
+for i in xrange(0, test, 997):
+  forest.flatten = False
+  a = forest.predict(test_x, i)[0]['prob']
+  forest.flatten = True
+  b = forest.predict(test_x, i)[0]['prob']
+  assert(numpy.all(a==b))
+
+print 'Flattening made no difference to the result'
@@ -0,0 +1,52 @@
+#! /usr/bin/env python
+
+# Copyright 2014 Tom SF Haines
+
+# Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except in compliance with the License. You may obtain a copy of the License at
+
+#   http://www.apache.org/licenses/LICENSE-2.0
+
+# Unless required by applicable law or agreed to in writing, software distributed under the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the License for the specific language governing permissions and limitations under the License.
+
+
+
+import time
+import frf
+import numpy
+
+
+
+# Parameters...
+dims = 6
+train = 200000
+test = 4096
+trees = 8
+
+
+
+# Generate a classification problem where the boundary is a curve, so the exact split positions matter a little...
+def generate(count):
+  x = numpy.random.random(size=(count, dims)).astype(numpy.float32)
+  y = (numpy.sin(6.0 * x[:,0]) + x[:,1] + 0.3 * x[:,2] > 1.0).astype(numpy.int32)
+  flip = numpy.random.random(size=count) < 0.05
+  y[flip] = 1 - y[flip]
+  return x, y
+
+train_x, train_y = generate(train)
+test_x, test_y = generate(test)
+
+
+
+# Train with the exact split learner and then the histogram learner, and compare...
+for code in ['S', 'H']:
+  forest = frf.Forest()
+  forest.configure('C', 'C', code * dims)
+  forest.min_exemplars = 4
+
+  start = time.time()
+  oob = forest.train(train_x, train_y, trees)
+  end = time.time()
+
+  pred = forest.predict(test_x)[0]['prob'].argmax(axis=1)
+
+  print '%s: trained %i trees in %.2f seconds; oob error = %.4f; test error = %.4f' % (code, trees, end - start, oob[0], (pred!=test_y).mean())
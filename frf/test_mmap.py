@@ -0,0 +1,90 @@
+#! /usr/bin/env python
+
+# Copyright 2014 Tom SF Haines
+
+# Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except in compliance with the License. You may obtain a copy of the License at
+
+#   http://www.apache.org/licenses/LICENSE-2.0
+
+# Unless required by applicable law or agreed to in writing, software distributed under the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the License for the specific language governing permissions and limitations under the License.
+
+
+
+import os
+import time
+import tempfile
+
+import frf
+import numpy
+
+
+
+# Parameters...
+dims = 6
+train = 20000
+test = 4096
+trees = 16
+
+
+
+# Generate a simple classification problem...
+def generate(count):
+  x = numpy.random.random(size=(count, dims)).astype(numpy.float32)
+  s = (x * numpy.arange(1, dims+1)[numpy.newaxis,:]).sum(axis=1) + 0.5 * numpy.random.normal(size=count)
+  y = (s > 0.25 * dims * (dims+1)).astype(numpy.int32)
+  return x, y
+
+train_x, train_y = generate(train)
+test_x, test_y = generate(test)
+
+
+
+# Train a forest and save it, both compressed and uncompressed...
+forest = frf.Forest()
+forest.configure('C', 'C', 'S' * dims)
+forest.min_exemplars = 2
+forest.train(train_x, train_y, trees)
+
+expected = forest.predict(test_x)[0]['prob']
+
+fn_bz2 = tempfile.mktemp('.rf')
+fn_raw = tempfile.mktemp('.rf')
+frf.save_forest(fn_bz2, forest)
+frf.save_forest(fn_raw, forest, False)
+
+print 'Compressed size = %i bytes; uncompressed size = %i bytes' % (os.path.getsize(fn_bz2), os.path.getsize(fn_raw))
+
+
+
+# Load each way, and check they all give the same answer...
+for name, fn, mapped in [('compressed', fn_bz2, False), ('uncompressed', fn_raw, False), ('mapped', fn_raw, True)]:
+  start = time.time()
+  loaded = frf.load_forest(fn, mapped)
+  end = time.time()
+  
+  assert(len(loaded)==trees)
+  
+  for flatten in [False, True]:
+    loaded.flatten = flatten
+    res = loaded.predict(test_x)[0]['prob']
+    assert(numpy.all(res==expected))
+  
+  print '%s: loaded in %.4f seconds, predictions match' % (name, end - start)
+
+
+
+# Mapped trees should refuse writes...
+loaded = frf.load_forest(fn_raw, True)
+assert(memoryview(loaded[0]).readonly)
+
+try:
+  frf.load_forest(fn_bz2, True)
+  assert(False)
+except ValueError:
+  pass
+
+del loaded
+os.remove(fn_bz2)
+os.remove(fn_raw)
+
+print 'Memory mapping made no difference to the result'
@@ -0,0 +1,62 @@
+#! /usr/bin/env python
+
+# Copyright 2014 Tom SF Haines
+
+# Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except in compliance with the License. You may obtain a copy of the License at
+
+#   http://www.apache.org/licenses/LICENSE-2.0
+
+# Unless required by applicable law or agreed to in writing, software distributed under the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the License for the specific language governing permissions and limitations under the License.
+
+
+
+import time
+import frf
+import numpy
+
+
+
+# Parameters...
+dims = 6
+train = 100000
+test = 4096
+trees = 4
+
+
+
+# Generate a classification problem - every feature is a random permutation so there are no tied values, in which case the presorted learner should build exactly the same trees as the split learner...
+def generate(count):
+  x = numpy.empty((count, dims), dtype=numpy.float32)
+  for d in xrange(dims):
+    x[:,d] = numpy.random.permutation(count) / float(count)
+  
+  y = (numpy.sin(6.0 * x[:,0]) + x[:,1] + 0.3 * x[:,2] > 1.0).astype(numpy.int32)
+  flip = numpy.random.random(size=count) < 0.05
+  y[flip] = 1 - y[flip]
+  return x, y
+
+train_x, train_y = generate(train)
+test_x, test_y = generate(test)
+
+
+
+# Train with the split learner and then the presorted learner, without bootstrap sampling (duplicates are ties)...
+results = []
+for code in ['S', 'P']:
+  forest = frf.Forest()
+  forest.configure('C', 'C', code * dims)
+  forest.bootstrap = False
+  forest.min_exemplars = 4
+
+  start = time.time()
+  forest.train(train_x, train_y, trees)
+  end = time.time()
+
+  res = forest.predict(test_x)[0]['prob']
+  pred = res.argmax(axis=1)
+
+  print '%s: trained %i trees in %.2f seconds; test error = %.4f' % (code, trees, end - start, (pred!=test_y).mean())
+  results.append(res)
+
+assert(numpy.all(results[0]==results[1]))
+print 'Identical predictions'
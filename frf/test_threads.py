@@ -0,0 +1,58 @@
+#! /usr/bin/env python
+
+# Copyright 2014 Tom SF Haines
+
+# Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except in compliance with the License. You may obtain a copy of the License at
+
+#   http://www.apache.org/licenses/LICENSE-2.0
+
+# Unless required by applicable law or agreed to in writing, software distributed under the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the License for the specific language governing permissions and limitations under the License.
+
+
+
+import time
+import frf
+import numpy
+
+
+
+# Parameters...
+dims = 8
+train = 100000
+test = 4096
+trees = 16
+
+
+
+# Generate a simple classification problem - class is decided by a noisy weighted sum of the features...
+def generate(count):
+  x = numpy.random.random(size=(count, dims)).astype(numpy.float32)
+  s = (x * numpy.arange(1, dims+1)[numpy.newaxis,:]).sum(axis=1) + 0.5 * numpy.random.normal(size=count)
+  y = (s > 0.25 * dims * (dims+1)).astype(numpy.int32) + (s > 0.3 * dims * (dims+1)).astype(numpy.int32)
+  return x, y
+
+train_x, train_y = generate(train)
+test_x, test_y = generate(test)
+
+
+
+# Train the same forest with one thread and then one per core - the trees should be identical, so the oob error and predictions should match exactly...
+results = []
+for threads in [1, 0]:
+  forest = frf.Forest()
+  forest.configure('C', 'C', 'S' * dims)
+  forest.min_exemplars = 2
+
+  start = time.time()
+  oob = forest.train(train_x, train_y, trees, None, threads)
+  end = time.time()
+
+  res = forest.predict(test_x)[0]
+  pred = res['prob'].argmax(axis=1)
+
+  print 'threads = %i: trained %i trees in %.2f seconds; oob error = %.4f; test error = %.4f' % (threads, trees, end - start, oob[0], (pred!=test_y).mean())
+  results.append((oob, res['prob']))
+
+assert(numpy.all(results[0][0]==results[1][0]))
+assert(numpy.all(results[0][1]==results[1][1]))
+print 'Thread count made no difference to the result'
@@ -209,7 +209,8 @@ void Node_learn(PtrArray * store, int index, int depth, TreeParam * param, Index
  // If we have a node record it, otherwise create and store a summary...
   if (node!=NULL)
   {
-   PtrArray_set(store, index, 'N', (void*)node); 
+   PtrArray_set(store, index, 'N', (void*)node);
+   LearnerSet_split(param->ls, view, &pass, &fail);
   }
   else
   {
@@ -262,6 +263,7 @@ Tree * Tree_learn(TreeParam * param, IndexSet * indices, ReportSummarisation rs,
   IndexView view;
   IndexView_init(&view, indices);
   
+  LearnerSet_root(param->ls, &view);
   Node_learn(store, 1, 0, param, &view, rs, rs_ptr, importance->gain);
   
   PtrArray_set(store, store->count, 'I', (void*)importance); // Store importance at the end so it gets stored in the next bit.
@@ -304,9 +306,9 @@ Tree * Tree_learn(TreeParam * param, IndexSet * indices, ReportSummarisation rs,
   this->revision = FRF_REVISION;
   this->size = tree_size + total_size;
   this->trained = view.size;
-  this->index = NULL;
-  
   this->objects = store->count;
+  this->unused = 0;
+  
   size_t offset = tree_size;
   
   for (i=0; i<this->objects; i++)
@@ -343,9 +345,6 @@ Tree * Tree_learn(TreeParam * param, IndexSet * indices, ReportSummarisation rs,
  // Clean up the store...
   PtrArray_delete(store);
  
- // Calculate the index structure for the tree...
-  Tree_init(this);
- 
  // Return the shiny new tree...
   return this;
 }
@@ -365,70 +364,66 @@ int Tree_safe(Tree * this)
  return 1;
 }
 
-int Tree_init(Tree * this)
+size_t * Tree_index(Tree * this)
 {
- if (Tree_safe(this)==0) return 0;
+ if (Tree_safe(this)==0) return NULL;
  
- this->index = (void**)malloc(this->objects * sizeof(void*));
+ size_t * index = (size_t*)malloc(this->objects * sizeof(size_t));
  
  size_t offset = Tree_head_size();
- this->index[0] = (char*)this + offset;
+ index[0] = offset;
  offset += Tree_type_size(this->objects);
  
+ const char * codes = (char*)this + index[0];
+ 
  int i;
  for (i=1; i<this->objects; i++)
  {
-  this->index[i] = (char*)this + offset;
-  char code = ((char*)this->index[0])[i];
-  if ('N'==code)
+  index[i] = offset;
+  void * block = (char*)this + offset;
+  
+  if ('N'==codes[i])
   {
    // Node...
-    Node * targ = (Node*)this->index[i];
+    Node * targ = (Node*)block;
     offset += sizeof(Node) + Test_size(targ->code, targ->test);
   }
   else
   {
-   if ('S'==code)
+   if ('S'==codes[i])
    {
     // Summary...
-     offset += SummarySet_size((SummarySet*)this->index[i]);
+     offset += SummarySet_size((SummarySet*)block);
    }
    else // 'I'==code
    {
-    offset += sizeof(int) + sizeof(float) * ((Importance*)this->index[i])->features;
+    offset += sizeof(int) + sizeof(float) * ((Importance*)block)->features;
    }
   }
   
   if (offset>this->size)
   {
-   free(this->index);
-   this->index = NULL;
+   free(index);
    PyErr_SetString(PyExc_ValueError, "Tree structure overruns tree size - corruption.");
-   return 0; // Overrun of block - data must be corrupted! 
+   return NULL; // Overrun of block - data must be corrupted! 
   }
  }
  
  if (offset!=this->size)
  {
-  free(this->index);
-  this->index = NULL;
+  free(index);
   PyErr_SetString(PyExc_ValueError, "Tree size does not match consumed memory.");
-  return 0; // If we don't eat precisely all the data we have an issue.
+  return NULL; // If we don't eat precisely all the data we have an issue.
  }
  
- return 1; // Success.
-}
-
-void Tree_deinit(Tree * this)
-{
- free(this->index); 
+ return index; // Success.
 }
 
 
 
 size_t Tree_head_size(void)
 {
- return sizeof(Tree) + sizeof(long long) - sizeof(void*);
+ return sizeof(Tree);
 }
 
 size_t Tree_size(Tree * this)
@@ -443,18 +438,18 @@ int Tree_objects(Tree * this)
 
 
 
-SummarySet * Tree_run_rec(Tree * this, int object, DataMatrix * x, int exemplar)
+SummarySet * Tree_run_rec(Tree * this, const size_t * index, int object, DataMatrix * x, int exemplar)
 {
  // Fetch the object, behavour depends on type...
-  char code = ((char*)this->index[0])[object];
-  void * block = this->index[object];
+  char code = ((char*)this + index[0])[object];
+  void * block = (char*)this + index[object];
   
   if (code=='N')
   {
    Node * targ = (Node*)block;
    int res = Test(targ->code, (void*)targ->test, x, exemplar);
-   if (res==0) return Tree_run_rec(this, targ->fail, x, exemplar);
-          else return Tree_run_rec(this, targ->pass, x, exemplar);
+   if (res==0) return Tree_run_rec(this, index, targ->fail, x, exemplar);
+          else return Tree_run_rec(this, index, targ->pass, x, exemplar);
   }
   else
   {
@@ -462,17 +457,17 @@ SummarySet * Tree_run_rec(Tree * this, int object, DataMatrix * x, int exemplar)
   }
 }
 
-SummarySet * Tree_run(Tree * this, DataMatrix * x, int exemplar)
+SummarySet * Tree_run(Tree * this, const size_t * index, DataMatrix * x, int exemplar)
 {
- return Tree_run_rec(this, 1, x, exemplar);
+ return Tree_run_rec(this, index, 1, x, exemplar);
 }
 
 
-void Tree_run_many_rec(Tree * this, int object, DataMatrix * x, IndexView * view, SummarySet ** out, int step)
+void Tree_run_many_rec(Tree * this, const size_t * index, int object, DataMatrix * x, IndexView * view, SummarySet ** out, int step)
 {
  // Fetch the object, behavour depends on type...
-  char code = ((char*)this->index[0])[object];
-  void * block = this->index[object];
+  char code = ((char*)this + index[0])[object];
+  void * block = (char*)this + index[object];
   
   if (code=='N')
   {
@@ -483,8 +478,8 @@ void Tree_run_many_rec(Tree * this, int object, DataMatrix * x, IndexView * view
     IndexView pass;
     IndexView_split(view, x, targ->code, (void*)targ->test, &pass, &fail);
     
-    if (fail.size!=0) Tree_run_many_rec(this, targ->fail, x, &fail, out, step);
-    if (pass.size!=0) Tree_run_many_rec(this, targ->pass, x, &pass, out, step);
+    if (fail.size!=0) Tree_run_many_rec(this, index, targ->fail, x, &fail, out, step);
+    if (pass.size!=0) Tree_run_many_rec(this, index, targ->pass, x, &pass, out, step);
   }
   else
   {
@@ -499,20 +494,20 @@ void Tree_run_many_rec(Tree * this, int object, DataMatrix * x, IndexView * view
   }
 }
 
-void Tree_run_many(Tree * this, DataMatrix * x, IndexSet * is, SummarySet ** out, int step)
+void Tree_run_many(Tree * this, const size_t * index, DataMatrix * x, IndexSet * is, SummarySet ** out, int step)
 {
  IndexView view;
  IndexView_init(&view, is);
  
- Tree_run_many_rec(this, 1, x, &view, out, step);
+ Tree_run_many_rec(this, index, 1, x, &view, out, step);
 }
 
 
-PyObject * Tree_human_rec(Tree * this, int object)
+PyObject * Tree_human_rec(Tree * this, const size_t * index, int object)
 {
  // Fetch the object, behavour depends on type...
-  char code = ((char*)this->index[0])[object];
-  void * block = this->index[object];
+  char code = ((char*)this + index[0])[object];
+  void * block = (char*)this + index[object];
   
   if (code=='N')
   {
@@ -520,8 +515,8 @@ PyObject * Tree_human_rec(Tree * this, int object)
     Node * targ = (Node*)block;
     
     PyObject * test = Test_string(targ->code, targ->test);
-    PyObject * pass = Tree_human_rec(this, targ->pass);
-    PyObject * fail = Tree_human_rec(this, targ->fail);
+    PyObject * pass = Tree_human_rec(this, index, targ->pass);
+    PyObject * fail = Tree_human_rec(this, index, targ->fail);
     
     return Py_BuildValue("{sNsNsN}", "test", test, "pass", pass, "fail", fail);
   }
@@ -533,14 +528,14 @@ PyObject * Tree_human_rec(Tree * this, int object)
   }
 }
 
-PyObject * Tree_human(Tree * this)
+PyObject * Tree_human(Tree * this, const size_t * index)
 {
- return Tree_human_rec(this, 1); 
+ return Tree_human_rec(this, index, 1); 
 }
 
-const float * Tree_importance(Tree * this, int * length)
+const float * Tree_importance(Tree * this, const size_t * index, int * length)
 {
- Importance * imp = (Importance*)this->index[this->objects-1];
+ Importance * imp = (Importance*)((char*)this + index[this->objects-1]);
  
  if (length!=NULL) *length = imp->features;
  return imp->gain;
@@ -548,6 +543,220 @@ const float * Tree_importance(Tree * this, int * length)
 
 
 
+// The flattened tree - size in bytes of the dense buffer the exemplars are copied into (the bigger the block the more exemplars go through each tree whilst it is in cache), and number of exemplars pushed through each tree in lockstep...
+#define FLAT_BUFFER (4*1024*1024)
+#define FLAT_LOCKSTEP 8
+
+FlatTree * FlatTree_new(Tree * tree, const size_t * index)
+{
+ const char * codes = (char*)tree + index[0];
+ 
+ // Count the nodes, including leaves - everything that is not the code block or importance...
+  int count = 0;
+  int i;
+  for (i=1; i<tree->objects; i++)
+  {
+   if ((codes[i]=='N')||(codes[i]=='S')) count += 1;
+  }
+ 
+ // Create the object...
+  FlatTree * this = (FlatTree*)malloc(sizeof(FlatTree));
+  this->nodes = count;
+  this->depth = 0;
+  this->slots = 0;
+  
+  this->slot = (int*)malloc(count * sizeof(int));
+  this->value = (TestValue*)malloc(count * sizeof(TestValue));
+  this->child = (int*)malloc(2 * count * sizeof(int));
+  this->leaf = (SummarySet**)malloc(count * sizeof(SummarySet*));
+  
+ // Breadth first traversal, where the queue is the output order - object and depth of each node, with nodes numbered as they are added...
+  int * object = (int*)malloc(count * sizeof(int));
+  int * depth = (int*)malloc(count * sizeof(int));
+  
+  object[0] = 1;
+  depth[0] = 0;
+  int added = 1;
+  
+  for (i=0; i<count; i++)
+  {
+   if (depth[i]>this->depth) this->depth = depth[i];
+   
+   if (codes[object[i]]=='N')
+   {
+    Node * targ = (Node*)((char*)tree + index[object[i]]);
+    
+    int feature;
+    int discrete;
+    if (Test_flat(targ->code, targ->test, &feature, this->value + i, &discrete)==0)
+    {
+     free(depth);
+     free(object);
+     FlatTree_delete(this);
+     return NULL;
+    }
+    
+    this->slot[i] = feature * 2 + discrete;
+    if (this->slot[i]>=this->slots) this->slots = this->slot[i] + 1;
+    this->leaf[i] = NULL;
+    
+    object[added] = targ->fail;
+    depth[added] = depth[i] + 1;
+    this->child[i*2] = added;
+    added += 1;
+    
+    object[added] = targ->pass;
+    depth[added] = depth[i] + 1;
+    this->child[i*2+1] = added;
+    added += 1;
+   }
+   else
+   {
+    this->slot[i] = 0; // Fixed below, once the root is known.
+    this->value[i].cat = 0;
+    this->child[i*2] = i;
+    this->child[i*2+1] = i;
+    this->leaf[i] = (SummarySet*)((char*)tree + index[object[i]]);
+   }
+  }
+  
+  for (i=0; i<count; i++)
+  {
+   if (this->leaf[i]!=NULL) this->slot[i] = this->slot[0];
+  }
+ 
+ // Clean up and return...
+  free(depth);
+  free(object);
+  
+  return this;
+}
+
+void FlatTree_delete(FlatTree * this)
+{
+ free(this->leaf);
+ free(this->child);
+ free(this->value);
+ free(this->slot);
+ free(this);
+}
+
+size_t FlatTree_size(FlatTree * this)
+{
+ return sizeof(FlatTree) + this->nodes * (2 * sizeof(int) + sizeof(TestValue) + sizeof(int) + sizeof(SummarySet*));
+}
+
+void FlatTree_run_many(int trees, FlatTree ** tree, DataMatrix * x, int start, int exemplars, SummarySet ** out)
+{
+ int i, j, t;
+ 
+ // Work out which slots are used, so only they are extracted from the data matrix...
+  int slots = 0;
+  for (t=0; t<trees; t++)
+  {
+   if ((tree[t]!=NULL)&&(tree[t]->slots>slots)) slots = tree[t]->slots;
+  }
+  
+  char * used = (char*)malloc(slots>0 ? slots : 1);
+  for (i=0; i<slots; i++) used[i] = 0;
+  
+  for (t=0; t<trees; t++)
+  {
+   if (tree[t]==NULL) continue;
+   for (i=0; i<tree[t]->nodes; i++)
+   {
+    if (tree[t]->leaf[i]==NULL) used[tree[t]->slot[i]] = 1;
+   }
+  }
+  
+ // Dense buffer of values, [exemplar][slot]...
+  int block_size = FLAT_BUFFER / ((slots>0 ? slots : 1) * sizeof(TestValue));
+  if (block_size<FLAT_LOCKSTEP) block_size = FLAT_LOCKSTEP;
+  if (block_size>exemplars) block_size = exemplars;
+  
+  TestValue * buffer = (TestValue*)malloc((block_size>0 ? block_size : 1) * (slots>0 ? slots : 1) * sizeof(TestValue));
+ 
+ // Loop the blocks of exemplars...
+  int base;
+  for (base=0; base<exemplars; base+=block_size)
+  {
+   int block = exemplars - base;
+   if (block>block_size) block = block_size;
+   
+   // Extract the used values for this block...
+    for (j=0; j<slots; j++)
+    {
+     if (used[j]==0) continue;
+     
+     int feature = j / 2;
+     if ((j%2)==0)
+     {
+      for (i=0; i<block; i++) buffer[i*slots + j].real = DataMatrix_GetContinuous(x, start + base + i, feature);
+     }
+     else
+     {
+      for (i=0; i<block; i++) buffer[i*slots + j].cat = DataMatrix_GetDiscrete(x, start + base + i, feature);
+     }
+    }
+   
+   // Push the block through every tree, several exemplars at a time...
+    for (t=0; t<trees; t++)
+    {
+     FlatTree * targ = tree[t];
+     if (targ==NULL) continue;
+     
+     const int * slot = targ->slot;
+     const TestValue * value = targ->value;
+     const int * child = targ->child;
+     
+     int group;
+     for (group=0; group<block; group+=FLAT_LOCKSTEP)
+     {
+      int size = block - group;
+      if (size>FLAT_LOCKSTEP) size = FLAT_LOCKSTEP;
+      
+      int node[FLAT_LOCKSTEP];
+      const TestValue * fv[FLAT_LOCKSTEP];
+      for (i=0; i<FLAT_LOCKSTEP; i++)
+      {
+       node[i] = 0;
+       fv[i] = buffer + (group + (i<size ? i : 0)) * slots;
+      }
+      
+      int step;
+      int moved = 1;
+      for (step=0; (step<targ->depth)&&(moved!=0); step++)
+      {
+       moved = 0;
+       for (i=0; i<FLAT_LOCKSTEP; i++)
+       {
+        int n = node[i];
+        int s = slot[n];
+        TestValue v = fv[i][s];
+        
+        // Written as !(a<b) to match DoContinuousSplit exactly, including for nan...
+         int pass = (s&1) ? (v.cat==value[n].cat) : !(v.real<value[n].real);
+        
+        node[i] = child[n*2 + pass];
+        moved |= node[i] ^ n;
+       }
+      }
+      
+      for (i=0; i<size; i++)
+      {
+       out[(base + group + i) * trees + t] = targ->leaf[node[i]];
+      }
+     }
+    }
+  }
+ 
+ // Clean up...
+  free(buffer);
+  free(used);
+}
+
+
+
 void Setup_Tree(void)
 {
  import_array();  
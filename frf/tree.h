@@ -44,7 +44,7 @@ struct TreeParam
 
 
 
-// Define the tree object - its one single block of memory for all the data, plus a single pointer to some extra stuff to accelerate indexing during runtime, but its designed to be dumped to disk at will, and then recovered afterwards, and used with only the building of a simple index...
+// Define the tree object - its one single block of memory for all the data, designed to be dumped to disk at will, and then recovered afterwards, and used with only the building of a simple index. The index is kept outside of the block (see Tree_index), so the block is never written to once created, and can be in read only memory - e.g. a memory mapped file, shared between processes...
 typedef struct Tree Tree;
 
 struct Tree
@@ -54,8 +54,8 @@ struct Tree
  long long size; // How big entire tree blob is - assuming long long is 64 bits.
   
  int trained; // How many exemplars were used to train this tree.
- int objects; // Number of entities.
- void ** index; // Index - gets you a pointer to each object. Has to be rebuilt after reloading. Note - first object (position 0) is an int aligned array of chars, giving types for the rest of the objects. 'N' for node, 'S' for summary. The root of the tree is always at position 1. The final object can be of type 'I', and contain feature importance, as sum of information gain multiplied by training exemplars that went through split.
+ int objects; // Number of entities. Note - first object (position 0) is an int aligned array of chars, giving types for the rest of the objects. 'N' for node, 'S' for summary. The root of the tree is always at position 1. The final object can be of type 'I', and contain feature importance, as sum of information gain multiplied by training exemplars that went through split.
+ long long unused; // Where a pointer to the index used to be stored - kept so the file format is unchanged. Written as zero, ignored on reading.
 };
 
 
@@ -63,21 +63,18 @@ struct Tree
 // Function type that is called for progress reporting - it is called each time exemplars are summarised, with the number done, such that the total of count will, when done, sum to the number passed in via the IndexSet at the start...
 typedef void (*ReportSummarisation)(int count, void * ptr);
 
-// Methods to learn a new tree from some data - internally this is rather complicated, but only because it has to deal with all the crazy memory stuff - all the real work is elsewhere in this library. Return value will have been malloc'ed - user needs to free. More of the parameters are in the param struct - see it for details, but a seperate index set of exemplars to use is required...
+// Methods to learn a new tree from some data - internally this is rather complicated, but only because it has to deal with all the crazy memory stuff - all the real work is elsewhere in this library. Return value will have been malloc'ed - user needs to free, and call Tree_index before using it. More of the parameters are in the param struct - see it for details, but a seperate index set of exemplars to use is required...
 Tree * Tree_learn(TreeParam * param, IndexSet * indices, ReportSummarisation rs, void * rs_ptr);
 
 
 // Returns non-zero if it thinks its a tree - i.e. the magic numbers and revision are correct, zero if there is a problem...
 int Tree_safe(Tree * this);
 
-// If you have just created a memory block to contain a tree then this rebuilds the index. Must be called before actually using the tree. Returns zero if it doesn't think you actually have a tree (and sets a python error), nonzero if all is good. On zero you don't call deinit...
-int Tree_init(Tree * this);
+// Builds the index of a tree, which is required by all of the methods that use the tree - an array of the offset of each object from the start of the tree, so object i is at (char*)tree + index[i]. Returns NULL if it doesn't think you actually have a tree (and sets a python error), otherwise a malloc-ed array the user has to free. Only reads the tree...
+size_t * Tree_index(Tree * this);
 
-// When done with a tree this cleans up the index, but not the memory of the actual Tree object...
-void Tree_deinit(Tree * this);
 
-
-// Returns how many bytes in size the Tree object should be - could be larger than sizeof(Tree) due to 32 bit/64 bit issues. Good number of bytes to read in before calling size and creating a real memory block...
+// Returns how many bytes in size the Tree object should be. Good number of bytes to read in before calling size and creating a real memory block...
 size_t Tree_head_size(void);
 
 // Returns how big the tree object is, in bytes. Note that this can be called during the loading process on the first sizeof(Tree) bytes to still get the correct answer...
@@ -87,17 +84,46 @@ size_t Tree_size(Tree * this);
 int Tree_objects(Tree * this);
 
 
-// Runs a Tree on a single exemplar - returns the SummarySet object that it lands in...
-SummarySet * Tree_run(Tree * this, DataMatrix * x, int exemplar);
+// Runs a Tree on a single exemplar - returns the SummarySet object that it lands in. This and the below all take the index, as returned by Tree_index...
+SummarySet * Tree_run(Tree * this, const size_t * index, DataMatrix * x, int exemplar);
 
 // Runs a Tree on many exemplars, recording the result into the provided array - step is how many to step between entries in out when writting the output, so you can interleave values from multiple trees as required by the SummarySet_merge_many_py method. Assumes that IndexSet is everything in the DataMatrix, in the sense that otherwise there will be gaps...
-void Tree_run_many(Tree * this, DataMatrix * x, IndexSet * is, SummarySet ** out, int step);
+void Tree_run_many(Tree * this, const size_t * index, DataMatrix * x, IndexSet * is, SummarySet ** out, int step);
 
 // Converts the Tree into a Python object suitable for human consumption - tests and summaries (leaf nodes) are represented as strings, whilst non-leaf nodes are represented with dictionaries, containing 'test', 'pass' and 'fail'...
-PyObject * Tree_human(Tree * this);
+PyObject * Tree_human(Tree * this, const size_t * index);
 
 // Returns a pointer to the feature importance vector that was calculated on tree creation, optionally outputting the feature count into the pointer. Feature importance is calculated by summing into this vector for each learnt split the number of nodes the split was over multiplied by the information gain of the split, for the relevant feature...
-const float * Tree_importance(Tree * this, int * length);
+const float * Tree_importance(Tree * this, const size_t * index, int * length);
+
+
+// A flattened copy of a tree, for fast inference - the Tree format above has to chase the index to variable sized objects and call a function per test, which is cache miss heavy. This is fixed size structure of arrays node storage instead, in breadth first order so the top of the tree (which every exemplar visits) is packed together. Leaves are included as nodes that loop back to themselves, so exemplars can be stepped without checking if they have arrived, which allows several exemplars to be pushed through a tree in lockstep, hiding the memory latency of each behind the others - a group stops when none of its exemplars moved, or the depth is reached. Tests are represented by a slot, which is feature * 2 + (1 if its a discrete equality test, 0 if its a continuous threshold test), and the value to compare with. Only the test types with a TestFlat function can be flattened. It points into the Tree it was made from for the leaves, so must not outlive it...
+typedef struct FlatTree FlatTree;
+
+struct FlatTree
+{
+ int nodes; // Number of nodes, including leaves; the root is always node 0.
+ int depth; // Number of steps required to get from the root to the deepest leaf.
+ int slots; // One more than the largest slot used by any test.
+ 
+ int * slot; // Slot of the value each node tests - for leaves the slot of the root, so it is safe to read.
+ TestValue * value; // Value each node compares against.
+ int * child; // Indexed [node * 2 + pass], so the fail child then the pass child. Leaves point to themselves.
+ SummarySet ** leaf; // Summary of each node, NULL if it is not a leaf.
+};
+
+
+// Creates a flattened version of a tree, given its index. Returns NULL if the tree contains a test that can not be flattened...
+FlatTree * FlatTree_new(Tree * tree, const size_t * index);
+
+// Cleans up...
+void FlatTree_delete(FlatTree * this);
+
+// Memory used by a flattened tree, in bytes...
+size_t FlatTree_size(FlatTree * this);
+
+// Runs a set of flattened trees on the exemplars [start, start+exemplars) of the data matrix, writting the leaf into out[(exemplar-start) * trees + tree], so its the same layout as Tree_run_many with step set to trees. Entrys in the tree array may be NULL, in which case they are skipped and their part of out left untouched. Works on blocks of exemplars, copying the features they use into a dense buffer once per block, so the cost of reading from the data matrix is shared by all trees...
+void FlatTree_run_many(int trees, FlatTree ** tree, DataMatrix * x, int start, int exemplars, SummarySet ** out);
 
 
 // Setup this module - for internal use only...
@@ -761,10 +761,289 @@ const BallsType BallsHashType =
 
 
 
+// Implimentation that can be used by many threads at once - spatial hashing again, but with a fixed size table of chained buckets, where new entries are pushed onto the front of a chain with an atomic compare and swap, so no locks are needed. Balls are stored in chunks that never move, so a ball that has been found can be read whilst others are being created. The table does not grow, so it should be created with a sensible size...
+static const int concurrent_chunk = 4096; // Balls per chunk.
+static const int concurrent_chunks = 4096; // Maximum number of chunks.
+
+typedef struct BallsEntry BallsEntry;
+struct BallsEntry
+{
+ BallsEntry * next;
+ int index; // Of the ball.
+ unsigned int hash; // Before it is reduced to the range of the table, so other cells that land in the same bucket can be skipped.
+};
+
+typedef struct BallsConcurrent BallsConcurrent;
+struct BallsConcurrent
+{
+ const BallsType * type;
+
+ int dims;
+ float step; // For discretising coordinates.
+
+ int count; // Number of ball indices handed out - only changed atomically.
+ int entries; // Number of entries in the table - only changed atomically, and only used for reporting memory.
+ char ** chunk; // concurrent_chunks pointers to chunks of balls, created as needed.
+
+ unsigned int mask; // Size of the table minus one - size is a power of two.
+ BallsEntry ** table;
+};
+
+
+
+Ball * BallsConcurrent_get(BallsConcurrent * this, int index)
+{
+ char * ptr = __atomic_load_n(this->chunk + index / concurrent_chunk, __ATOMIC_ACQUIRE);
+ ptr += (index % concurrent_chunk) * (sizeof(Ball) + this->dims * sizeof(float));
+ return (Ball*)ptr;
+}
+
+
+
+Balls BallsConcurrent_new_sized(int dims, float radius, int buckets)
+{
+ BallsConcurrent * this = (BallsConcurrent*)malloc(sizeof(BallsConcurrent));
+
+ this->type = &BallsConcurrentType;
+ this->dims = dims;
+ this->step = radius * 2.0;
+
+ this->count = 0;
+ this->entries = 0;
+ this->chunk = (char**)calloc(concurrent_chunks, sizeof(char*));
+
+ unsigned int size = 1024;
+ while ((int)size<buckets) size *= 2;
+ this->mask = size - 1;
+ this->table = (BallsEntry**)calloc(size, sizeof(BallsEntry*));
+
+ return (Balls)this;
+}
+
+Balls BallsConcurrent_new(int dims, float radius)
+{
+ return BallsConcurrent_new_sized(dims, radius, 65536);
+}
+
+void BallsConcurrent_delete(Balls self)
+{
+ BallsConcurrent * this = (BallsConcurrent*)self;
+
+ unsigned int i;
+ for (i=0; i<=this->mask; i++)
+ {
+  while (this->table[i]!=NULL)
+  {
+   BallsEntry * to_die = this->table[i];
+   this->table[i] = to_die->next;
+   free(to_die);
+  }
+ }
+ free(this->table);
+
+ int c;
+ for (c=0; c<concurrent_chunks; c++) free(this->chunk[c]);
+ free(this->chunk);
+
+ free(this);
+}
+
+int BallsConcurrent_dims(Balls self)
+{
+ BallsConcurrent * this = (BallsConcurrent*)self;
+ return this->dims;
+}
+
+int BallsConcurrent_count(Balls self)
+{
+ BallsConcurrent * this = (BallsConcurrent*)self;
+ int ret = __atomic_load_n(&this->count, __ATOMIC_ACQUIRE);
+ if (ret>concurrent_chunk*concurrent_chunks) ret = concurrent_chunk*concurrent_chunks; // Failed creates still claim an index.
+ return ret;
+}
+
+int BallsConcurrent_full(Balls self)
+{
+ BallsConcurrent * this = (BallsConcurrent*)self;
+ return __atomic_load_n(&this->count, __ATOMIC_ACQUIRE) > concurrent_chunk*concurrent_chunks;
+}
+
+int BallsConcurrent_create(Balls self, const float * pos, float radius)
+{
+ BallsConcurrent * this = (BallsConcurrent*)self;
+
+ // Claim an index, and make sure the chunk it lives in exists - if two threads race to create a chunk the loser frees theirs...
+  int index = __atomic_fetch_add(&this->count, 1, __ATOMIC_ACQ_REL);
+  int c = index / concurrent_chunk;
+  if (c>=concurrent_chunks) return -1;
+
+  if (__atomic_load_n(this->chunk + c, __ATOMIC_ACQUIRE)==NULL)
+  {
+   char * fresh = (char*)malloc(concurrent_chunk * (sizeof(Ball) + this->dims * sizeof(float)));
+   char * expected = NULL;
+   if (!__atomic_compare_exchange_n(this->chunk + c, &expected, fresh, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+   {
+    free(fresh);
+   }
+  }
+
+ // Fill in the ball - nobody else can see it until it is in the table...
+  Ball * targ = BallsConcurrent_get(this, index);
+  targ->radius = radius;
+  int i;
+  for (i=0; i<this->dims; i++) targ->pos[i] = pos[i];
+
+ // Iterate the grid cells that the hyper-sphere intersects, pushing an entry for each onto the front of its chain...
+  int * low = (int*)malloc(3 * this->dims * sizeof(int));
+  int * cell = low + this->dims;
+  int * high = cell + this->dims;
+
+  for (i=0; i<this->dims; i++)
+  {
+   low[i] = (int)floor((pos[i] - radius)/this->step);
+   cell[i] = low[i];
+   high[i] = (int)floor((pos[i] + radius)/this->step) + 1;
+  }
+
+  while (cell[0]<high[0])
+  {
+   // Check if the hyper-sphere intersects with the current cell...
+    float distSqr = 0.0;
+    for (i=0; i<this->dims; i++)
+    {
+     if (pos[i]<(cell[i]*this->step))
+     {
+      float delta = cell[i] * this->step - pos[i];
+      distSqr += delta*delta;
+     }
+     else
+     {
+      if (pos[i]>((cell[i]+1)*this->step))
+      {
+       float delta = pos[i] - (cell[i]+1) * this->step;
+       distSqr += delta*delta;
+      }
+     }
+    }
+
+    if (distSqr<radius*radius)
+    {
+     BallsEntry * nbe = (BallsEntry*)malloc(sizeof(BallsEntry));
+     nbe->index = index;
+     nbe->hash = grid_cell_hash(this->dims, this->step, NULL, cell);
+
+     BallsEntry ** head = this->table + (nbe->hash & this->mask);
+     nbe->next = __atomic_load_n(head, __ATOMIC_ACQUIRE);
+     while (!__atomic_compare_exchange_n(head, &nbe->next, nbe, 1, __ATOMIC_RELEASE, __ATOMIC_ACQUIRE));
+
+     __atomic_fetch_add(&this->entries, 1, __ATOMIC_RELAXED);
+    }
+
+   // Move to the next cell; break if done...
+    for (i=this->dims-1;; i--)
+    {
+     cell[i] += 1;
+     if (cell[i]<high[i]) break;
+     if (i==0) break;
+     cell[i] = low[i];
+    }
+  }
+
+  free(low);
+
+ return index;
+}
+
+const float * BallsConcurrent_pos(Balls self, int index)
+{
+ BallsConcurrent * this = (BallsConcurrent*)self;
+ Ball * targ = BallsConcurrent_get(this, index);
+ return targ->pos;
+}
+
+float BallsConcurrent_radius(Balls self, int index)
+{
+ BallsConcurrent * this = (BallsConcurrent*)self;
+ Ball * targ = BallsConcurrent_get(this, index);
+ return targ->radius;
+}
+
+int BallsConcurrent_within(Balls self, const float * pos)
+{
+ BallsConcurrent * this = (BallsConcurrent*)self;
+
+ // Find the chain for the cell the position is in...
+  unsigned int hash = grid_cell_hash(this->dims, this->step, pos, NULL);
+  BallsEntry * targ = __atomic_load_n(this->table + (hash & this->mask), __ATOMIC_ACQUIRE);
+
+ // Check every ball in it that is recorded for this cell, returning the one with the lowest index if there are several, so the answer does not depend on the order they were added...
+  int ret = -1;
+  while (targ!=NULL)
+  {
+   if ((targ->hash==hash)&&((ret<0)||(targ->index<ret)))
+   {
+    Ball * ball = BallsConcurrent_get(this, targ->index);
+
+    float distSqr = 0.0;
+    int i;
+    for (i=0; i<this->dims; i++)
+    {
+     float delta = ball->pos[i] - pos[i];
+     distSqr += delta * delta;
+    }
+
+    if (distSqr<=(ball->radius*ball->radius)) ret = targ->index;
+   }
+
+   targ = targ->next;
+  }
+
+ return ret;
+}
+
+size_t BallsConcurrent_byte_size(Balls self)
+{
+ BallsConcurrent * this = (BallsConcurrent*)self;
+
+ size_t mem = sizeof(BallsConcurrent);
+
+ mem += concurrent_chunks * sizeof(char*);
+ int c;
+ for (c=0; c<concurrent_chunks; c++)
+ {
+  if (this->chunk[c]!=NULL) mem += concurrent_chunk * (sizeof(Ball) + this->dims * sizeof(float));
+ }
+
+ mem += (this->mask + 1) * sizeof(BallsEntry*);
+ mem += this->entries * sizeof(BallsEntry);
+
+ return mem;
+}
+
+
+
+const BallsType BallsConcurrentType =
+{
+ "concurrent",
+ "Spatial hashing with a fixed size table of chained buckets, where insertion is lock free - create and within can be called by many threads at once. Slower than hash for single threaded use.",
+ BallsConcurrent_new,
+ BallsConcurrent_delete,
+ BallsConcurrent_dims,
+ BallsConcurrent_count,
+ BallsConcurrent_create,
+ BallsConcurrent_pos,
+ BallsConcurrent_radius,
+ BallsConcurrent_within,
+ BallsConcurrent_byte_size,
+};
+
+
+
 // List of hyper-sphere indexing structures...
 const BallsType * ListBalls[] =
 {
  &BallsListType,
  &BallsHashType,
+ &BallsConcurrentType,
  NULL
 };
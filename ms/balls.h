@@ -12,11 +12,48 @@
 
 
 #include <stddef.h>
+#include <math.h>
+
+#include "philox.h"
 
 // Defines code to handle a set of hyper-spheres - essentially provides online algorithms to create them, and query if a given point is within one, where each ball is represented by a center and radius...
 
 
 
+// Hashes a cell of a regular grid with cells of size step, given either as an integer cell (pos NULL) or a position to discretise (cell NULL) - shared by the concurrent balls and the basins cache, which both hash grid cells into fixed size tables...
+static inline unsigned int grid_cell_hash(int dims, float step, const float * pos, const int * cell)
+{
+ unsigned int ret = 0;
+
+ int base = 0;
+ int prev = 0;
+ while (base<dims)
+ {
+  unsigned int out[4];
+
+  int i;
+  for (i=0; i<4; i++)
+  {
+   int oi = base + i;
+   if (oi<dims)
+   {
+    prev += (cell!=NULL) ? cell[oi] : (int)floor(pos[oi] / step);
+    out[i] = (unsigned int)prev;
+   }
+   else out[i] = 0;
+  }
+
+  philox(out);
+  ret = ret ^ out[0];
+
+  base += 4;
+ }
+
+ return ret;
+}
+
+
+
 // Typedef for a hyper-sphere intersection object instance...
 typedef void * Balls;
 
@@ -34,7 +71,7 @@ typedef int (*BallsDims)(Balls this);
 // Returns how many balls are known to the system - note that their identifying integers must be tightly packed, so this allows them to be iterated...
 typedef int (*BallsCount)(Balls this);
 
-// Allows you to create a new ball, returning the number it is assigned...
+// Allows you to create a new ball, returning the number it is assigned, or a negative number if there is no room for it (only the concurrent version has a limit)...
 typedef int (*BallsCreate)(Balls this, const float * pos, float radius);
 
 // Returns the position of the given ball - you must not mess with the returned poiinter...
@@ -97,6 +134,12 @@ extern const BallsType BallsListType;
 // Spatial hashing version - divides the space into grid cells, storing each hyper-sphere into all grid cells with which it collides. Makes within tests very fast...
 extern const BallsType BallsHashType;
 
+// Concurrent version of the above - create and within can be called from many threads at the same time, without locks. Within returns the lowest index ball when a point is in several, and count includes balls whose create has not yet returned. The table does not grow, so the sized constructor is provided for when you have an idea of how many balls there will be. Ball storage is capped (at 4096 chunks of 4096 balls) - create returns -1 once it is full, and BallsConcurrent_full then returns non-zero, so the caller can report the failure rather than trust the labels...
+extern const BallsType BallsConcurrentType;
+
+Balls BallsConcurrent_new_sized(int dims, float radius, int buckets);
+int BallsConcurrent_full(Balls self);
+
 
 
 // List of all balls types known to the system - for automatic detection...
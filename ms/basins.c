@@ -0,0 +1,274 @@
+// Copyright 2013 Tom SF Haines
+
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except in compliance with the License. You may obtain a copy of the License at
+
+//   http://www.apache.org/licenses/LICENSE-2.0
+
+// Unless required by applicable law or agreed to in writing, software distributed under the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the License for the specific language governing permissions and limitations under the License.
+
+
+
+#include "basins.h"
+#include "balls.h"
+
+#include <stdlib.h>
+#include <math.h>
+
+#include "philox.h"
+
+
+
+static const int basins_chunk = 1024; // Positions per chunk.
+static const int basins_chunks = 4096; // Maximum number of chunks.
+static const int basins_load = 4; // Average chain length at which record stops adding entries, until sync grows the table.
+
+
+
+Basins * Basins_new(int dims, float step, int buckets)
+{
+ Basins * this = (Basins*)malloc(sizeof(Basins));
+
+ this->dims = dims;
+ this->step = step;
+ this->generation = 0;
+
+ unsigned int size = 1024;
+ while ((int)size<buckets) size *= 2;
+ this->mask = size - 1;
+ this->table = (BasinsEntry**)calloc(size, sizeof(BasinsEntry*));
+
+ this->entries = 0;
+
+ this->pos_count = 0;
+ this->pos_chunk = (float**)calloc(basins_chunks, sizeof(float*));
+
+ return this;
+}
+
+void Basins_delete(Basins * this)
+{
+ Basins_clear(this);
+
+ free(this->pos_chunk);
+ free(this->table);
+ free(this);
+}
+
+
+
+void Basins_clear(Basins * this)
+{
+ unsigned int i;
+ for (i=0; i<=this->mask; i++)
+ {
+  while (this->table[i]!=NULL)
+  {
+   BasinsEntry * to_die = this->table[i];
+   this->table[i] = to_die->next;
+   free(to_die);
+  }
+ }
+ this->entries = 0;
+
+ int c;
+ for (c=0; c<basins_chunks; c++)
+ {
+  free(this->pos_chunk[c]);
+  this->pos_chunk[c] = NULL;
+ }
+ this->pos_count = 0;
+}
+
+
+
+// Doubles the size of the table until there is at least one bucket per entry, moving the entries over - the hash before reduction is stored, so nothing is rehashed. Must not be called whilst other threads are using the cache...
+static void Basins_grow(Basins * this)
+{
+ unsigned int size = this->mask + 1;
+ if ((unsigned int)this->entries<=size) return;
+ 
+ while (size<(unsigned int)this->entries) size *= 2;
+ unsigned int mask = size - 1;
+ BasinsEntry ** table = (BasinsEntry**)calloc(size, sizeof(BasinsEntry*));
+ 
+ // Moving entries reverses the order of each chain, so duplicates of a cell (from racing threads) can swap; they will have been recorded by trajectories going to the same place, so either is fine...
+  unsigned int i;
+  for (i=0; i<=this->mask; i++)
+  {
+   while (this->table[i]!=NULL)
+   {
+    BasinsEntry * targ = this->table[i];
+    this->table[i] = targ->next;
+    
+    targ->next = table[targ->hash & mask];
+    table[targ->hash & mask] = targ;
+   }
+  }
+ 
+ free(this->table);
+ this->table = table;
+ this->mask = mask;
+}
+
+
+
+void Basins_sync(Basins * this, unsigned int generation)
+{
+ if (this->generation!=generation)
+ {
+  Basins_clear(this);
+  this->generation = generation;
+ }
+ else
+ {
+  Basins_grow(this);
+ }
+}
+
+
+
+int Basins_lookup(Basins * this, const float * pos)
+{
+ unsigned int hash = grid_cell_hash(this->dims, this->step, pos, NULL);
+ BasinsEntry * targ = __atomic_load_n(this->table + (hash & this->mask), __ATOMIC_ACQUIRE);
+
+ while (targ!=NULL)
+ {
+  if (targ->hash==hash)
+  {
+   int i;
+   for (i=0; i<this->dims; i++)
+   {
+    if (targ->cell[i]!=(int)floor(pos[i] / this->step)) break;
+   }
+   if (i==this->dims) return targ->value;
+  }
+
+  targ = targ->next;
+ }
+
+ return -1;
+}
+
+
+
+void Basins_record(Basins * this, const float * pos, int value)
+{
+ if (__atomic_load_n(&this->entries, __ATOMIC_RELAXED)>=basins_load*(int)(this->mask+1)) return;
+ if (Basins_lookup(this, pos)>=0) return;
+
+ BasinsEntry * nbe = (BasinsEntry*)malloc(sizeof(BasinsEntry) + this->dims * sizeof(int));
+ nbe->value = value;
+
+ int i;
+ for (i=0; i<this->dims; i++) nbe->cell[i] = (int)floor(pos[i] / this->step);
+ nbe->hash = grid_cell_hash(this->dims, this->step, NULL, nbe->cell);
+
+ // Push it onto the front of the chain - if another thread records the same cell at the same time there will be two entries, which is harmless as lookup takes the first...
+  BasinsEntry ** head = this->table + (nbe->hash & this->mask);
+  nbe->next = __atomic_load_n(head, __ATOMIC_ACQUIRE);
+  while (!__atomic_compare_exchange_n(head, &nbe->next, nbe, 1, __ATOMIC_RELEASE, __ATOMIC_ACQUIRE));
+
+  __atomic_fetch_add(&this->entries, 1, __ATOMIC_RELAXED);
+}
+
+
+
+int Basins_add_pos(Basins * this, const float * pos)
+{
+ // Claim an index, and make sure the chunk it lives in exists - if two threads race to create a chunk the loser frees theirs...
+  int index = __atomic_fetch_add(&this->pos_count, 1, __ATOMIC_ACQ_REL);
+  int c = index / basins_chunk;
+  if (c>=basins_chunks) return -1;
+
+  if (__atomic_load_n(this->pos_chunk + c, __ATOMIC_ACQUIRE)==NULL)
+  {
+   float * fresh = (float*)malloc(basins_chunk * this->dims * sizeof(float));
+   float * expected = NULL;
+   if (!__atomic_compare_exchange_n(this->pos_chunk + c, &expected, fresh, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+   {
+    free(fresh);
+   }
+  }
+
+ // Copy it in...
+  float * targ = __atomic_load_n(this->pos_chunk + c, __ATOMIC_ACQUIRE) + (index % basins_chunk) * this->dims;
+  int i;
+  for (i=0; i<this->dims; i++) targ[i] = pos[i];
+
+ return index;
+}
+
+const float * Basins_pos(Basins * this, int index)
+{
+ float * chunk = __atomic_load_n(this->pos_chunk + index / basins_chunk, __ATOMIC_ACQUIRE);
+ return chunk + (index % basins_chunk) * this->dims;
+}
+
+
+
+size_t Basins_byte_size(Basins * this)
+{
+ size_t mem = sizeof(Basins);
+
+ mem += (this->mask + 1) * sizeof(BasinsEntry*);
+ mem += this->entries * (sizeof(BasinsEntry) + this->dims * sizeof(int));
+
+ mem += basins_chunks * sizeof(float*);
+ int c;
+ for (c=0; c<basins_chunks; c++)
+ {
+  if (this->pos_chunk[c]!=NULL) mem += basins_chunk * this->dims * sizeof(float);
+ }
+
+ return mem;
+}
+
+
+
+void Trajectory_init(Trajectory * this, int dims)
+{
+ this->dims = dims;
+ this->count = 0;
+ this->size = 0;
+ this->pos = NULL;
+}
+
+void Trajectory_deinit(Trajectory * this)
+{
+ free(this->pos);
+ this->pos = NULL;
+}
+
+
+
+void Trajectory_add(Trajectory * this, const float * pos)
+{
+ if (this->count>=this->size)
+ {
+  this->size = (this->size<16) ? 16 : (this->size * 2);
+  this->pos = (float*)realloc(this->pos, this->size * this->dims * sizeof(float));
+ }
+
+ float * targ = this->pos + this->count * this->dims;
+ int i;
+ for (i=0; i<this->dims; i++) targ[i] = pos[i];
+
+ this->count += 1;
+}
+
+
+
+void Trajectory_record(Trajectory * this, Basins * basins, int value)
+{
+ if (value>=0)
+ {
+  int t;
+  for (t=0; t<this->count; t++)
+  {
+   Basins_record(basins, this->pos + t * this->dims, value);
+  }
+ }
+
+ this->count = 0;
+}
@@ -0,0 +1,97 @@
+#ifndef BASINS_H
+#define BASINS_H
+
+// Copyright 2013 Tom SF Haines
+
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except in compliance with the License. You may obtain a copy of the License at
+
+//   http://www.apache.org/licenses/LICENSE-2.0
+
+// Unless required by applicable law or agreed to in writing, software distributed under the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the License for the specific language governing permissions and limitations under the License.
+
+
+
+#include <stddef.h>
+
+// A cache of the basins of attraction of mean shift - the space is divided into grid cells, and every cell a mean shift trajectory passes through is recorded with where the trajectory ended up, so later trajectories that enter the same cell can stop early. What is stored is an integer, which is either an index of something held by the caller (e.g. a ball) or of a position stored by the cache (the mode). Lookup and record can be called by many threads at once, as they are lock free (new entries are pushed onto chained buckets with an atomic compare and swap), but clear, sync and delete can not. Cells that straddle the boundary between basins will send some trajectories to the wrong mode, so the cell size (step) controls a speed/accuracy trade off...
+
+
+
+typedef struct BasinsEntry BasinsEntry;
+
+struct BasinsEntry
+{
+ BasinsEntry * next;
+ unsigned int hash; // Before reduction to the table size.
+ int value;
+ int cell[];
+};
+
+
+
+typedef struct Basins Basins;
+
+struct Basins
+{
+ int dims;
+ float step; // Size of the grid cells.
+ unsigned int generation; // Whatever the cache is valid for - see Basins_sync.
+
+ unsigned int mask; // Table size minus one; a power of two.
+ BasinsEntry ** table;
+
+ int entries; // Only changed atomically.
+
+ int pos_count; // Stored positions - chunked, so they never move and can be appended to by many threads. Only changed atomically.
+ float ** pos_chunk;
+};
+
+
+
+// New and delete - dims is the dimensionality of the space, step the size of the grid cells and buckets the initial size of the hash table - it can only grow in sync, as lookup and record are lock free, so record stops adding entries once the average chain reaches a few entries, and the next sync grows the table to one bucket per entry. Lookups therefore stay constant time however long a stream of queries runs, and at worst a long batch stops caching part way through...
+Basins * Basins_new(int dims, float step, int buckets);
+void Basins_delete(Basins * this);
+
+// Empties the cache...
+void Basins_clear(Basins * this);
+
+// Makes sure the cache is for the given generation, clearing it if not - the caller increments the generation whenever something that invalidates the cache (kernel, scale, data) changes. If it is still valid this grows the table if it has become too full, so call it before every batch of queries...
+void Basins_sync(Basins * this, unsigned int generation);
+
+// Returns the value recorded for the cell pos is in, or a negative number if there isn't one...
+int Basins_lookup(Basins * this, const float * pos);
+
+// Records the given value for the cell pos is in, unless it already has one or the table is too full (see Basins_new)...
+void Basins_record(Basins * this, const float * pos, int value);
+
+// For storing positions (modes) - returns its index, which can then be used as a value...
+int Basins_add_pos(Basins * this, const float * pos);
+const float * Basins_pos(Basins * this, int index);
+
+// Returns how many bytes the cache is using...
+size_t Basins_byte_size(Basins * this);
+
+
+
+// Helper for recording trajectories - remembers the positions visited, so they can all be recorded once the destination is known...
+typedef struct Trajectory Trajectory;
+
+struct Trajectory
+{
+ int dims;
+ int count;
+ int size;
+ float * pos;
+};
+
+void Trajectory_init(Trajectory * this, int dims);
+void Trajectory_deinit(Trajectory * this);
+
+void Trajectory_add(Trajectory * this, const float * pos);
+
+// Records every position visited with the given value, then empties the trajectory...
+void Trajectory_record(Trajectory * this, Basins * basins, int value);
+
+
+
+#endif
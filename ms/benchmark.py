@@ -0,0 +1,182 @@
+#! /usr/bin/env python
+
+# Copyright 2013 Tom SF Haines
+
+# Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except in compliance with the License. You may obtain a copy of the License at
+
+#   http://www.apache.org/licenses/LICENSE-2.0
+
+# Unless required by applicable law or agreed to in writing, software distributed under the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the License for the specific language governing permissions and limitations under the License.
+
+import sys
+import time
+import json
+import platform
+import resource
+import argparse
+
+import numpy
+import numpy.random
+
+from ms import MeanShift
+
+
+
+# Performance suite for the module - generates synthetic data sets, sweeps kernel x spatial x dimension (and balls for clustering), timing the main operations, and writes the results out as json so runs can be compared to catch regressions. Run with --help for the options; progress goes to stderr, the json to stdout (or --output).
+
+
+
+parser = argparse.ArgumentParser(description='Benchmark the ms module, outputing json.')
+parser.add_argument('--exemplars', type=int, default=20000, help='Number of exemplars in the main data sets.')
+parser.add_argument('--queries', type=int, default=2000, help='Number of probs queries per configuration.')
+parser.add_argument('--dims', type=str, default='2,4,8', help='Comma separated list of dimensionalities to test.')
+parser.add_argument('--kernels', type=str, default='gaussian,epanechnikov,uniform,cauchy,fisher(16.0)', help='Comma separated list of kernels, with configuration where needed.')
+parser.add_argument('--spatials', type=str, default=','.join(MeanShift.spatials()), help='Comma separated list of spatial indexing structures.')
+parser.add_argument('--balls', type=str, default=','.join(MeanShift.balls()), help='Comma separated list of balls types, used for the clustering test.')
+parser.add_argument('--modes', type=int, default=200, help='Number of points to run mean shift from for the modes test.')
+parser.add_argument('--cluster', type=int, default=2000, help='Number of exemplars in the data set that is clustered - clustering runs mean shift from every exemplar, so this is kept smaller. 0 to skip.')
+parser.add_argument('--loo', type=int, default=500, help='Sample limit for loo_nll. 0 to skip.')
+parser.add_argument('--mult', type=int, default=200, help='Number of draws from the product of two density estimates (of 1000 exemplars each). 0 to skip.')
+parser.add_argument('--threads', type=int, default=1, help='Thread count passed to the batch methods - 0 for one per core.')
+parser.add_argument('--seed', type=int, default=0, help='Seed for the synthetic data.')
+parser.add_argument('--output', type=str, default=None, help='File to write the json to, rather than stdout.')
+args = parser.parse_args()
+
+
+
+# Synthetic data - a mixture of a few Gaussian blobs, projected onto the unit hypersphere for the directional kernels...
+def make_data(rng, count, dims, directional):
+  centres = rng.normal(scale=4.0, size=(5, dims))
+  data = centres[rng.randint(5, size=count),:] + rng.normal(size=(count, dims))
+
+  if directional:
+    data /= numpy.sqrt(numpy.square(data).sum(axis=1))[:,numpy.newaxis]
+
+  return data.astype(numpy.float32)
+
+
+def directional(kernel):
+  return kernel.startswith('fisher') or kernel.startswith('mirror_fisher')
+
+
+def make_ms(data, kernel, spatial, balls = None):
+  ms = MeanShift()
+  ms.set_data(data, 'df')
+  ms.set_kernel(kernel)
+  ms.set_spatial(spatial)
+  if balls!=None: ms.set_balls(balls)
+  if not directional(kernel): ms.scale_silverman()
+  return ms
+
+
+def progress(msg):
+  sys.stderr.write(msg + '\n')
+  sys.stderr.flush()
+
+
+
+# Run the sweep...
+rng = numpy.random.RandomState(args.seed)
+results = []
+
+for dims in [int(d) for d in args.dims.split(',')]:
+  for kernel in args.kernels.split(','):
+    data = make_data(rng, args.exemplars, dims, directional(kernel))
+    query = make_data(rng, args.queries, dims, directional(kernel))
+
+    for spatial in args.spatials.split(','):
+      progress('%iD %s %s' % (dims, kernel, spatial))
+      entry = {'dims' : dims, 'kernel' : kernel, 'spatial' : spatial, 'exemplars' : args.exemplars}
+      peak = 0
+
+      ms = make_ms(data, kernel, spatial)
+
+      # probs - includes building the spatial, which is timed separately by doing one query first...
+      start = time.time()
+      ms.probs(query[:1,:])
+      mid = time.time()
+      ms.probs(query)
+      end = time.time()
+
+      entry['build_s'] = mid - start
+      entry['probs'] = {'queries_per_s' : query.shape[0] / (end - mid)}
+      if spatial=='brute_force':
+        entry['probs']['ns_per_kernel_eval'] = 1e9 * (end - mid) / (query.shape[0] * float(args.exemplars))
+
+      c = ms.counters(True)
+      if c['enabled']:
+        entry['probs']['candidates_per_query'] = c['candidates_per_query']
+        entry['probs']['nodes_per_query'] = c['nodes_per_query']
+      peak = max(peak, ms.memory()['total'])
+
+      # modes...
+      if args.modes>0:
+        start = time.time()
+        ms.modes(query[:args.modes,:], args.threads)
+        end = time.time()
+        entry['modes'] = {'per_s' : args.modes / (end - start)}
+
+        c = ms.counters(True)
+        if c['enabled']:
+          entry['modes']['iterations_per_mode'] = c['iterations_per_mode']
+          entry['modes']['iter_cap_rate'] = c['iter_cap_rate']
+          entry['modes']['candidates_per_query'] = c['candidates_per_query']
+
+      # loo_nll...
+      if args.loo>0:
+        start = time.time()
+        ms.loo_nll(1e-16, args.loo)
+        end = time.time()
+        entry['loo_nll'] = {'samples' : args.loo, 'seconds' : end - start}
+
+      peak = max(peak, ms.memory()['total'])
+
+      # mult, of two small estimates drawn from the data...
+      if args.mult>0:
+        a = make_ms(data[:1000,:], kernel, spatial)
+        b = make_ms(data[1000:2000,:], kernel, spatial)
+        out = numpy.empty((args.mult, dims), dtype=numpy.float32)
+
+        start = time.time()
+        MeanShift.mult([a, b], out)
+        end = time.time()
+        entry['mult'] = {'draws_per_s' : args.mult / (end - start)}
+
+      # cluster, for each balls type...
+      if args.cluster>0:
+        entry['cluster'] = []
+        for balls in args.balls.split(','):
+          cms = make_ms(data[:args.cluster,:], kernel, spatial, balls)
+
+          start = time.time()
+          modes, assignment = cms.cluster(args.threads)
+          end = time.time()
+
+          entry['cluster'].append({'balls' : balls, 'seconds' : end - start, 'clusters' : modes.shape[0]})
+
+          c = cms.counters()
+          if c['enabled']:
+            entry['cluster'][-1]['iterations_per_mode'] = c['iterations_per_mode']
+            entry['cluster'][-1]['ball_hit_rate'] = c['ball_hit_rate']
+          peak = max(peak, cms.memory()['total'])
+
+      entry['memory'] = ms.memory()
+      entry['peak_memory'] = peak
+      results.append(entry)
+
+
+
+# Output...
+report = {}
+report['config'] = vars(args)
+report['platform'] = {'python' : platform.python_version(), 'numpy' : numpy.__version__, 'machine' : platform.machine(), 'processor' : platform.processor()}
+report['max_rss_kb'] = resource.getrusage(resource.RUSAGE_SELF).ru_maxrss
+report['results'] = results
+
+if args.output!=None:
+  f = open(args.output, 'w')
+  json.dump(report, f, indent=1, sort_keys=True)
+  f.close()
+else:
+  json.dump(report, sys.stdout, indent=1, sort_keys=True)
+  print
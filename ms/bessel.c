@@ -10,7 +10,9 @@
 
 #include "bessel.h"
 
+#include <stdlib.h>
 #include <math.h>
+#include <pthread.h>
 
 // For C99...
 #ifndef M_PI
@@ -19,34 +21,50 @@
 
 
 
-// Giant cache of the logs of the integers and half integers, to accelerate the below...
-int log_array_size;
-float * log_array_data;
+// Giant cache of the logs of the integers and half integers, to accelerate the below - called from many threads at once (e.g. mult_batch), so it is grown under a lock into a fresh block that is then published atomically. Older blocks are kept until the module is unloaded, as other threads may still be reading them; as the size at least doubles each time they total less than the current block...
+typedef struct LogHalfBlock LogHalfBlock;
+
+struct LogHalfBlock
+{
+ LogHalfBlock * prev; // Older, smaller block.
+ int size;
+ float data[];
+};
+
+static pthread_mutex_t log_array_lock = PTHREAD_MUTEX_INITIALIZER;
+static LogHalfBlock * log_array = NULL;
 
 // Given the maximum desired value * 2, so the halves are integers, this returns an array indexed by value * 2 to get log(value)...
 const float * LogHalfArray(int max)
 {
  int size = max+1;
- if (size>log_array_size)
- {
-  log_array_data = (float*)realloc(log_array_data, size*sizeof(float));
-  
-  if (log_array_size==0)
-  {
-   log_array_data[0] = 1e-32;
-   log_array_size = 1;
-  }
-  
-  int i;
-  for (i=log_array_size; i<size; i++)
+ 
+ LogHalfBlock * block = __atomic_load_n(&log_array, __ATOMIC_ACQUIRE);
+ if ((block!=NULL)&&(block->size>=size)) return block->data;
+ 
+ pthread_mutex_lock(&log_array_lock);
+  block = log_array;
+  if ((block==NULL)||(block->size<size))
   {
-   log_array_data[i] = log(0.5 * i);
+   if ((block!=NULL)&&(size<2*block->size)) size = 2*block->size;
+   
+   LogHalfBlock * fresh = (LogHalfBlock*)malloc(sizeof(LogHalfBlock) + size*sizeof(float));
+   fresh->prev = block;
+   fresh->size = size;
+   
+   fresh->data[0] = 1e-32;
+   int i;
+   for (i=1; i<size; i++)
+   {
+    fresh->data[i] = log(0.5 * i);
+   }
+   
+   __atomic_store_n(&log_array, fresh, __ATOMIC_RELEASE);
+   block = fresh;
   }
+ pthread_mutex_unlock(&log_array_lock);
   
-  log_array_size = size;
- }
-  
- return log_array_data;
+ return block->data;
 }
 
 
@@ -305,5 +323,10 @@ float LogLowerIncompleteGamma(int x2, float limit)
 
 void FreeBesselMemory(PyObject * ignored)
 {
- free(log_array_data);
+ while (log_array!=NULL)
+ {
+  LogHalfBlock * to_die = log_array;
+  log_array = to_die->prev;
+  free(to_die);
+ }
 }
@@ -0,0 +1,241 @@
+// Copyright 2013 Tom SF Haines
+
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except in compliance with the License. You may obtain a copy of the License at
+
+//   http://www.apache.org/licenses/LICENSE-2.0
+
+// Unless required by applicable law or agreed to in writing, software distributed under the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the License for the specific language governing permissions and limitations under the License.
+
+
+
+#include "coreset.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+
+
+// Appends a cell to the output, growing the arrays as needed...
+static void Coreset_emit(Coreset * this, int * capacity, const float * fv, float weight)
+{
+ if (this->count==*capacity)
+ {
+  *capacity *= 2;
+  this->fv = (float*)realloc(this->fv, (size_t)(*capacity) * this->dims * sizeof(float));
+  this->weight = (float*)realloc(this->weight, (*capacity) * sizeof(float));
+ }
+
+ memcpy(this->fv + (size_t)this->count * this->dims, fv, this->dims * sizeof(float));
+ this->weight[this->count] = weight;
+ this->count += 1;
+}
+
+
+
+Coreset * Coreset_new(DataMatrix * dm, const Kernel * kernel, KernelConfig config, float tolerance)
+{
+ int dims = DataMatrix_features(dm);
+ int exemplars = DataMatrix_exemplars(dm);
+
+ Coreset * this = (Coreset*)malloc(sizeof(Coreset));
+ this->dims = dims;
+ this->count = 0;
+ this->mean_shift = 0.0;
+ this->max_shift = 0.0;
+
+ int capacity = 64;
+ this->fv = (float*)malloc((size_t)capacity * dims * sizeof(float));
+ this->weight = (float*)malloc(capacity * sizeof(float));
+
+ // Copy out every feature vector with a non-zero weight, as they are visited many times...
+  float * data = (float*)malloc((size_t)exemplars * dims * sizeof(float));
+  float * w = (float*)malloc(exemplars * sizeof(float));
+  int * index = (int*)malloc(exemplars * sizeof(int));
+
+  int i, j;
+  int valid = 0;
+  for (i=0; i<exemplars; i++)
+  {
+   DataMatrix_fv_into(dm, i, data + (size_t)valid * dims, w + valid);
+   if (w[valid]>0.0)
+   {
+    index[valid] = valid;
+    valid += 1;
+   }
+  }
+
+ // Temporary storage for the cell being processed...
+  double * sum = (double*)malloc(dims * sizeof(double));
+  float * mean = (float*)malloc(dims * sizeof(float));
+  float * centre = (float*)malloc(dims * sizeof(float));
+  float * zero = (float*)malloc(dims * sizeof(float));
+  float * low = (float*)malloc(dims * sizeof(float));
+  float * high = (float*)malloc(dims * sizeof(float));
+  for (j=0; j<dims; j++) zero[j] = 0.0;
+
+  double total_shift = 0.0;
+  double total_weight = 0.0;
+  float tol_sqr = tolerance * tolerance;
+
+ // Stack of ranges of index still to process...
+  int stack_size = 64;
+  int stack_len = 0;
+  int * stack = (int*)malloc(2 * stack_size * sizeof(int));
+
+  if (valid>0)
+  {
+   stack[0] = 0;
+   stack[1] = valid;
+   stack_len = 1;
+  }
+
+  while (stack_len>0)
+  {
+   stack_len -= 1;
+   int start = stack[2*stack_len];
+   int end = stack[2*stack_len+1];
+
+   // Weighted mean and bounding box of the cell...
+    double weight = 0.0;
+    for (j=0; j<dims; j++)
+    {
+     sum[j] = 0.0;
+     low[j] = data[(size_t)index[start] * dims + j];
+     high[j] = low[j];
+    }
+
+    for (i=start; i<end; i++)
+    {
+     const float * fv = data + (size_t)index[i] * dims;
+     float wi = w[index[i]];
+     weight += wi;
+
+     for (j=0; j<dims; j++)
+     {
+      sum[j] += wi * fv[j];
+      if (fv[j]<low[j]) low[j] = fv[j];
+      if (fv[j]>high[j]) high[j] = fv[j];
+     }
+    }
+
+    for (j=0; j<dims; j++)
+    {
+     mean[j] = sum[j] / weight;
+     centre[j] = mean[j];
+    }
+    kernel->offset(dims, config, centre, zero);
+
+   // A directional kernel can not project a mean of (near) zero length, e.g. a cell holding q and -q - that gives a non-finite centre, which forces a split...
+    int lost = 0;
+    for (j=0; j<dims; j++)
+    {
+     if (!isfinite(centre[j])) lost = 1;
+    }
+
+   // Check if every exemplar is close enough to the centre, noting the shift in case they are...
+    float furthest = (lost!=0) ? INFINITY : 0.0;
+    double shift = 0.0;
+    for (i=start; (lost==0)&&(i<end); i++)
+    {
+     const float * fv = data + (size_t)index[i] * dims;
+     float dist_sqr = 0.0;
+     for (j=0; j<dims; j++)
+     {
+      float delta = fv[j] - centre[j];
+      dist_sqr += delta * delta;
+     }
+
+     if (dist_sqr>furthest) furthest = dist_sqr;
+     shift += w[index[i]] * sqrt(dist_sqr);
+    }
+
+   // Find the dimension with the widest spread, and partition on it at the mean...
+    int split = 0;
+    for (j=1; j<dims; j++)
+    {
+     if ((high[j]-low[j])>(high[split]-low[split])) split = j;
+    }
+
+    int mid = start;
+    if ((furthest>tol_sqr)&&((end-start)>1))
+    {
+     float value = mean[split];
+     if ((value<=low[split])||(value>high[split])) value = 0.5 * (low[split] + high[split]); // Rounding safety.
+
+     int top = end - 1;
+     mid = start;
+     while (mid<=top)
+     {
+      if (data[(size_t)index[mid] * dims + split] < value) mid += 1;
+      else
+      {
+       int temp = index[mid];
+       index[mid] = index[top];
+       index[top] = temp;
+       top -= 1;
+      }
+     }
+    }
+
+   // Either emit the cell or push both halves; degenerate splits (which only happen when rounding makes the spread unsplittable) are emitted, as their original exemplars if there is no centre to emit...
+    if (((mid==start)||(mid==end))&&(lost!=0))
+    {
+     for (i=start; i<end; i++)
+     {
+      Coreset_emit(this, &capacity, data + (size_t)index[i] * dims, w[index[i]]);
+     }
+     
+     total_weight += weight;
+    }
+    else if ((mid==start)||(mid==end))
+    {
+     Coreset_emit(this, &capacity, centre, weight);
+
+     total_shift += shift;
+     total_weight += weight;
+     if (furthest>this->max_shift) this->max_shift = furthest;
+    }
+    else
+    {
+     if ((stack_len+2)>stack_size)
+     {
+      stack_size *= 2;
+      stack = (int*)realloc(stack, 2 * stack_size * sizeof(int));
+     }
+
+     stack[2*stack_len]   = start;
+     stack[2*stack_len+1] = mid;
+     stack[2*stack_len+2] = mid;
+     stack[2*stack_len+3] = end;
+     stack_len += 2;
+    }
+  }
+
+ // Finish the statistics...
+  this->max_shift = sqrt(this->max_shift);
+  if (total_weight>0.0) this->mean_shift = total_shift / total_weight;
+
+ // Clean up...
+  free(stack);
+  free(high);
+  free(low);
+  free(zero);
+  free(centre);
+  free(mean);
+  free(sum);
+  free(index);
+  free(w);
+  free(data);
+
+ return this;
+}
+
+
+
+void Coreset_delete(Coreset * this)
+{
+ free(this->weight);
+ free(this->fv);
+ free(this);
+}
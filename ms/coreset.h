@@ -0,0 +1,48 @@
+#ifndef CORESET_H
+#define CORESET_H
+
+// Copyright 2013 Tom SF Haines
+
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except in compliance with the License. You may obtain a copy of the License at
+
+//   http://www.apache.org/licenses/LICENSE-2.0
+
+// Unless required by applicable law or agreed to in writing, software distributed under the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the License for the specific language governing permissions and limitations under the License.
+
+
+
+#include <stddef.h>
+
+#include "kernels.h"
+#include "data_matrix.h"
+
+
+
+// Compression of a kernel density estimate into a weighted coreset, by merging kd tree cells - the exemplars are recursively split, on the dimension with the widest spread at the weighted mean, until every exemplar in a cell is within tolerance of the cells weighted mean, at which point the cell becomes a single exemplar at that mean, carrying the cells total weight. Everything is done in the internal (converted and scaled) space, where the kernel has its standard size, so the tolerance is in units of the kernels bandwidth. The mean is passed through the kernels offset method with a zero offset before being used, so kernels with a constrained domain (the directional ones) get it projected back onto their domain - distances are measured to the projected point. A mean that can not be projected, because it has (near) zero length, as for a cell holding both q and -q, forces a split, and if the cell can not be split its original exemplars are kept. Exemplars with zero weight are dropped. Cost is O(exemplars * dims * depth), and a copy of the feature vectors is made.
+
+// Accuracy guarantee - no exemplar moves more than tolerance. For a kernel with Lipschitz constant L (in the internal space, for the normalised kernel) every probability is therefore within L * tolerance of the original, and more usefully the L1 distance between the original and compressed density estimates is at most the weighted mean distance moved (mean_shift below) times the L1 norm of the kernels directional derivative - for the Gaussian that is sqrt(2/pi), so L1 <= 0.8 mean_shift <= 0.8 tolerance.
+
+
+
+typedef struct Coreset Coreset;
+
+struct Coreset
+{
+ int dims;
+ int count; // Number of exemplars in the coreset.
+ float * fv; // count x dims matrix of feature vectors, in the internal space.
+ float * weight; // count weights, with the data matrices weight_scale applied.
+
+ float mean_shift; // Weighted mean of how far each original exemplar moved.
+ float max_shift; // Furthest any original exemplar moved - never more than the tolerance.
+};
+
+
+
+// Builds a coreset from the data matrix - see above...
+Coreset * Coreset_new(DataMatrix * dm, const Kernel * kernel, KernelConfig config, float tolerance);
+void Coreset_delete(Coreset * this);
+
+
+
+#endif
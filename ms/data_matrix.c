@@ -12,6 +12,7 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <math.h>
 
 
 
@@ -128,7 +129,8 @@ void DataMatrix_init(DataMatrix * dm)
   dm->dt = NULL;
   dm->weight_index = -1;
   dm->weight_scale = 1.0;
-  dm->weight_cum = NULL;
+  dm->alias_prob = NULL;
+  dm->alias = NULL;
   dm->exemplars = 0;
   dm->feats = 0;
   dm->dual_feats = 0;
@@ -141,19 +143,58 @@ void DataMatrix_init(DataMatrix * dm)
   dm->fv_conv = NULL;
   dm->ops_conv = 0;
   dm->conv = NULL;
+  dm->mat = NULL;
+  dm->mat_weight = NULL;
+  dm->mat_offset = 0;
+  dm->mat_capacity = 0;
+  dm->mat_external = 0;
+  dm->mat_type = MAT_NONE;
+  dm->mat_compact = NULL;
+  dm->quant_base = NULL;
+  dm->quant_step = NULL;
+  dm->source = NULL;
 }
 
 
 void DataMatrix_deinit(DataMatrix * dm)
 {
+ // Views only own their temporary storage, plus the alias table if they had to build it themselves...
+  if (dm->source!=NULL)
+  {
+   free(dm->fv);
+   free(dm->fv_conv);
+   if (dm->alias!=dm->source->alias)
+   {
+    free(dm->alias_prob);
+    free(dm->alias);
+   }
+   
+   dm->fv = NULL;
+   dm->fv_conv = NULL;
+   dm->alias_prob = NULL;
+   dm->alias = NULL;
+   dm->mat = NULL;
+   dm->mat_weight = NULL;
+   dm->mat_type = MAT_NONE;
+   dm->mat_compact = NULL;
+   dm->quant_base = NULL;
+   dm->quant_step = NULL;
+   dm->source = NULL;
+   return;
+  }
+ 
+ DataMatrix_materialise(dm, 0);
+ 
  Py_XDECREF(dm->array);
  dm->array = NULL;
  
  free(dm->dt);
  dm->dt = NULL;
  
- free(dm->weight_cum);
- dm->weight_cum = NULL;
+ free(dm->alias_prob);
+ dm->alias_prob = NULL;
+ free(dm->alias);
+ dm->alias = NULL;
  
  dm->exemplars = 0;
  dm->feats = 0;
@@ -245,9 +286,11 @@ void DataMatrix_set(DataMatrix * dm, PyArrayObject * array, DimType * dt, int we
    }
   }
   
- // Clean up any cache of cumulative weight...
-  free(dm->weight_cum);
-  dm->weight_cum = NULL;
+ // Clean up any alias table...
+  free(dm->alias_prob);
+  dm->alias_prob = NULL;
+  free(dm->alias);
+  dm->alias = NULL;
   
  // Store a function pointer in the to_float variable that matches this array type...
   dm->to_float = KindToFunc(PyArray_DESCR(dm->array));
@@ -291,6 +334,164 @@ void DataMatrix_set(DataMatrix * dm, PyArrayObject * array, DimType * dt, int we
 
 
 
+void DataMatrix_view(DataMatrix * dm, DataMatrix * source)
+{
+ // Shallow copy everything...
+  *dm = *source;
+  dm->source = source;
+  
+ // Replace the temporary storage with our own...
+  dm->fv = (float*)malloc(dm->feats * sizeof(float));
+  if (source->fv_conv!=NULL)
+  {
+   dm->fv_conv = (float*)malloc(dm->feats_conv * sizeof(float));
+  }
+}
+
+
+
+// Helpers for the compact formats, defined below...
+static size_t DataMatrix_compact_elem(DataMatrix * dm);
+static void DataMatrix_encode(DataMatrix * dm, int index, const float * fv, float levels);
+
+
+void DataMatrix_shift(DataMatrix * dm, PyArrayObject * array, int evicted)
+{
+ // Swap in the new array - the old one is kept until the end, as it could own the memory the materialised copy is in...
+  PyArrayObject * old = dm->array;
+  Py_INCREF(array);
+  dm->array = array;
+  
+  int kept = dm->exemplars - evicted;
+  dm->exemplars = PyArray_DIMS(dm->array)[0];
+  
+ // The alias table is now wrong...
+  free(dm->alias_prob);
+  dm->alias_prob = NULL;
+  free(dm->alias);
+  dm->alias = NULL;
+  
+ // Update the materialised copy, if it exists - drop the evicted rows from the front, then make sure there is space for the new rows at the end, compacting into a new allocation with room to grow if not...
+  if (dm->mat!=NULL)
+  {
+   int feats = dm->feats_conv;
+   dm->mat += (size_t)evicted * feats;
+   dm->mat_weight += evicted;
+   dm->mat_offset += evicted;
+   
+   if (((dm->mat_offset + dm->exemplars)>dm->mat_capacity)||(dm->mat_external!=0))
+   {
+    int capacity = 2 * dm->exemplars;
+    if (capacity<64) capacity = 64;
+    
+    void * ptr;
+    if (posix_memalign(&ptr, 64, (size_t)capacity * feats * sizeof(float))!=0)
+    {
+     DataMatrix_materialise(dm, 0);
+     Py_DECREF(old);
+     return;
+    }
+    float * mat = (float*)ptr;
+    float * mat_weight = (float*)malloc(capacity * sizeof(float));
+    
+    memcpy(mat, dm->mat, (size_t)kept * feats * sizeof(float));
+    memcpy(mat_weight, dm->mat_weight, kept * sizeof(float));
+    
+    if (dm->mat_external==0)
+    {
+     free(dm->mat - (size_t)dm->mat_offset * feats);
+     free(dm->mat_weight - dm->mat_offset);
+    }
+    
+    dm->mat = mat;
+    dm->mat_weight = mat_weight;
+    dm->mat_offset = 0;
+    dm->mat_capacity = capacity;
+    dm->mat_external = 0;
+   }
+   
+   // Fill in the new rows, with the slow path - mat is not used by it...
+    int i;
+    for (i=kept; i<dm->exemplars; i++)
+    {
+     float * fv = DataMatrix_ext_fv(dm, i, dm->mat_weight + i);
+     fv = DataMatrix_to_int(dm, fv, dm->fv_conv);
+     memcpy(dm->mat + (size_t)i * feats, fv, feats * sizeof(float));
+    }
+  }
+  
+ // Same again for the compact formats, except that the quantised ones have a fixed range per feature - new rows are only encoded in place if they are inside it, otherwise everything is rebuilt with a range that covers them. The range therefore only grows between rebuilds...
+  if (dm->mat_compact!=NULL)
+  {
+   int feats = dm->feats_conv;
+   size_t row = feats * DataMatrix_compact_elem(dm);
+   float levels = (dm->mat_type==MAT_UINT8) ? 255.0 : 65535.0;
+   int i, j;
+   
+   dm->mat_compact = (char*)dm->mat_compact + (size_t)evicted * row;
+   if (dm->mat_weight!=NULL) dm->mat_weight += evicted;
+   dm->mat_offset += evicted;
+   
+   if (dm->quant_base!=NULL)
+   {
+    for (i=kept; i<dm->exemplars; i++)
+    {
+     float * fv = DataMatrix_ext_fv(dm, i, NULL);
+     fv = DataMatrix_to_int(dm, fv, dm->fv_conv);
+     
+     for (j=0; j<feats; j++)
+     {
+      if ((fv[j]<dm->quant_base[j])||(fv[j]>(dm->quant_base[j] + levels * dm->quant_step[j])))
+      {
+       DataMatrix_materialise(dm, dm->mat_type);
+       Py_DECREF(old);
+       return;
+      }
+     }
+    }
+   }
+   
+   if ((dm->mat_offset + dm->exemplars)>dm->mat_capacity)
+   {
+    int capacity = 2 * dm->exemplars;
+    if (capacity<64) capacity = 64;
+    
+    void * compact = malloc((size_t)capacity * row);
+    if (compact==NULL)
+    {
+     DataMatrix_materialise(dm, 0);
+     Py_DECREF(old);
+     return;
+    }
+    memcpy(compact, dm->mat_compact, (size_t)kept * row);
+    free((char*)dm->mat_compact - (size_t)dm->mat_offset * row);
+    
+    if (dm->mat_weight!=NULL)
+    {
+     float * mat_weight = (float*)malloc(capacity * sizeof(float));
+     memcpy(mat_weight, dm->mat_weight, kept * sizeof(float));
+     free(dm->mat_weight - dm->mat_offset);
+     dm->mat_weight = mat_weight;
+    }
+    
+    dm->mat_compact = compact;
+    dm->mat_offset = 0;
+    dm->mat_capacity = capacity;
+   }
+   
+   for (i=kept; i<dm->exemplars; i++)
+   {
+    float * fv = DataMatrix_ext_fv(dm, i, (dm->mat_weight!=NULL) ? (dm->mat_weight + i) : NULL);
+    fv = DataMatrix_to_int(dm, fv, dm->fv_conv);
+    DataMatrix_encode(dm, i, fv, levels);
+   }
+  }
+  
+ Py_DECREF(old);
+}
+
+
+
 int DataMatrix_exemplars(DataMatrix * dm)
 {
  return dm->exemplars;  
@@ -314,15 +515,317 @@ void DataMatrix_set_scale(DataMatrix * dm, float * scale, float weight_scale)
  int i;
  for (i=0; i<dm->feats_conv; i++) dm->mult[i] = scale[i];
  dm->weight_scale = weight_scale;
+ 
+ if (dm->mat_type!=MAT_NONE) DataMatrix_materialise(dm, dm->mat_type);
+}
+
+
+
+// Conversion to and from half precision floats, done with bit manipulation so as not to depend on compiler or hardware support - rounds to nearest even, including into the subnormals, and clamps anything that would overflow to the largest finite value...
+static unsigned short Float_to_half(float f)
+{
+ union {float f; unsigned int u;} v;
+ v.f = f;
+ 
+ unsigned int sign = (v.u >> 16) & 0x8000;
+ unsigned int mag = v.u & 0x7fffffff;
+ 
+ if (mag>=0x477fe000) return sign | 0x7bff; // At least 65504, or inf/nan.
+ 
+ if (mag<0x38800000) // Below the smallest normal half, 2^-14.
+ {
+  if (mag<0x33000000) return sign; // At most half of the smallest subnormal, 2^-25.
+  
+  unsigned int shift = 126 - (mag >> 23);
+  unsigned int mant = (mag & 0x7fffff) | 0x800000;
+  unsigned int h = mant >> shift;
+  unsigned int rem = mant & ((1u << shift) - 1);
+  unsigned int half = 1u << (shift - 1);
+  
+  if ((rem>half)||((rem==half)&&(h&1))) h += 1;
+  return sign | h;
+ }
+ 
+ unsigned int h = (mag - 0x38000000) >> 13;
+ unsigned int rem = mag & 0x1fff;
+ if ((rem>0x1000)||((rem==0x1000)&&(h&1))) h += 1;
+ 
+ return sign | h;
+}
+
+static inline float Half_to_float(unsigned short h)
+{
+ // Shift the exponent and mantissa into place then fix the bias with a multiply, which handles the subnormals for free...
+  union {float f; unsigned int u;} v;
+  v.u = (unsigned int)(h & 0x7fff) << 13;
+  v.f *= 5.192296858534828e+33f; // 2^112
+  v.u |= (unsigned int)(h & 0x8000) << 16;
+  
+ return v.f;
+}
+
+
+
+// Decodes row index of the compact materialised copy into out...
+static inline void DataMatrix_decode(DataMatrix * dm, int index, float * out)
+{
+ int feats = dm->feats_conv;
+ int i;
+ 
+ switch (dm->mat_type)
+ {
+  case MAT_FLOAT16:
+  {
+   const unsigned short * row = (const unsigned short*)dm->mat_compact + (size_t)index * feats;
+   for (i=0; i<feats; i++) out[i] = Half_to_float(row[i]);
+  }
+  break;
+  
+  case MAT_UINT16:
+  {
+   const unsigned short * row = (const unsigned short*)dm->mat_compact + (size_t)index * feats;
+   for (i=0; i<feats; i++) out[i] = dm->quant_base[i] + row[i] * dm->quant_step[i];
+  }
+  break;
+  
+  case MAT_UINT8:
+  {
+   const unsigned char * row = (const unsigned char*)dm->mat_compact + (size_t)index * feats;
+   for (i=0; i<feats; i++) out[i] = dm->quant_base[i] + row[i] * dm->quant_step[i];
+  }
+  break;
+  
+  default:
+  break;
+ }
+}
+
+
+// Bytes per feature of the compact materialised copy...
+static size_t DataMatrix_compact_elem(DataMatrix * dm)
+{
+ return (dm->mat_type==MAT_UINT8) ? sizeof(unsigned char) : sizeof(unsigned short);
+}
+
+
+// Encodes a feature vector into row index of the compact materialised copy...
+static void DataMatrix_encode(DataMatrix * dm, int index, const float * fv, float levels)
+{
+ int feats = dm->feats_conv;
+ int i;
+ 
+ if (dm->mat_type==MAT_FLOAT16)
+ {
+  unsigned short * row = (unsigned short*)dm->mat_compact + (size_t)index * feats;
+  for (i=0; i<feats; i++) row[i] = Float_to_half(fv[i]);
+  return;
+ }
+ 
+ for (i=0; i<feats; i++)
+ {
+  float code = 0.0;
+  if (dm->quant_step[i]>0.0)
+  {
+   code = floor((fv[i] - dm->quant_base[i]) / dm->quant_step[i] + 0.5);
+   if (code<0.0) code = 0.0;
+   if (code>levels) code = levels;
+  }
+  
+  if (dm->mat_type==MAT_UINT16) ((unsigned short*)dm->mat_compact)[(size_t)index * feats + i] = (unsigned short)code;
+                           else ((unsigned char*)dm->mat_compact)[(size_t)index * feats + i] = (unsigned char)code;
+ }
+}
+
+
+
+void DataMatrix_materialise(DataMatrix * dm, int state)
+{
+ // Terminate any previous version...
+  if ((dm->mat!=NULL)&&(dm->mat_external==0))
+  {
+   free(dm->mat - (size_t)dm->mat_offset * dm->feats_conv);
+   free(dm->mat_weight - dm->mat_offset);
+  }
+  
+  if (dm->mat_compact!=NULL)
+  {
+   free((char*)dm->mat_compact - (size_t)dm->mat_offset * dm->feats_conv * DataMatrix_compact_elem(dm));
+   if (dm->mat_weight!=NULL) free(dm->mat_weight - dm->mat_offset);
+   free(dm->quant_base);
+   free(dm->quant_step);
+  }
+  
+  dm->mat = NULL;
+  dm->mat_weight = NULL;
+  dm->mat_offset = 0;
+  dm->mat_capacity = 0;
+  dm->mat_external = 0;
+  dm->mat_type = MAT_NONE;
+  dm->mat_compact = NULL;
+  dm->quant_base = NULL;
+  dm->quant_step = NULL;
+  
+  if ((state==MAT_NONE)||(dm->array==NULL)) return;
+  if ((state<MAT_FLOAT32)||(state>MAT_UINT8)) state = MAT_FLOAT32;
+  
+  int feats = dm->feats_conv;
+  int i, j;
+  
+ // Compact formats - for the quantised formats a first pass finds the range of each feature, then a second pass encodes, all using the slow path...
+  if (state!=MAT_FLOAT32)
+  {
+   size_t elem = (state==MAT_UINT8) ? sizeof(unsigned char) : sizeof(unsigned short);
+   void * compact = malloc((size_t)dm->exemplars * feats * elem);
+   if (compact==NULL) return;
+   
+   float * quant_base = (float*)malloc(feats * sizeof(float));
+   float * quant_step = (float*)malloc(feats * sizeof(float));
+   float levels = (state==MAT_UINT8) ? 255.0 : 65535.0;
+   
+   if (state!=MAT_FLOAT16)
+   {
+    float * high = quant_step;
+    for (j=0; j<feats; j++)
+    {
+     quant_base[j] = 0.0;
+     high[j] = 0.0;
+    }
+    
+    for (i=0; i<dm->exemplars; i++)
+    {
+     float * fv = DataMatrix_fv(dm, i, NULL);
+     for (j=0; j<feats; j++)
+     {
+      if ((i==0)||(fv[j]<quant_base[j])) quant_base[j] = fv[j];
+      if ((i==0)||(fv[j]>high[j])) high[j] = fv[j];
+     }
+    }
+    
+    for (j=0; j<feats; j++) quant_step[j] = (high[j] - quant_base[j]) / levels;
+   }
+   else
+   {
+    free(quant_base);
+    free(quant_step);
+    quant_base = NULL;
+    quant_step = NULL;
+   }
+   
+   float * mat_weight = NULL;
+   if (dm->weight_index>=0) mat_weight = (float*)malloc(dm->exemplars * sizeof(float));
+   
+   dm->mat_type = state;
+   dm->mat_compact = compact;
+   dm->mat_capacity = dm->exemplars;
+   dm->quant_base = quant_base;
+   dm->quant_step = quant_step;
+   
+   for (i=0; i<dm->exemplars; i++)
+   {
+    float * fv = DataMatrix_ext_fv(dm, i, (mat_weight!=NULL) ? (mat_weight + i) : NULL);
+    fv = DataMatrix_to_int(dm, fv, dm->fv_conv);
+    DataMatrix_encode(dm, i, fv, levels);
+   }
+   
+   dm->mat_weight = mat_weight;
+   return;
+  }
+ 
+ // Allocate, aligned to a cache line...
+  void * ptr;
+  if (posix_memalign(&ptr, 64, (size_t)dm->exemplars * feats * sizeof(float))!=0) return;
+  float * mat = (float*)ptr;
+  float * mat_weight = (float*)malloc(dm->exemplars * sizeof(float));
+  
+ // Fill it in, using the slow path...
+  for (i=0; i<dm->exemplars; i++)
+  {
+   float * fv = DataMatrix_ext_fv(dm, i, mat_weight + i);
+   fv = DataMatrix_to_int(dm, fv, dm->fv_conv);
+   memcpy(mat + (size_t)i * feats, fv, feats * sizeof(float));
+  }
+  
+ // Only now make it live, so the above did not use it...
+  dm->mat = mat;
+  dm->mat_weight = mat_weight;
+  dm->mat_capacity = dm->exemplars;
+  dm->mat_type = MAT_FLOAT32;
+}
+
+
+void DataMatrix_materialise_external(DataMatrix * dm, float * mat, float * mat_weight)
+{
+ DataMatrix_materialise(dm, 0);
+ 
+ dm->mat = mat;
+ dm->mat_weight = mat_weight;
+ dm->mat_capacity = dm->exemplars;
+ dm->mat_external = 1;
+ dm->mat_type = MAT_FLOAT32;
+}
+
+
+int DataMatrix_materialised(DataMatrix * dm)
+{
+ return (dm->mat_type!=MAT_NONE) ? 1 : 0;
 }
 
 
 
 float * DataMatrix_fv(DataMatrix * dm, int index, float * weight)
 {
- float * ret = DataMatrix_ext_fv(dm, index, weight);
- ret = DataMatrix_to_int(dm, ret, dm->fv_conv); 
- return ret;
+ // Fastest path - the float32 materialised matrix already holds the row in the right form, so hand out a pointer into it...
+  if (dm->mat_type==MAT_FLOAT32)
+  {
+   if (weight!=NULL) *weight = (dm->mat_weight!=NULL) ? dm->mat_weight[index] : dm->weight_scale;
+   return dm->mat + (size_t)index * dm->feats_conv;
+  }
+  
+ // Fast path - decode from a compact materialised matrix...
+  if (dm->mat_type!=MAT_NONE)
+  {
+   float * ret = (dm->fv_conv!=NULL) ? dm->fv_conv : dm->fv;
+   DataMatrix_fv_into(dm, index, ret, weight);
+   return ret;
+  }
+  
+ // Slow path - extract and convert...
+  float * ret = DataMatrix_ext_fv(dm, index, weight);
+  ret = DataMatrix_to_int(dm, ret, dm->fv_conv); 
+  return ret;
+}
+
+
+void DataMatrix_fv_into(DataMatrix * dm, int index, float * out, float * weight)
+{
+ switch (dm->mat_type)
+ {
+  case MAT_NONE:
+  {
+   // Convert (or scale) straight into out, rather than into internal storage that then has to be copied...
+    float * ext = DataMatrix_ext_fv(dm, index, weight);
+    if (dm->fv_conv!=NULL)
+    {
+     DataMatrix_to_int(dm, ext, out);
+    }
+    else
+    {
+     int i;
+     for (i=0; i<dm->feats_conv; i++) out[i] = ext[i] * dm->mult[i];
+    }
+  }
+  return;
+  
+  case MAT_FLOAT32:
+   memcpy(out, dm->mat + (size_t)index * dm->feats_conv, dm->feats_conv * sizeof(float));
+  break;
+  
+  default:
+   DataMatrix_decode(dm, index, out);
+  break;
+ }
+ 
+ if (weight!=NULL) *weight = (dm->mat_weight!=NULL) ? dm->mat_weight[index] : dm->weight_scale;
 }
 
 
@@ -411,62 +914,183 @@ float * DataMatrix_ext_fv(DataMatrix * dm, int index, float * weight)
 
 
 
+float DataMatrix_weight(DataMatrix * dm, int index)
+{
+ // Fast paths - materialised or no weight feature...
+  if (dm->mat_weight!=NULL) return dm->mat_weight[index];
+  if (dm->weight_index<0) return dm->weight_scale;
+  
+ // Indexing pass, as for DataMatrix_ext_fv, but only paying attention to the weight...
+  int i;
+  char * base = PyArray_DATA(dm->array);
+  int next_dual_feat = dm->dual_feats-1;
+  float ret = dm->weight_scale;
+  
+  for (i=PyArray_NDIM(dm->array)-1; i>=0; i--)
+  {
+   npy_intp size = PyArray_DIMS(dm->array)[i];
+   npy_intp step = index % size;
+   
+   if (dm->dt[i]==DIM_DUAL)
+   {
+    if (dm->weight_index==next_dual_feat) ret *= step;
+    next_dual_feat -= 1;
+   }
+   
+   if (dm->dt[i]!=DIM_FEATURE)
+   {
+    base += PyArray_STRIDES(dm->array)[i] * step;
+    index /= size;
+   }
+  }
+  
+ // If the weight is a feature go and fetch it...
+  if (dm->weight_index>=dm->dual_feats)
+  {
+   int fi = dm->weight_index - dm->dual_feats;
+   for (i=dm->feat_dims-1; i>=0; i--)
+   {
+    int di = dm->feat_indices[i];
+    npy_intp size = PyArray_DIMS(dm->array)[di];
+    base += PyArray_STRIDES(dm->array)[di] * (fi % size);
+    fi /= size;
+   }
+   
+   ret *= dm->to_float(base);
+  }
+  
+ return ret;
+}
+
+
+
+// Builds the alias table, using Vose's algorithm - exemplars with below average weight are paired up with one with above average weight that fills the rest of their slot...
+static void DataMatrix_build_alias(DataMatrix * dm)
+{
+ int n = dm->exemplars;
+ float * alias_prob = (float*)malloc(n * sizeof(float));
+ int * alias = (int*)malloc(n * sizeof(int));
+ 
+ // Get the weights, scaled so the average is 1 - double to avoid the errors accumulating...
+  double * scaled = (double*)malloc(n * sizeof(double));
+  double total = 0.0;
+  
+  int i;
+  for (i=0; i<n; i++)
+  {
+   scaled[i] = DataMatrix_weight(dm, i);
+   if (scaled[i]<0.0) scaled[i] = 0.0;
+   total += scaled[i];
+  }
+  
+  if (total>0.0)
+  {
+   for (i=0; i<n; i++) scaled[i] *= n / total;
+  }
+  else
+  {
+   for (i=0; i<n; i++) scaled[i] = 1.0;
+  }
+ 
+ // Split into the small and large work lists, stored at either end of the same array...
+  int * work = (int*)malloc(n * sizeof(int));
+  int small = 0;
+  int large = n;
+  
+  for (i=0; i<n; i++)
+  {
+   if (scaled[i]<1.0)
+   {
+    work[small] = i;
+    small += 1;
+   }
+   else
+   {
+    large -= 1;
+    work[large] = i;
+   }
+  }
+  
+ // Pair them up...
+  while ((small>0)&&(large<n))
+  {
+   small -= 1;
+   int s = work[small];
+   int l = work[large];
+   
+   alias_prob[s] = scaled[s];
+   alias[s] = l;
+   
+   scaled[l] -= 1.0 - scaled[s];
+   if (scaled[l]<1.0)
+   {
+    large += 1;
+    work[small] = l;
+    small += 1;
+   }
+  }
+  
+ // Anything left over is only unpaired due to numerical error, so it gets its entire slot...
+  while (small>0)
+  {
+   small -= 1;
+   alias_prob[work[small]] = 1.0;
+   alias[work[small]] = work[small];
+  }
+  
+  while (large<n)
+  {
+   alias_prob[work[large]] = 1.0;
+   alias[work[large]] = work[large];
+   large += 1;
+  }
+  
+ // Clean up and make it live...
+  free(work);
+  free(scaled);
+  
+  dm->alias_prob = alias_prob;
+  dm->alias = alias;
+}
+
+
+
 int DataMatrix_draw(DataMatrix * dm, PhiloxRNG * rng)
 {
- // Two scenarios - all samples have the same weight, or they don't, resulting in different approaches...
-  if (dm->weight_index<0) // All samples have the same weight
-  { 
-   // Uniform draw multiplied by the number of exemplars...
-    float pos = dm->exemplars * PhiloxRNG_uniform(rng);
-    
-   // Return the index of the sample that is that far in...
-    return (int)pos;
+ // Select a slot, uniformly - a full 32 bit random number is used so this does not run out of precision for large data sets...
+  int slot = (int)(((unsigned long long)PhiloxRNG_next(rng) * (unsigned long long)dm->exemplars) >> 32);
+  
+ // If all samples have the same weight we are done...
+  if (dm->weight_index<0) return slot;
+  
+ // Otherwise use the alias table, building it if needed...
+  if (dm->alias==NULL) DataMatrix_build_alias(dm);
+  
+  if (PhiloxRNG_uniform(rng)<dm->alias_prob[slot]) return slot;
+  return dm->alias[slot];
+}
+
+
+void DataMatrix_draws(DataMatrix * dm, PhiloxRNG * rng, int count, int * out)
+{
+ int i;
+ if (dm->weight_index<0)
+ {
+  for (i=0; i<count; i++)
+  {
+   out[i] = (int)(((unsigned long long)PhiloxRNG_next(rng) * (unsigned long long)dm->exemplars) >> 32);
   }
-  else // Samples have variable weights
+ }
+ else
+ {
+  if (dm->alias==NULL) DataMatrix_build_alias(dm);
+  
+  for (i=0; i<count; i++)
   {
-   // Build the array of cumulative weights if it has not already been cached...
-    if (dm->weight_cum==NULL)
-    {
-     dm->weight_cum = (float*)malloc(dm->exemplars * sizeof(float));
-     
-     float sum = 0.0;
-     int i;
-     for (i=0; i<dm->exemplars; i++)
-     {
-      float weight;
-      DataMatrix_fv(dm, i, &weight); // Inefficient - could write code to get just the weight out, but its as painful as the called function. May do later.
-      sum += weight;
-      dm->weight_cum[i] = sum;
-     }
-    }
-    
-   // Uniform draw multiplied by the total weight, as given by weight_cum...
-    float pos = dm->weight_cum[dm->exemplars-1] * PhiloxRNG_uniform(rng);
-    
-   // Use a biased binary search (under the assumption that similar weights are more likelly) to find the index of the relevant item; return it...
-    if (pos<=dm->weight_cum[0]) return 0;
-    
-    int low  = 0;
-    int high = dm->exemplars-1;
-    
-    while (low+1<high)
-    {
-     // Select a split point...
-      float wc_low = dm->weight_cum[low];
-      float wc_high = dm->weight_cum[high];
-      
-      int split = (int)(low + (high - low)*((pos - wc_low) / (wc_high-wc_low)));
-      
-      if (split>=high) split = high-1;
-      if (split<=low)  split = low+1;
-      
-     // Recurse to the relevant side...
-      if (dm->weight_cum[split]>pos) high = split;
-                                else low  = split;
-    }
-    
-    return high;
+   int slot = (int)(((unsigned long long)PhiloxRNG_next(rng) * (unsigned long long)dm->exemplars) >> 32);
+   out[i] = (PhiloxRNG_uniform(rng)<dm->alias_prob[slot]) ? slot : dm->alias[slot];
   }
+ }
 }
 
 
@@ -524,12 +1148,22 @@ size_t DataMatrix_byte_size(DataMatrix * dm)
  size_t mem = sizeof(DataMatrix);
  
  if (dm->dt!=NULL) mem += PyArray_NDIM(dm->array) * sizeof(DimType);
- if (dm->weight_cum!=NULL) mem += dm->exemplars * sizeof(float);
+ if (dm->alias_prob!=NULL) mem += dm->exemplars * sizeof(float);
+ if (dm->alias!=NULL) mem += dm->exemplars * sizeof(int);
  if (dm->mult!=NULL) mem += dm->feats_conv * sizeof(float);
  if (dm->fv!=NULL) mem += dm->feats * sizeof(float);
  if (dm->feat_indices!=NULL) mem += dm->feat_dims * sizeof(int);
  if (dm->fv_conv!=NULL) mem += dm->feats_conv * sizeof(float);
  if (dm->conv!=NULL) mem += dm->ops_conv * sizeof(ConvertOp);
+ if ((dm->mat!=NULL)&&(dm->mat_external==0)) mem += (size_t)dm->mat_capacity * dm->feats_conv * sizeof(float);
+ if ((dm->mat_weight!=NULL)&&(dm->mat_external==0)) mem += dm->mat_capacity * sizeof(float);
+ 
+ if (dm->mat_compact!=NULL)
+ {
+  mem += (size_t)dm->mat_capacity * dm->feats_conv * DataMatrix_compact_elem(dm);
+  if (dm->mat_weight!=NULL) mem += dm->mat_capacity * sizeof(float);
+  if (dm->quant_base!=NULL) mem += 2 * dm->feats_conv * sizeof(float);
+ }
 
  return mem;  
 }
@@ -29,6 +29,9 @@
 // Define the types for an index of a matrix...
 typedef enum {DIM_DATA, DIM_DUAL, DIM_FEATURE} DimType;
 
+// The formats the materialised copy of the data matrix can be stored in - not materialised, full precision floats, half precision floats, or affine quantised to 16 or 8 bit unsigned integers with a scale and offset per feature...
+typedef enum {MAT_NONE, MAT_FLOAT32, MAT_FLOAT16, MAT_UINT16, MAT_UINT8} MatType;
+
 // A function that converts a pointer to a float...
 typedef float (*ToFloat)(void * data);
 
@@ -62,8 +65,9 @@ struct DataMatrix
   int weight_index;
   float weight_scale;
   
- // Cumulative weight array, so we can do a binary search when drawing a  specific exemplar from the data matrix - only used if there is a weight_index set. If not NULL then it must be valid - note that this uses a random weight_scale as its not relevant (Whatever it was when the cache is built), and is inclusive, so the last entry is the total weight...
-  float * weight_cum;
+ // Alias table (Walker's method, built with Vose's algorithm), so drawing a specific exemplar from the data matrix is constant time - only used if there is a weight_index set. Exemplar i is drawn with probability alias_prob[i] when its slot is selected, otherwise alias[i] is. Built on first use; if not NULL then it must be valid...
+  float * alias_prob;
+  int * alias;
   
  // Number of data items represented by the data matrix - calculated when you set the array...
   int exemplars;
@@ -93,6 +97,22 @@ struct DataMatrix
   
   int ops_conv; // Number of below - conversion is to loop and apply each in turn.
   ConvertOp * conv;
+  
+ // Optional materialised copy of every feature vector, after conversion and scaling, as a contiguous (and aligned) exemplars x feats_conv matrix, plus a column of weights with weight_scale already applied. NULL if not in use, otherwise fv is just a row copy. Kept in sync by set_scale...
+  float * mat;
+  float * mat_weight;
+  int mat_offset; // Rows of the allocation before mat - rows that have been shifted out but not yet reclaimed.
+  int mat_capacity; // Total rows in the allocation.
+  int mat_external; // Non-zero if mat and mat_weight belong to someone else, e.g. a memory mapped file, and must not be freed or written to.
+  
+ // Which format the materialised copy is in - for the compact formats (everything other than MAT_FLOAT32) mat is NULL and the values live in mat_compact instead, an exemplars x feats_conv matrix of half floats, unsigned shorts or unsigned chars that is decoded on extraction. For the integer formats feature i is quant_base[i] + code * quant_step[i]. The compact formats only keep mat_weight if the exemplars have different weights, otherwise it is NULL...
+  MatType mat_type;
+  void * mat_compact;
+  float * quant_base;
+  float * quant_step;
+  
+ // If this is a view of another data matrix then this points to it - a view shares everything with its source except for the temporary storage, so multiple threads can fetch feature vectors at the same time. NULL if this data matrix owns its data...
+  DataMatrix * source;
 };
 
 
@@ -101,10 +121,17 @@ struct DataMatrix
 void DataMatrix_init(DataMatrix * dm);
 void DataMatrix_deinit(DataMatrix * dm);
 
+// Initialises dm as a view of source - it shares the array and all of the configuration, but has its own temporary storage so that it can be used by a different thread to source. The source must not be changed (set, set_scale or deinit) whilst the view exists, and the view should be deinit-ed as normal when done; you can't call set on a view...
+void DataMatrix_view(DataMatrix * dm, DataMatrix * source);
+
 // Allows you to set a numpy data matrix for use; you have to assign a type to each dimension as well. If you want a weight that is not 1 you can assign one of the features to be a weight, by giving its index - this feature will not appear in the feature count and return of the fv method. Otherwise set the weight index to be negative. You can optionally provide a conversion string (rather than NULL), of convert codes to define a runtime format different to the storage format (no error checking!)...
 void DataMatrix_set(DataMatrix * dm, PyArrayObject * array, DimType * dt, int weight_index, const char * conv_str);
 
 
+// For streaming - replaces the array with one that has identical layout and type apart from the size of the first dimension, on the assumption that row i of the new array is row i+evicted of the old array, with any extra rows at the end being new. The first dimension must be the only data dimension, and there can be no dual dimensions. If materialised only the new rows are converted, with space reserved so this is amortised constant time per row - the quantised formats also have to rebuild in full when new rows are outside their range...
+void DataMatrix_shift(DataMatrix * dm, PyArrayObject * array, int evicted);
+
+
 // Returns basic stats...
 int DataMatrix_exemplars(DataMatrix * dm);
 int DataMatrix_features(DataMatrix * dm);
@@ -112,19 +139,38 @@ int DataMatrix_features(DataMatrix * dm);
 int DataMatrix_ext_features(DataMatrix * dm); // External feature count, before conversion (if any).
 
 
-// Allows you to set the multipliers for the features - the scale array passed in better have the right length, as returned by the feats method. You should also provide a weight_scale...
+// Allows you to set the multipliers for the features - the scale array passed in better have the right length, as returned by the feats method. You should also provide a weight_scale. If the data matrix is materialised this rebuilds the materialised copy...
 void DataMatrix_set_scale(DataMatrix * dm, float * scale, float weight_scale);
 
 
-// Fetches a feature vector, using a single index to do row-major indexing into all dimensions marked as data or dual. Note that the returned pointer is to internal storage, that is replaced every time this method is called. The dual dimensions will always be first, followed by all the feature dimensions in row major flattened order. If you want the weight as well provide a pointer and it will be filled...
+// Switches the materialised copy on (state non-zero) or off (state zero, MAT_NONE) - when on every feature vector is converted and scaled once, in a single pass, and stored in a contiguous matrix, so fetching a feature vector becomes a pointer into it; costs exemplars * (features + 1) floats. Calling it when already on rebuilds it, which you need to do if the contents of the numpy array change. Note that set deinitialises it - you have to switch it back on. state is a MatType, with any value that is not recognised treated as MAT_FLOAT32. The compact formats trade accuracy for memory, in the internal (converted and scaled) space: MAT_FLOAT16 has a relative error of at most 2^-11 (absolute error 2^-25 for magnitudes below 2^-14, and magnitudes above 65504 are clamped), whilst MAT_UINT16 and MAT_UINT8 quantise each feature uniformly between its minimum and maximum, so the absolute error is at most half of (maximum - minimum) / 65535 or / 255. Bytes per exemplar are features * (2, 2 or 1), plus 4 if weighted. They are decoded straight into the callers storage by DataMatrix_fv_into. A shift only encodes the new rows, unless they fall outside the quantisation range, in which case it rebuilds in full with a range that covers them - between rebuilds the range can be wider than the current data...
+void DataMatrix_materialise(DataMatrix * dm, int state);
+
+// As above, but with the materialised matrix and weights provided by the caller, who still owns them - for when they come from a memory mapped file. They must contain what DataMatrix_materialise would have calculated, with the current scale, and remain valid until the data matrix is deinit-ed, set or materialised again; set_scale and shift replace them with an owned copy...
+void DataMatrix_materialise_external(DataMatrix * dm, float * mat, float * mat_weight);
+
+// Returns non-zero if the data matrix is currently materialised, in any format - only the MAT_FLOAT32 format has a valid mat pointer...
+int DataMatrix_materialised(DataMatrix * dm);
+
+
+// Fetches a feature vector, using a single index to do row-major indexing into all dimensions marked as data or dual. Note that the returned pointer is to internal storage and must be treated as read only - when materialised as MAT_FLOAT32 it points straight into the matrix (which may be a read only memory map), otherwise it is a buffer that is replaced every time this method is called. If you want to edit the vector use DataMatrix_fv_into. The dual dimensions will always be first, followed by all the feature dimensions in row major flattened order. If you want the weight as well provide a pointer and it will be filled...
 float * DataMatrix_fv(DataMatrix * dm, int index, float * weight);
 
-// As above, but in the external format, without conversion or scaling...
+// As above, but writes the feature vector into out, which must have room for DataMatrix_features floats, rather than returning internal storage - saves a copy when the caller wants the vector somewhere specific, such as a block of exemplars, and the compact materialised formats are decoded directly into it...
+void DataMatrix_fv_into(DataMatrix * dm, int index, float * out, float * weight);
+
+// As DataMatrix_fv, but in the external format, without conversion or scaling...
 float * DataMatrix_ext_fv(DataMatrix * dm, int index, float * weight);
 
+// Returns the weight of an exemplar, without the cost of extracting the feature vector...
+float DataMatrix_weight(DataMatrix * dm, int index);
+
 // Draws the index of a random exemplar from the datamatrix, using the philox random number generator (If exemplars are weighted it will be a weighted draw)...
 int DataMatrix_draw(DataMatrix * dm, PhiloxRNG * rng);
 
+// As above, but makes count draws in one call, writing the indices into out...
+void DataMatrix_draws(DataMatrix * dm, PhiloxRNG * rng, int count, int * out);
+
 
 // Converts an external vector to an internal vector, noting that if no conversion happens it just returns the pointer to the provided external array rather than copying the data across (in the no-conversion case its safe for internal to be NULL!) This means conversion and multiplication by scale. Effectivly destructive to external...
 float * DataMatrix_to_int(DataMatrix * dm, float * external, float * internal);
@@ -0,0 +1,380 @@
+// Copyright 2013 Tom SF Haines
+
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except in compliance with the License. You may obtain a copy of the License at
+
+//   http://www.apache.org/licenses/LICENSE-2.0
+
+// Unless required by applicable law or agreed to in writing, software distributed under the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the License for the specific language governing permissions and limitations under the License.
+
+
+
+#include "fisher_cache.h"
+
+#include "bessel.h"
+#include "kernels.h"
+
+#include <math.h>
+#include <pthread.h>
+
+// For C99...
+#ifndef M_PI
+#define M_PI 3.141592653589793238462643383279502884L
+#endif
+
+
+
+// Returns log(I_v(x)) - v log(x), where I_v is the modified Bessel function of the first kind, in double precision - subtracting the v log(x) term gets rid of the singularity at zero, which makes the result smooth (and finite) for all x>=0. Sums the series in log space, keeping a running maximum so nothing overflows, and stops once the terms are well past their peak and negligible...
+static double LogBesselRatio(double v, double x)
+{
+ double log_2 = log(2.0);
+ if (x<=0.0) return -v * log_2 - lgamma(v + 1.0);
+
+ double log_main_mult = 2.0 * log(0.5 * x);
+ double peak = 0.5 * x; // Terms increase until r(r+v) exceeds (x/2)^2, so are past their peak once r is above this.
+
+ double term = -lgamma(v + 1.0);
+ double max = term;
+ double sum = 1.0; // Relative to exp(max).
+
+ int r;
+ for (r=1; r<1000000; r++)
+ {
+  term += log_main_mult - log((double)r) - log(r + v);
+
+  if (term>max)
+  {
+   sum = sum * exp(max - term) + 1.0;
+   max = term;
+  }
+  else
+  {
+   sum += exp(term - max);
+   if ((r>peak) && (term<(max-40.0))) break;
+  }
+ }
+
+ return -v * log_2 + max + log(sum);
+}
+
+
+
+// Log normaliser of the von-Mises Fisher distribution in double precision, plus the concentration, which is the quantity that is tabulated as it is smooth with a bounded derivative (without adding conc it heads off towards minus infinity linearly)...
+static double LogNormPlusConc(int dims, double conc)
+{
+ double v = 0.5 * dims - 1.0;
+ return -0.5 * dims * log(2.0 * M_PI) - LogBesselRatio(v, conc) + conc;
+}
+
+
+
+// The per dimension normaliser table, in a lock free linked list...
+typedef struct FisherNorm FisherNorm;
+
+struct FisherNorm
+{
+ int dims;
+ float error; // Maximum absolute error of the interpolation, measured halfway between entries.
+ FisherNorm * next;
+
+ double value[FISHER_NORM_SIZE+3]; // LogNormPlusConc at sqrt(conc) = (i-1) * step, for i in 0..FISHER_NORM_SIZE+2 - one entry of padding either end for the cubic interpolation.
+};
+
+static FisherNorm * fisher_norm_list = NULL;
+
+
+
+// Catmull-Rom interpolation of the four values, at t in [0, 1] between the middle two...
+static inline double CatmullRom(const double * v, double t)
+{
+ double t2 = t * t;
+ double t3 = t2 * t;
+
+ return 0.5 * ((2.0 * v[1]) + (v[2] - v[0]) * t + (2.0*v[0] - 5.0*v[1] + 4.0*v[2] - v[3]) * t2 + (3.0*v[1] - v[0] - 3.0*v[2] + v[3]) * t3);
+}
+
+
+
+static FisherNorm * FisherNorm_build(int dims)
+{
+ FisherNorm * this = (FisherNorm*)malloc(sizeof(FisherNorm));
+ this->dims = dims;
+ this->next = NULL;
+
+ double step = sqrt(CONC_SWITCH) / FISHER_NORM_SIZE;
+
+ // Fill in the table - the function is even in sqrt(conc) (the series only has whole powers of conc squared, bar the linear term which is tabulated away), so the padding entry below zero is a copy...
+  int i;
+  for (i=1; i<FISHER_NORM_SIZE+3; i++)
+  {
+   double root = (i-1) * step;
+   this->value[i] = LogNormPlusConc(dims, root * root);
+  }
+  this->value[0] = this->value[2];
+
+ // Measure the error halfway between each pair of entries...
+  this->error = 0.0;
+  for (i=0; i<FISHER_NORM_SIZE; i++)
+  {
+   double root = (i + 0.5) * step;
+   double err = fabs(CatmullRom(this->value + i, 0.5) - LogNormPlusConc(dims, root * root));
+   if (err>this->error) this->error = err;
+  }
+
+ return this;
+}
+
+static FisherNorm * FisherNorm_get(int dims)
+{
+ FisherNorm * fresh = NULL;
+
+ while (1)
+ {
+  FisherNorm * head = __atomic_load_n(&fisher_norm_list, __ATOMIC_ACQUIRE);
+
+  FisherNorm * targ = head;
+  while (targ!=NULL)
+  {
+   if (targ->dims==dims)
+   {
+    free(fresh); // Another thread got there first.
+    return targ;
+   }
+   targ = targ->next;
+  }
+
+  if (fresh==NULL) fresh = FisherNorm_build(dims);
+  fresh->next = head;
+
+  if (__atomic_compare_exchange_n(&fisher_norm_list, &head, fresh, 0, __ATOMIC_RELEASE, __ATOMIC_ACQUIRE)) return fresh;
+ }
+}
+
+
+
+float FisherNorm_log_norm(int dims, float conc)
+{
+ if (conc>CONC_SWITCH)
+ {
+  return LogNormPlusConc(dims, conc) - conc;
+ }
+
+ FisherNorm * this = FisherNorm_get(dims);
+
+ double t = sqrt(conc) * (FISHER_NORM_SIZE / sqrt(CONC_SWITCH));
+ int low = (int)t;
+ if (low>=FISHER_NORM_SIZE) low = FISHER_NORM_SIZE - 1;
+ t -= low;
+
+ return CatmullRom(this->value + low, t) - conc;
+}
+
+float FisherNorm_error(int dims)
+{
+ return FisherNorm_get(dims)->error;
+}
+
+
+
+// The registry of per concentration tables - only touched when kernel configurations are created and destroyed, so a simple lock is fine...
+static pthread_mutex_t fisher_table_lock = PTHREAD_MUTEX_INITIALIZER;
+static FisherTable * fisher_table_list = NULL;
+
+
+
+static FisherTable * FisherTable_build(int dims, float alpha)
+{
+ FisherTable * this = (FisherTable*)malloc(sizeof(FisherTable));
+ static const double epsilon = 1e-6;
+
+ this->ref_count = 1;
+ this->next = NULL;
+ this->dims = dims;
+ this->alpha = alpha;
+
+ // The normaliser, plus the log of the Bessel function which the marginal needs...
+  double v = 0.5 * dims - 1.0;
+  double bessel = LogBesselRatio(v, alpha) + v * log(alpha);
+  this->log_norm = LogNormPlusConc(dims, alpha) - alpha;
+
+ // For the below we need the marginal over the dot product between directions...
+  double log_base = v * (log(alpha) - log(2.0));
+  log_base -= LogGamma(dims - 2);
+  log_base -= 0.5 * log(M_PI);
+  log_base -= bessel;
+
+  const int size = FISHER_CULM_SIZE;
+  const int size_big = FISHER_CULM_OVERSAMPLE * size;
+  double * culm = (double*)malloc(size_big * sizeof(double));
+
+  int i;
+  for (i=0;i<size_big; i++)
+  {
+   double dot = ((double)(2*i)) / (size_big-1) - 1.0;
+   if (dot<(-1+epsilon)) dot = -1 + epsilon; // To avoid infinities
+   if (dot>(1-epsilon))  dot =  1 - epsilon; // "
+
+   culm[i] = alpha * dot + log_base;
+   if (dims!=3) culm[i] += (0.5 * (dims - 3)) * log(1.0 - dot*dot);
+   culm[i] = exp(culm[i]);
+  }
+
+ // Make the marginal culumative...
+  double spacing = 2.0 / (size_big-1);
+  double prev = culm[0];
+  culm[0] = 0.0;
+
+  for (i=1;i<size_big; i++)
+  {
+   double temp = culm[i];
+   culm[i] = culm[i-1] + (prev + culm[i]) * 0.5 * spacing;
+   prev = temp;
+  }
+
+ // It should sum to 1, but numerical error is best corrected for - normalise...
+  for (i=0;i<size_big-1; i++)
+  {
+   culm[i] /= culm[size_big-1];
+  }
+  culm[size_big-1] = 1.0;
+
+ // Invert at twice the resolution of the stored table, so the odd entries can be used to measure the error of interpolating the even entries...
+  const int fine_size = 2 * size - 1;
+  double * fine = (double*)malloc(fine_size * sizeof(double));
+
+  int j = 1;
+
+  fine[0] = -1.0;
+  for (i=1; i<fine_size-1; i++)
+  {
+   // Set j to be one above the value...
+    double pos = ((double)i) / (fine_size-1);
+    while (culm[j]<pos) j += 1;
+
+   // Interpolate to fill in the relevant inverse value...
+    double div = culm[j] - culm[j-1];
+    if (div<epsilon) div = epsilon;
+    double t = (pos - culm[j-1]) / div;
+    double low = ((double)(2*(j-1))) / (size_big-1) - 1.0;
+    double high = ((double)(2*j)) / (size_big-1) - 1.0;
+
+    fine[i] = (1.0-t) * low + t * high;
+  }
+  fine[fine_size-1] = 1.0;
+
+ // Store the inverse culumative distribution over the dot product of the directions - this allows us to efficiently draw from the distribution - and record the error...
+  this->inv_culm_size = size;
+  this->inv_culm = (float*)malloc(size * sizeof(float));
+  this->error = 0.0;
+
+  for (i=0; i<size; i++)
+  {
+   this->inv_culm[i] = fine[2*i];
+
+   if ((i>0) && ((i+2)<size))
+   {
+    double err = fabs(fine[2*i+1] - 0.5 * (fine[2*i] + fine[2*i+2]));
+    if (err>this->error) this->error = err;
+   }
+  }
+
+ // Clean up...
+  free(fine);
+  free(culm);
+
+ return this;
+}
+
+
+
+FisherTable * FisherTable_acquire(int dims, float alpha)
+{
+ pthread_mutex_lock(&fisher_table_lock);
+
+ // Search for an existing table...
+  FisherTable * targ = fisher_table_list;
+  while (targ!=NULL)
+  {
+   if ((targ->dims==dims) && (targ->alpha==alpha))
+   {
+    targ->ref_count += 1;
+    pthread_mutex_unlock(&fisher_table_lock);
+    return targ;
+   }
+   targ = targ->next;
+  }
+
+ // Not found - build and register a new one...
+  targ = FisherTable_build(dims, alpha);
+  targ->next = fisher_table_list;
+  fisher_table_list = targ;
+
+ pthread_mutex_unlock(&fisher_table_lock);
+ return targ;
+}
+
+void FisherTable_release(FisherTable * this)
+{
+ pthread_mutex_lock(&fisher_table_lock);
+
+ this->ref_count -= 1;
+ if (this->ref_count==0)
+ {
+  FisherTable ** prev = &fisher_table_list;
+  while (*prev!=this) prev = &(*prev)->next;
+  *prev = this->next;
+
+  free(this->inv_culm);
+  free(this);
+ }
+
+ pthread_mutex_unlock(&fisher_table_lock);
+}
+
+size_t FisherTable_byte_size(FisherTable * this)
+{
+ return sizeof(FisherTable) + this->inv_culm_size * sizeof(float);
+}
+
+
+
+PyObject * FisherCache_report(void)
+{
+ PyObject * ret = PyList_New(0);
+
+ FisherNorm * norm = __atomic_load_n(&fisher_norm_list, __ATOMIC_ACQUIRE);
+ while (norm!=NULL)
+ {
+  PyObject * entry = Py_BuildValue("{sisOsisnsOsf}", "dims", norm->dims, "alpha", Py_None, "entries", FISHER_NORM_SIZE+3, "bytes", (Py_ssize_t)sizeof(FisherNorm), "ref_count", Py_None, "error", norm->error);
+  PyList_Append(ret, entry);
+  Py_DECREF(entry);
+
+  norm = norm->next;
+ }
+
+ pthread_mutex_lock(&fisher_table_lock);
+ FisherTable * targ = fisher_table_list;
+ while (targ!=NULL)
+ {
+  PyObject * entry = Py_BuildValue("{sisfsisnsisf}", "dims", targ->dims, "alpha", targ->alpha, "entries", targ->inv_culm_size, "bytes", (Py_ssize_t)FisherTable_byte_size(targ), "ref_count", targ->ref_count, "error", targ->error);
+  PyList_Append(ret, entry);
+  Py_DECREF(entry);
+
+  targ = targ->next;
+ }
+ pthread_mutex_unlock(&fisher_table_lock);
+
+ return ret;
+}
+
+
+
+void FreeFisherCache(PyObject * ignored)
+{
+ FisherNorm * targ = __atomic_exchange_n(&fisher_norm_list, NULL, __ATOMIC_ACQ_REL);
+ while (targ!=NULL)
+ {
+  FisherNorm * next = targ->next;
+  free(targ);
+  targ = next;
+ }
+}
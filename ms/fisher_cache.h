@@ -0,0 +1,79 @@
+#ifndef FISHER_CACHE_H
+#define FISHER_CACHE_H
+
+// Copyright 2013 Tom SF Haines
+
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except in compliance with the License. You may obtain a copy of the License at
+
+//   http://www.apache.org/licenses/LICENSE-2.0
+
+// Unless required by applicable law or agreed to in writing, software distributed under the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the License for the specific language governing permissions and limitations under the License.
+
+
+
+#include <Python.h>
+
+
+
+// Cached normalisers and sampling tables for the von-Mises Fisher distribution, shared by every Fisher/MirrorFisher kernel configuration in the process. There are two kinds of table. The first is per dimension count, and covers the log of the normalising constant for every concentration in [0, CONC_SWITCH] - this is what the multiplication code needs, as the concentration of a product of Fisher distributions is different every time. It is a cubic (Catmull-Rom) interpolation of a function of sqrt(concentration) that is smooth everywhere, including at a concentration of zero where the normaliser is finite but the Bessel function terms individually are not; built lazily the first time a dimension count is used, lock free, so it is safe to call from the threads of mult_batch. The second is per (dimension count, concentration) pair, and holds the exact log normaliser plus the inverse cumulative distribution of the dot product with the mean direction, which is what drawing uses; these are reference counted, so every kernel configuration with the same parameters shares one, and one is freed when the last configuration using it goes. Both are built from a double precision evaluation of the Bessel series (rather than the float one in bessel.h), and both record their own accuracy.
+
+
+
+// Number of intervals in a per dimension normaliser table, evenly spaced in sqrt(concentration) over [0, sqrt(CONC_SWITCH)]...
+#define FISHER_NORM_SIZE 1024
+
+// Size of the inverse cumulative distribution tables used for drawing - the tables are built by inverting a cumulative distribution evaluated with FISHER_CULM_OVERSAMPLE times as many points...
+#define FISHER_CULM_SIZE 4096
+#define FISHER_CULM_OVERSAMPLE 32
+
+
+
+// The per (dims, concentration) table - everything that is stored for a Fisher distribution with a fixed concentration...
+typedef struct FisherTable FisherTable;
+
+struct FisherTable
+{
+ int ref_count; // Number of kernel configurations using this table; protected by the registry lock.
+ FisherTable * next; // Next in the registry.
+
+ int dims; // Number of dimensions, with the distribution on the unit hypersphere within this space.
+ float alpha; // Concentration parameter.
+
+ float log_norm; // Log of the normalising constant, evaluated in double precision.
+
+ int inv_culm_size; // Length of below.
+ float * inv_culm; // Inverse cumulative distribution of the dot product between a draw and the mean direction, evenly spaced in probability from 0 to 1 inclusive - linear interpolation of this is how drawing is done.
+
+ float error; // Largest error, in units of the dot product, of linearly interpolating inv_culm, as measured halfway between entries against the full resolution inversion. The first and last intervals are excluded - they hold the extreme tails, where the inverse has a vertical tangent, so linear interpolation is always poor there whatever the table size.
+};
+
+
+
+// Returns the table for the given dimension count and concentration, creating it if it does not already exist, with its reference count incremented. Should only be called for concentrations where the Gaussian approximation is not being used...
+FisherTable * FisherTable_acquire(int dims, float alpha);
+
+// Releases a table previously obtained from FisherTable_acquire, freeing it when nothing is using it...
+void FisherTable_release(FisherTable * this);
+
+// Memory used by a table, including the structure itself...
+size_t FisherTable_byte_size(FisherTable * this);
+
+
+
+// Returns the log of the normalising constant of the (exact, not Gaussian approximated) von-Mises Fisher distribution with the given dimension count and concentration. Concentrations in [0, CONC_SWITCH] are a table lookup (building the table for this dimension count if this is its first use); larger values are evaluated directly, which is slow. Returned value has an absolute error below FisherNorm_error(dims), plus the rounding of a float...
+float FisherNorm_log_norm(int dims, float conc);
+
+// Returns the maximum absolute error of FisherNorm_log_norm for the given dimension count (as it is a log this is also, approximately, the relative error of the normaliser itself), as measured halfway between table entries when the table was built. Builds the table if needed...
+float FisherNorm_error(int dims);
+
+
+
+// Returns a new reference to a list containing a dictionary for every table currently in the cache, so the user can see what is being shared and how accurate it is. Each dictionary has 'dims', 'alpha' (None for a per dimension normaliser table), 'entries', 'bytes', 'ref_count' (None for normaliser tables, which are never freed) and 'error'...
+PyObject * FisherCache_report(void);
+
+// Frees the per dimension normaliser tables - called on module death, via a capsule, in the same way as FreeBesselMemory (the per concentration tables belong to the kernel configurations using them)...
+void FreeFisherCache(PyObject * ignored);
+
+
+
+#endif
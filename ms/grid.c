@@ -0,0 +1,343 @@
+// Copyright 2013 Tom SF Haines
+
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except in compliance with the License. You may obtain a copy of the License at
+
+//   http://www.apache.org/licenses/LICENSE-2.0
+
+// Unless required by applicable law or agreed to in writing, software distributed under the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the License for the specific language governing permissions and limitations under the License.
+
+
+
+#include "grid.h"
+
+#include <stdlib.h>
+#include <math.h>
+
+#include "mean_shift.h"
+
+
+
+int Grid_supported(const Kernel * kernel, int dims)
+{
+ return (dims>=1) && (dims<=3) && radial_kernel(kernel);
+}
+
+
+
+// In place radix 2 fast Fourier transform of n complex numbers, interleaved real then imaginary - n must be a power of two. sign is -1 for the forward transform, +1 for the inverse (which is not scaled)...
+static void fft(double * data, int n, int sign)
+{
+ // Bit reversal permutation...
+  int i, j = 0;
+  for (i=0; i<n-1; i++)
+  {
+   if (i<j)
+   {
+    double t = data[2*i]; data[2*i] = data[2*j]; data[2*j] = t;
+    t = data[2*i+1]; data[2*i+1] = data[2*j+1]; data[2*j+1] = t;
+   }
+
+   int m = n / 2;
+   while ((m>=1)&&(j>=m))
+   {
+    j -= m;
+    m /= 2;
+   }
+   j += m;
+  }
+
+ // Butterflies...
+  int len;
+  for (len=2; len<=n; len*=2)
+  {
+   double ang = sign * 2.0 * M_PI / len;
+   double w_re = cos(ang);
+   double w_im = sin(ang);
+
+   for (i=0; i<n; i+=len)
+   {
+    double c_re = 1.0;
+    double c_im = 0.0;
+
+    int k;
+    for (k=0; k<len/2; k++)
+    {
+     double * a = data + 2*(i+k);
+     double * b = data + 2*(i+k+len/2);
+
+     double t_re = b[0] * c_re - b[1] * c_im;
+     double t_im = b[0] * c_im + b[1] * c_re;
+
+     b[0] = a[0] - t_re;
+     b[1] = a[1] - t_im;
+     a[0] += t_re;
+     a[1] += t_im;
+
+     double n_re = c_re * w_re - c_im * w_im;
+     c_im = c_re * w_im + c_im * w_re;
+     c_re = n_re;
+    }
+   }
+  }
+}
+
+
+
+// Multi-dimensional transform, done as a 1D transform along each dimension in turn - n is the size of each dimension, row major, line a temporary big enough for the longest dimension...
+static void fft_nd(double * data, int dims, const int * n, int sign, double * line)
+{
+ int total = 1;
+ int d;
+ for (d=0; d<dims; d++) total *= n[d];
+
+ int stride = total;
+ for (d=0; d<dims; d++)
+ {
+  stride /= n[d];
+
+  // Every line along this dimension starts at an index whose component in this dimension is zero...
+   int start;
+   for (start=0; start<total; start++)
+   {
+    if (((start / stride) % n[d])!=0) continue;
+
+    int i;
+    for (i=0; i<n[d]; i++)
+    {
+     line[2*i] = data[2*(start + i*stride)];
+     line[2*i+1] = data[2*(start + i*stride) + 1];
+    }
+
+    fft(line, n[d], sign);
+
+    for (i=0; i<n[d]; i++)
+    {
+     data[2*(start + i*stride)] = line[2*i];
+     data[2*(start + i*stride) + 1] = line[2*i+1];
+    }
+   }
+ }
+}
+
+
+
+Grid * Grid_new(DataMatrix * dm, const Kernel * kernel, KernelConfig config, float range, float step, float norm, int max_cells)
+{
+ int dims = DataMatrix_features(dm);
+ int exemplars = DataMatrix_exemplars(dm);
+ if ((Grid_supported(kernel, dims)==0)||(exemplars==0)||(step<=0.0)) return NULL;
+
+ // Find the bounding box of the data...
+  float low[3];
+  float high[3];
+  int i, d;
+
+  float * fv = DataMatrix_fv(dm, 0, NULL);
+  for (d=0; d<dims; d++)
+  {
+   low[d] = fv[d];
+   high[d] = fv[d];
+  }
+
+  for (i=1; i<exemplars; i++)
+  {
+   fv = DataMatrix_fv(dm, i, NULL);
+   for (d=0; d<dims; d++)
+   {
+    if (fv[d]<low[d]) low[d] = fv[d];
+    if (fv[d]>high[d]) high[d] = fv[d];
+   }
+  }
+
+ // Size the grid so it covers everything the kernel can reach, and the transform so the convolution does not wrap around - the binned data occupies all but reach cells at either end, and the kernel extends reach cells either side, so the transform only needs to be as large as the grid...
+  int reach = (int)ceil(range / step);
+
+  int size[3];
+  int n[3];
+  int total = 1;
+  int longest = 1;
+  for (d=0; d<dims; d++)
+  {
+   low[d] -= reach * step;
+   size[d] = (int)ceil((high[d] - low[d]) / step) + reach + 2;
+
+   n[d] = 1;
+   while (n[d]<size[d]) n[d] *= 2;
+
+   if ((max_cells / total)<n[d]) return NULL;
+   total *= n[d];
+   if (n[d]>longest) longest = n[d];
+  }
+
+ // Linearly bin the data - each exemplars weight is split between the corners of its cell...
+  double * data = (double*)calloc(2 * total, sizeof(double));
+
+  for (i=0; i<exemplars; i++)
+  {
+   float w;
+   fv = DataMatrix_fv(dm, i, &w);
+
+   int base[3];
+   float frac[3];
+   for (d=0; d<dims; d++)
+   {
+    float pos = (fv[d] - low[d]) / step;
+    base[d] = (int)floor(pos);
+    frac[d] = pos - base[d];
+   }
+
+   int corner;
+   for (corner=0; corner<(1<<dims); corner++)
+   {
+    double cw = w;
+    int index = 0;
+    for (d=0; d<dims; d++)
+    {
+     int up = (corner>>d) & 1;
+     cw *= up ? frac[d] : (1.0 - frac[d]);
+     index = index * n[d] + base[d] + up;
+    }
+
+    data[2*index] += cw;
+   }
+  }
+
+ // Sample the kernel at every offset it can reach, wrapped around so zero offset is at index zero...
+  double * kern = (double*)calloc(2 * total, sizeof(double));
+
+  int span = 2 * reach + 1;
+  int offsets = 1;
+  for (d=0; d<dims; d++) offsets *= span;
+
+  float offset[3];
+  for (i=0; i<offsets; i++)
+  {
+   int rem = i;
+   int index = 0;
+   int mult = 1;
+   float dist_sqr = 0.0;
+   for (d=dims-1; d>=0; d--)
+   {
+    int o = (rem % span) - reach;
+    rem /= span;
+
+    offset[d] = o * step;
+    dist_sqr += offset[d] * offset[d];
+
+    index += ((o + n[d]) % n[d]) * mult;
+    mult *= n[d];
+   }
+
+   if (dist_sqr>range*range) continue;
+
+   kern[2*index] = kernel->weight(dims, config, offset);
+  }
+
+ // Convolve, by multiplying in the frequency domain...
+  double * line = (double*)malloc(2 * longest * sizeof(double));
+
+  fft_nd(data, dims, n, -1, line);
+  fft_nd(kern, dims, n, -1, line);
+
+  for (i=0; i<total; i++)
+  {
+   double re = data[2*i] * kern[2*i] - data[2*i+1] * kern[2*i+1];
+   double im = data[2*i] * kern[2*i+1] + data[2*i+1] * kern[2*i];
+   data[2*i] = re;
+   data[2*i+1] = im;
+  }
+
+  fft_nd(data, dims, n, 1, line);
+
+  free(line);
+  free(kern);
+
+ // Create the grid, filling it from the (unpadded part of the) transform - round off can give tiny negative values, which are clamped...
+  Grid * this = (Grid*)malloc(sizeof(Grid));
+  this->dims = dims;
+  this->step = step;
+  this->generation = 0;
+
+  int cells = 1;
+  for (d=0; d<3; d++)
+  {
+   this->low[d] = (d<dims) ? low[d] : 0.0;
+   this->size[d] = (d<dims) ? size[d] : 1;
+   cells *= this->size[d];
+  }
+
+  this->value = (float*)malloc(cells * sizeof(float));
+  double scale = norm / (double)total;
+
+  for (i=0; i<cells; i++)
+  {
+   int rem = i;
+   int index = 0;
+   int mult = 1;
+   for (d=dims-1; d>=0; d--)
+   {
+    index += (rem % size[d]) * mult;
+    rem /= size[d];
+    mult *= n[d];
+   }
+
+   double v = data[2*index] * scale;
+   this->value[i] = (v>0.0) ? v : 0.0;
+  }
+
+  free(data);
+
+ return this;
+}
+
+
+
+void Grid_delete(Grid * this)
+{
+ free(this->value);
+ free(this);
+}
+
+
+
+float Grid_prob(Grid * this, const float * fv)
+{
+ // Find the cell, returning zero if outside the grid...
+  int base[3];
+  float frac[3];
+  int d;
+  for (d=0; d<this->dims; d++)
+  {
+   float pos = (fv[d] - this->low[d]) / this->step;
+   if ((pos<0.0)||(pos>=(this->size[d]-1))) return 0.0;
+
+   base[d] = (int)pos;
+   frac[d] = pos - base[d];
+  }
+
+ // Multi-linear interpolation...
+  float ret = 0.0;
+  int corner;
+  for (corner=0; corner<(1<<this->dims); corner++)
+  {
+   float w = 1.0;
+   int index = 0;
+   for (d=0; d<this->dims; d++)
+   {
+    int up = (corner>>d) & 1;
+    w *= up ? frac[d] : (1.0 - frac[d]);
+    index = index * this->size[d] + base[d] + up;
+   }
+
+   ret += w * this->value[index];
+  }
+
+ return ret;
+}
+
+
+
+size_t Grid_byte_size(Grid * this)
+{
+ return sizeof(Grid) + this->size[0] * this->size[1] * this->size[2] * sizeof(float);
+}
@@ -0,0 +1,61 @@
+#ifndef GRID_H
+#define GRID_H
+
+// Copyright 2013 Tom SF Haines
+
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except in compliance with the License. You may obtain a copy of the License at
+
+//   http://www.apache.org/licenses/LICENSE-2.0
+
+// Unless required by applicable law or agreed to in writing, software distributed under the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the License for the specific language governing permissions and limitations under the License.
+
+
+
+#include <stddef.h>
+
+#include "kernels.h"
+#include "data_matrix.h"
+
+
+
+// A binned approximation of a kernel density estimate, for evaluating the probability of huge numbers of points when there are only a few dimensions (1-3) - the exemplars are linearly binned onto a regular grid (each exemplars weight is split between the corners of the cell it is in, such that the mass and mean are preserved), the grid is convolved with the kernel using the fast Fourier transform, and the probability of a point is then obtained by multi-linear interpolation of the grid. Construction is O(exemplars + cells log cells) and evaluation is O(1), independent of the number of exemplars. Everything is done in the internal (converted and scaled) space, where the kernel has its standard size, with step the size of the grid cells in that space. The kernel is cut off at its range, as for probs_dual.
+
+// Accuracy guarantee - let d be the number of dimensions, s the step and h the largest value the density could take (the kernel normaliser times the product of the scale, i.e. the peak height of a single kernel holding all of the weight). Relative to the range truncated kernel density estimate, the absolute error of every probability returned is at most:
+//   gaussian: d s^2 h / 4 (binning and interpolation each contribute d s^2 / 8 times the largest second derivative of the kernel, which is 1.)
+//   epanechnikov, triangular, cosine, cauchy, logistic: 2 sqrt(d) s L h, where L is the Lipschitz constant of the kernel profile (2 for epanechnikov, 1 for triangular), as these are not smooth everywhere. In practise the error is second order away from the edge of the support.
+//   uniform: no pointwise guarantee, as the kernel is discontinuous - the mass is preserved exactly, but values within sqrt(d) s of the edge of a kernel are blurred over that distance. Use a small step.
+// e.g. gaussian with step 0.1 in 2D is within 0.005 h. Floating point error in the transform adds a further (tiny) error of around 1e-12 h.
+
+
+
+typedef struct Grid Grid;
+
+struct Grid
+{
+ int dims;
+ float step;
+ float low[3]; // Position of the first grid point in each dimension.
+ int size[3]; // Number of grid points in each dimension.
+ float * value; // Probability at each grid point, row major.
+
+ unsigned int generation; // Not used by the grid - lets the owner record what it was built for.
+};
+
+
+
+// Returns non-zero if the grid can handle the given kernel at the given dimensionality - it has to be one of the radial kernels, with 1, 2 or 3 dimensions...
+int Grid_supported(const Kernel * kernel, int dims);
+
+// Creates a grid from the data matrix, for the given kernel, range (beyond which the kernel is taken to be zero) and step. norm is the normalising multiplier for the sum of the weighted kernel values, as used by prob. Returns NULL if the kernel or dimensionality is not supported or if the transform would need more than max_cells cells...
+Grid * Grid_new(DataMatrix * dm, const Kernel * kernel, KernelConfig config, float range, float step, float norm, int max_cells);
+void Grid_delete(Grid * this);
+
+// Returns the probability of the given feature vector, in the internal space - zero if outside the grid, which covers everything the kernel can reach...
+float Grid_prob(Grid * this, const float * fv);
+
+// Returns how many bytes the grid is using...
+size_t Grid_byte_size(Grid * this);
+
+
+
+#endif
@@ -15,7 +15,8 @@
 #include <string.h>
 
 #include "philox.h"
-#include "bessel.h"
+#include "fisher_cache.h"
+#include "simd.h"
 
 
 
@@ -56,6 +57,40 @@ void Kernel_to_offset(int dims, KernelConfig config, float * fv, const float * b
  for (i=0; i<dims; i++) fv[i] -= base_fv[i];
 }
 
+// Block weights for the radial kernels - converts the feature vectors to offsets, as Kernel_to_offset does, then passes their squared lengths to a vectorised profile from simd.h, in chunks...
+#define KERNEL_CHUNK 64
+
+void Kernel_block_offset(int dims, int count, float * fv, const float * base_fv, float * dist_sqr)
+{
+ int i, j;
+ for (i=0; i<count; i++)
+ {
+  float * offset = fv + (size_t)i * dims;
+  float d_sqr = 0.0;
+  for (j=0; j<dims; j++)
+  {
+   offset[j] -= base_fv[j];
+   d_sqr += offset[j] * offset[j];
+  }
+  dist_sqr[i] = d_sqr;
+ }
+}
+
+void Kernel_radial_weights(int dims, int count, float * fv, const float * base_fv, float * weight, void (*profile)(int count, const float * dist_sqr, float * weight))
+{
+ float dist_sqr[KERNEL_CHUNK];
+ 
+ int i;
+ for (i=0; i<count; i+=KERNEL_CHUNK)
+ {
+  int chunk = count - i;
+  if (chunk>KERNEL_CHUNK) chunk = KERNEL_CHUNK;
+  
+  Kernel_block_offset(dims, chunk, fv + (size_t)i * dims, base_fv, dist_sqr);
+  profile(chunk, dist_sqr, weight + i);
+ }
+}
+
 // Most kernels use the same offset method, as provided by this implimentaiton...
 float Kernel_offset(int dims, KernelConfig config, float * fv, const float * offset)
 {
@@ -150,8 +185,10 @@ const Kernel Discrete =
  Kernel_config_acquire,
  Kernel_config_release,
  Discrete_weight,
+ NULL,
  Discrete_norm,
  Discrete_range,
+ Discrete_range,
  Kernel_to_offset,
  Kernel_offset,
  Discrete_draw,
@@ -179,6 +216,11 @@ float Uniform_weight(int dims, KernelConfig config, float * offset)
  return 1.0;
 }
 
+void Uniform_weights(int dims, KernelConfig config, int count, float * fv, const float * base_fv, float * weight)
+{
+ Kernel_radial_weights(dims, count, fv, base_fv, weight, Simd_uniform);
+}
+
 float Uniform_norm(int dims, KernelConfig config)
 {
  if ((dims&1)==0)
@@ -286,8 +328,10 @@ const Kernel Uniform =
  Kernel_config_acquire,
  Kernel_config_release,
  Uniform_weight,
+ Uniform_weights,
  Uniform_norm,
  Uniform_range,
+ Uniform_range,
  Kernel_to_offset,
  Kernel_offset,
  Uniform_draw,
@@ -315,6 +359,11 @@ float Triangular_weight(int dims, KernelConfig config, float * offset)
  return 1.0 - sqrt(dist_sqr);
 }
 
+void Triangular_weights(int dims, KernelConfig config, int count, float * fv, const float * base_fv, float * weight)
+{
+ Kernel_radial_weights(dims, count, fv, base_fv, weight, Simd_triangular);
+}
+
 float Triangular_norm(int dims, KernelConfig config)
 {
  return (dims + 1.0) * Uniform_norm(dims, NULL);
@@ -395,8 +444,10 @@ const Kernel Triangular =
  Kernel_config_acquire,
  Kernel_config_release,
  Triangular_weight,
+ Triangular_weights,
  Triangular_norm,
  Triangular_range,
+ Triangular_range,
  Kernel_to_offset,
  Kernel_offset,
  Triangular_draw,
@@ -424,6 +475,11 @@ float Epanechnikov_weight(int dims, KernelConfig config, float * offset)
  return 1.0 - dist_sqr;
 }
 
+void Epanechnikov_weights(int dims, KernelConfig config, int count, float * fv, const float * base_fv, float * weight)
+{
+ Kernel_radial_weights(dims, count, fv, base_fv, weight, Simd_epanechnikov);
+}
+
 float Epanechnikov_norm(int dims, KernelConfig config)
 {
  return 0.5 * (dims + 2.0) * Uniform_norm(dims, NULL);
@@ -505,8 +561,10 @@ const Kernel Epanechnikov =
  Kernel_config_acquire,
  Kernel_config_release,
  Epanechnikov_weight,
+ Epanechnikov_weights,
  Epanechnikov_norm,
  Epanechnikov_range,
+ Epanechnikov_range,
  Kernel_to_offset,
  Kernel_offset,
  Epanechnikov_draw,
@@ -640,8 +698,10 @@ const Kernel Cosine =
  Kernel_config_acquire,
  Kernel_config_release,
  Cosine_weight,
+ NULL,
  Cosine_norm,
  Cosine_range,
+ Cosine_range,
  Kernel_to_offset,
  Kernel_offset,
  Cosine_draw,
@@ -668,6 +728,11 @@ float Gaussian_weight(int dims, KernelConfig config, float * offset)
  return exp(-0.5 * dist_sqr);
 }
 
+void Gaussian_weights(int dims, KernelConfig config, int count, float * fv, const float * base_fv, float * weight)
+{
+ Kernel_radial_weights(dims, count, fv, base_fv, weight, Simd_gaussian);
+}
+
 float Gaussian_norm(int dims, KernelConfig config)
 {
  return pow(2.0 * M_PI, -0.5*dims);
@@ -716,8 +781,10 @@ const Kernel Gaussian =
  Kernel_config_acquire,
  Kernel_config_release,
  Gaussian_weight,
+ Gaussian_weights,
  Gaussian_norm,
  Gaussian_range,
+ Gaussian_range,
  Kernel_to_offset,
  Kernel_offset,
  Gaussian_draw,
@@ -744,6 +811,11 @@ float Cauchy_weight(int dims, KernelConfig config, float * offset)
  return 1.0 / (1.0 + dist_sqr);
 }
 
+void Cauchy_weights(int dims, KernelConfig config, int count, float * fv, const float * base_fv, float * weight)
+{
+ Kernel_radial_weights(dims, count, fv, base_fv, weight, Simd_cauchy);
+}
+
 float Cauchy_norm(int dims, KernelConfig config)
 {
  float ret = 0.0;
@@ -836,8 +908,10 @@ const Kernel Cauchy =
  Kernel_config_acquire,
  Kernel_config_release,
  Cauchy_weight,
+ Cauchy_weights,
  Cauchy_norm,
  Cauchy_range,
+ Cauchy_range,
  Kernel_to_offset,
  Kernel_offset,
  Cauchy_draw,
@@ -958,8 +1032,10 @@ const Kernel Logistic =
  Kernel_config_acquire,
  Kernel_config_release,
  Logistic_weight,
+ NULL,
  Logistic_norm,
  Logistic_range,
+ Logistic_range,
  Kernel_to_offset,
  Kernel_offset,
  Logistic_draw,
@@ -976,8 +1052,7 @@ const Kernel Logistic =
 KernelConfig Fisher_config_new(int dims, const char * config)
 {
  FisherConfig * ret = (FisherConfig*)malloc(sizeof(FisherConfig));
- static const float epsilon = 1e-6;
- 
+
  // Basic value storage...
   ret->ref_count = 1;
   char * end;
@@ -990,101 +1065,24 @@ KernelConfig Fisher_config_new(int dims, const char * config)
    if (*end=='a') approximate = 1;
   }
   
- // Record the log of the normalising constant - we return normalised values for this distribution for reasons of numerical stability...
-  const float log_2PI = log(2 * M_PI);
-  
-  float bessel = 0.0;
-  if (approximate)
-  {
-   ret->log_norm = (-0.5*(dims-1)) * (log_2PI - log(ret->alpha));
-  }
-  else
-  {
-   bessel = LogModBesselFirst(dims-2, ret->alpha, epsilon, 1024);
-   
-   ret->log_norm  = (0.5 * dims - 1) * log(ret->alpha);
-   ret->log_norm -= (0.5 * dims) * log_2PI;
-   ret->log_norm -= bessel;
-  }
- 
- // Only create the inverse culm array if we are being accurate - its not required in approximate mode...
-  int i;
+ // Record the log of the normalising constant - we return normalised values for this distribution for reasons of numerical stability. In the accurate case this and the inverse culmative array come from a table shared with every other configuration with the same dimension count and concentration...
   if (approximate)
   {
+   ret->log_norm = (-0.5*(dims-1)) * (log(2 * M_PI) - log(ret->alpha));
+   ret->table = NULL;
    ret->inv_culm_size = 0;
    ret->inv_culm = NULL;
   }
   else
   {
-   // For the below we need the marginal over the dot product between directions...
-    float log_base = (0.5 * dims - 1) * (log(ret->alpha) - log(2));
-    log_base -= LogGamma(dims - 2);
-    log_base -= 0.5 * log(M_PI);  
-    log_base -= bessel;
-  
-    const int size = 4*1024;
-    const int size_big = 32 * size;
-    float * culm = (float*)malloc(size_big * sizeof(float));
-    
-    for (i=0;i<size_big; i++)
-    {
-     float dot = ((float)(2*i)) / (size_big-1) - 1.0;
-     if (dot<(-1+epsilon)) dot = -1 + epsilon; // To avoid infinities
-     if (dot>(1-epsilon))  dot =  1 - epsilon; // "
-     
-     culm[i] = ret->alpha * dot + log_base;
-     if (dims!=3) culm[i] += (0.5 * (dims - 3)) * log(1.0 - dot*dot);
-     culm[i] = exp(culm[i]);
-    }
-  
-   // Make the marginal culumative...
-    float spacing = 2.0 / (size_big-1);
-    float prev = culm[0];
-    culm[0] = 0.0;
-  
-    for (i=1;i<size_big; i++)
-    {
-     float temp = culm[i];
-     culm[i] = culm[i-1] + (prev + culm[i]) * 0.5 * spacing;
-     prev = temp;
-    }
-  
-   // It should sum to 1, but numerical error is best corrected for - normalise...
-    for (i=0;i<size_big-1; i++)
-    {
-     culm[i] /= culm[size_big-1];
-    }
-    culm[size_big-1] = 1.0;
-  
-   // Calculate and store the inverse culumative distribution over the dot product of the directions - this allows us to efficiently draw from the distribution...
-    ret->inv_culm_size = size;
-    ret->inv_culm = (float*)malloc(size * sizeof(float));
-  
-    int j = 1;
-  
-    ret->inv_culm[0] = -1.0;
-    for (i=1; i<size-1; i++)
-    {
-     // Set j to be one above the value...
-      float pos = ((float)i) / (size-1);
-      while (culm[j]<pos) j += 1;
-    
-     // Interpolate to fill in the relevant inverse value...
-      float div = culm[j] - culm[j-1];
-      if (div<epsilon) div = epsilon;
-      float t = (pos - culm[j-1]) / div;
-      float low = ((float)(2*(j-1))) / (size_big-1) - 1.0;
-      float high = ((float)(2*j)) / (size_big-1) - 1.0;
-    
-      ret->inv_culm[i] = (1.0-t) * low + t * high;
-    }
-    ret->inv_culm[size-1] = 1.0;
-   
-   // Clean up...
-    free(culm);
+   ret->table = FisherTable_acquire(dims, ret->alpha);
+   ret->log_norm = ret->table->log_norm;
+   ret->inv_culm_size = ret->table->inv_culm_size;
+   ret->inv_culm = ret->table->inv_culm;
   }
   
  // Create the order array, for use when drawing...
+  int i;
   ret->order = (int*)malloc(dims*sizeof(int));
   for (i=0; i<dims; i++)
   {
@@ -1140,7 +1138,7 @@ void Fisher_config_release(KernelConfig config)
  if (self->ref_count==0)
  {
   free(self->order);
-  free(self->inv_culm);
+  if (self->table!=NULL) FisherTable_release(self->table);
   free(self);
  }
 }
@@ -1178,6 +1176,22 @@ float Fisher_weight(int dims, KernelConfig config, float * offset)
   }
 }
 
+void Fisher_weights(int dims, KernelConfig config, int count, float * fv, const float * base_fv, float * weight)
+{
+ FisherConfig * self = (FisherConfig*)config;
+ float dist_sqr[KERNEL_CHUNK];
+ 
+ int i;
+ for (i=0; i<count; i+=KERNEL_CHUNK)
+ {
+  int chunk = count - i;
+  if (chunk>KERNEL_CHUNK) chunk = KERNEL_CHUNK;
+  
+  Kernel_block_offset(dims, chunk, fv + (size_t)i * dims, base_fv, dist_sqr);
+  Simd_fisher(chunk, dist_sqr, weight + i, self->alpha, self->log_norm, (self->inv_culm==NULL) ? 1 : 0);
+ }
+}
+
 float Fisher_norm(int dims, KernelConfig config)
 {
  return 1.0; // We return normalised values directly, for reasons of numerical stability.
@@ -1359,7 +1373,7 @@ size_t Fisher_byte_size(int dims, KernelConfig config, int * ref_count)
  FisherConfig * self = (FisherConfig*)config;
  
  size_t mem = sizeof(FisherConfig);
- mem += self->inv_culm_size * sizeof(float);
+ if (self->table!=NULL) mem += FisherTable_byte_size(self->table) / self->table->ref_count; // Shared between configurations - count this ones share.
  mem += dims * sizeof(int);
  
  if (ref_count!=NULL) *ref_count = self->ref_count;
@@ -1378,8 +1392,10 @@ const Kernel Fisher =
  Fisher_config_acquire,
  Fisher_config_release,
  Fisher_weight,
+ Fisher_weights,
  Fisher_norm,
  Fisher_range,
+ Fisher_range,
  Kernel_to_offset,
  Fisher_offset,
  Fisher_draw,
@@ -1416,7 +1432,7 @@ float MirrorFisher_weight(int dims, KernelConfig config, float * offset)
 
 float MirrorFisher_range(int dims, KernelConfig config, float quality)
 {
- return 2.001; // Due to the nature of the distribution this optimisation is not possible - greater than 2 effectivly switches it off.
+ return 2.001; // Due to the nature of the distribution this optimisation is not possible - greater than 2 effectivly switches it off. The range around the nearest image is that of the Fisher kernel however, hence range_image is Fisher_range.
 }
 
 void MirrorFisher_to_offset(int dims, KernelConfig config, float * fv, const float * base_fv)
@@ -1492,8 +1508,10 @@ const Kernel MirrorFisher =
  Fisher_config_acquire,
  Fisher_config_release,
  MirrorFisher_weight,
+ NULL,
  Fisher_norm,
  MirrorFisher_range,
+ Fisher_range,
  MirrorFisher_to_offset,
  Fisher_offset,
  MirrorFisher_draw,
@@ -1517,12 +1535,20 @@ struct CompositeChild
  KernelConfig config;
 };
 
+typedef void (*CompositeWeights)(CompositeConfig * self, int dims, int count, float * fv, const float * base_fv, float * weight);
+
 struct CompositeConfig
 {
  int ref_count;
  
- int kca_length; // Temporary array used during multiplication.
- KernelConfig * kca;
+ int depth; // Levels of composite kernel, this one included - multiplication claims terms * depth configurations from the MultCache.
+ 
+ // Specialisation for the most common combination of children, chosen by config_new - every child a Gaussian apart from at most one Fisher or MirrorFisher, e.g. a position plus a direction or quaternion. fused is then a block weights function with the combination compiled in, so the inner loop makes no calls through the child kernels, and mult_mass calls the area functions directly. fused is NULL if the children don't fit, in which case the generic path is used...
+ CompositeWeights fused;
+ const Kernel * dir_kernel; // &Fisher or &MirrorFisher, NULL if all Gaussian.
+ FisherConfig * dir; // Config of the directional child, NULL if none.
+ int dir_start; // Dimensions covered by the directional child - all others are covered by Gaussians.
+ int dir_dims;
  
  int children; // Number of children.
  CompositeChild child[0];
@@ -1530,6 +1556,205 @@ struct CompositeConfig
 
 
 
+// The fused block weights - the Gaussian dimensions and the directional dimensions are each reduced to a squared distance, which are then combined into a single exponent, so the entire kernel is one call to the vectorised Gaussian profile, with exp(-0.5 x) for each exemplar. kind and dir_dims are constants in every use, so the compiler generates a specialised loop for each...
+typedef enum {COMP_GAUSSIAN, COMP_FISHER, COMP_FISHER_APPROX, COMP_MIRROR, COMP_MIRROR_APPROX} CompositeKind;
+
+static inline __attribute__((always_inline)) void Composite_fused(CompositeConfig * self, int dims, int count, float * fv, const float * base_fv, float * weight, const CompositeKind kind, const int dir_dims)
+{
+ int dir_start = self->dir_start;
+ int dir_end = dir_start + dir_dims;
+ 
+ float alpha = 0.0;
+ float log_norm = 0.0;
+ if (kind!=COMP_GAUSSIAN)
+ {
+  alpha = self->dir->alpha;
+  log_norm = self->dir->log_norm;
+ }
+ 
+ float x[KERNEL_CHUNK];
+ float mirror[KERNEL_CHUNK];
+ 
+ int start, i, j;
+ for (start=0; start<count; start+=KERNEL_CHUNK)
+ {
+  int chunk = count - start;
+  if (chunk>KERNEL_CHUNK) chunk = KERNEL_CHUNK;
+  
+  float * block = fv + (size_t)start * dims;
+  float * w = weight + start;
+  
+  for (i=0; i<chunk; i++)
+  {
+   float * offset = block + (size_t)i * dims;
+   
+   // Gaussian dimensions, either side of the directional ones...
+    float dist_sqr = 0.0;
+    for (j=0; j<dir_start; j++)
+    {
+     offset[j] -= base_fv[j];
+     dist_sqr += offset[j] * offset[j];
+    }
+    
+    for (j=dir_end; j<dims; j++)
+    {
+     offset[j] -= base_fv[j];
+     dist_sqr += offset[j] * offset[j];
+    }
+    
+    if (kind==COMP_GAUSSIAN)
+    {
+     x[i] = dist_sqr;
+     continue;
+    }
+   
+   // Directional dimensions - the mirrored kernels use the reflection closest to the centre, as MirrorFisher_to_offset does...
+    float * dir = offset + dir_start;
+    const float * dir_base = base_fv + dir_start;
+    
+    if ((kind==COMP_MIRROR)||(kind==COMP_MIRROR_APPROX))
+    {
+     float dot = 0.0;
+     for (j=0; j<dir_dims; j++) dot += dir[j] * dir_base[j];
+     
+     if (dot<=0.0)
+     {
+      for (j=0; j<dir_dims; j++) dir[j] = -dir[j];
+     }
+    }
+    
+    float dir_sqr = 0.0;
+    for (j=0; j<dir_dims; j++)
+    {
+     dir[j] -= dir_base[j];
+     dir_sqr += dir[j] * dir[j];
+    }
+    
+    float cos_ang = 1.0 - 0.5 * dir_sqr;
+    
+   // Combine, matching Fisher_weight and MirrorFisher_weight...
+    switch (kind)
+    {
+     case COMP_FISHER:
+      x[i] = dist_sqr - 2.0 * (alpha * cos_ang + log_norm);
+     break;
+     
+     case COMP_FISHER_APPROX:
+      x[i] = dist_sqr + alpha * (1.0 - cos_ang*cos_ang) - 2.0 * log_norm;
+      if (cos_ang<=0.0) w[i] = 0.0;
+     break;
+     
+     case COMP_MIRROR:
+      x[i] = dist_sqr - 2.0 * (alpha * cos_ang + log_norm);
+      mirror[i] = 4.0 * alpha * cos_ang;
+     break;
+     
+     case COMP_MIRROR_APPROX:
+      x[i] = dist_sqr + alpha * (1.0 - cos_ang*cos_ang) - 2.0 * log_norm;
+      w[i] *= 0.5;
+     break;
+     
+     default:
+     break;
+    }
+  }
+  
+  // The exact mirrored kernel has a second term, exp(-alpha cos_ang) - relative to the first it is exp(-2 alpha cos_ang), giving a multiplier of 0.5 (1 + exp(-2 alpha cos_ang))...
+   if (kind==COMP_MIRROR)
+   {
+    float half[KERNEL_CHUNK];
+    for (i=0; i<chunk; i++) half[i] = 0.5;
+    Simd_gaussian(chunk, mirror, half);
+    for (i=0; i<chunk; i++) w[i] *= 0.5 + half[i];
+   }
+   
+  Simd_gaussian(chunk, x, w);
+ }
+}
+
+
+// The specialised versions, with the directional dimensions fixed for the common cases of 2 (a circle), 3 (a sphere) and 4 (a quaternion), plus a version that reads it from the config...
+#define COMPOSITE_FUSED(name, kind, size) static void name(CompositeConfig * self, int dims, int count, float * fv, const float * base_fv, float * weight) {Composite_fused(self, dims, count, fv, base_fv, weight, kind, (size>0) ? size : self->dir_dims);}
+
+COMPOSITE_FUSED(Composite_fused_gaussian, COMP_GAUSSIAN, 0)
+
+COMPOSITE_FUSED(Composite_fused_fisher_2, COMP_FISHER, 2)
+COMPOSITE_FUSED(Composite_fused_fisher_3, COMP_FISHER, 3)
+COMPOSITE_FUSED(Composite_fused_fisher_4, COMP_FISHER, 4)
+COMPOSITE_FUSED(Composite_fused_fisher_n, COMP_FISHER, 0)
+
+COMPOSITE_FUSED(Composite_fused_fisher_approx_2, COMP_FISHER_APPROX, 2)
+COMPOSITE_FUSED(Composite_fused_fisher_approx_3, COMP_FISHER_APPROX, 3)
+COMPOSITE_FUSED(Composite_fused_fisher_approx_4, COMP_FISHER_APPROX, 4)
+COMPOSITE_FUSED(Composite_fused_fisher_approx_n, COMP_FISHER_APPROX, 0)
+
+COMPOSITE_FUSED(Composite_fused_mirror_2, COMP_MIRROR, 2)
+COMPOSITE_FUSED(Composite_fused_mirror_3, COMP_MIRROR, 3)
+COMPOSITE_FUSED(Composite_fused_mirror_4, COMP_MIRROR, 4)
+COMPOSITE_FUSED(Composite_fused_mirror_n, COMP_MIRROR, 0)
+
+COMPOSITE_FUSED(Composite_fused_mirror_approx_2, COMP_MIRROR_APPROX, 2)
+COMPOSITE_FUSED(Composite_fused_mirror_approx_3, COMP_MIRROR_APPROX, 3)
+COMPOSITE_FUSED(Composite_fused_mirror_approx_4, COMP_MIRROR_APPROX, 4)
+COMPOSITE_FUSED(Composite_fused_mirror_approx_n, COMP_MIRROR_APPROX, 0)
+
+#undef COMPOSITE_FUSED
+
+static const CompositeWeights CompositeFusedTable[4][4] =
+{
+ {Composite_fused_fisher_2, Composite_fused_fisher_3, Composite_fused_fisher_4, Composite_fused_fisher_n},
+ {Composite_fused_fisher_approx_2, Composite_fused_fisher_approx_3, Composite_fused_fisher_approx_4, Composite_fused_fisher_approx_n},
+ {Composite_fused_mirror_2, Composite_fused_mirror_3, Composite_fused_mirror_4, Composite_fused_mirror_n},
+ {Composite_fused_mirror_approx_2, Composite_fused_mirror_approx_3, Composite_fused_mirror_approx_4, Composite_fused_mirror_approx_n},
+};
+
+
+// Chooses the specialisation for a freshly created config, if there is one...
+static void Composite_specialise(CompositeConfig * self)
+{
+ self->fused = NULL;
+ self->dir_kernel = NULL;
+ self->dir = NULL;
+ self->dir_start = 0;
+ self->dir_dims = 0;
+ 
+ int pos = 0;
+ int child;
+ for (child=0; child<self->children; child++)
+ {
+  const Kernel * kernel = self->child[child].kernel;
+  
+  if ((kernel==&Fisher)||(kernel==&MirrorFisher))
+  {
+   if (self->dir_kernel!=NULL) return; // Only one directional child is supported.
+   
+   self->dir_kernel = kernel;
+   self->dir = (FisherConfig*)self->child[child].config;
+   self->dir_start = pos;
+   self->dir_dims = self->child[child].dims;
+  }
+  else
+  {
+   if (kernel!=&Gaussian) return;
+  }
+  
+  pos += self->child[child].dims;
+ }
+ 
+ if (self->dir_kernel==NULL)
+ {
+  self->fused = Composite_fused_gaussian;
+ }
+ else
+ {
+  int kind = ((self->dir_kernel==&MirrorFisher) ? 2 : 0) + ((self->dir->inv_culm==NULL) ? 1 : 0);
+  int size = ((self->dir_dims>=2)&&(self->dir_dims<=4)) ? (self->dir_dims - 2) : 3;
+  self->fused = CompositeFusedTable[kind][size];
+ }
+}
+
+
+
 KernelConfig Composite_config_new(int dims, const char * config)
 { 
  // First pass to count how many child kernels there are...
@@ -1568,10 +1793,7 @@ KernelConfig Composite_config_new(int dims, const char * config)
   CompositeConfig * ret = (CompositeConfig*)malloc(sizeof(CompositeConfig) + children * sizeof(CompositeChild));
   
   ret->ref_count = 1;
-  
-  ret->kca_length = 0;
-  ret->kca = NULL;
-  
+  ret->depth = 1;
   ret->children = children;
  
  // Second pass to fill in the data structure...
@@ -1595,6 +1817,11 @@ KernelConfig Composite_config_new(int dims, const char * config)
      ret->child[child].kernel = ListKernel[i];
      ret->child[child].config = ListKernel[i]->config_new(ret->child[child].dims, targ);
      
+     if ((ListKernel[i]==&Composite)&&(ret->depth<=((CompositeConfig*)ret->child[child].config)->depth))
+     {
+      ret->depth = ((CompositeConfig*)ret->child[child].config)->depth + 1;
+     }
+     
      targ += nlength;
      break;
     }
@@ -1605,6 +1832,9 @@ KernelConfig Composite_config_new(int dims, const char * config)
    ++targ; // Skip ,
   }
  
+ // Check for a specialisation...
+  Composite_specialise(ret);
+ 
  // Return...
   return (KernelConfig)ret;
 }
@@ -1683,7 +1913,6 @@ void Composite_config_release(KernelConfig config)
    self->child[i].kernel->config_release(self->child[i].config);
   }
   
-  free(self->kca);
   free(self); 
  }
 }
@@ -1738,6 +1967,22 @@ float Composite_range(int dims, KernelConfig config, float quality)
  return ret;
 }
 
+float Composite_range_image(int dims, KernelConfig config, float quality)
+{
+ CompositeConfig * self = (CompositeConfig*)config;
+ 
+ float ret = 0.0;
+ 
+ int child;
+ for (child=0; child<self->children; child++)
+ {
+  float range = self->child[child].kernel->range_image(self->child[child].dims, self->child[child].config, quality);
+  if (range>ret) ret = range;
+ }
+ 
+ return ret;
+}
+
 void Composite_to_offset(int dims, KernelConfig config, float * fv, const float * base_fv)
 {
  CompositeConfig * self = (CompositeConfig*)config;
@@ -1752,6 +1997,27 @@ void Composite_to_offset(int dims, KernelConfig config, float * fv, const float
  }
 }
 
+void Composite_weights(int dims, KernelConfig config, int count, float * fv, const float * base_fv, float * weight)
+{
+ CompositeConfig * self = (CompositeConfig*)config;
+ 
+ // Specialised version if available...
+  if (self->fused!=NULL)
+  {
+   self->fused(self, dims, count, fv, base_fv, weight);
+   return;
+  }
+ 
+ // Generic version, going through the children for each exemplar in turn...
+  int i;
+  for (i=0; i<count; i++)
+  {
+   float * loc = fv + (size_t)i * dims;
+   Composite_to_offset(dims, config, loc, base_fv);
+   weight[i] *= Composite_weight(dims, config, loc);
+  }
+}
+
 float Composite_offset(int dims, KernelConfig config, float * fv, const float * offset)
 {
  CompositeConfig * self = (CompositeConfig*)config;
@@ -1792,27 +2058,66 @@ float Composite_mult_mass(int dims, KernelConfig * config, int terms, const floa
  CompositeConfig ** selves = (CompositeConfig**)config;
  CompositeConfig * self = selves[0];
  
- if (self->kca_length<terms)
- {
-  self->kca_length = terms;
-  self->kca = realloc(self->kca, terms * sizeof(KernelConfig));
- }
+ KernelConfig * kca = MultCache_push_configs(cache, terms, terms * self->depth);
  
  int i;
  int child;
  
+ // If specialised call the area functions directly - the Gaussian dimensions either side of the directional child are independent, so their areas multiply...
+  if (self->fused!=NULL)
+  {
+   int dir_end = self->dir_start + self->dir_dims;
+   if (self->dir_start>0) ret *= mult_area_gaussian(self->dir_start, terms, fv, scale, cache);
+   
+   if (self->dir_dims>0)
+   {
+    for (i=0; i<terms; i++)
+    {
+     kca[i] = selves[i]->dir;
+     fv[i] += self->dir_start;
+     scale[i] += self->dir_start;
+    }
+    
+    if (self->dir_kernel==&MirrorFisher) ret *= mult_area_mirror_fisher((FisherConfig**)kca, self->dir_dims, terms, fv, scale, cache);
+                                    else ret *= mult_area_fisher((FisherConfig**)kca, self->dir_dims, terms, fv, scale, cache);
+    
+    for (i=0; i<terms; i++)
+    {
+     fv[i] += self->dir_dims;
+     scale[i] += self->dir_dims;
+    }
+    
+    if (dir_end<dims) ret *= mult_area_gaussian(dims - dir_end, terms, fv, scale, cache);
+    
+    for (i=0; i<terms; i++)
+    {
+     fv[i] -= dir_end;
+     scale[i] -= dir_end;
+    }
+   }
+   else
+   {
+    if (dir_end<dims) ret *= mult_area_gaussian(dims, terms, fv, scale, cache);
+   }
+   
+   MultCache_pop_configs(cache, terms);
+   return ret;
+  }
+ 
+ // Generic version...
+ 
  int total = 0;
  for (child=0; child<self->children; child++)
  {
   // Prepare the kernel config array...
    for (i=0; i<terms; i++)
    {
-    self->kca[i] = selves[i]->child[child].config;
+    kca[i] = selves[i]->child[child].config;
    }
    
   // Factor in the current child...
    int c_dims = self->child[child].dims;
-   ret *= self->child[child].kernel->mult_mass(c_dims, self->kca, terms, fv, scale, cache);
+   ret *= self->child[child].kernel->mult_mass(c_dims, kca, terms, fv, scale, cache);
   
   // Move array pointers to the next item...
    for (i=0; i<terms; i++)
@@ -1830,6 +2135,7 @@ float Composite_mult_mass(int dims, KernelConfig * config, int terms, const floa
    scale[i] -= total;
   }
   
+ MultCache_pop_configs(cache, terms);
  return ret;
 }
 
@@ -1838,11 +2144,7 @@ void Composite_mult_draw(int dims, KernelConfig * config, int terms, const float
  CompositeConfig ** selves = (CompositeConfig**)config;
  CompositeConfig * self = selves[0];
  
- if (self->kca_length<terms)
- {
-  self->kca_length = terms;
-  self->kca = realloc(self->kca, terms * sizeof(KernelConfig));
- }
+ KernelConfig * kca = MultCache_push_configs(cache, terms, terms * self->depth);
 
  int i;
  int child;
@@ -1853,12 +2155,12 @@ void Composite_mult_draw(int dims, KernelConfig * config, int terms, const float
   // Prepare the kernel config array...
    for (i=0; i<terms; i++)
    {
-    self->kca[i] = selves[i]->child[child].config;
+    kca[i] = selves[i]->child[child].config;
    }
 
   // Draw for the current child...
    int c_dims = self->child[child].dims;
-   self->child[child].kernel->mult_draw(c_dims, self->kca, terms, fv, scale, out, cache, fake);
+   self->child[child].kernel->mult_draw(c_dims, kca, terms, fv, scale, out, cache, fake);
   
   // Move array pointers to the next item...
    for (i=0; i<terms; i++)
@@ -1876,6 +2178,8 @@ void Composite_mult_draw(int dims, KernelConfig * config, int terms, const float
    fv[i] -= total;
    scale[i] -= total;
   }
+  
+ MultCache_pop_configs(cache, terms);
 }
 
 
@@ -1932,7 +2236,6 @@ size_t Composite_byte_size(int dims, KernelConfig config, int * ref_count)
 
  size_t mem = sizeof(CompositeConfig);
  mem += self->children * sizeof(CompositeChild);
- mem += self->kca_length * sizeof(KernelConfig);
  
  int i;
  for (i=0; i<self->children; i++)
@@ -1949,15 +2252,17 @@ size_t Composite_byte_size(int dims, KernelConfig config, int * ref_count)
 const Kernel Composite =
 {
  "composite",
- "Allows you to use different kernels on different features, by specifying a list of kernels and how many dimensions each child kernel applies to. For instance, you could have a Gaussian on the first three features then a Fisher on the last three features. Note that this assumes that the number of dims in the data matches the number specificed in the kernel - if this is not the case brown stuff will interact with the spining blades of cooling.",
+ "Allows you to use different kernels on different features, by specifying a list of kernels and how many dimensions each child kernel applies to. For instance, you could have a Gaussian on the first three features then a Fisher on the last three features. Note that this assumes that the number of dims in the data matches the number specificed in the kernel - if this is not the case brown stuff will interact with the spining blades of cooling. When every child is a gaussian apart from at most one fisher or mirror_fisher, e.g. a position plus a direction or quaternion, a specialised implementation is used that evaluates the entire kernel in one vectorised pass, which is several times faster.",
  "Configured with a comma seperated list of kernel specifications, where any kernel can be used; each kernel is proceded by the  number of features/dimensions it covers then a colon before giving the actual kernel spec. For example: composite(3:gaussian,3:fisher(48.0)) to have a Gaussian kernel on the first three dimensions then a Fisher kernel on the last three.",
  Composite_config_new,
  Composite_config_verify,
  Composite_config_acquire,
  Composite_config_release,
  Composite_weight,
+ Composite_weights,
  Composite_norm,
  Composite_range,
+ Composite_range_image,
  Composite_to_offset,
  Composite_offset,
  Composite_draw,
@@ -43,12 +43,17 @@ typedef void (*KernelConfigRelease)(KernelConfig config);
 // Given a configuration and the offsets of a point from the kernel centre (Pointer to an array of length dim, noting that they will have been scaled for a kernel size of 1), this returns the weight of the point in the calculation. Does not need to be normalised. alpha is an arbitrary parameter that the kernel can interprete at will, noting that most kernels ignore it...
 typedef float (*KernelWeight)(int dims, KernelConfig config, float * offset);
 
+// Optional (can be NULL) - block version of to_offset followed by weight, for evaluating the kernel on lots of exemplars at once, so it can be vectorised. fv is count feature vectors, contiguous, which are converted in place to offsets from base_fv, as to_offset does; weight is an array of count values, each of which is multiplied by the weight of the matching feature vector...
+typedef void (*KernelWeights)(int dims, KernelConfig config, int count, float * fv, const float * base_fv, float * weight);
+
 // Given the number of dimensions and alpha this returns the multiplicative constant to acheive normalisation that is missing from weight. Can be negative if it is not defined / the kernel coder is lazy...
 typedef float (*KernelNorm)(int dims, KernelConfig config);
 
 // Given the configuration and a quality parameter this returns a maximum offset range after which it can clip the samples and not factor them into the kernel. Quality goes from 0, for low quality, to 1, for high quality...
 typedef float (*KernelRange)(int dims, KernelConfig config, float quality);
 
+// (The range_image member of the kernel uses the above signature, but returns the range around the nearest state (see KernelStates/KernelNext) of the kernel centre rather than the centre itself - for kernels with symmetries, such as MirrorFisher, this can be much smaller. Only valid with a spatial index that searches around every state - see Spatial_images.)
+
 // Converts the given feature vector into an offset from the base feature vector, modifying it inplace - it is this converted offset that has the weight function applied and is then averaged to get the mean shift. For most kernels this is simply subtracting the base feature vector from the feature vector in place - exists to support really weird kernels...
 typedef void (*KernelToOffset)(int dims, KernelConfig config, float * fv, const float * base_fv);
 
@@ -90,8 +95,10 @@ struct Kernel
  KernelConfigRelease config_release;
  
  KernelWeight   weight;
+ KernelWeights  weights;
  KernelNorm     norm;
  KernelRange    range;
+ KernelRange    range_image;
  KernelToOffset to_offset;
  KernelOffset   offset;
  KernelDraw     draw;
@@ -158,6 +165,7 @@ extern const Kernel * ListKernel[];
 
 // Would normally be kept private, but the multiplication system requires access to this...
 typedef struct FisherConfig FisherConfig;
+typedef struct FisherTable FisherTable;
 
 struct FisherConfig
 {
@@ -165,8 +173,9 @@ struct FisherConfig
  float alpha; // Concentration parameter.
  float log_norm; // log of the normalising constant.
  
+ FisherTable * table; // Shared table (see fisher_cache.h) that log_norm and inv_culm come from; NULL when the Gaussian approximation is being used.
  int inv_culm_size; // Length of below.
- float * inv_culm; // Array containing the inverse culmative of the distribution over the dot product result.
+ float * inv_culm; // Array containing the inverse culmative of the distribution over the dot product result - points into table, so is not owned.
  
  int * order; // Array of length dims that contains the integers 0..dims-1; used when drawing.
 };
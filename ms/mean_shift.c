@@ -12,6 +12,10 @@
 
 #include "eigen.h"
 
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
 
 
 float calc_weight(DataMatrix * dm)
@@ -46,34 +50,424 @@ float calc_norm(DataMatrix * dm, const Kernel * kernel, KernelConfig config, flo
 
 
 
-float prob(Spatial spatial, const Kernel * kernel, KernelConfig config, const float * fv, float norm, float quality)
+float spatial_range(Spatial spatial, const Kernel * kernel, KernelConfig config, float quality)
 {
- // Extract a bunch of things...
-  DataMatrix * dm = Spatial_dm(spatial);
+ int feats = DataMatrix_features(Spatial_dm(spatial));
+ int states = kernel->states(feats, config);
+ 
+ if (Spatial_images(spatial, states, kernel->next, config))
+ {
+  return kernel->range_image(feats, config, quality);
+ }
+ else
+ {
+  return kernel->range(feats, config, quality);
+ }
+}
+
+
+
+// Kernels are evaluated on blocks of exemplars, so that kernels with a weights method can vectorise - the exemplars returned by a spatial are gathered into a contiguous block, with their weights...
+static const int block_size = 64;
+
+struct Block
+{
+ int feats;
+ int count; // Number of exemplars in the block.
+ float * fv; // block_size x feats - offsets from the centre once filled.
+ float * weight; // block_size - exemplar weights multiplied by the kernel once filled.
+};
+
+
+void Block_init(Block * this, int feats)
+{
+ this->feats = feats;
+ this->count = 0;
+ this->fv = (float*)malloc((size_t)block_size * feats * sizeof(float));
+ this->weight = (float*)malloc(block_size * sizeof(float));
+}
+
+void Block_deinit(Block * this)
+{
+ free(this->fv);
+ free(this->weight);
+}
+
+Block * Block_new(int feats)
+{
+ Block * this = (Block*)malloc(sizeof(Block));
+ Block_init(this, feats);
+ return this;
+}
+
+void Block_delete(Block * this)
+{
+ Block_deinit(this);
+ free(this);
+}
+
+
+// Fills the block with the next exemplars from the spatial, which must have been started, skipping the exemplar skip (-1 to skip none), leaving their positions and weights as they are. Returns how many exemplars are in the block - less than block_size means the spatial has run out...
+int Block_gather(Block * this, Spatial spatial, int skip)
+{
+ DataMatrix * dm = Spatial_dm(spatial);
+ int feats = this->feats;
+ 
+ this->count = 0;
+ while (this->count<block_size)
+ {
+  int targ = Spatial_next(spatial);
+  if (targ<0) break;
+  if (targ==skip) continue;
   
-  int feats = DataMatrix_features(dm);
-  float range = kernel->range(feats, config, quality);
+  DataMatrix_fv_into(dm, targ, this->fv + (size_t)this->count * feats, this->weight + this->count);
+  this->count += 1;
+ }
+ 
+ return this->count;
+}
+
+
+// Evaluates the kernel, centred on centre, for the gathered exemplars - converts the positions into offsets and multiplies the weights by the kernel...
+void Block_weigh(Block * this, const Kernel * kernel, KernelConfig config, const float * centre)
+{
+ int feats = this->feats;
+ 
+ if (kernel->weights!=NULL)
+ {
+  kernel->weights(feats, config, this->count, this->fv, centre, this->weight);
+ }
+ else
+ {
+  int i;
+  for (i=0; i<this->count; i++)
+  {
+   float * loc = this->fv + (size_t)i * feats;
+   kernel->to_offset(feats, config, loc, centre);
+   this->weight[i] *= kernel->weight(feats, config, loc);
+  }
+ }
+}
+
+
+// Both of the above...
+int Block_fill(Block * this, Spatial spatial, const Kernel * kernel, KernelConfig config, const float * centre, int skip)
+{
+ Block_gather(this, spatial, skip);
+ Block_weigh(this, kernel, config, centre);
+ COUNT(Spatial_counters(spatial), kernel_evals, this->count);
+ return this->count;
+}
+
+
+// Returns the sum of the kernel over the exemplars within range of fv, each multiplied by norm, skipping exemplar skip (-1 to skip none)...
+float Block_sum(Block * this, Spatial spatial, const Kernel * kernel, KernelConfig config, const float * fv, float range, float norm, int skip)
+{
+ float ret = 0.0;
+ Spatial_start(spatial, fv, range);
+ 
+ int count;
+ do
+ {
+  count = Block_fill(this, spatial, kernel, config, fv, skip);
   
- // Loop and sum the return value...
-  float ret = 0.0;
-  Spatial_start(spatial, fv, range);
+  int i;
+  for (i=0; i<count; i++) ret += this->weight[i] * norm;
+ }
+ while (count==block_size);
+ 
+ return ret;
+}
+
+
+// Calculates the kernel weighted mean of the offsets of the exemplars within range of fv, writing it into temp - a mean shift step, ready to be passed to the offset method of the kernel...
+void Block_mean(Block * this, Spatial spatial, const Kernel * kernel, KernelConfig config, const float * fv, float range, float * temp)
+{
+ int feats = this->feats;
+ float weight = 0.0;
+ int i, j;
+ for (i=0; i<feats; i++) temp[i] = 0.0;
+ 
+ Spatial_start(spatial, fv, range);
+ 
+ int count;
+ do
+ {
+  count = Block_fill(this, spatial, kernel, config, fv, -1);
+  
+  for (j=0; j<count; j++)
+  {
+   float w = this->weight[j];
+   if (w>1e-6)
+   {
+    const float * loc = this->fv + (size_t)j * feats;
+    weight += w;
+    for (i=0; i<feats; i++) temp[i] += w * (loc[i] - temp[i]) / weight;
+   }
+  }
+ }
+ while (count==block_size);
+}
+
+
+
+float prob(Spatial spatial, const Kernel * kernel, KernelConfig config, const float * fv, Block * block, float norm, float quality)
+{
+ // Sum the kernel over everything in range...
+  float range = spatial_range(spatial, kernel, config, quality);
+  return Block_sum(block, spatial, kernel, config, fv, range, norm, -1);
+}
+
+
+
+// Everything needed for the dual tree evaluation, passed around the recursion...
+typedef struct DualTree DualTree;
+
+struct DualTree
+{
+ const Kernel * kernel;
+ KernelConfig config;
+ int feats;
+ 
+ DataMatrix * ref_dm;
+ const int * ref_indices;
+ DataMatrix * query_dm;
+ const int * query_indices;
+ 
+ float range; // Half width of the box a kd tree query uses - an exemplar contributes if its leafs bounding box overlaps the box around the query, exactly as for prob.
+ float abs_tol; // Tolerances, converted so they apply to the kernel weight.
+ float rel_tol;
+ 
+ float * offset; // Temporary, for evaluating the kernel at a distance.
+ float * loc; // Temporary, a reference exemplar converted to an offset from the query.
+ float * out; // Unnormalised output, indexed by query exemplar.
+ Counters * counters; // Of the reference spatial, for recording the kernel evaluations.
+ 
+ int stack_size; // Storage for the lists of reference nodes that are still being considered for each query node.
+ KDNode ** stack;
+};
+
+
+
+int radial_kernel(const Kernel * kernel)
+{
+ return (kernel==&Uniform) || (kernel==&Triangular) || (kernel==&Epanechnikov) || (kernel==&Cosine) || (kernel==&Gaussian) || (kernel==&Cauchy) || (kernel==&Logistic);
+}
+
+
+float DualTree_weight(DualTree * this, float dist)
+{
+ this->offset[0] = dist;
+ return this->kernel->weight(this->feats, this->config, this->offset);
+}
+
+
+void DualTree_ensure(DualTree * this, int size)
+{
+ if (size>this->stack_size)
+ {
+  this->stack_size = 2 * size;
+  this->stack = (KDNode**)realloc(this->stack, this->stack_size * sizeof(KDNode*));
+ }
+}
+
+
+// Returns 0 if a node pair has been handled - it either contributes nothing or has been approximated, in which case the approximation is added to approx. Otherwise returns 1, to indicate that the pair needs to be refined...
+int DualTree_check(DualTree * this, KDNode * q, KDNode * r, float * approx)
+{
+ // Calculate the minimum and maximum distance between the bounding boxes, plus the largest gap and span in any one feature, as the kd tree includes a leaf when its bounding box overlaps the box around the query...
+  float min_sqr = 0.0;
+  float max_sqr = 0.0;
+  float max_gap = 0.0;
+  float max_span = 0.0;
   
-  while (1)
+  int i;
+  for (i=0; i<this->feats; i++)
   {
-   int targ = Spatial_next(spatial);
-   if (targ<0) break;
+   float gap = q->range[i*2] - r->range[i*2+1];
+   float gap2 = r->range[i*2] - q->range[i*2+1];
+   if (gap2>gap) gap = gap2;
+   if (gap>0.0) min_sqr += gap * gap;
+   if (gap>max_gap) max_gap = gap;
    
+   float span = q->range[i*2+1] - r->range[i*2];
+   float span2 = r->range[i*2+1] - q->range[i*2];
+   if (span2>span) span = span2;
+   max_sqr += span * span;
+   if (span>max_span) max_span = span;
+  }
+  
+  if (max_gap>this->range) return 0;
+  
+ // Kernel is non-increasing with distance, so we have bounds - if they are tight enough approximate with the middle of them. If r is not entirely within range of every query in q some of it may be excluded, so the lower bound drops to zero...
+  float high = DualTree_weight(this, sqrt(min_sqr));
+  float low = (max_span>this->range) ? 0.0 : DualTree_weight(this, sqrt(max_sqr));
+  float err = 0.5 * (high - low);
+  
+  if ((err<=this->abs_tol)||(err<=this->rel_tol*low))
+  {
+   *approx += r->weight * 0.5 * (high + low);
+   return 0;
+  }
+  
+ return 1;
+}
+
+
+// Exact evaluation for a pair of leaf nodes - each query includes all of r if r's bounding box overlaps the box around it, as KDTree_start would...
+void DualTree_leaf(DualTree * this, KDNode * q, KDNode * r)
+{
+ int i, j, k;
+ for (i=q->low; i<q->high; i++)
+ {
+  int qi = this->query_indices[i];
+  float * fv = DataMatrix_fv(this->query_dm, qi, NULL);
+  
+  for (k=0; k<this->feats; k++)
+  {
+   if ((fv[k]+this->range<r->range[k*2])||(fv[k]-this->range>r->range[k*2+1])) break;
+  }
+  if (k<this->feats) continue;
+  
+  float sum = 0.0;
+  for (j=r->low; j<r->high; j++)
+  {
    float w;
-   float * loc = DataMatrix_fv(dm, targ, &w);
+   float * loc = this->loc;
+   DataMatrix_fv_into(this->ref_dm, this->ref_indices[j], loc, &w);
+   
+   this->kernel->to_offset(this->feats, this->config, loc, fv);
+   sum += w * this->kernel->weight(this->feats, this->config, loc);
+  }
+  COUNT(this->counters, kernel_evals, r->high - r->low);
+  
+  this->out[qi] += sum;
+ }
+}
+
 
-   kernel->to_offset(feats, config, loc, fv);
-   w *= kernel->weight(feats, config, loc);
+// The recursion - processes query node q against the list of reference nodes in stack[base, base+count), with acc the approximated contribution collected by its ancestors...
+void DualTree_recurse(DualTree * this, KDNode * q, int base, int count, float acc)
+{
+ int end = base + count;
+ int keep = base;
+ int i = base;
+ 
+ // Go through the list, approximating what we can - splitting reference nodes that are larger than q, so we get to try again with their children, and keeping the rest for q's children; if q is a leaf the rest get resolved here...
+  while (i<end)
+  {
+   KDNode * r = this->stack[i];
+   i += 1;
+   
+   if (DualTree_check(this, q, r, &acc)==0) continue;
+   
+   if (r->child_low!=0)
+   {
+    if ((q->child_low==0)||((r->high - r->low) > (q->high - q->low)))
+    {
+     DualTree_ensure(this, end+2);
+     this->stack[end] = KDNode_child_low(r);
+     this->stack[end+1] = KDNode_child_high(r);
+     end += 2;
+     continue;
+    }
+   }
    
-   w *= norm;
-   ret += w;
+   if (q->child_low==0)
+   {
+    DualTree_leaf(this, q, r);
+   }
+   else
+   {
+    this->stack[keep] = r; // keep is never ahead of i, so this is safe.
+    keep += 1;
+   }
+  }
+ 
+ // Either record the approximation into the outputs or recurse to the children...
+  if (q->child_low==0)
+  {
+   for (i=q->low; i<q->high; i++) this->out[this->query_indices[i]] += acc;
+  }
+  else
+  {
+   count = keep - base;
+   if (count==0)
+   {
+    DualTree_recurse(this, KDNode_child_low(q), base, 0, acc);
+    DualTree_recurse(this, KDNode_child_high(q), base, 0, acc);
+   }
+   else
+   {
+    // First child gets a copy of the list, as the recursion edits it in place...
+     DualTree_ensure(this, keep + count);
+     for (i=0; i<count; i++) this->stack[keep+i] = this->stack[base+i];
+     
+     DualTree_recurse(this, KDNode_child_low(q), keep, count, acc);
+     DualTree_recurse(this, KDNode_child_high(q), base, count, acc);
+   }
+  }
+}
+
+
+
+void probs_dual(Spatial spatial, const Kernel * kernel, KernelConfig config, Spatial query, float * out, float norm, float quality, float abs_tol, float rel_tol)
+{
+ DataMatrix * dm = Spatial_dm(spatial);
+ DataMatrix * query_dm = Spatial_dm(query);
+ int queries = DataMatrix_exemplars(query_dm);
+ int i;
+ 
+ // If we can't use the dual tree just do it the normal way...
+  if ((radial_kernel(kernel)==0)||(Spatial_type(spatial)!=&KDTreeType)||(Spatial_type(query)!=&KDTreeType))
+  {
+   Block * block = Block_new(DataMatrix_features(dm));
+   for (i=0; i<queries; i++)
+   {
+    float * fv = DataMatrix_fv(query_dm, i, NULL);
+    out[i] = prob(spatial, kernel, config, fv, block, norm, quality);
+   }
+   Block_delete(block);
+   return;
   }
   
- return ret;
+ // Setup the state...
+  DualTree this;
+  this.kernel = kernel;
+  this.config = config;
+  this.feats = DataMatrix_features(dm);
+  
+  this.ref_dm = dm;
+  this.ref_indices = KDTree_indices(spatial);
+  this.query_dm = query_dm;
+  this.query_indices = KDTree_indices(query);
+  
+  KDNode * root = KDTree_root(spatial);
+  this.range = spatial_range(spatial, kernel, config, quality);
+  this.abs_tol = abs_tol / (norm * root->weight);
+  this.rel_tol = rel_tol;
+  
+  this.offset = (float*)malloc(this.feats * sizeof(float));
+  for (i=0; i<this.feats; i++) this.offset[i] = 0.0;
+  this.loc = (float*)malloc(this.feats * sizeof(float));
+  
+  this.out = out;
+  for (i=0; i<queries; i++) out[i] = 0.0;
+  this.counters = Spatial_counters(spatial);
+  
+  this.stack_size = 64;
+  this.stack = (KDNode**)malloc(this.stack_size * sizeof(KDNode*));
+  this.stack[0] = root;
+  
+ // Do the work...
+  DualTree_recurse(&this, KDTree_root(query), 0, 1, 0.0);
+  
+ // Apply the normalising constant, clean up...
+  for (i=0; i<queries; i++) out[i] *= norm;
+  
+  free(this.stack);
+  free(this.offset);
+  free(this.loc);
 }
 
 
@@ -94,6 +488,28 @@ void draw(DataMatrix * dm, const Kernel * kernel, KernelConfig config, PhiloxRNG
 
 
 
+void draws(DataMatrix * dm, const Kernel * kernel, KernelConfig config, PhiloxRNG * rng, int count, int * index, float * out)
+{
+ int feats = DataMatrix_features(dm);
+ 
+ // Draw all of the exemplars first, using the callers storage if provided...
+  int * ind = (index!=NULL) ? index : (int*)malloc(count * sizeof(int));
+  DataMatrix_draws(dm, rng, count, ind);
+  
+ // Draw from the kernel at each...
+  int i;
+  for (i=0; i<count; i++)
+  {
+   float * fv = DataMatrix_fv(dm, ind[i], NULL);
+   kernel->draw(feats, config, rng, fv, out + (size_t)i * feats);
+  }
+  
+ // Clean up...
+  if (index==NULL) free(ind);
+}
+
+
+
 float loo_nll(Spatial spatial, const Kernel * kernel, KernelConfig config, float norm, float quality, float limit, int sample_clamp, PhiloxRNG * rng)
 {
  // Extract a bunch of things...
@@ -101,7 +517,7 @@ float loo_nll(Spatial spatial, const Kernel * kernel, KernelConfig config, float
   
   int exemplars = DataMatrix_exemplars(dm);
   int features = DataMatrix_features(dm);
-  float range = kernel->range(features, config, quality);
+  float range = spatial_range(spatial, kernel, config, quality);
   
   int sample_count;
   if (exemplars<=sample_clamp)
@@ -126,6 +542,9 @@ float loo_nll(Spatial spatial, const Kernel * kernel, KernelConfig config, float
   
   float * fvi = (float*)malloc(features * sizeof(float));
   
+  Block block;
+  Block_init(&block, features);
+  
   int i, ii, j;
   for (i=0; i<sample_count; i++)
   {
@@ -139,33 +558,264 @@ float loo_nll(Spatial spatial, const Kernel * kernel, KernelConfig config, float
     for (j=0; j<features; j++) fvi[j] = fv[j];
     
    // Calculate the probability of exemplar i, ignoring entry i...
-    float prob = 0.0;
+    float prob = Block_sum(&block, spatial, kernel, config, fvi, range, norm, ii);
+    
+   // Update the return cost...
+    if (prob<limit) prob = limit;
+    ret -= wi * log(prob);
+  }
+  
+  Block_deinit(&block);
+  free(fvi);
+  
+ return ret;
+}
+
+
+
+void loo_nll_multi(Spatial spatial, const Kernel * kernel, KernelConfig config, float norm, float quality, float limit, int sample_clamp, PhiloxRNG * rng, int candidates, const float * ratio, float * out, Progress progress, void * progress_data)
+{
+ // Extract a bunch of things...
+  DataMatrix * dm = Spatial_dm(spatial);
+  
+  int exemplars = DataMatrix_exemplars(dm);
+  int features = DataMatrix_features(dm);
+  
+  int sample_count;
+  if (exemplars<=sample_clamp)
+  {
+   rng = NULL;
+   sample_count = exemplars;
+  }
+  else
+  {
+   if (rng!=NULL)
+   {
+    sample_count = sample_clamp; 
+   }
+   else
+   {
+    sample_count = exemplars;
+   }
+  }
+  
+ // The spatial is searched with the range of the widest candidate, and each candidate has its own normalising constant...
+  float min_ratio = ratio[0];
+  float * norms = (float*)malloc(candidates * sizeof(float));
+  
+  int i, j, k;
+  for (k=0; k<candidates; k++)
+  {
+   norms[k] = norm;
+   for (j=0; j<features; j++)
+   {
+    float r = ratio[k*features + j];
+    if (r<min_ratio) min_ratio = r;
+    norms[k] *= r;
+   }
+  }
+  
+  float cand_range = spatial_range(spatial, kernel, config, quality);
+  float cand_range_sqr = cand_range * cand_range;
+  float range = cand_range / min_ratio;
+  
+ // Neighbours beyond the range of a candidate are culled before evaluating it, so the answer matches loo_nll and narrow candidates stay cheap - can't be done if the kernel has symmetries, as the spatial may return exemplars that are in range of an image...
+  int cull = kernel->states(features, config)==1;
+  
+ // Loop and do each exemplar in the data set in turn, gathering its neighbours once and evaluating every candidate on them... 
+  for (k=0; k<candidates; k++) out[k] = 0.0;
+  
+  float * fvi = (float*)malloc(features * sizeof(float));
+  float * centre = (float*)malloc(features * sizeof(float));
+  float * prob = (float*)malloc(candidates * sizeof(float));
+  
+  Block block;
+  Block_init(&block, features);
+  
+  Block scaled;
+  Block_init(&scaled, features);
+  
+  int ii;
+  for (i=0; i<sample_count; i++)
+  {
+   // Report how far we have got...
+    if (progress!=NULL) progress(progress_data, i, sample_count);
+    
+   // Handle if we are doing random selection...
+    if (rng==NULL) ii = i;
+              else ii = (int)(exemplars * PhiloxRNG_uniform(rng));
+   
+   // Get exemplar i, so we can play with it...
+    float wi;
+    float * fv = DataMatrix_fv(dm, ii, &wi);
+    for (j=0; j<features; j++) fvi[j] = fv[j];
+    
+   // Sum the kernel for each candidate, ignoring entry i...
+    for (k=0; k<candidates; k++) prob[k] = 0.0;
+    
     Spatial_start(spatial, fvi, range);
+    int count;
+    do
+    {
+     count = Block_gather(&block, spatial, ii);
+     
+     for (k=0; k<candidates; k++)
+     {
+      // Rescale the block into the candidates space, dropping anything out of range...
+       const float * r = ratio + k*features;
+       for (j=0; j<features; j++) centre[j] = fvi[j] * r[j];
+       
+       int e;
+       scaled.count = 0;
+       for (e=0; e<count; e++)
+       {
+        const float * src = block.fv + (size_t)e * features;
+        float * dest = scaled.fv + (size_t)scaled.count * features;
+        
+        float dist_sqr = 0.0;
+        for (j=0; j<features; j++)
+        {
+         dest[j] = src[j] * r[j];
+         float delta = dest[j] - centre[j];
+         dist_sqr += delta * delta;
+        }
+        
+        if ((cull==0)||(dist_sqr<=cand_range_sqr))
+        {
+         scaled.weight[scaled.count] = block.weight[e];
+         scaled.count += 1;
+        }
+       }
+       
+      // Evaluate and sum...
+       Block_weigh(&scaled, kernel, config, centre);
+       COUNT(Spatial_counters(spatial), kernel_evals, scaled.count);
+       for (e=0; e<scaled.count; e++) prob[k] += scaled.weight[e] * norms[k];
+     }
+    }
+    while (count==block_size);
+    
+   // Update the return costs...
+    for (k=0; k<candidates; k++)
+    {
+     if (prob[k]<limit) prob[k] = limit;
+     out[k] -= wi * log(prob[k]);
+    }
+  }
+  
+  Block_deinit(&scaled);
+  Block_deinit(&block);
+  free(prob);
+  free(centre);
+  free(fvi);
+  free(norms);
+}
+
+
+
+// Offsets the progress of loo_nll_multi by the pass of loo_nll_search it is part of...
+typedef struct PassProgress PassProgress;
+
+struct PassProgress
+{
+ Progress progress;
+ void * data;
+ int pass;
+ int passes;
+};
+
+void PassProgress_report(void * data, int done, int total)
+{
+ PassProgress * this = (PassProgress*)data;
+ this->progress(this->data, this->pass * total + done, this->passes * total);
+}
+
+
+float loo_nll_search(Spatial spatial, const Kernel * kernel, KernelConfig config, float norm, float quality, float limit, int sample_clamp, PhiloxRNG * rng, const float * low, const float * high, int candidates, int passes, float * best, Progress progress, void * progress_data)
+{
+ int features = DataMatrix_features(Spatial_dm(spatial));
+ if (candidates<3) candidates = 3;
+ if (passes<1) passes = 1;
+ 
+ float * ratio = (float*)malloc(candidates * features * sizeof(float));
+ float * nll = (float*)malloc(candidates * sizeof(float));
+ 
+ // Every pass uses the same random draws, so their scores can be compared - this is a copy of the rng, with its own index...
+  unsigned int index[4];
+  PhiloxRNG pass_rng;
+  
+  PassProgress pass_progress;
+  pass_progress.progress = progress;
+  pass_progress.data = progress_data;
+  pass_progress.passes = passes;
+  
+ // Do each pass in turn, shrinking the bracket around the best candidate each time...
+  float t_low = 0.0;
+  float t_high = 1.0;
+  float best_t = 0.0;
+  float best_nll = 0.0;
+  
+  int p, k, j;
+  for (p=0; p<passes; p++)
+  {
+   // Fill in the candidate scale ratios, evenly spaced along the log-linear path across the bracket...
+    for (k=0; k<candidates; k++)
+    {
+     float t = t_low + (t_high - t_low) * k / (float)(candidates-1);
+     for (j=0; j<features; j++)
+     {
+      ratio[k*features + j] = low[j] * pow(high[j] / low[j], t);
+     }
+    }
+   
+   // Evaluate them all...
+    PhiloxRNG * use_rng = NULL;
+    if (rng!=NULL)
+    {
+     pass_rng = *rng;
+     memcpy(index, rng->index, 4 * sizeof(unsigned int));
+     pass_rng.index = index;
+     use_rng = &pass_rng;
+    }
+    
+    pass_progress.pass = p;
+    loo_nll_multi(spatial, kernel, config, norm, quality, limit, sample_clamp, use_rng, candidates, ratio, nll, (progress!=NULL) ? PassProgress_report : NULL, &pass_progress);
     
-    while (1)
+   // Find the best, and bracket it with its neighbours...
+    int bi = 0;
+    for (k=1; k<candidates; k++)
     {
-     int targ = Spatial_next(spatial);
-     if (targ<0) break;
-     if (targ==ii) continue; // Skip the one we are currently analysing!
-   
-     float w;
-     float * fv = DataMatrix_fv(dm, targ, &w);
-
-     kernel->to_offset(features, config, fv, fvi);
-     w *= kernel->weight(features, config, fv);
-   
-     w *= norm;
-     prob += w;
+     if (nll[k]<nll[bi]) bi = k;
     }
     
-   // Update the return cost...
-    if (prob<limit) prob = limit;
-    ret -= wi * log(prob);
+    float step = (t_high - t_low) / (candidates-1);
+    if ((p==0)||(nll[bi]<best_nll))
+    {
+     best_nll = nll[bi];
+     best_t = t_low + step * bi;
+     for (j=0; j<features; j++) best[j] = ratio[bi*features + j];
+    }
+    
+    t_low = best_t - step;
+    t_high = best_t + step;
+    if (t_low<0.0) t_low = 0.0;
+    if (t_high>1.0) t_high = 1.0;
   }
   
-  free(fvi);
+ // Move the callers rng on, as though it had been used once...
+  if (rng!=NULL)
+  {
+   unsigned int * keep = rng->index;
+   *rng = pass_rng;
+   rng->index = keep;
+   memcpy(keep, index, 4 * sizeof(unsigned int));
+  }
   
- return ret;
+ // Clean up and return...
+  free(nll);
+  free(ratio);
+  
+ return best_nll;
 }
 
 
@@ -177,7 +827,7 @@ float entropy(Spatial spatial, const Kernel * kernel, KernelConfig config, float
   
   int exemplars = DataMatrix_exemplars(dm);
   int features = DataMatrix_features(dm);
-  float range = kernel->range(features, config, quality);
+  float range = spatial_range(spatial, kernel, config, quality);
   
   int sample_count;
   if (exemplars<=sample_clamp)
@@ -203,6 +853,9 @@ float entropy(Spatial spatial, const Kernel * kernel, KernelConfig config, float
   
   float * fvi = (float*)malloc(features * sizeof(float));
   
+  Block block;
+  Block_init(&block, features);
+  
   int i, ii, j;
   for (i=0; i<sample_count; i++)
   {
@@ -216,29 +869,14 @@ float entropy(Spatial spatial, const Kernel * kernel, KernelConfig config, float
     for (j=0; j<features; j++) fvi[j] = fv[j];
     
    // Calculate the probability of exemplar i...
-    float prob = 0.0;
-    Spatial_start(spatial, fvi, range);
-    
-    while (1)
-    {
-     int targ = Spatial_next(spatial);
-     if (targ<0) break;
-   
-     float w;
-     float * fv = DataMatrix_fv(dm, targ, &w);
-
-     kernel->to_offset(features, config, fv, fvi);
-     w *= kernel->weight(features, config, fv);
-   
-     w *= norm;
-     prob += w;
-    }
+    float prob = Block_sum(&block, spatial, kernel, config, fvi, range, norm, -1);
     
    // Update the return cost - incrimental mean...
     samples += wi;
     ret += wi * (log(prob) - ret) / samples;
   }
   
+  Block_deinit(&block);
   free(fvi);
   
  return -ret;
@@ -250,12 +888,11 @@ float kl_divergence(Spatial spatial_p, const Kernel * kernel_p, KernelConfig con
 {
  // Extract a bunch of things...
   DataMatrix * dm_p = Spatial_dm(spatial_p);
-  DataMatrix * dm_q = Spatial_dm(spatial_q);
   
   int exemplars = DataMatrix_exemplars(dm_p);
   int features = DataMatrix_features(dm_p);
-  float range_p = kernel_p->range(features, config_p, quality_p);
-  float range_q = kernel_q->range(features, config_q, quality_q);
+  float range_p = spatial_range(spatial_p, kernel_p, config_p, quality_p);
+  float range_q = spatial_range(spatial_q, kernel_q, config_q, quality_q);
 
   int sample_count;
   if (exemplars<=sample_clamp)
@@ -281,6 +918,9 @@ float kl_divergence(Spatial spatial_p, const Kernel * kernel_p, KernelConfig con
   
   float * fvi = (float*)malloc(features * sizeof(float));
   
+  Block block;
+  Block_init(&block, features);
+  
   int i, ii, j;
   for (i=0; i<sample_count; i++)
   {
@@ -294,42 +934,10 @@ float kl_divergence(Spatial spatial_p, const Kernel * kernel_p, KernelConfig con
     for (j=0; j<features; j++) fvi[j] = fv[j];
     
    // Calculate the probability of exemplar i in p...
-    float prob_p = 0.0;
-    Spatial_start(spatial_p, fvi, range_p);
-    
-    while (1)
-    {
-     int targ = Spatial_next(spatial_p);
-     if (targ<0) break;
-   
-     float w;
-     float * fv = DataMatrix_fv(dm_p, targ, &w);
-
-     kernel_p->to_offset(features, config_p, fv, fvi);
-     w *= kernel_p->weight(features, config_p, fv);
-   
-     w *= norm_p;
-     prob_p += w;
-    }
+    float prob_p = Block_sum(&block, spatial_p, kernel_p, config_p, fvi, range_p, norm_p, -1);
    
    // Calculate the probability of exemplar i in q...
-    float prob_q = 0.0;
-    Spatial_start(spatial_q, fvi, range_q);
-    
-    while (1)
-    {
-     int targ = Spatial_next(spatial_q);
-     if (targ<0) break;
-   
-     float w;
-     float * fv = DataMatrix_fv(dm_q, targ, &w);
-
-     kernel_q->to_offset(features, config_q, fv, fvi);
-     w *= kernel_q->weight(features, config_q, fv);
-   
-     w *= norm_q;
-     prob_q += w;
-    }
+    float prob_q = Block_sum(&block, spatial_q, kernel_q, config_q, fvi, range_q, norm_q, -1);
     
     if (prob_q<limit) prob_q = limit;
     
@@ -338,6 +946,7 @@ float kl_divergence(Spatial spatial_p, const Kernel * kernel_p, KernelConfig con
     ret += wi * (log(prob_p / prob_q) - ret) / samples;
   }
   
+  Block_deinit(&block);
   free(fvi);
   
  return ret;
@@ -345,60 +954,85 @@ float kl_divergence(Spatial spatial_p, const Kernel * kernel_p, KernelConfig con
 
 
 
-void mode(Spatial spatial, const Kernel * kernel, KernelConfig config, float * fv, float * temp, float quality, float epsilon, int iter_cap)
+// Records a finished convergence in the counters of the spatial - capped is non-zero if it stopped because it ran out of iterations, hit if it stopped early because it landed in a merge ball or cached basin...
+static void count_convergence(Spatial spatial, int iters, int capped, int hit)
+{
+#ifndef MS_NO_COUNTERS
+ Counters * counters = Spatial_counters(spatial);
+ COUNT(counters, modes, 1);
+ COUNT(counters, iterations, iters);
+ COUNT(counters, iter_cap_hits, capped ? 1 : 0);
+ COUNT(counters, ball_hits, hit ? 1 : 0);
+#endif
+}
+
+
+
+void mode(Spatial spatial, const Kernel * kernel, KernelConfig config, float * fv, float * temp, Block * block, float quality, float epsilon, int iter_cap, Basins * basins)
 {
  // Extract the many things we need... 
   DataMatrix * dm = Spatial_dm(spatial);
   
   int feats = DataMatrix_features(dm);
-  float range = kernel->range(feats, config, quality);
+  float range = spatial_range(spatial, kernel, config, quality);
+
+  Trajectory path;
+  Trajectory_init(&path, feats);
 
  // Loop until convergance...
   float delta = 2.0 * epsilon;
   int iters = 0;
+  int hit = -1;
   while ((delta>epsilon)&&(iters<iter_cap))
   {
-   // Prepare the temporary for incrimental mean calculation...
-    float weight = 0.0;
-    int i;
-    for (i=0; i<feats; i++) temp[i] = 0.0;
-   
-   // Iterate all relevant samples, to calculate the mean...
-    Spatial_start(spatial, fv, range);
-    while (1)
+   // If we have entered a cell that an earlier trajectory passed through jump to where it went...
+    if (basins!=NULL)
     {
-     int targ = Spatial_next(spatial);
-     if (targ<0) break;
-     
-     float w;
-     float * loc = DataMatrix_fv(dm, targ, &w);
-
-     kernel->to_offset(feats, config, loc, fv);
-     w *= kernel->weight(feats, config, loc);
-     
-     if (w>1e-6)
-     {
-      weight += w;
-      for (i=0; i<feats; i++) temp[i] += w * (loc[i] - temp[i]) / weight;
-     }
+     hit = Basins_lookup(basins, fv);
+     if (hit>=0) break;
+     Trajectory_add(&path, fv);
     }
-   
+
+   // Calculate the mean of everything in range...
+    Block_mean(block, spatial, kernel, config, fv, range, temp);
+
    // Copy into the fv, calculating delta as well...
     delta = kernel->offset(feats, config, fv, temp);
-    
+
    // We just iterated...
     iters += 1;
   }
+  count_convergence(spatial, iters, (delta>epsilon)&&(hit<0), hit>=0);
+
+ // Update the cache with the path taken, storing the mode if its a new one...
+  if (basins!=NULL)
+  {
+   if (hit<0)
+   {
+    hit = Basins_lookup(basins, fv);
+    if (hit<0) hit = Basins_add_pos(basins, fv);
+   }
+   else
+   {
+    const float * dest = Basins_pos(basins, hit);
+    int i;
+    for (i=0; i<feats; i++) fv[i] = dest[i];
+   }
+
+   Trajectory_record(&path, basins, hit);
+  }
+
+ Trajectory_deinit(&path);
 }
 
 
 
-int mode_merge(Spatial spatial, const Kernel * kernel, KernelConfig config, Balls balls, float * fv, float * temp, float quality, float epsilon, int iter_cap, float merge_range, int check_step)
+int mode_merge(Spatial spatial, const Kernel * kernel, KernelConfig config, Balls balls, float * fv, float * temp, Block * block, float quality, float epsilon, int iter_cap, float merge_range, int check_step)
 {
  // Extract some things that we need... 
   DataMatrix * dm = Spatial_dm(spatial);
   int feats = DataMatrix_features(dm);
-  float range = kernel->range(feats, config, quality);
+  float range = spatial_range(spatial, kernel, config, quality);
   int states = kernel->states(feats, config);
   
  // Converge the provided feature vector, with breaks every check_step-s to find out if its hit a mode or not...
@@ -430,30 +1064,8 @@ int mode_merge(Spatial spatial, const Kernel * kernel, KernelConfig config, Ball
      if (out>=0) break;
     }
     
-   // Prepare the temporary for incrimental mean calculation...
-    float weight = 0.0;
-    int i;
-    for (i=0; i<feats; i++) temp[i] = 0.0;
-   
-   // Iterate all relevant samples, to calculate the mean...
-    Spatial_start(spatial, fv, range);
-    while (1)
-    {
-     int targ = Spatial_next(spatial);
-     if (targ<0) break;
-     
-     float w;
-     float * loc = DataMatrix_fv(dm, targ, &w);
-       
-     kernel->to_offset(feats, config, loc, fv);
-     w *= kernel->weight(feats, config, loc);
-     
-     if (w>1e-6)
-     {
-      weight += w;
-      for (i=0; i<feats; i++) temp[i] += w * (loc[i] - temp[i]) / weight;
-     }
-    }
+   // Calculate the mean of everything in range...
+    Block_mean(block, spatial, kernel, config, fv, range, temp);
    
    // Copy into the fv, calculating delta as well...
     delta = kernel->offset(feats, config, fv, temp);
@@ -461,6 +1073,7 @@ int mode_merge(Spatial spatial, const Kernel * kernel, KernelConfig config, Ball
    // We just iterated...
     iters += 1; 
   }
+  count_convergence(spatial, iters, (delta>epsilon)&&(out<0), out>=0);
   
  // If it has not merged with an existing mode create a new one to assign it to...
   if (out<0)
@@ -494,14 +1107,14 @@ int mode_merge(Spatial spatial, const Kernel * kernel, KernelConfig config, Ball
 
 
 
-void cluster(Spatial spatial, const Kernel * kernel, KernelConfig config, Balls balls, int * out, float quality, float epsilon, int iter_cap, float ident_dist, float merge_range, int check_step)
+void cluster(Spatial spatial, const Kernel * kernel, KernelConfig config, Balls balls, int * out, float quality, float epsilon, int iter_cap, float ident_dist, float merge_range, int check_step, Basins * basins)
 {
  // Extract some things that we need... 
   DataMatrix * dm = Spatial_dm(spatial);
   
   int exemplars = DataMatrix_exemplars(dm);
   int feats = DataMatrix_features(dm);
-  float range = kernel->range(feats, config, quality);
+  float range = spatial_range(spatial, kernel, config, quality);
   int states = kernel->states(feats, config);
  
  // Create some temporary storage...
@@ -509,6 +1122,12 @@ void cluster(Spatial spatial, const Kernel * kernel, KernelConfig config, Balls
   float * temp = (float*)malloc(feats * sizeof(float));
   int * same_dest = (int*)malloc(exemplars * sizeof(int));
   
+  Block block;
+  Block_init(&block, feats);
+  
+  Trajectory path;
+  Trajectory_init(&path, feats);
+  
  // Set all memeber of the output to -1, to indicate that they are not yet assigned...
   int ei;
   for (ei=0; ei<exemplars; ei++) out[ei] = -1;
@@ -533,6 +1152,14 @@ void cluster(Spatial spatial, const Kernel * kernel, KernelConfig config, Balls
     
     while ((delta>epsilon)&&(iters<iter_cap))
     {
+     // If we have entered a cell that an earlier trajectory passed through we are going to the same ball...
+      if (basins!=NULL)
+      {
+       out[ei] = Basins_lookup(basins, fv);
+       if (out[ei]>=0) break;
+       Trajectory_add(&path, fv);
+      }
+      
      // Check if there is anyone going to the same destination as us - if so record them to be assigned to the same destination...
       if (ident_dist>1e-6)
       {
@@ -593,28 +1220,8 @@ void cluster(Spatial spatial, const Kernel * kernel, KernelConfig config, Balls
        if (out[ei]>=0) break;
       }
      
-     // Prepare the temporary for incrimental mean calculation...
-      float weight = 0.0;
-      for (i=0; i<feats; i++) temp[i] = 0.0;
-   
-     // Iterate all relevant samples, to calculate the mean...
-      Spatial_start(spatial, fv, range);
-      while (1)
-      {
-       int targ = Spatial_next(spatial);
-       if (targ<0) break;
-       
-       loc = DataMatrix_fv(dm, targ, &w);
-       
-       kernel->to_offset(feats, config, loc, fv);
-       w *= kernel->weight(feats, config, loc);
-     
-       if (w>1e-6)
-       {
-        weight += w;
-        for (i=0; i<feats; i++) temp[i] += w * (loc[i] - temp[i]) / weight;
-       }
-      }
+     // Calculate the mean of everything in range...
+      Block_mean(&block, spatial, kernel, config, fv, range, temp);
    
      // Copy into the fv, calculating delta as well...
       delta = kernel->offset(feats, config, fv, temp);
@@ -622,6 +1229,7 @@ void cluster(Spatial spatial, const Kernel * kernel, KernelConfig config, Balls
      // We just iterated...
       iters += 1; 
     }
+    count_convergence(spatial, iters, (delta>epsilon)&&(out[ei]<0), out[ei]>=0);
    
    // If it has not merged with an existing mode create a new one to assign it to...
     if (out[ei]<0)
@@ -649,6 +1257,9 @@ void cluster(Spatial spatial, const Kernel * kernel, KernelConfig config, Balls
       }
     }
     
+   // Record the path taken in the cache...
+    if (basins!=NULL) Trajectory_record(&path, basins, out[ei]);
+    
    // Go through and record its destination for all exemplars that are assumed to go to the same location...
     for (i=0; i<same_dest_count; i++)
     {
@@ -657,6 +1268,8 @@ void cluster(Spatial spatial, const Kernel * kernel, KernelConfig config, Balls
   }
   
  // Clean up...
+  Trajectory_deinit(&path);
+  Block_deinit(&block);
   free(same_dest);
   free(temp);
   free(fv);
@@ -664,21 +1277,269 @@ void cluster(Spatial spatial, const Kernel * kernel, KernelConfig config, Balls
 
 
 
-int assign_cluster(Spatial spatial, const Kernel * kernel, KernelConfig config, Balls balls, float * fv, float * temp, float quality, float epsilon, int iter_cap, int check_step)
+void ClusterGuess_init(ClusterGuess * this, int feats)
+{
+ this->ei = -1;
+ this->iters = 0;
+ this->stop = 0;
+ this->delta = 0.0;
+ Trajectory_init(&this->path, feats);
+ 
+ this->claims = 0;
+ this->claim_size = 0;
+ this->claim = NULL;
+}
+
+
+void ClusterGuess_deinit(ClusterGuess * this)
+{
+ free(this->claim);
+ Trajectory_deinit(&this->path);
+}
+
+
+// Adds an exemplar to the claims of a guess, unless it is already there...
+static void ClusterGuess_claim(ClusterGuess * this, int targ, int iter)
+{
+ int i;
+ for (i=0; i<this->claims; i++)
+ {
+  if (this->claim[i*2]==targ) return;
+ }
+ 
+ if (this->claims>=this->claim_size)
+ {
+  this->claim_size = (this->claim_size<16) ? 16 : (this->claim_size * 2);
+  this->claim = (int*)realloc(this->claim, this->claim_size * 2 * sizeof(int));
+ }
+ 
+ this->claim[this->claims*2] = targ;
+ this->claim[this->claims*2 + 1] = iter;
+ this->claims += 1;
+}
+
+
+// Returns the ball fv is within, checking every state of the kernel in turn as cluster does, or a negative number if there isn't one - fv is left moved on by the states that were checked, exactly as cluster leaves it...
+static int cluster_within(Balls balls, const Kernel * kernel, KernelConfig config, int feats, int states, float * fv)
+{
+ if (states>1)
+ {
+  int s;
+  for (s=0; s<states; s++)
+  {
+   int ret = Balls_within(balls, fv);
+   if (ret>=0) return ret;
+   kernel->next(feats, config, s, fv);
+  }
+  return -1;
+ }
+ else
+ {
+  return Balls_within(balls, fv);
+ }
+}
+
+
+
+void cluster_speculate(Spatial spatial, const Kernel * kernel, KernelConfig config, Balls balls, const int * out, ClusterGuess * guess, int ei, float * fv, float * temp, Block * block, float quality, float epsilon, int iter_cap, float ident_dist, int check_step, Basins * basins)
+{
+ // Extract some things that we need...
+  DataMatrix * dm = Spatial_dm(spatial);
+
+  int feats = DataMatrix_features(dm);
+  float range = spatial_range(spatial, kernel, config, quality);
+  int states = kernel->states(feats, config);
+
+ // Reset the guess, then skip exemplars that have already been assigned or have no weight, as cluster does...
+  guess->ei = -1;
+  guess->iters = 0;
+  guess->stop = 0;
+  guess->delta = 0.0;
+  guess->path.count = 0;
+  guess->claims = 0;
+  
+  if (out[ei]>=0) return;
+  
+  float w;
+  float * loc = DataMatrix_fv(dm, ei, &w);
+  if (w<1e-3) return;
+  
+  guess->ei = ei;
+
+  int i;
+  for (i=0; i<feats; i++) fv[i] = loc[i];
+
+ // Converge it, remembering every position, exactly as cluster does, except it can only stop early on what existed when it started...
+  float delta = 2.0 * epsilon;
+  int iters = 0;
+
+  while ((delta>epsilon)&&(iters<iter_cap))
+  {
+   Trajectory_add(&guess->path, fv);
+   
+   // Stop if we have entered a cell that an earlier trajectory passed through...
+    if ((basins!=NULL)&&(Basins_lookup(basins, fv)>=0))
+    {
+     guess->stop = 1;
+     break;
+    }
+   
+   // Remember anyone close enough to be going to the same destination as us...
+    if (ident_dist>1e-6)
+    {
+     Spatial_start(spatial, fv, ident_dist);
+     while (1)
+     {
+      int targ = Spatial_next(spatial);
+      if (targ<0) break;
+
+      loc = DataMatrix_fv(dm, targ, NULL);
+      float distSqr = 0.0;
+      for (i=0; i<feats; i++)
+      {
+       float delta = loc[i] - fv[i];
+       distSqr += delta*delta;
+      }
+
+      if (distSqr<=ident_dist*ident_dist)
+      {
+       ClusterGuess_claim(guess, targ, iters);
+      }
+     }
+    }
+
+   // Stop if we collided with a mode that already exists...
+    if ((iters%check_step)==0)
+    {
+     if (cluster_within(balls, kernel, config, feats, states, fv)>=0)
+     {
+      guess->stop = 1;
+      break;
+     }
+    }
+
+   // Calculate the mean of everything in range...
+    Block_mean(block, spatial, kernel, config, fv, range, temp);
+
+   // Copy into the fv, calculating delta as well...
+    delta = kernel->offset(feats, config, fv, temp);
+
+   // We just iterated...
+    iters += 1;
+  }
+  
+  if (guess->stop==0) Trajectory_add(&guess->path, fv);
+  guess->iters = iters;
+  guess->delta = delta;
+}
+
+
+
+void cluster_commit(Spatial spatial, const Kernel * kernel, KernelConfig config, Balls balls, int * out, ClusterGuess * guess, float * fv, float epsilon, float merge_range, int check_step, Basins * basins)
+{
+ // Skipped, or assigned by an earlier commit, in which case cluster would have skipped it too...
+  int ei = guess->ei;
+  if ((ei<0)||(out[ei]>=0)) return;
+  
+  int feats = Balls_dims(balls);
+  int states = kernel->states(feats, config);
+  
+ // Replay the trajectory against the balls and basins as they are now, to find the iteration cluster would have stopped on - claims count up to and including it, as does the position for recording in the basins, unless it was a basin that stopped it, as cluster checks the basins first...
+  int hit = -1;
+  int claim_limit = guess->iters;
+  int record = guess->iters;
+  
+  int t, i;
+  for (t=0; t<guess->iters+guess->stop; t++)
+  {
+   const float * pos = guess->path.pos + t * feats;
+   
+   if (basins!=NULL)
+   {
+    hit = Basins_lookup(basins, pos);
+    if (hit>=0)
+    {
+     claim_limit = t - 1;
+     record = t;
+     break;
+    }
+   }
+   
+   if ((t%check_step)==0)
+   {
+    for (i=0; i<feats; i++) fv[i] = pos[i];
+    hit = cluster_within(balls, kernel, config, feats, states, fv);
+    if (hit>=0)
+    {
+     claim_limit = t;
+     record = t + 1;
+     break;
+    }
+   }
+  }
+  
+ // If it did not stop early check the final position, creating a new ball if needed...
+  if (hit>=0)
+  {
+   count_convergence(spatial, t, 0, 1);
+  }
+  else
+  {
+   count_convergence(spatial, guess->iters, guess->delta>epsilon, 0);
+   
+   const float * pos = guess->path.pos + guess->iters * feats;
+   for (i=0; i<feats; i++) fv[i] = pos[i];
+   
+   hit = cluster_within(balls, kernel, config, feats, states, fv);
+   if (hit<0) hit = Balls_create(balls, fv, merge_range);
+  }
+  
+ // Record the result, the path taken in the cache, and the destination of everyone it claimed that has not gone somewhere already...
+  out[ei] = hit;
+  
+  if (basins!=NULL)
+  {
+   guess->path.count = record;
+   Trajectory_record(&guess->path, basins, hit);
+  }
+  
+  for (i=0; i<guess->claims; i++)
+  {
+   int targ = guess->claim[i*2];
+   if ((guess->claim[i*2 + 1]<=claim_limit)&&(out[targ]<0)) out[targ] = hit;
+  }
+}
+
+
+
+int assign_cluster(Spatial spatial, const Kernel * kernel, KernelConfig config, Balls balls, float * fv, float * temp, Block * block, float quality, float epsilon, int iter_cap, int check_step, Basins * basins)
 {
  // Extract some things that we need... 
   DataMatrix * dm = Spatial_dm(spatial);
   
   int feats = DataMatrix_features(dm);
-  float range = kernel->range(feats, config, quality);
+  float range = spatial_range(spatial, kernel, config, quality);
   int states = kernel->states(feats, config);
 
+  Trajectory path;
+  Trajectory_init(&path, feats);
+
  // Converge the feature vector, regularly checking if its bumped into a ball...
   float delta = 2.0 * epsilon;
   int iters = 0;
+  
+  int ret = -1; // Output
     
   while ((delta>epsilon)&&(iters<iter_cap))
   {
+   // If we have entered a cell that an earlier trajectory passed through we are going to the same place...
+    if (basins!=NULL)
+    {
+     ret = Basins_lookup(basins, fv);
+     if (ret>=0) break;
+     Trajectory_add(&path, fv);
+    }
+
    // Check if we collided with a mode that already exists...
     if ((iters%check_step)==0)
     {
@@ -687,42 +1548,21 @@ int assign_cluster(Spatial spatial, const Kernel * kernel, KernelConfig config,
       int s;
       for (s=0; s<states; s++)
       {
-       int ret = Balls_within(balls, fv);
-       if (ret>=0) return ret;
+       ret = Balls_within(balls, fv);
+       if (ret>=0) break;
        kernel->next(feats, config, s, fv);
       }
      }
      else
      {
-      int ret = Balls_within(balls, fv);
-      if (ret>=0) return ret;
+      ret = Balls_within(balls, fv);
      }
-    }
      
-   // Prepare the temporary for incrimental mean calculation...
-    float weight = 0.0;
-    int i;
-    for (i=0; i<feats; i++) temp[i] = 0.0;
-   
-   // Iterate all relevant samples, to calculate the mean...
-    Spatial_start(spatial, fv, range);
-    while (1)
-    {
-     int targ = Spatial_next(spatial);
-     if (targ<0) break;
-     
-     float w;
-     float * loc = DataMatrix_fv(dm, targ, &w);
-
-     kernel->to_offset(feats, config, loc, fv);
-     w *= kernel->weight(feats, config, loc);
-     
-     if (w>1e-6)
-     {
-      weight += w;
-      for (i=0; i<feats; i++) temp[i] += w * (loc[i] - temp[i]) / weight;
-     }
+     if (ret>=0) break;
     }
+     
+   // Calculate the mean of everything in range...
+    Block_mean(block, spatial, kernel, config, fv, range, temp);
    
    // Copy into the fv, calculating delta as well...
     delta = kernel->offset(feats, config, fv, temp);
@@ -730,22 +1570,32 @@ int assign_cluster(Spatial spatial, const Kernel * kernel, KernelConfig config,
    // We just iterated...
     iters += 1; 
   }
+  count_convergence(spatial, iters, (delta>epsilon)&&(ret<0), ret>=0);
   
- if (states>1)
- {
-  int s;
-  for (s=0; s<states; s++)
+ // If it did not bump into a ball while converging check where it ended up...
+  if (ret<0)
   {
-   int ret = Balls_within(balls, fv);
-   if (ret>=0) return ret;
-   kernel->next(feats, config, s, fv);
+   if (states>1)
+   {
+    int s;
+    for (s=0; s<states; s++)
+    {
+     ret = Balls_within(balls, fv);
+     if (ret>=0) break;
+     kernel->next(feats, config, s, fv);
+    }
+   }
+   else
+   {
+    ret = Balls_within(balls, fv);
+   }
   }
-  return -1;
- }
- else
- {
-  return Balls_within(balls, fv);
- }
+
+ // Record the path taken in the cache...
+  if (basins!=NULL) Trajectory_record(&path, basins, ret);
+
+ Trajectory_deinit(&path);
+ return ret;
 }
 
 
@@ -758,7 +1608,7 @@ void manifold(Spatial spatial, int degrees, float * fv, float * grad, float * he
   DataMatrix * dm = Spatial_dm(spatial);
   
   int feats = DataMatrix_features(dm);
-  float range = Gaussian.range(feats, NULL, quality);
+  float range = spatial_range(spatial, &Gaussian, NULL, quality);
   float norm = Gaussian.norm(feats, NULL);
   
  // Converge the feature vector, one step at a time...
@@ -778,7 +1628,8 @@ void manifold(Spatial spatial, int degrees, float * fv, float * grad, float * he
       for (i=0; i<feats*feats; i++) hess[i] = 0.0;
      }
      
-    // Loop all relevant exemplars in the dataset...
+    // Loop all relevant exemplars in the dataset (The eigen_val vector is free until the hessian is decomposed, so it holds the offset)...
+     float * loc = eigen_val;
      Spatial_start(spatial, fv, range);
      while (1)
      {
@@ -786,10 +1637,11 @@ void manifold(Spatial spatial, int degrees, float * fv, float * grad, float * he
       if (targ<0) break;
       
       float w;
-      float * loc = DataMatrix_fv(dm, targ, &w);
+      const float * ex = DataMatrix_fv(dm, targ, &w);
       
-      for (i=0; i<feats; i++) loc[i] -= fv[i];
+      for (i=0; i<feats; i++) loc[i] = ex[i] - fv[i];
       w *= norm * Gaussian.weight(feats, NULL, loc);
+      COUNT(Spatial_counters(spatial), kernel_evals, 1);
      
       if (w>1e-6)
       {
@@ -857,6 +1709,7 @@ void manifold(Spatial spatial, int degrees, float * fv, float * grad, float * he
    // To the next iteration...
     iters += 1;
   }
+  count_convergence(spatial, iters, delta>epsilon, 0);
 }
 
 
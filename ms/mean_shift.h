@@ -14,6 +14,7 @@
 #include "kernels.h"
 #include "spatial.h"
 #include "balls.h"
+#include "basins.h"
 
 
 
@@ -29,20 +30,53 @@ float calc_norm(DataMatrix * dm, const Kernel * kernel, KernelConfig config, flo
 
 
 
-// This calculates the probability of a given feature vector, as defined by the kernel density estimate defined by the provided spatial and kernel (with an associated alpha). You also provide the normalising multiplier, as that can be cached to save repeated calculation, and quality to define the search range around the kernel. The norm parameter must be the kernel normalising constant divided by the weight of the samples and factoring in the scale change - as calc_norm does. Note that this is strange as it expects fv in scaled space and then outputs a probability in unscaled space!..
-float prob(Spatial spatial, const Kernel * kernel, KernelConfig config, const float * fv, float norm, float quality);
+// Returns the range to pass to Spatial_start for the given kernel - if the spatial supports images it is told about the states of the kernel (see KernelStates) and the range around the nearest is returned, which is much tighter for kernels with symmetries, such as MirrorFisher. Must be called before searching the spatial with a kernel, as it replaces whatever kernel the spatial was previously told about. All of the below functions do this...
+float spatial_range(Spatial spatial, const Kernel * kernel, KernelConfig config, float quality);
+
+
+
+// Scratch space for evaluating the kernel on blocks of exemplars, as used by prob, mode, mode_merge, cluster_speculate and assign_cluster - create one per thread, with the number of features in the data matrix (internal), and pass it to every call, so they don't allocate it for every query. Can be reused with any spatial that has the same number of features...
+typedef struct Block Block;
+
+Block * Block_new(int feats);
+void Block_delete(Block * this);
+
+
+
+// This calculates the probability of a given feature vector, as defined by the kernel density estimate defined by the provided spatial and kernel (with an associated alpha). You also provide a Block, for scratch space, and the normalising multiplier, as that can be cached to save repeated calculation, and quality to define the search range around the kernel. The norm parameter must be the kernel normalising constant divided by the weight of the samples and factoring in the scale change - as calc_norm does. Note that this is strange as it expects fv in scaled space and then outputs a probability in unscaled space!..
+float prob(Spatial spatial, const Kernel * kernel, KernelConfig config, const float * fv, Block * block, float norm, float quality);
+
+
+
+// Returns non-zero if the kernel only depends on the distance from its centre, and never increases with it - this is what the dual tree evaluation requires...
+int radial_kernel(const Kernel * kernel);
+
+// Dual tree version of prob, for when you have a lot of feature vectors to evaluate - they are provided as a second spatial, which must be a kd tree of feature vectors in the same internal (converted and scaled) space as the data. The probability of each is written into out, indexed by exemplar. Pairs of nodes are approximated when the kernel values at their minimum and maximum separation are close enough, such that each output is within abs_tol + rel_tol * its true value. The true value is that calculated by prob - the same exemplars are included, those in any leaf of the kd tree whose bounding box overlaps the box around the query, so the two agree to within the tolerances. Requires a radial kernel and a kd tree for spatial - if these are not available it falls back to calling prob for each query...
+void probs_dual(Spatial spatial, const Kernel * kernel, KernelConfig config, Spatial query, float * out, float norm, float quality, float abs_tol, float rel_tol);
 
 
 
 // This draws a sample from the distribution - you provide the usual indexing structure, which contains the data matrix, the kernel to use and an index into the philox rng, which it then uses to deterministically draw into out. out must be long enough to store the # of dimensions within the data matrix...
 void draw(DataMatrix * dm, const Kernel * kernel, KernelConfig config, PhiloxRNG * rng, float * out);
 
+// Bulk version of the above - makes count draws, writing them into out, which is count x # of dimensions. If index is not NULL the index of the exemplar each draw is centred on is written into it. Draws the exemplar indices in one pass before drawing from the kernel, so the rng is used in a different order to repeated calls to draw...
+void draws(DataMatrix * dm, const Kernel * kernel, KernelConfig config, PhiloxRNG * rng, int count, int * index, float * out);
+
 
 
 // Calculates the log probability of all the items in the data set, leave one out style - allows for model comparison so you can optimise any of the parameters, such as scale or kernel type. Parameters match up with the prob function, except it gets the feature vectors from spatial and returns a negative log probability. It includes three extra parameters - a minimum probability to assign to any given exemplar, to limit the damage of outliers, and a sample clamp - if less than the exemplar count it will randomly select this many (with repetition) and return that instead. In this case the provided rng is needed...
 // (Note that it does not correctly adjust the total weight for each exemplar probability calculation, which technically can bias things a bit if they all have different weights, but not really enough to worry about, and it would prevent the use of the norm optimisation.)
 float loo_nll(Spatial spatial, const Kernel * kernel, KernelConfig config, float norm, float quality, float limit, int sample_clamp, PhiloxRNG * rng);
 
+// Progress reporting for the slower functions - called regularly with how much work has been done out of the total, with data passed through untouched. Can be NULL...
+typedef void (*Progress)(void * data, int done, int total);
+
+// Multi-bandwidth version of loo_nll, that evaluates it for many scales in a single pass - the neighbours of each exemplar are gathered once, at the range of the widest candidate, and the kernel evaluated for every candidate. ratio is a candidates x features array, the scale of each candidate divided by the current scale of the data matrix (which the spatial has been built with), and the loo_nll of each candidate is written into out. norm is for the current scale. progress, if not NULL, is called with progress_data before each exemplar is processed. Only makes sense for kernels where the scale is an inverse bandwidth - not the directional kernels...
+void loo_nll_multi(Spatial spatial, const Kernel * kernel, KernelConfig config, float norm, float quality, float limit, int sample_clamp, PhiloxRNG * rng, int candidates, const float * ratio, float * out, Progress progress, void * progress_data);
+
+// Searches for the scale that minimises loo_nll, along the path low * (high/low)^t for t in [0, 1], where low and high are scale ratios, as for loo_nll_multi. Each pass evaluates candidates evenly spaced points across the current bracket with a single call to loo_nll_multi, then shrinks the bracket to the neighbours of the best point - a parallel version of golden section search, that needs passes traversals rather than one per evaluation. Every pass uses the same rng draws, so they are comparable. Writes the ratio of the best scale found into best and returns its loo_nll. progress is as for loo_nll_multi, with the total covering every pass...
+float loo_nll_search(Spatial spatial, const Kernel * kernel, KernelConfig config, float norm, float quality, float limit, int sample_clamp, PhiloxRNG * rng, const float * low, const float * high, int candidates, int passes, float * best, Progress progress, void * progress_data);
+
 
 
 // Calculates and returns an approximation of the entropy of the distribution, using the samples that the datamatrix contains as a sample from the distribution so its super efficient to calculate. Has the same sample_clamp/rng idea as loo_nll...
@@ -54,20 +88,42 @@ float kl_divergence(Spatial spatial_p, const Kernel * kernel_p, KernelConfig con
 
 
 
-// Given a kernel (with an alpha parameter), spatial indexing data structure and a feature vector this updates that feature vector to be its mean shift converged point. A temporary vector of the same length as the feature must also be provided. The quality parameter goes from 0 to 1, and maps to the low and high spatial ranges provided by the kernel. There is also an epsilon parameter - it stops when movement drops below it, typically something like 1e-3 is good. The iteration cap ensures that no infinite loops cna occur if epsilon is too low. If the spatial has an ignore entry in the feature vector it uses that as a weight (Will call the get method of spatial.)...
-void mode(Spatial spatial, const Kernel * kernel, KernelConfig config, float * fv, float * temp, float quality, float epsilon, int iter_cap);
+// Given a kernel (with an alpha parameter), spatial indexing data structure and a feature vector this updates that feature vector to be its mean shift converged point. A temporary vector of the same length as the feature must also be provided, plus a Block. The quality parameter goes from 0 to 1, and maps to the low and high spatial ranges provided by the kernel. There is also an epsilon parameter - it stops when movement drops below it, typically something like 1e-3 is good. The iteration cap ensures that no infinite loops cna occur if epsilon is too low. If the spatial has an ignore entry in the feature vector it uses that as a weight (Will call the get method of spatial.) basins is an optional (NULL to not use) cache of where earlier trajectories went, using stored positions as the values - if the trajectory enters a cell another has passed through it jumps straight to that mode, and once done it records the cells it passed through. The cache must be cleared if anything that changes the density estimate changes...
+void mode(Spatial spatial, const Kernel * kernel, KernelConfig config, float * fv, float * temp, Block * block, float quality, float epsilon, int iter_cap, Basins * basins);
 
 
 // Like mode, except its trying to find the relevant cluster in a provided Balls object to merge with, noting that if it doesn't do so it will create a new ball. Returns the index of the ball it reaches. Parameters match up with those for mode and cluster - this really is a half-way house between them (though no path shortening), for when you want to cluster data using a different set of exemplars to define the desnity estimate...
-int mode_merge(Spatial spatial, const Kernel * kernel, KernelConfig config, Balls balls, float * fv, float * temp, float quality, float epsilon, int iter_cap, float merge_range, int check_step);
+int mode_merge(Spatial spatial, const Kernel * kernel, KernelConfig config, Balls balls, float * fv, float * temp, Block * block, float quality, float epsilon, int iter_cap, float merge_range, int check_step);
+
+// Given a Spatial, a Kernel (with its alpha parameter) and an (empty) Balls this assigns modes to every single point in the data matrix contained within the Spatial - after running the Balls object contains the modes, and the output array, aligned with the exemplar index of the data matrix, contains the indices of the modes for each data point (check_step is how many iterations to do between checking if its intersected a hyper-sphere that indicates convergance - exists because that check is much slower than doing a bunch of iterations.) basins is an optional (NULL to not use) cache of where trajectories went, as for assign_cluster, filled with the indices of the balls - it must have been emptied when balls was, and can then be handed on to assign_cluster. Note that if spatial has an ignored vector then the same vector must be ignored by balls...
+void cluster(Spatial spatial, const Kernel * kernel, KernelConfig config, Balls balls, int * out, float quality, float epsilon, int iter_cap, float ident_dist, float merge_range, int check_step, Basins * basins);
+
+// Thread safe pieces of cluster, so it can be run in parallel whilst giving exactly the same result, whatever the number of threads. The exemplars are done in runs, in order: first many threads call cluster_speculate, one per exemplar of the run, each with its own ClusterGuess - this converges the exemplar (unless out says it is already assigned or it has no weight) whilst only reading balls, basins and out, remembering every position visited and every exemplar within ident_dist of each. Then a single thread calls cluster_commit on every guess of the run, in exemplar order - this replays the remembered trajectory against balls and basins as they are now, including everything committed since, to find exactly where cluster would have stopped, then creates a ball, writes out and records basins as cluster would. Stopping early only ever happens on something that still exists at commit time, so the replay never needs positions beyond those remembered...
+typedef struct ClusterGuess ClusterGuess;
+
+struct ClusterGuess
+{
+ int ei; // Exemplar, negative if it was skipped.
+ int iters; // Iterations done - the trajectory has one more position than this.
+ int stop; // Non-zero if it stopped early, on the last position of the trajectory, rather than converging or hitting the iteration cap.
+ float delta; // Final change, for deciding if it hit the iteration cap.
+ Trajectory path; // Position at the start of each iteration, plus the final position.
+ 
+ int claims; // Exemplars within ident_dist of the trajectory, as pairs of (exemplar, first iteration it was within range), so the ones cluster would have assigned can be applied.
+ int claim_size;
+ int * claim;
+};
+
+void ClusterGuess_init(ClusterGuess * this, int feats);
+void ClusterGuess_deinit(ClusterGuess * this);
 
-// Given a Spatial, a Kernel (with its alpha parameter) and an (empty) Balls this assigns modes to every single point in the data matrix contained within the Spatial - after running the Balls object contains the modes, and the output array, aligned with the exemplar index of the data matrix, contains the indices of the modes for each data point (check_step is how many iterations to do between checking if its intersected a hyper-sphere that indicates convergance - exists because that check is much slower than doing a bunch of iterations.) Note that if spatial has an ignored vector then the same vector must be ignored by balls...
-void cluster(Spatial spatial, const Kernel * kernel, KernelConfig config, Balls balls, int * out, float quality, float epsilon, int iter_cap, float ident_dist, float merge_range, int check_step);
+void cluster_speculate(Spatial spatial, const Kernel * kernel, KernelConfig config, Balls balls, const int * out, ClusterGuess * guess, int ei, float * fv, float * temp, Block * block, float quality, float epsilon, int iter_cap, float ident_dist, int check_step, Basins * basins);
+void cluster_commit(Spatial spatial, const Kernel * kernel, KernelConfig config, Balls balls, int * out, ClusterGuess * guess, float * fv, float epsilon, float merge_range, int check_step, Basins * basins);
 
 
 
-// Given that a clustering has occured this takes a feature vector and calculates to which cluster it belongs, or returns -1 if its does not belong to any of them...
-int assign_cluster(Spatial spatial, const Kernel * kernel, KernelConfig config, Balls balls, float * fv, float * temp, float quality, float epsilon, int iter_cap, int check_step);
+// Given that a clustering has occured this takes a feature vector and calculates to which cluster it belongs, or returns -1 if its does not belong to any of them. basins is an optional cache, as for mode but with ball indices as the values, so it must also be cleared if the balls change...
+int assign_cluster(Spatial spatial, const Kernel * kernel, KernelConfig config, Balls balls, float * fv, float * temp, Block * block, float quality, float epsilon, int iter_cap, int check_step, Basins * basins);
 
 
 
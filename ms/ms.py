@@ -13,7 +13,7 @@ try:
   from utils.make import make_mod
   import os.path
 
-  make_mod('ms_c', os.path.dirname(__file__), ['philox.h', 'philox.c', 'bessel.h', 'bessel.c', 'eigen.h', 'eigen.c', 'mult.h', 'mult.c', 'kernels.h', 'kernels.c', 'convert.h', 'convert.c', 'data_matrix.h', 'data_matrix.c', 'spatial.h', 'spatial.c', 'balls.h', 'balls.c', 'mean_shift.h', 'mean_shift.c', 'ms_c.h', 'ms_c.c'], numpy=True)
+  make_mod('ms_c', os.path.dirname(__file__), ['philox.h', 'philox.c', 'bessel.h', 'bessel.c', 'fisher_cache.h', 'fisher_cache.c', 'eigen.h', 'eigen.c', 'mult.h', 'mult.c', 'simd.h', 'simd.c', 'kernels.h', 'kernels.c', 'convert.h', 'convert.c', 'data_matrix.h', 'data_matrix.c', 'spatial.h', 'spatial.c', 'balls.h', 'balls.c', 'basins.h', 'basins.c', 'mean_shift.h', 'mean_shift.c', 'grid.h', 'grid.c', 'coreset.h', 'coreset.c', 'ms_c.h', 'ms_c.c'], numpy=True)
 except: pass
 
 
@@ -39,7 +39,7 @@ class MeanShift(MeanShiftC):
     
     
   def scale_loo_nll(self, low = 0.01, high = 2.0, steps = 64, callback = None, prob_limit = 1e-6, sample_limit = None):
-    """Does a sweep of the scale, from low to high, on a logarithmic scale with the given number of steps. Sets the scale to the one with the lowest loo_nll score. If low/high are provided as multipliers then these are multipliers of the silverman scale; otherwise they can by arbitrary vectors. After the main parameters there is callback, for reporting progress, prob_limit and sample_limit, which are passed though to loo_nll and control outlier robustness and a sub-sampling speed optimisation respectivly."""
+    """Does a sweep of the scale, from low to high, on a logarithmic scale with the given number of steps. Sets the scale to the one with the lowest loo_nll score. If low/high are provided as multipliers then these are multipliers of the silverman scale; otherwise they can by arbitrary vectors. After the main parameters there is callback, for reporting progress - called as callback(step, steps) for each step in turn as the single pass over the data progresses - then prob_limit and sample_limit, which are passed though to loo_nll and control outlier robustness and a sub-sampling speed optimisation respectivly."""
     
     # Select values for low and high as needed...
     if isinstance(low, float) or isinstance(high, float):
@@ -54,31 +54,45 @@ class MeanShift(MeanShiftC):
       if isinstance(high, float):
         high = silverman * high
 
-    # Iterate, recording the scale with the best score thus far...
+    # Evaluate every scale in a single pass, with the index built at the smallest scale (widest kernel), so it covers all of them...
     if steps<2: steps = 2
     
     log_low = numpy.log(low)
     log_step = (numpy.log(high) - log_low) / (steps-1)
     
-    best_score = None
-    best_scale = None
+    scales = numpy.exp(log_low[numpy.newaxis,:] + numpy.arange(steps)[:,numpy.newaxis] * log_step[numpy.newaxis,:])
     
-    for i in xrange(steps):
-      if callback!=None:
-        callback(i, steps)
-
-      scale = numpy.exp(log_low + i*log_step)
+    self.set_scale(numpy.minimum(low, high))
+    scores = self.loo_nll_scales(scales, prob_limit, sample_limit if isinstance(sample_limit, int) else -1, callback)
+    
+    # Set it to the best...
+    best = numpy.argmin(scores)
+    self.set_scale(scales[best,:])
+    return scores[best]
+  
+  
+  def scale_loo_nll_search(self, low = 0.01, high = 2.0, candidates = 16, passes = 3, prob_limit = 1e-6, sample_limit = None, callback = None):
+    """Same as scale_loo_nll, including the behaviour for low and high, except it searches for the best scale rather than doing a sweep - each pass evaluates candidates scales, evenly spaced on a logarithmic scale across the current bracket, then narrows the bracket to the neighbours of the best. All of the work is done in C, one pass over the data per pass of the search. The optional callback reports progress, as callback(step, candidates * passes) for each step in turn. Sets the scale to the best found and returns its loo_nll score."""
+    
+    # Select values for low and high as needed...
+    if isinstance(low, float) or isinstance(high, float):
+      _, silverman = self.stats()
+      silverman = silverman * (self.weight() * (silverman.shape[0] + 2.0) / 4.0) ** (-1.0 / (silverman.shape[0] + 4.0))
+      silverman[silverman<1e-6] = 1e-6
+      silverman = 1.0 / silverman
       
-      self.set_scale(scale)
-      score = self.loo_nll(prob_limit, sample_limit if isinstance(sample_limit, int) else -1)
+      if isinstance(low, float):
+        low = silverman * low
       
-      if best_score==None or score < best_score:
-        best_score = score
-        best_scale = scale
+      if isinstance(high, float):
+        high = silverman * high
     
-    # Set it to the best...
-    self.set_scale(best_scale)
-    return best_score
+    # Do the search, with the index built at the smallest scale...
+    self.set_scale(numpy.minimum(low, high))
+    scale, score = self.loo_nll_search(low, high, candidates, passes, prob_limit, sample_limit if isinstance(sample_limit, int) else -1, callback)
+    
+    self.set_scale(scale)
+    return score
   
   
   def scale_loo_nll_array(self, choices, callback = None, prob_limit = 1e-6, sample_limit = None):
@@ -10,7 +10,13 @@
 
 #include "ms_c.h"
 
+#include <stdio.h>
 #include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
 
 
 
@@ -46,14 +52,34 @@ void MeanShift_new(MeanShift * this)
  
  this->fv_int = NULL;
  this->fv_ext = NULL;
+ 
+ this->materialise = 0;
+ 
+ this->buffer = NULL;
+ this->buffer_start = 0;
+ this->window = 0;
+ 
+ this->cache_step = 0.0;
+ this->generation = 0;
+ this->mode_cache = NULL;
+ this->cluster_cache = NULL;
+ 
+ this->grid_step = 0.0;
+ this->grid = NULL;
+ 
+ Counters_zero(&this->counters);
 }
 
 void MeanShift_dealloc(MeanShift * this)
 {
  Py_XDECREF(this->rng_link);
  DataMatrix_deinit(&this->dm);
+ Py_XDECREF(this->buffer);
  if (this->spatial!=NULL) Spatial_delete(this->spatial);
  if (this->balls!=NULL) Balls_delete(this->balls);
+ if (this->mode_cache!=NULL) Basins_delete(this->mode_cache);
+ if (this->cluster_cache!=NULL) Basins_delete(this->cluster_cache);
+ if (this->grid!=NULL) Grid_delete(this->grid);
  this->kernel->config_release(this->config);
  
  free(this->fv_int);
@@ -150,6 +176,7 @@ static PyObject * MeanShift_set_kernel_py(MeanShift * self, PyObject * args)
     self->kernel = ListKernel[i];
     self->config = self->kernel->config_new(dims, kname+klength);
     self->norm = -1.0;
+    self->generation += 1;
     
     if (self->name!=NULL)
     {
@@ -201,6 +228,8 @@ static PyObject * MeanShift_copy_kernel_py(MeanShift * self, PyObject * args)
    self->name = other->name;
    Py_INCREF(self->name);
   }
+  
+  self->generation += 1;
  
  // Return None...
   Py_INCREF(Py_None);
@@ -277,6 +306,7 @@ static PyObject * MeanShift_set_spatial_py(MeanShift * self, PyObject * args)
     
     if (self->spatial!=NULL)
     {
+     Counters_add(&self->counters, Spatial_counters(self->spatial));
      Spatial_delete(self->spatial);
      self->spatial = NULL; 
     }
@@ -316,6 +346,12 @@ static PyObject * MeanShift_balls_py(MeanShift * self, PyObject * args)
 }
 
 
+static PyObject * MeanShift_fisher_cache_py(MeanShift * self, PyObject * args)
+{
+ return FisherCache_report();
+}
+
+
 static PyObject * MeanShift_get_balls_py(MeanShift * self, PyObject * args)
 {
  return Py_BuildValue("s", self->balls_type->name);
@@ -342,6 +378,7 @@ static PyObject * MeanShift_set_balls_py(MeanShift * self, PyObject * args)
       Balls_delete(self->balls);
       self->balls = NULL;
      }
+     self->generation += 1;
   
     Py_INCREF(Py_None);
     return Py_None;
@@ -455,9 +492,11 @@ static PyObject * MeanShift_copy_all_py(MeanShift * self, PyObject * args)
   
   self->weight = -1.0;
   self->norm = -1.0;
+  self->generation += 1;
   
   if (self->spatial!=NULL)
   {
+   Counters_add(&self->counters, Spatial_counters(self->spatial));
    Spatial_delete(self->spatial);
    self->spatial = NULL;
   }
@@ -491,6 +530,14 @@ static PyObject * MeanShift_copy_all_py(MeanShift * self, PyObject * args)
   self->merge_range = other->merge_range;
   self->merge_check_step = other->merge_check_step;
   
+  self->window = other->window;
+  
+  if (self->materialise!=other->materialise)
+  {
+   self->materialise = other->materialise;
+   DataMatrix_materialise(&self->dm, self->materialise);
+  }
+  
  // Return None...
   Py_INCREF(Py_None);
   return Py_None;
@@ -502,9 +549,13 @@ static PyObject * MeanShift_reset_py(MeanShift * self, PyObject * args)
  // Trash everything dependent on the contents of the data matrix...
   self->weight = -1.0;
   self->norm = -1.0;
+  self->generation += 1;
+  
+  if (self->materialise!=0) DataMatrix_materialise(&self->dm, self->materialise);
   
   if (self->spatial!=NULL)
   {
+   Counters_add(&self->counters, Spatial_counters(self->spatial));
    Spatial_delete(self->spatial);
    self->spatial = NULL;
   }
@@ -685,13 +736,21 @@ static PyObject * MeanShift_set_data_py(MeanShift * self, PyObject * args)
   DataMatrix_set(&self->dm, data, dt, weight_i, conv_codes);
   free(dt);
   
+  if (self->materialise!=0) DataMatrix_materialise(&self->dm, self->materialise);
+  
  // Setup the temporaries kept with the mean shift object...
   self->fv_int = (float*)realloc(self->fv_int, DataMatrix_features(&self->dm) * sizeof(float));
   self->fv_ext = (float*)realloc(self->fv_ext, DataMatrix_ext_features(&self->dm) * sizeof(float));
   
+ // Any streaming buffer is no longer relevant...
+  Py_XDECREF(self->buffer);
+  self->buffer = NULL;
+  self->buffer_start = 0;
+  
  // Trash the spatial...
   if (self->spatial!=NULL)
   {
+   Counters_add(&self->counters, Spatial_counters(self->spatial));
    Spatial_delete(self->spatial);
    self->spatial = NULL; 
   }
@@ -706,6 +765,7 @@ static PyObject * MeanShift_set_data_py(MeanShift * self, PyObject * args)
  // Trash the weight record...
   self->weight = -1.0;
   self->norm = -1.0;
+  self->generation += 1;
  
  // Return None...
   Py_INCREF(Py_None);
@@ -713,156 +773,238 @@ static PyObject * MeanShift_set_data_py(MeanShift * self, PyObject * args)
 }
 
 
-static PyObject * MeanShift_get_dm_py(MeanShift * self, PyObject * args)
+// Names of the materialisation formats, indexed by MatType...
+static const char * mat_type_name[] = {NULL, "float32", "float16", "uint16", "uint8"};
+
+
+static PyObject * MeanShift_set_materialise_py(MeanShift * self, PyObject * args)
 {
- if (self->dm.array!=NULL) // Verify that there is a data matrix to in fact return!
- {
-  Py_INCREF((PyObject*)self->dm.array);
-  return (PyObject*)self->dm.array;
- }
- else
- {
+ // Get the parameter - a boolean, or the name of a format...
+  PyObject * state;
+  if (!PyArg_ParseTuple(args, "O", &state)) return NULL;
+  
+  int mat_type = MAT_NONE;
+  if (PyString_Check(state))
+  {
+   const char * name = PyString_AsString(state);
+   for (mat_type=MAT_FLOAT32; mat_type<=MAT_UINT8; mat_type++)
+   {
+    if (strcmp(name, mat_type_name[mat_type])==0) break;
+   }
+   
+   if (mat_type>MAT_UINT8)
+   {
+    PyErr_SetString(PyExc_KeyError, "Unrecognised materialisation format - must be one of float32, float16, uint16 or uint8");
+    return NULL;
+   }
+  }
+  else
+  {
+   mat_type = PyObject_IsTrue(state) ? MAT_FLOAT32 : MAT_NONE;
+  }
+  
+ // Record it and apply to the data matrix - note that this has no effect on anything but speed and memory consumption, plus accuracy for the compact formats...
+  int previous = self->materialise;
+  self->materialise = mat_type;
+  DataMatrix_materialise(&self->dm, self->materialise);
+  
+ // The compact formats change the values the kernels see, so if switching to or from one everything dependent on them has to go...
+  if ((previous!=mat_type)&&((previous>MAT_FLOAT32)||(mat_type>MAT_FLOAT32)))
+  {
+   self->weight = -1.0;
+   self->norm = -1.0;
+   self->generation += 1;
+   
+   if (self->spatial!=NULL)
+   {
+    Counters_add(&self->counters, Spatial_counters(self->spatial));
+    Spatial_delete(self->spatial);
+    self->spatial = NULL;
+   }
+  }
+  
+ // Return None...
   Py_INCREF(Py_None);
   return Py_None;
- }
 }
 
 
-static PyObject * MeanShift_get_dim_py(MeanShift * self, PyObject * args)
+static PyObject * MeanShift_get_materialise_py(MeanShift * self, PyObject * args)
 {
- PyObject * ret = PyString_FromStringAndSize(NULL, PyArray_NDIM(self->dm.array));
- char * out = PyString_AsString(ret);
- 
- int i;
- for (i=0;i<PyArray_NDIM(self->dm.array);i++)
- {
-  switch (self->dm.dt[i])
-  {
-   case DIM_DATA:    out[i] = 'd'; break;
-   case DIM_FEATURE: out[i] = 'f'; break;
-   case DIM_DUAL:    out[i] = 'b'; break;
-   default: out[i] = 'e'; break; // Should never happen, obviously.
-  }
- }
-  
- return ret;
+ if (self->materialise!=0) {Py_INCREF(Py_True); return Py_True;}
+                      else {Py_INCREF(Py_False); return Py_False;}
 }
 
 
-static PyObject * MeanShift_get_weight_dim_py(MeanShift * self, PyObject * args)
+static PyObject * MeanShift_get_materialise_format_py(MeanShift * self, PyObject * args)
 {
- if (self->dm.weight_index>=0)
- {
-  return Py_BuildValue("f", self->dm.weight_index);
- }
- else
- {
+ if (self->materialise==MAT_NONE) {Py_INCREF(Py_None); return Py_None;}
+ return PyString_FromString(mat_type_name[self->materialise]);
+}
+
+
+
+static PyObject * MeanShift_set_window_py(MeanShift * self, PyObject * args)
+{
+ // Get the parameter...
+  int window;
+  if (!PyArg_ParseTuple(args, "i", &window)) return NULL;
+  
+  if (window<0) window = 0;
+  self->window = window;
+  
+ // Return None...
   Py_INCREF(Py_None);
   return Py_None;
- }
 }
 
 
+static PyObject * MeanShift_get_window_py(MeanShift * self, PyObject * args)
+{
+ return Py_BuildValue("i", self->window);
+}
+
 
-static PyObject * MeanShift_fetch_dm_py(MeanShift * self, PyObject * args)
+static PyObject * MeanShift_append_py(MeanShift * self, PyObject * args)
 {
- // Handle there being no data by returning None...
-  if (self->dm.array==NULL)
+ // Get the parameter - the new exemplars...
+  PyObject * data_obj;
+  if (!PyArg_ParseTuple(args, "O", &data_obj)) return NULL;
+  
+ // Check the current data matrix can be streamed into...
+  PyArrayObject * current = self->dm.array;
+  if (current==NULL)
   {
-   Py_INCREF(Py_None);
-   return Py_None;
+   PyErr_SetString(PyExc_RuntimeError, "append requires that set_data has been called, to define the layout of the data");
+   return NULL;
   }
- 
- // Calculate the dimensions and create the matrix to return...
-  npy_intp dim[2];
-  dim[0] = DataMatrix_exemplars(&self->dm);
-  dim[1] = DataMatrix_ext_features(&self->dm);
-   
-  PyArrayObject * ret = (PyArrayObject*)PyArray_SimpleNew(2, dim, NPY_FLOAT32);
   
- // Loop and fill in the feature vectors...
+  int nd = PyArray_NDIM(current);
   int i;
-  for (i=0; i<dim[0]; i++)
+  for (i=0; i<nd; i++)
   {
-   float * fv = DataMatrix_ext_fv(&self->dm, i, NULL);
-   
-   int j;
-   for (j=0; j<dim[1]; j++)
+   if ((self->dm.dt[i]==DIM_DUAL)||((self->dm.dt[i]==DIM_DATA)&&(i!=0))||((self->dm.dt[i]!=DIM_DATA)&&(i==0)))
    {
-    *(float*)PyArray_GETPTR2(ret, i, j) = fv[j];
+    PyErr_SetString(PyExc_RuntimeError, "append requires a data matrix with a single data dimension, which must be the first, and no dual dimensions");
+    return NULL;
    }
   }
   
- // Return the new data matrix...
-  return (PyObject*)ret;
-}
-
-
-static PyObject * MeanShift_fetch_weight_py(MeanShift * self, PyObject * args)
-{
- if (self->dm.array==NULL)
- {
-  Py_INCREF(Py_None);
-  return Py_None;
- }
- 
- // Create the matrix to return...
-  npy_intp exemplars = DataMatrix_exemplars(&self->dm);
-  PyArrayObject * ret = (PyArrayObject*)PyArray_SimpleNew(1, &exemplars, NPY_FLOAT32);
- 
-// Loop and fill in the weights...
-  int i;
-  for (i=0; i<exemplars; i++)
+ // Convert the new data to match, adding a first dimension if it is a single exemplar - uses the full description of the current data, including byte order, as the bytes are copied straight into the buffer...
+  PyArray_Descr * descr = PyArray_DESCR(current);
+  Py_INCREF(descr);
+  PyArrayObject * data = (PyArrayObject*)PyArray_FromAny(data_obj, descr, nd-1, nd, NPY_ARRAY_IN_ARRAY, NULL);
+  if (data==NULL) return NULL;
+  
+  int offset = (PyArray_NDIM(data)==nd) ? 1 : 0;
+  for (i=1; i<nd; i++)
   {
-   DataMatrix_ext_fv(&self->dm, i, (float*)PyArray_GETPTR1(ret, i)); 
+   if (PyArray_DIMS(data)[i-1+offset]!=PyArray_DIMS(current)[i])
+   {
+    Py_DECREF(data);
+    PyErr_SetString(PyExc_RuntimeError, "appended data must match the shape of the current data matrix, apart from the first dimension");
+    return NULL;
+   }
   }
- 
- // Return the new weight matrix...
-  return (PyObject*)ret; 
-}
-
-
-
-static PyObject * MeanShift_set_scale_py(MeanShift * self, PyObject * args)
-{
- // Extract the parameters...
-  PyArrayObject * scale;
-  float weight_scale = 1.0;
-  if (!PyArg_ParseTuple(args, "O!|f", &PyArray_Type, &scale, &weight_scale)) return NULL;
- 
- // Handle the scale...
-  if ((PyArray_NDIM(scale)!=1)||(PyArray_DIMS(scale)[0]!=DataMatrix_features(&self->dm)))
+  
+  int count = (offset!=0) ? PyArray_DIMS(data)[0] : 1;
+  
+ // Work out how many exemplars are to be evicted, and how many of the new ones survive...
+  int exemplars = self->dm.exemplars;
+  int evicted = 0;
+  int skip = 0;
+  
+  if ((self->window>0)&&((exemplars+count)>self->window))
   {
-   PyErr_SetString(PyExc_RuntimeError, "scale vector must be a simple 1D numpy array with length matching the number of features after any conversion.");
-   return NULL;
+   evicted = exemplars + count - self->window;
+   if (evicted>exemplars)
+   {
+    skip = evicted - exemplars;
+    evicted = exemplars;
+   }
   }
-  ToFloat atof = KindToFunc(PyArray_DESCR(scale));
   
-  int i;
-  for (i=0; i<PyArray_DIMS(scale)[0]; i++)
+  int kept = exemplars - evicted;
+  int added = count - skip;
+  
+ // Make sure the buffer exists and has space - if the data matrix is not a view of it then this is the first append since set_data and we need to copy it in; if there is not enough space at the end then the live exemplars are moved to a new, larger, buffer...
+  npy_intp * dims = (npy_intp*)malloc(nd * sizeof(npy_intp));
+  for (i=1; i<nd; i++) dims[i] = PyArray_DIMS(current)[i];
+  
+  int fresh = (self->buffer==NULL)||(PyArray_BASE(current)!=(PyObject*)self->buffer);
+  
+  if ((fresh!=0)||((self->buffer_start + exemplars + added)>PyArray_DIMS(self->buffer)[0]))
   {
-   self->fv_int[i] = atof(PyArray_GETPTR1(scale, i));
+   int capacity = 2 * (kept + added);
+   if (capacity<64) capacity = 64;
+   dims[0] = capacity;
+   
+   descr = PyArray_DESCR(current);
+   Py_INCREF(descr);
+   PyArrayObject * buffer = (PyArrayObject*)PyArray_NewFromDescr(&PyArray_Type, descr, nd, dims, NULL, NULL, 0, NULL);
+   if (buffer==NULL)
+   {
+    free(dims);
+    Py_DECREF(data);
+    return NULL;
+   }
+   
+   if (kept!=0)
+   {
+    PyObject * from = PySequence_GetSlice((PyObject*)current, evicted, exemplars);
+    PyObject * to = PySequence_GetSlice((PyObject*)buffer, 0, kept);
+    PyArray_CopyInto((PyArrayObject*)to, (PyArrayObject*)from);
+    Py_DECREF(from);
+    Py_DECREF(to);
+   }
+   
+   Py_XDECREF(self->buffer);
+   self->buffer = buffer;
+   self->buffer_start = 0;
+  }
+  else
+  {
+   self->buffer_start += evicted;
   }
   
-  DataMatrix_set_scale(&self->dm, self->fv_int, weight_scale);
+  free(dims);
   
- // Trash the spatial - changing either of the above invalidates it...
+ // Copy the new exemplars in...
+  if (added!=0)
+  {
+   char * to = PyArray_BYTES(self->buffer) + (size_t)(self->buffer_start + kept) * PyArray_STRIDES(self->buffer)[0];
+   char * from = PyArray_BYTES(data) + (size_t)skip * PyArray_STRIDES(self->buffer)[0];
+   memcpy(to, from, (size_t)added * PyArray_STRIDES(self->buffer)[0]);
+  }
+  
+  Py_DECREF(data);
+  
+ // Update the data matrix to a view of the live part of the buffer...
+  PyArrayObject * view = (PyArrayObject*)PySequence_GetSlice((PyObject*)self->buffer, self->buffer_start, self->buffer_start + kept + added);
+  DataMatrix_shift(&self->dm, view, evicted);
+  Py_DECREF(view);
+  
+ // Update the spatial, or trash it if it can't be updated - a compact materialised format has been requantised in full, so the old part of the index no longer matches either...
   if (self->spatial!=NULL)
   {
-   Spatial_delete(self->spatial);
-   self->spatial = NULL; 
+   if ((self->materialise>MAT_FLOAT32)||(Spatial_shift(self->spatial, evicted)==0))
+   {
+    Counters_add(&self->counters, Spatial_counters(self->spatial));
+    Spatial_delete(self->spatial);
+    self->spatial = NULL;
+   }
   }
   
- // Trash the cluster centers...
+ // Trash the cluster centers and the weight record...
   if (self->balls!=NULL)
   {
    Balls_delete(self->balls);
    self->balls = NULL;
   }
   
- // Trash the weight record...
   self->weight = -1.0;
   self->norm = -1.0;
+  self->generation += 1;
  
  // Return None...
   Py_INCREF(Py_None);
@@ -870,429 +1012,1936 @@ static PyObject * MeanShift_set_scale_py(MeanShift * self, PyObject * args)
 }
 
 
-static PyObject * MeanShift_get_scale_py(MeanShift * self, PyObject * args)
+
+// Header of the file written by save - all offsets are in bytes from the start of the file, with every section aligned to 64 bytes so that load can use them directly from a read only memory map. Links within the kd tree are relative, so the file is position independent...
+typedef struct ModelHeader ModelHeader;
+
+struct ModelHeader
 {
- npy_intp dim = DataMatrix_features(&self->dm);
- PyArrayObject * ret = (PyArrayObject*)PyArray_SimpleNew(1, &dim, NPY_FLOAT32);
+ char magic[8]; // "ms_model"
+ int version;
+ int node_size; // sizeof(KDNode), so files from an incompatible build are rejected.
  
- int i;
- for (i=0; i<dim; i++)
- {
-  *(float*)PyArray_GETPTR1(ret, i) = self->dm.mult[i];
- }
+ int exemplars;
+ int feats; // External features, excluding the weight.
+ int weighted; // Non-zero if the data has a weight column at the end.
+ int feats_conv; // Internal features, after conversion.
  
- return (PyObject*)ret;
-}
+ char conv[64]; // Conversion codes, empty string for none.
+ char spatial[64]; // Name of spatial type.
+ char balls[64]; // Name of balls type.
+ 
+ float weight_scale;
+ float quality;
+ float epsilon;
+ int iter_cap;
+ float spatial_param;
+ float ident_dist;
+ float merge_range;
+ int merge_check_step;
+ 
+ int balls_count;
+ int padding;
+ 
+ long long kernel; // Null terminated kernel string, as given to set_kernel.
+ long long data; // exemplars x (feats + weighted) float32 - the external data, in the 'df' format.
+ long long scale; // feats_conv float32.
+ long long mat; // exemplars x feats_conv float32 - the materialised data, converted and scaled.
+ long long mat_weight; // exemplars float32, with weight_scale applied.
+ long long indices; // exemplars int32, zero if there is no kd tree.
+ long long arena; // The kd tree nodes, zero if there is no kd tree.
+ long long arena_size; // In bytes.
+ long long balls_data; // balls_count x (feats_conv + 1) float32 - position then radius of each.
+ long long size; // Of the entire file.
+};
 
+static const char model_magic[8] = {'m','s','_','m','o','d','e','l'};
+static const int model_version = 1;
 
-static PyObject * MeanShift_get_weight_scale_py(MeanShift * self, PyObject * args)
-{
- return Py_BuildValue("f", self->dm.weight_scale);
-}
 
 
-static PyObject * MeanShift_copy_scale_py(MeanShift * self, PyObject * args)
+// Helpers for writing the file - write a block and pad to the next section; each returns non-zero on error...
+int Model_write(FILE * f, long long * pos, const void * data, size_t size)
 {
- // Get the parameters - another mean shift object...
-  MeanShift * other;
-  if (!PyArg_ParseTuple(args, "O!", &MeanShiftType, &other)) return NULL;
-
- // Copy over the scale...  
-  DataMatrix_set_scale(&self->dm, other->dm.mult, other->dm.weight_scale);
-  
- // Trash the spatial - changing either of the above invalidates it...
-  if (self->spatial!=NULL)
-  {
-   Spatial_delete(self->spatial);
-   self->spatial = NULL; 
-  }
-  
- // Trash the cluster centers...
-  if (self->balls!=NULL)
-  {
-   Balls_delete(self->balls);
-   self->balls = NULL;
-  }
-  
- // Trash the weight record...
-  self->weight = -1.0;
-  self->norm = -1.0;
+ if ((size!=0)&&(fwrite(data, size, 1, f)!=1)) return 1;
+ *pos += size;
+ return 0;
+}
 
- // Return None...
-  Py_INCREF(Py_None);
-  return Py_None;
+int Model_align(FILE * f, long long * pos)
+{
+ static const char zeros[64] = {0};
+ size_t pad = (64 - (*pos % 64)) % 64;
+ return Model_write(f, pos, zeros, pad);
 }
 
 
+// Owner of a memory map, in a capsule that is the base object of the numpy array that wraps it - when the last reference goes it is unmapped...
+typedef struct ModelMap ModelMap;
 
-static PyObject * MeanShift_exemplars_py(MeanShift * self, PyObject * args)
+struct ModelMap
 {
- return Py_BuildValue("i", DataMatrix_exemplars(&self->dm));
-}
-
+ void * ptr;
+ size_t size;
+};
 
-static PyObject * MeanShift_features_py(MeanShift * self, PyObject * args)
+// Returns non-zero if a section of the file, starting at offset and containing count elements of the given size, lies entirely within the file, after the header and aligned as save writes it - done without overflowing...
+int Model_section(const ModelHeader * head, long long offset, long long count, long long elem)
 {
- return Py_BuildValue("i", DataMatrix_ext_features(&self->dm));
+ if ((offset<(long long)sizeof(ModelHeader))||((offset % 64)!=0)||(offset>head->size)) return 0;
+ if (count<0) return 0;
+ return count <= (head->size - offset) / elem;
 }
 
 
-static PyObject * MeanShift_features_internal_py(MeanShift * self, PyObject * args)
+void ModelMap_release(PyObject * capsule)
 {
- return Py_BuildValue("i", DataMatrix_features(&self->dm));
+ ModelMap * map = (ModelMap*)PyCapsule_GetPointer(capsule, "ms_model");
+ munmap(map->ptr, map->size);
+ free(map);
 }
 
 
-float MeanShift_weight(MeanShift * this)
+static PyObject * MeanShift_save_layout_py(MeanShift * self, PyObject * args)
 {
- if (this->weight<0.0)
- {
-  this->weight = calc_weight(&this->dm);
- }
-  
- return this->weight;
+ return Py_BuildValue("{s:i,s:i,s:i,s:i,s:i,s:i,s:i,s:i,s:i,s:i,s:i}", "header", (int)sizeof(ModelHeader), "kernel", (int)offsetof(ModelHeader, kernel), "data", (int)offsetof(ModelHeader, data), "scale", (int)offsetof(ModelHeader, scale), "mat", (int)offsetof(ModelHeader, mat), "mat_weight", (int)offsetof(ModelHeader, mat_weight), "indices", (int)offsetof(ModelHeader, indices), "arena", (int)offsetof(ModelHeader, arena), "arena_size", (int)offsetof(ModelHeader, arena_size), "balls_data", (int)offsetof(ModelHeader, balls_data), "size", (int)offsetof(ModelHeader, size));
 }
 
 
-static PyObject * MeanShift_weight_py(MeanShift * self, PyObject * args)
+static PyObject * MeanShift_save_py(MeanShift * self, PyObject * args)
 {
- return Py_BuildValue("f", MeanShift_weight(self));
-}
-
-
-static PyObject * MeanShift_stats_py(MeanShift * self, PyObject * args)
-{
- // Prep...
-  int exemplars = DataMatrix_exemplars(&self->dm);
-  npy_intp features = DataMatrix_features(&self->dm);
+ // Get the filename...
+  char * fn;
+  if (!PyArg_ParseTuple(args, "s", &fn)) return NULL;
   
-  PyArrayObject * mean = (PyArrayObject*)PyArray_SimpleNew(1, &features, NPY_FLOAT32);
-  PyArrayObject * sd   = (PyArrayObject*)PyArray_SimpleNew(1, &features, NPY_FLOAT32);
+  if (self->dm.array==NULL)
+  {
+   PyErr_SetString(PyExc_RuntimeError, "no data to save - call set_data first");
+   return NULL;
+  }
   
-  int i, j;
-  for (j=0; j<features; j++)
+  if (self->dm.ops_conv>=64)
   {
-   *(float*)PyArray_GETPTR1(mean, j) = 0.0;
-   *(float*)PyArray_GETPTR1(sd, j)   = 0.0;
+   PyErr_SetString(PyExc_RuntimeError, "too many conversion codes to save");
+   return NULL;
   }
   
- // Single pass to calculate everything at once...
-  float total = 0.0;  
-  for (i=0; i<exemplars; i++)
+  int i;
+  for (i=0; i<PyArray_NDIM(self->dm.array); i++)
   {
-   float w;
-   float * fv = DataMatrix_fv(&self->dm, i, &w);
-   float new_total = total + w;
-   
-   for (j=0; j<features; j++)
+   if (self->dm.dt[i]==DIM_DUAL)
    {
-    float delta = fv[j] - *(float*)PyArray_GETPTR1(mean , j);
-    float r = delta * w / new_total;
-    *(float*)PyArray_GETPTR1(mean, j) += r;
-    *(float*)PyArray_GETPTR1(sd, j) += total * delta * r;
+    PyErr_SetString(PyExc_RuntimeError, "can not save a data matrix with dual dimensions - the file format only has data and feature dimensions");
+    return NULL;
    }
-    
-   total = new_total;
   }
-    
- // Finish the sd and adapt the scale...
-  if (total<1e-6) total = 1e-6; // Safety, for if they are all outliers.
-  for (j=0; j<features; j++)
+  
+ // If the spatial is a kd tree make sure it exists, so it gets saved...
+  if ((self->spatial==NULL)&&(self->spatial_type==&KDTreeType))
   {
-   *(float*)PyArray_GETPTR1(mean, j) /= self->dm.mult[j];
-   *(float*)PyArray_GETPTR1(sd, j) = sqrt(*(float*)PyArray_GETPTR1(sd, j) / total) / self->dm.mult[j];
+   self->spatial = Spatial_new(self->spatial_type, &self->dm, self->spatial_param);
   }
   
- // Construct and do the return...
-  return Py_BuildValue("(N,N)", mean, sd);
-}
-
-
-
-static PyObject * MeanShift_scale_silverman_py(MeanShift * self, PyObject * args)
-{
- int i, j;
- 
- // Reset the scale to 1 before we start, so fv does something sensible...
-  int exemplars = DataMatrix_exemplars(&self->dm);
-  int features = DataMatrix_features(&self->dm);
+  int save_tree = (self->spatial!=NULL)&&(Spatial_type(self->spatial)==&KDTreeType);
   
-  for (i=0; i<features; i++) self->dm.mult[i] = 1.0;
+ // Fill in the header, as far as possible...
+  ModelHeader head;
+  memset(&head, 0, sizeof(ModelHeader));
   
- // Use Silverman's rule of thumb to calculate scale values...
-  float weight = 0.0;
-  float * mean = (float*)malloc(features * sizeof(float));
-  float * sd = (float*)malloc(features * sizeof(float));
+  memcpy(head.magic, model_magic, 8);
+  head.version = model_version;
+  head.node_size = sizeof(KDNode);
   
-  // Calculate and store the standard deviation of each dimension...
-   for (i=0; i<features; i++)
-   {
-    mean[i] = 0.0;
-    sd[i] = 0.0;
-   }
-   
-   for (j=0; j<exemplars; j++)
+  head.exemplars = DataMatrix_exemplars(&self->dm);
+  head.feats = DataMatrix_ext_features(&self->dm);
+  head.weighted = (self->dm.weight_index>=0) ? 1 : 0;
+  head.feats_conv = DataMatrix_features(&self->dm);
+  
+  for (i=0; i<self->dm.ops_conv; i++) head.conv[i] = self->dm.conv[i].conv->code;
+  strncpy(head.spatial, self->spatial_type->name, 63);
+  strncpy(head.balls, self->balls_type->name, 63);
+  
+  head.weight_scale = self->dm.weight_scale;
+  head.quality = self->quality;
+  head.epsilon = self->epsilon;
+  head.iter_cap = self->iter_cap;
+  head.spatial_param = self->spatial_param;
+  head.ident_dist = self->ident_dist;
+  head.merge_range = self->merge_range;
+  head.merge_check_step = self->merge_check_step;
+  
+  head.balls_count = (self->balls!=NULL) ? Balls_count(self->balls) : 0;
+  
+ // Open the file and write a placeholder header...
+  FILE * f = fopen(fn, "wb");
+  if (f==NULL) return PyErr_SetFromErrnoWithFilename(PyExc_IOError, fn);
+  
+  long long pos = 0;
+  int error = Model_write(f, &pos, &head, sizeof(ModelHeader));
+  
+ // Kernel string...
+  const char * kernel = (self->name!=NULL) ? PyString_AsString(self->name) : self->kernel->name;
+  error |= Model_align(f, &pos);
+  head.kernel = pos;
+  error |= Model_write(f, &pos, kernel, strlen(kernel) + 1);
+  
+ // External data - extracted with a weight scale of one, so the weights are the raw values...
+  error |= Model_align(f, &pos);
+  head.data = pos;
+  
+  float weight_scale = self->dm.weight_scale;
+  self->dm.weight_scale = 1.0;
+  for (i=0; (i<head.exemplars)&&(error==0); i++)
+  {
+   float weight;
+   float * fv = DataMatrix_ext_fv(&self->dm, i, &weight);
+   error |= Model_write(f, &pos, fv, head.feats * sizeof(float));
+   if (head.weighted) error |= Model_write(f, &pos, &weight, sizeof(float));
+  }
+  self->dm.weight_scale = weight_scale;
+  
+ // Scale...
+  error |= Model_align(f, &pos);
+  head.scale = pos;
+  error |= Model_write(f, &pos, self->dm.mult, head.feats_conv * sizeof(float));
+  
+ // Materialised data, from the data matrix if it has it at full precision, calculated (or decoded from a compact format) otherwise...
+  error |= Model_align(f, &pos);
+  head.mat = pos;
+  if (self->dm.mat!=NULL)
+  {
+   error |= Model_write(f, &pos, self->dm.mat, (size_t)head.exemplars * head.feats_conv * sizeof(float));
+  }
+  else
+  {
+   for (i=0; (i<head.exemplars)&&(error==0); i++)
    {
-    float w;
-    float * fv = DataMatrix_fv(&self->dm, j, &w);
-    float temp = weight + w;
-    
-    for (i=0; i<features; i++)
-    {
-     float delta = fv[i] - mean[i];
-     float r = delta * w / temp;
-     mean[i] += r;
-     sd[i] += weight * delta * r;
-    }
-    
-    weight = temp;
+    float * fv = DataMatrix_fv(&self->dm, i, NULL);
+    error |= Model_write(f, &pos, fv, head.feats_conv * sizeof(float));
    }
+  }
+  
+  error |= Model_align(f, &pos);
+  head.mat_weight = pos;
+  for (i=0; (i<head.exemplars)&&(error==0); i++)
+  {
+   float weight;
+   DataMatrix_fv(&self->dm, i, &weight);
+   error |= Model_write(f, &pos, &weight, sizeof(float));
+  }
+  
+ // kd tree...
+  if (save_tree)
+  {
+   error |= Model_align(f, &pos);
+   head.indices = pos;
+   error |= Model_write(f, &pos, KDTree_indices(self->spatial), head.exemplars * sizeof(int));
    
-   for (i=0; i<features; i++)
-   {
-    sd[i] = sqrt(sd[i] / weight);
-    if (sd[i]<1e-6) sd[i] = 1e-6;
-   }
+   error |= Model_align(f, &pos);
+   head.arena = pos;
+   head.arena_size = KDTree_arena_size(self->spatial);
+   error |= Model_write(f, &pos, KDTree_root(self->spatial), head.arena_size);
+  }
   
-  // Convert standard deviations into a bandwidth via applying the rule...
-   float mult = pow(weight * (features + 2.0) / 4.0, -1.0 / (features + 4.0));
-   for (i=0; i<features; i++)
+ // Balls...
+  if (head.balls_count!=0)
+  {
+   error |= Model_align(f, &pos);
+   head.balls_data = pos;
+   
+   for (i=0; i<head.balls_count; i++)
    {
-    sd[i] = 1.0 / (sd[i] * mult);
+    float radius = Balls_radius(self->balls, i);
+    error |= Model_write(f, &pos, Balls_pos(self->balls, i), head.feats_conv * sizeof(float));
+    error |= Model_write(f, &pos, &radius, sizeof(float));
    }
- 
- // Set the scale...
-  DataMatrix_set_scale(&self->dm, sd, self->dm.weight_scale);
-  free(sd);
-  free(mean);
- 
- // Trash the spatial - changing the above invalidates it...
-  if (self->spatial!=NULL)
-  {
-   Spatial_delete(self->spatial);
-   self->spatial = NULL; 
   }
   
- // Trash the cluster centers...
-  if (self->balls!=NULL)
+ // Finish with the real header...
+  error |= Model_align(f, &pos);
+  head.size = pos;
+  
+  if (error==0) error |= (fseek(f, 0, SEEK_SET)!=0) ? 1 : 0;
+  if (error==0) error |= (fwrite(&head, sizeof(ModelHeader), 1, f)!=1) ? 1 : 0;
+  
+  if (error!=0)
   {
-   Balls_delete(self->balls);
-   self->balls = NULL;
+   PyErr_SetFromErrnoWithFilename(PyExc_IOError, fn);
+   fclose(f);
+   return NULL;
   }
   
- // Trash the normalising constant...
-  self->norm = -1.0;
-
+  if (fclose(f)!=0) return PyErr_SetFromErrnoWithFilename(PyExc_IOError, fn);
+ 
  // Return None...
   Py_INCREF(Py_None);
   return Py_None;
 }
 
 
-static PyObject * MeanShift_scale_scott_py(MeanShift * self, PyObject * args)
+static PyObject * MeanShift_load_py(MeanShift * self, PyObject * args)
 {
- int i, j;
- 
- // Reset the scale to 1 before we start, so fv does something sensible...
-  int exemplars = DataMatrix_exemplars(&self->dm);
-  int features = DataMatrix_features(&self->dm);
+ // Get the filename...
+  char * fn;
+  if (!PyArg_ParseTuple(args, "s", &fn)) return NULL;
   
-  for (i=0; i<features; i++) self->dm.mult[i] = 1.0;
- 
- // Use Silverman's rule fo thumb to calculate scale values...   
-  float weight = 0.0;
-  float * mean = (float*)malloc(features * sizeof(float));
-  float * sd = (float*)malloc(features * sizeof(float));
+ // Map the file...
+  int fd = open(fn, O_RDONLY);
+  if (fd<0) return PyErr_SetFromErrnoWithFilename(PyExc_IOError, fn);
   
-  // Calculate and store into s the standard deviation of each dimension...
-   for (i=0; i<features; i++)
-   {
-    mean[i] = 0.0;
-    sd[i] = 0.0;
-   }
-   
-   for (j=0; j<exemplars; j++)
+  struct stat st;
+  if (fstat(fd, &st)!=0)
+  {
+   close(fd);
+   return PyErr_SetFromErrnoWithFilename(PyExc_IOError, fn);
+  }
+  
+  if (st.st_size<sizeof(ModelHeader))
+  {
+   close(fd);
+   PyErr_SetString(PyExc_RuntimeError, "file is too small to be a saved model");
+   return NULL;
+  }
+  
+  void * ptr = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (ptr==MAP_FAILED) return PyErr_SetFromErrnoWithFilename(PyExc_IOError, fn);
+  
+  ModelMap * map = (ModelMap*)malloc(sizeof(ModelMap));
+  map->ptr = ptr;
+  map->size = st.st_size;
+  PyObject * capsule = PyCapsule_New(map, "ms_model", ModelMap_release);
+  
+ // Check the header...
+  const ModelHeader * head = (const ModelHeader*)ptr;
+  char * base = (char*)ptr;
+  
+  const char * error = NULL;
+  if (memcmp(head->magic, model_magic, 8)!=0) error = "file is not a saved model";
+  else if (head->version!=model_version) error = "saved model is of an unsupported version";
+  else if (head->node_size!=sizeof(KDNode)) error = "saved model was written by an incompatible build";
+  else if (head->size!=st.st_size) error = "saved model is truncated";
+  
+  const SpatialType * spatial_type = NULL;
+  const BallsType * balls_type = NULL;
+  int i, j;
+  
+  for (i=0; ListSpatial[i]!=NULL; i++)
+  {
+   if (strncmp(ListSpatial[i]->name, head->spatial, 64)==0) spatial_type = ListSpatial[i];
+  }
+  
+  for (i=0; ListBalls[i]!=NULL; i++)
+  {
+   if (strncmp(ListBalls[i]->name, head->balls, 64)==0) balls_type = ListBalls[i];
+  }
+  
+  if ((error==NULL)&&((spatial_type==NULL)||(balls_type==NULL))) error = "saved model uses an unknown spatial or balls type";
+  
+ // Check the sizes and conversion codes agree, so the sections below have the sizes we think they have...
+  if (error==NULL)
+  {
+   if ((head->exemplars<0)||(head->feats<1)||(head->feats_conv<1)||((head->weighted!=0)&&(head->weighted!=1))||(head->balls_count<0)) error = "saved model has invalid sizes";
+   else if (memchr(head->conv, 0, 64)==NULL) error = "saved model has invalid conversion codes";
+   else
    {
-    float w;
-    float * fv = DataMatrix_fv(&self->dm, j, &w);
-    float temp = weight + w;
+    int ext = 0;
+    int internal = 0;
+    for (i=0; head->conv[i]!=0; i++)
+    {
+     for (j=0; (ListConvert[j]!=NULL)&&(ListConvert[j]->code!=head->conv[i]); j++);
+     if (ListConvert[j]==NULL) break;
+     
+     ext += ListConvert[j]->dim_ext;
+     internal += ListConvert[j]->dim_int;
+    }
     
-    for (i=0; i<features; i++)
+    if (i==0)
     {
-     float delta = fv[i] - mean[i];
-     float r = delta * w / temp;
-     mean[i] += r;
-     sd[i] += weight * delta * r;
+     ext = head->feats;
+     internal = head->feats;
     }
     
-    weight = temp;
+    if ((head->conv[i]!=0)||(ext!=head->feats)||(internal!=head->feats_conv)) error = "saved model has invalid conversion codes";
    }
+  }
+  
+ // Check every section is within the file, so nothing below reads past the end of the map...
+  if (error==NULL)
+  {
+   long long ex = head->exemplars;
    
-   for (i=0; i<features; i++)
+   if (Model_section(head, head->kernel, 1, 1)==0) error = "saved model has an invalid kernel";
+   else if (memchr(base + head->kernel, 0, head->size - head->kernel)==NULL) error = "saved model has an invalid kernel";
+   else if (Model_section(head, head->data, ex * ((long long)head->feats + head->weighted), sizeof(float))==0) error = "saved model has invalid data";
+   else if (Model_section(head, head->scale, head->feats_conv, sizeof(float))==0) error = "saved model has an invalid scale";
+   else if (Model_section(head, head->mat, ex * head->feats_conv, sizeof(float))==0) error = "saved model has invalid materialised data";
+   else if (Model_section(head, head->mat_weight, ex, sizeof(float))==0) error = "saved model has invalid materialised weights";
+   else if ((head->balls_count!=0)&&(Model_section(head, head->balls_data, (long long)head->balls_count * ((long long)head->feats_conv + 1), sizeof(float))==0)) error = "saved model has invalid balls";
+   else if (head->indices!=0)
    {
-    sd[i] = sqrt(sd[i] / weight);
-    if (sd[i]<1e-6) sd[i] = 1e-6;
+    if ((Model_section(head, head->indices, ex, sizeof(int))==0)||(Model_section(head, head->arena, head->arena_size, 1)==0)) error = "saved model has an invalid kd tree";
+    else if (KDTree_valid(head->feats_conv, head->exemplars, (const int*)(base + head->indices), (const KDNode*)(base + head->arena), head->arena_size)==0) error = "saved model has an invalid kd tree";
    }
+  }
+  
+  if (error!=NULL)
+  {
+   Py_DECREF(capsule);
+   PyErr_SetString(PyExc_RuntimeError, error);
+   return NULL;
+  }
+  
+ // Wrap the data in a numpy array, which keeps the map alive...
+  npy_intp dims[2];
+  dims[0] = head->exemplars;
+  dims[1] = head->feats + head->weighted;
+  
+  PyArrayObject * data = (PyArrayObject*)PyArray_New(&PyArray_Type, 2, dims, NPY_FLOAT32, NULL, base + head->data, 0, NPY_ARRAY_CARRAY_RO, NULL);
+  if (data==NULL)
+  {
+   Py_DECREF(capsule);
+   return NULL;
+  }
+  PyArray_SetBaseObject(data, capsule);
+  
+ // Trash everything that depends on the current data...
+  Py_XDECREF(self->buffer);
+  self->buffer = NULL;
+  self->buffer_start = 0;
   
-  // Convert standard deviations into a bandwidth via applying the rule...
-   float mult = pow(weight, -1.0 / (features + 4.0));
-   for (i=0; i<features; i++)
-   {
-    sd[i] = 1.0 / (sd[i] * mult);
-   }
- 
- // Set the scale...
-  DataMatrix_set_scale(&self->dm, sd, self->dm.weight_scale);
-  free(sd);
-  free(mean);
- 
- // Trash the spatial - changing the above invalidates it...
   if (self->spatial!=NULL)
   {
+   Counters_add(&self->counters, Spatial_counters(self->spatial));
    Spatial_delete(self->spatial);
-   self->spatial = NULL; 
+   self->spatial = NULL;
   }
   
- // Trash the cluster centers...
   if (self->balls!=NULL)
   {
    Balls_delete(self->balls);
    self->balls = NULL;
   }
   
- // Trash the normalising constant...
+  self->weight = -1.0;
   self->norm = -1.0;
+  self->generation += 1;
+  
+ // Setup the data matrix, with the mapped materialised copy...
+  DimType dt[2] = {DIM_DATA, DIM_FEATURE};
+  DataMatrix_set(&self->dm, data, dt, head->weighted ? head->feats : -1, (head->conv[0]!=0) ? head->conv : NULL);
+  Py_DECREF(data);
+  
+  DataMatrix_set_scale(&self->dm, (float*)(base + head->scale), head->weight_scale);
+  DataMatrix_materialise_external(&self->dm, (float*)(base + head->mat), (float*)(base + head->mat_weight));
+  self->materialise = 1;
+  
+  self->fv_int = (float*)realloc(self->fv_int, DataMatrix_features(&self->dm) * sizeof(float));
+  self->fv_ext = (float*)realloc(self->fv_ext, DataMatrix_ext_features(&self->dm) * sizeof(float));
+  
+ // Parameters...
+  self->spatial_type = spatial_type;
+  self->balls_type = balls_type;
+  
+  self->quality = head->quality;
+  self->epsilon = head->epsilon;
+  self->iter_cap = head->iter_cap;
+  self->spatial_param = head->spatial_param;
+  self->ident_dist = head->ident_dist;
+  self->merge_range = head->merge_range;
+  self->merge_check_step = head->merge_check_step;
+  
+ // The kernel, which goes through set_kernel...
+  PyObject * kargs = Py_BuildValue("(s)", base + head->kernel);
+  PyObject * ret = MeanShift_set_kernel_py(self, kargs);
+  Py_DECREF(kargs);
+  if (ret==NULL) return NULL;
+  Py_DECREF(ret);
   
+ // The kd tree, straight from the map...
+  if ((head->indices!=0)&&(self->spatial_type==&KDTreeType))
+  {
+   self->spatial = KDTree_map(&self->dm, (int*)(base + head->indices), (KDNode*)(base + head->arena), head->arena_size);
+  }
+  
+ // The balls, which have to be recreated...
+  if (head->balls_count!=0)
+  {
+   self->balls = Balls_new(self->balls_type, head->feats_conv, self->merge_range);
+   
+   const float * ball = (const float*)(base + head->balls_data);
+   for (i=0; i<head->balls_count; i++)
+   {
+    Balls_create(self->balls, ball, ball[head->feats_conv]);
+    ball += head->feats_conv + 1;
+   }
+  }
+ 
  // Return None...
   Py_INCREF(Py_None);
   return Py_None;
 }
 
 
-static PyObject * MeanShift_loo_nll_py(MeanShift * self, PyObject * args)
+
+static PyObject * MeanShift_get_dm_py(MeanShift * self, PyObject * args)
 {
- // Extract the limits from the parameters...
-  float limit = 1e-16;
-  int sample_limit = -1;
-  if (!PyArg_ParseTuple(args, "|fi", &limit, &sample_limit)) return NULL;
- 
- // If spatial is null create it...
-  if (self->spatial==NULL)
-  {
+ if (self->dm.array!=NULL) // Verify that there is a data matrix to in fact return!
+ {
+  Py_INCREF((PyObject*)self->dm.array);
+  return (PyObject*)self->dm.array;
+ }
+ else
+ {
+  Py_INCREF(Py_None);
+  return Py_None;
+ }
+}
+
+
+static PyObject * MeanShift_get_dim_py(MeanShift * self, PyObject * args)
+{
+ PyObject * ret = PyString_FromStringAndSize(NULL, PyArray_NDIM(self->dm.array));
+ char * out = PyString_AsString(ret);
+ 
+ int i;
+ for (i=0;i<PyArray_NDIM(self->dm.array);i++)
+ {
+  switch (self->dm.dt[i])
+  {
+   case DIM_DATA:    out[i] = 'd'; break;
+   case DIM_FEATURE: out[i] = 'f'; break;
+   case DIM_DUAL:    out[i] = 'b'; break;
+   default: out[i] = 'e'; break; // Should never happen, obviously.
+  }
+ }
+  
+ return ret;
+}
+
+
+static PyObject * MeanShift_get_weight_dim_py(MeanShift * self, PyObject * args)
+{
+ if (self->dm.weight_index>=0)
+ {
+  return Py_BuildValue("f", self->dm.weight_index);
+ }
+ else
+ {
+  Py_INCREF(Py_None);
+  return Py_None;
+ }
+}
+
+
+
+static PyObject * MeanShift_fetch_dm_py(MeanShift * self, PyObject * args)
+{
+ // Handle there being no data by returning None...
+  if (self->dm.array==NULL)
+  {
+   Py_INCREF(Py_None);
+   return Py_None;
+  }
+ 
+ // Calculate the dimensions and create the matrix to return...
+  npy_intp dim[2];
+  dim[0] = DataMatrix_exemplars(&self->dm);
+  dim[1] = DataMatrix_ext_features(&self->dm);
+   
+  PyArrayObject * ret = (PyArrayObject*)PyArray_SimpleNew(2, dim, NPY_FLOAT32);
+  
+ // Loop and fill in the feature vectors...
+  int i;
+  for (i=0; i<dim[0]; i++)
+  {
+   float * fv = DataMatrix_ext_fv(&self->dm, i, NULL);
+   
+   int j;
+   for (j=0; j<dim[1]; j++)
+   {
+    *(float*)PyArray_GETPTR2(ret, i, j) = fv[j];
+   }
+  }
+  
+ // Return the new data matrix...
+  return (PyObject*)ret;
+}
+
+
+static PyObject * MeanShift_fetch_weight_py(MeanShift * self, PyObject * args)
+{
+ if (self->dm.array==NULL)
+ {
+  Py_INCREF(Py_None);
+  return Py_None;
+ }
+ 
+ // Create the matrix to return...
+  npy_intp exemplars = DataMatrix_exemplars(&self->dm);
+  PyArrayObject * ret = (PyArrayObject*)PyArray_SimpleNew(1, &exemplars, NPY_FLOAT32);
+ 
+// Loop and fill in the weights...
+  int i;
+  for (i=0; i<exemplars; i++)
+  {
+   DataMatrix_ext_fv(&self->dm, i, (float*)PyArray_GETPTR1(ret, i)); 
+  }
+ 
+ // Return the new weight matrix...
+  return (PyObject*)ret; 
+}
+
+
+
+static PyObject * MeanShift_set_scale_py(MeanShift * self, PyObject * args)
+{
+ // Extract the parameters...
+  PyArrayObject * scale;
+  float weight_scale = 1.0;
+  if (!PyArg_ParseTuple(args, "O!|f", &PyArray_Type, &scale, &weight_scale)) return NULL;
+ 
+ // Handle the scale...
+  if ((PyArray_NDIM(scale)!=1)||(PyArray_DIMS(scale)[0]!=DataMatrix_features(&self->dm)))
+  {
+   PyErr_SetString(PyExc_RuntimeError, "scale vector must be a simple 1D numpy array with length matching the number of features after any conversion.");
+   return NULL;
+  }
+  ToFloat atof = KindToFunc(PyArray_DESCR(scale));
+  
+  int i;
+  for (i=0; i<PyArray_DIMS(scale)[0]; i++)
+  {
+   self->fv_int[i] = atof(PyArray_GETPTR1(scale, i));
+  }
+  
+  DataMatrix_set_scale(&self->dm, self->fv_int, weight_scale);
+  
+ // Trash the spatial - changing either of the above invalidates it...
+  if (self->spatial!=NULL)
+  {
+   Counters_add(&self->counters, Spatial_counters(self->spatial));
+   Spatial_delete(self->spatial);
+   self->spatial = NULL; 
+  }
+  
+ // Trash the cluster centers...
+  if (self->balls!=NULL)
+  {
+   Balls_delete(self->balls);
+   self->balls = NULL;
+  }
+  
+ // Trash the weight record...
+  self->weight = -1.0;
+  self->norm = -1.0;
+  self->generation += 1;
+ 
+ // Return None...
+  Py_INCREF(Py_None);
+  return Py_None;
+}
+
+
+static PyObject * MeanShift_get_scale_py(MeanShift * self, PyObject * args)
+{
+ npy_intp dim = DataMatrix_features(&self->dm);
+ PyArrayObject * ret = (PyArrayObject*)PyArray_SimpleNew(1, &dim, NPY_FLOAT32);
+ 
+ int i;
+ for (i=0; i<dim; i++)
+ {
+  *(float*)PyArray_GETPTR1(ret, i) = self->dm.mult[i];
+ }
+ 
+ return (PyObject*)ret;
+}
+
+
+static PyObject * MeanShift_get_weight_scale_py(MeanShift * self, PyObject * args)
+{
+ return Py_BuildValue("f", self->dm.weight_scale);
+}
+
+
+static PyObject * MeanShift_copy_scale_py(MeanShift * self, PyObject * args)
+{
+ // Get the parameters - another mean shift object...
+  MeanShift * other;
+  if (!PyArg_ParseTuple(args, "O!", &MeanShiftType, &other)) return NULL;
+
+ // Copy over the scale...  
+  DataMatrix_set_scale(&self->dm, other->dm.mult, other->dm.weight_scale);
+  
+ // Trash the spatial - changing either of the above invalidates it...
+  if (self->spatial!=NULL)
+  {
+   Counters_add(&self->counters, Spatial_counters(self->spatial));
+   Spatial_delete(self->spatial);
+   self->spatial = NULL; 
+  }
+  
+ // Trash the cluster centers...
+  if (self->balls!=NULL)
+  {
+   Balls_delete(self->balls);
+   self->balls = NULL;
+  }
+  
+ // Trash the weight record...
+  self->weight = -1.0;
+  self->norm = -1.0;
+  self->generation += 1;
+
+ // Return None...
+  Py_INCREF(Py_None);
+  return Py_None;
+}
+
+
+
+static PyObject * MeanShift_exemplars_py(MeanShift * self, PyObject * args)
+{
+ return Py_BuildValue("i", DataMatrix_exemplars(&self->dm));
+}
+
+
+static PyObject * MeanShift_features_py(MeanShift * self, PyObject * args)
+{
+ return Py_BuildValue("i", DataMatrix_ext_features(&self->dm));
+}
+
+
+static PyObject * MeanShift_features_internal_py(MeanShift * self, PyObject * args)
+{
+ return Py_BuildValue("i", DataMatrix_features(&self->dm));
+}
+
+
+float MeanShift_weight(MeanShift * this)
+{
+ if (this->weight<0.0)
+ {
+  this->weight = calc_weight(&this->dm);
+ }
+  
+ return this->weight;
+}
+
+
+static PyObject * MeanShift_weight_py(MeanShift * self, PyObject * args)
+{
+ return Py_BuildValue("f", MeanShift_weight(self));
+}
+
+
+static PyObject * MeanShift_stats_py(MeanShift * self, PyObject * args)
+{
+ // Prep...
+  int exemplars = DataMatrix_exemplars(&self->dm);
+  npy_intp features = DataMatrix_features(&self->dm);
+  
+  PyArrayObject * mean = (PyArrayObject*)PyArray_SimpleNew(1, &features, NPY_FLOAT32);
+  PyArrayObject * sd   = (PyArrayObject*)PyArray_SimpleNew(1, &features, NPY_FLOAT32);
+  
+  int i, j;
+  for (j=0; j<features; j++)
+  {
+   *(float*)PyArray_GETPTR1(mean, j) = 0.0;
+   *(float*)PyArray_GETPTR1(sd, j)   = 0.0;
+  }
+  
+ // Single pass to calculate everything at once...
+  float total = 0.0;  
+  for (i=0; i<exemplars; i++)
+  {
+   float w;
+   float * fv = DataMatrix_fv(&self->dm, i, &w);
+   float new_total = total + w;
+   
+   for (j=0; j<features; j++)
+   {
+    float delta = fv[j] - *(float*)PyArray_GETPTR1(mean , j);
+    float r = delta * w / new_total;
+    *(float*)PyArray_GETPTR1(mean, j) += r;
+    *(float*)PyArray_GETPTR1(sd, j) += total * delta * r;
+   }
+    
+   total = new_total;
+  }
+    
+ // Finish the sd and adapt the scale...
+  if (total<1e-6) total = 1e-6; // Safety, for if they are all outliers.
+  for (j=0; j<features; j++)
+  {
+   *(float*)PyArray_GETPTR1(mean, j) /= self->dm.mult[j];
+   *(float*)PyArray_GETPTR1(sd, j) = sqrt(*(float*)PyArray_GETPTR1(sd, j) / total) / self->dm.mult[j];
+  }
+  
+ // Construct and do the return...
+  return Py_BuildValue("(N,N)", mean, sd);
+}
+
+
+
+static PyObject * MeanShift_scale_silverman_py(MeanShift * self, PyObject * args)
+{
+ int i, j;
+ 
+ // Reset the scale to 1 before we start, so fv does something sensible...
+  int exemplars = DataMatrix_exemplars(&self->dm);
+  int features = DataMatrix_features(&self->dm);
+  
+  DataMatrix_materialise(&self->dm, 0);
+  for (i=0; i<features; i++) self->dm.mult[i] = 1.0;
+  
+ // Use Silverman's rule of thumb to calculate scale values...
+  float weight = 0.0;
+  float * mean = (float*)malloc(features * sizeof(float));
+  float * sd = (float*)malloc(features * sizeof(float));
+  
+  // Calculate and store the standard deviation of each dimension...
+   for (i=0; i<features; i++)
+   {
+    mean[i] = 0.0;
+    sd[i] = 0.0;
+   }
+   
+   for (j=0; j<exemplars; j++)
+   {
+    float w;
+    float * fv = DataMatrix_fv(&self->dm, j, &w);
+    float temp = weight + w;
+    
+    for (i=0; i<features; i++)
+    {
+     float delta = fv[i] - mean[i];
+     float r = delta * w / temp;
+     mean[i] += r;
+     sd[i] += weight * delta * r;
+    }
+    
+    weight = temp;
+   }
+   
+   for (i=0; i<features; i++)
+   {
+    sd[i] = sqrt(sd[i] / weight);
+    if (sd[i]<1e-6) sd[i] = 1e-6;
+   }
+  
+  // Convert standard deviations into a bandwidth via applying the rule...
+   float mult = pow(weight * (features + 2.0) / 4.0, -1.0 / (features + 4.0));
+   for (i=0; i<features; i++)
+   {
+    sd[i] = 1.0 / (sd[i] * mult);
+   }
+ 
+ // Set the scale...
+  DataMatrix_set_scale(&self->dm, sd, self->dm.weight_scale);
+  if (self->materialise!=0) DataMatrix_materialise(&self->dm, self->materialise);
+  free(sd);
+  free(mean);
+ 
+ // Trash the spatial - changing the above invalidates it...
+  if (self->spatial!=NULL)
+  {
+   Counters_add(&self->counters, Spatial_counters(self->spatial));
+   Spatial_delete(self->spatial);
+   self->spatial = NULL; 
+  }
+  
+ // Trash the cluster centers...
+  if (self->balls!=NULL)
+  {
+   Balls_delete(self->balls);
+   self->balls = NULL;
+  }
+  
+ // Trash the normalising constant...
+  self->norm = -1.0;
+  self->generation += 1;
+
+ // Return None...
+  Py_INCREF(Py_None);
+  return Py_None;
+}
+
+
+static PyObject * MeanShift_scale_scott_py(MeanShift * self, PyObject * args)
+{
+ int i, j;
+ 
+ // Reset the scale to 1 before we start, so fv does something sensible...
+  int exemplars = DataMatrix_exemplars(&self->dm);
+  int features = DataMatrix_features(&self->dm);
+  
+  DataMatrix_materialise(&self->dm, 0);
+  for (i=0; i<features; i++) self->dm.mult[i] = 1.0;
+ 
+ // Use Silverman's rule fo thumb to calculate scale values...   
+  float weight = 0.0;
+  float * mean = (float*)malloc(features * sizeof(float));
+  float * sd = (float*)malloc(features * sizeof(float));
+  
+  // Calculate and store into s the standard deviation of each dimension...
+   for (i=0; i<features; i++)
+   {
+    mean[i] = 0.0;
+    sd[i] = 0.0;
+   }
+   
+   for (j=0; j<exemplars; j++)
+   {
+    float w;
+    float * fv = DataMatrix_fv(&self->dm, j, &w);
+    float temp = weight + w;
+    
+    for (i=0; i<features; i++)
+    {
+     float delta = fv[i] - mean[i];
+     float r = delta * w / temp;
+     mean[i] += r;
+     sd[i] += weight * delta * r;
+    }
+    
+    weight = temp;
+   }
+   
+   for (i=0; i<features; i++)
+   {
+    sd[i] = sqrt(sd[i] / weight);
+    if (sd[i]<1e-6) sd[i] = 1e-6;
+   }
+  
+  // Convert standard deviations into a bandwidth via applying the rule...
+   float mult = pow(weight, -1.0 / (features + 4.0));
+   for (i=0; i<features; i++)
+   {
+    sd[i] = 1.0 / (sd[i] * mult);
+   }
+ 
+ // Set the scale...
+  DataMatrix_set_scale(&self->dm, sd, self->dm.weight_scale);
+  if (self->materialise!=0) DataMatrix_materialise(&self->dm, self->materialise);
+  free(sd);
+  free(mean);
+ 
+ // Trash the spatial - changing the above invalidates it...
+  if (self->spatial!=NULL)
+  {
+   Counters_add(&self->counters, Spatial_counters(self->spatial));
+   Spatial_delete(self->spatial);
+   self->spatial = NULL; 
+  }
+  
+ // Trash the cluster centers...
+  if (self->balls!=NULL)
+  {
+   Balls_delete(self->balls);
+   self->balls = NULL;
+  }
+  
+ // Trash the normalising constant...
+  self->norm = -1.0;
+  self->generation += 1;
+  
+ // Return None...
+  Py_INCREF(Py_None);
+  return Py_None;
+}
+
+
+static PyObject * MeanShift_loo_nll_py(MeanShift * self, PyObject * args)
+{
+ // Extract the limits from the parameters...
+  float limit = 1e-16;
+  int sample_limit = -1;
+  if (!PyArg_ParseTuple(args, "|fi", &limit, &sample_limit)) return NULL;
+ 
+ // If spatial is null create it...
+  if (self->spatial==NULL)
+  {
+   self->spatial = Spatial_new(self->spatial_type, &self->dm, self->spatial_param); 
+  }
+  
+ // Calculate the normalising term if needed...
+  if (self->norm<0.0)
+  {
+   self->norm = calc_norm(&self->dm, self->kernel, self->config, MeanShift_weight(self));
+  }
+  
+ // Calculate the probability...
+  float nll;
+  if (sample_limit>0)
+  {
+   PhiloxRNG rng;
+   PhiloxRNG_init(&rng, (self->rng_link!=NULL)?self->rng_link->rng:self->rng);
+ 
+   nll = loo_nll(self->spatial, self->kernel, self->config, self->norm, self->quality, limit, sample_limit, &rng);
+  }
+  else
+  {
+   nll = loo_nll(self->spatial, self->kernel, self->config, self->norm, self->quality, limit, 0, NULL);
+  }
+ 
+ // Return it...
+  return Py_BuildValue("f", nll);
+}
+
+
+
+// Passes the progress of the loo_nll methods on to a python callback, as callback(step, steps), for every step in turn as the fraction of the work done passes it. If the callback raises it is not called again and the error is reported when the method returns...
+typedef struct StepCallback StepCallback;
+
+struct StepCallback
+{
+ PyObject * callback;
+ int steps;
+ int reported; // Last step reported.
+ int error; // Non-zero if the callback has raised an exception.
+};
+
+void StepCallback_init(StepCallback * this, PyObject * callback, int steps)
+{
+ this->callback = (callback!=Py_None) ? callback : NULL;
+ this->steps = steps;
+ this->reported = -1;
+ this->error = 0;
+}
+
+void StepCallback_progress(void * data, int done, int total)
+{
+ StepCallback * this = (StepCallback*)data;
+ int step = (int)(((long long)done * this->steps) / total);
+ 
+ while ((this->reported<step)&&(this->error==0))
+ {
+  this->reported += 1;
+  PyObject * ret = PyObject_CallFunction(this->callback, "ii", this->reported, this->steps);
+  if (ret==NULL) this->error = 1;
+  Py_XDECREF(ret);
+ }
+}
+
+void StepCallback_finish(StepCallback * this)
+{
+ if (this->callback!=NULL) StepCallback_progress(this, this->steps-1, this->steps);
+}
+
+
+// The multi-scale loo_nll methods rescale the exemplars, which only makes sense when the scale is an inverse bandwidth, so the directional and composite kernels are rejected, as are scales that are not positive and finite - these set a python error and return non-zero...
+int MeanShift_loo_nll_kernel_check(MeanShift * self)
+{
+ if ((self->kernel==&Fisher)||(self->kernel==&MirrorFisher)||(self->kernel==&Composite))
+ {
+  PyErr_SetString(PyExc_RuntimeError, "loo_nll_scales and loo_nll_search do not support the directional or composite kernels - use scale_loo_nll_array instead");
+  return 1;
+ }
+ return 0;
+}
+
+int MeanShift_loo_nll_scale_check(float scale)
+{
+ if ((scale>0.0)&&(isfinite(scale))) return 0;
+ 
+ PyErr_SetString(PyExc_RuntimeError, "scales must be positive and finite");
+ return 1;
+}
+
+
+static PyObject * MeanShift_loo_nll_scales_py(MeanShift * self, PyObject * args)
+{
+ // Extract the parameters - the candidate scales, the limits and the progress callback...
+  PyArrayObject * scales;
+  float limit = 1e-16;
+  int sample_limit = -1;
+  PyObject * callback = Py_None;
+  if (!PyArg_ParseTuple(args, "O!|fiO", &PyArray_Type, &scales, &limit, &sample_limit, &callback)) return NULL;
+
+  int feats = DataMatrix_features(&self->dm);
+  if ((PyArray_NDIM(scales)!=2)||(PyArray_DIMS(scales)[1]!=feats))
+  {
+   PyErr_SetString(PyExc_RuntimeError, "scales must be a 2D numpy array, indexed [candidate, feature], with the number of features after any conversion.");
+   return NULL;
+  }
+  ToFloat atof = KindToFunc(PyArray_DESCR(scales));
+  
+  if (MeanShift_loo_nll_kernel_check(self)!=0) return NULL;
+  
+  int i, j;
+  for (i=0; i<PyArray_DIMS(scales)[0]; i++)
+  {
+   for (j=0; j<feats; j++)
+   {
+    if (MeanShift_loo_nll_scale_check(atof(PyArray_GETPTR2(scales, i, j)))!=0) return NULL;
+   }
+  }
+
+ // If spatial is null create it...
+  if (self->spatial==NULL)
+  {
+   self->spatial = Spatial_new(self->spatial_type, &self->dm, self->spatial_param);
+  }
+
+ // Calculate the normalising term if needed...
+  if (self->norm<0.0)
+  {
+   self->norm = calc_norm(&self->dm, self->kernel, self->config, MeanShift_weight(self));
+  }
+
+ // Convert the scales into ratios with the current scale...
+  int candidates = PyArray_DIMS(scales)[0];
+  float * ratio = (float*)malloc(candidates * feats * sizeof(float));
+
+  for (i=0; i<candidates; i++)
+  {
+   for (j=0; j<feats; j++)
+   {
+    ratio[i*feats + j] = atof(PyArray_GETPTR2(scales, i, j)) / self->dm.mult[j];
+   }
+  }
+
+ // Do the work...
+  npy_intp dims = candidates;
+  PyArrayObject * ret = (PyArrayObject*)PyArray_SimpleNew(1, &dims, NPY_FLOAT32);
+  
+  StepCallback step;
+  StepCallback_init(&step, callback, candidates);
+  Progress progress = (step.callback!=NULL) ? StepCallback_progress : NULL;
+
+  if (sample_limit>0)
+  {
+   PhiloxRNG rng;
+   PhiloxRNG_init(&rng, (self->rng_link!=NULL)?self->rng_link->rng:self->rng);
+
+   loo_nll_multi(self->spatial, self->kernel, self->config, self->norm, self->quality, limit, sample_limit, &rng, candidates, ratio, (float*)PyArray_DATA(ret), progress, &step);
+  }
+  else
+  {
+   loo_nll_multi(self->spatial, self->kernel, self->config, self->norm, self->quality, limit, 0, NULL, candidates, ratio, (float*)PyArray_DATA(ret), progress, &step);
+  }
+
+ // Clean up and return...
+  free(ratio);
+  StepCallback_finish(&step);
+  
+  if (step.error!=0)
+  {
+   Py_DECREF(ret);
+   return NULL;
+  }
+  
+  return (PyObject*)ret;
+}
+
+
+
+static PyObject * MeanShift_loo_nll_search_py(MeanShift * self, PyObject * args)
+{
+ // Extract the parameters - the ends of the path, search parameters and the limits...
+  PyArrayObject * low;
+  PyArrayObject * high;
+  int candidates = 16;
+  int passes = 3;
+  float limit = 1e-16;
+  int sample_limit = -1;
+  PyObject * callback = Py_None;
+  if (!PyArg_ParseTuple(args, "O!O!|iifiO", &PyArray_Type, &low, &PyArray_Type, &high, &candidates, &passes, &limit, &sample_limit, &callback)) return NULL;
+
+  int feats = DataMatrix_features(&self->dm);
+  if ((PyArray_NDIM(low)!=1)||(PyArray_DIMS(low)[0]!=feats)||(PyArray_NDIM(high)!=1)||(PyArray_DIMS(high)[0]!=feats))
+  {
+   PyErr_SetString(PyExc_RuntimeError, "low and high must be simple 1D numpy arrays with length matching the number of features after any conversion.");
+   return NULL;
+  }
+  ToFloat atof_low = KindToFunc(PyArray_DESCR(low));
+  ToFloat atof_high = KindToFunc(PyArray_DESCR(high));
+  
+  if (MeanShift_loo_nll_kernel_check(self)!=0) return NULL;
+  
+  int j;
+  for (j=0; j<feats; j++)
+  {
+   if (MeanShift_loo_nll_scale_check(atof_low(PyArray_GETPTR1(low, j)))!=0) return NULL;
+   if (MeanShift_loo_nll_scale_check(atof_high(PyArray_GETPTR1(high, j)))!=0) return NULL;
+  }
+
+ // If spatial is null create it...
+  if (self->spatial==NULL)
+  {
+   self->spatial = Spatial_new(self->spatial_type, &self->dm, self->spatial_param);
+  }
+
+ // Calculate the normalising term if needed...
+  if (self->norm<0.0)
+  {
+   self->norm = calc_norm(&self->dm, self->kernel, self->config, MeanShift_weight(self));
+  }
+
+ // Convert the ends into ratios with the current scale...
+  float * ratio_low = (float*)malloc(feats * sizeof(float));
+  float * ratio_high = (float*)malloc(feats * sizeof(float));
+
+  for (j=0; j<feats; j++)
+  {
+   ratio_low[j] = atof_low(PyArray_GETPTR1(low, j)) / self->dm.mult[j];
+   ratio_high[j] = atof_high(PyArray_GETPTR1(high, j)) / self->dm.mult[j];
+  }
+
+ // Do the work...
+  npy_intp dims = feats;
+  PyArrayObject * best = (PyArrayObject*)PyArray_SimpleNew(1, &dims, NPY_FLOAT32);
+  float * best_ratio = (float*)PyArray_DATA(best);
+  float nll;
+  
+  StepCallback step;
+  StepCallback_init(&step, callback, ((candidates<3) ? 3 : candidates) * ((passes<1) ? 1 : passes));
+  Progress progress = (step.callback!=NULL) ? StepCallback_progress : NULL;
+
+  if (sample_limit>0)
+  {
+   PhiloxRNG rng;
+   PhiloxRNG_init(&rng, (self->rng_link!=NULL)?self->rng_link->rng:self->rng);
+
+   nll = loo_nll_search(self->spatial, self->kernel, self->config, self->norm, self->quality, limit, sample_limit, &rng, ratio_low, ratio_high, candidates, passes, best_ratio, progress, &step);
+  }
+  else
+  {
+   nll = loo_nll_search(self->spatial, self->kernel, self->config, self->norm, self->quality, limit, 0, NULL, ratio_low, ratio_high, candidates, passes, best_ratio, progress, &step);
+  }
+
+ // Convert the best ratio back into a scale...
+  for (j=0; j<feats; j++) best_ratio[j] *= self->dm.mult[j];
+
+ // Clean up and return...
+  free(ratio_high);
+  free(ratio_low);
+  StepCallback_finish(&step);
+  
+  if (step.error!=0)
+  {
+   Py_DECREF(best);
+   return NULL;
+  }
+
+  return Py_BuildValue("(N,f)", best, nll);
+}
+
+
+
+static PyObject * MeanShift_entropy_py(MeanShift * self, PyObject * args)
+{
+ // Extract the limits from the parameters...
+  int sample_limit = -1;
+  if (!PyArg_ParseTuple(args, "|i", &sample_limit)) return NULL;
+  
+ // If spatial is null create it...
+  if (self->spatial==NULL)
+  {
+   self->spatial = Spatial_new(self->spatial_type, &self->dm, self->spatial_param); 
+  }
+  
+ // Calculate the normalising term if needed...
+  if (self->norm<0.0)
+  {
+   self->norm = calc_norm(&self->dm, self->kernel, self->config, MeanShift_weight(self));
+  }
+  
+ // Calculate and return...
+  float ret;
+  if (sample_limit>0)
+  {
+   PhiloxRNG rng;
+   PhiloxRNG_init(&rng, (self->rng_link!=NULL)?self->rng_link->rng:self->rng);
+ 
+   ret = entropy(self->spatial, self->kernel, self->config, self->norm, self->quality, sample_limit, &rng);
+  }
+  else
+  {
+   ret = entropy(self->spatial, self->kernel, self->config, self->norm, self->quality, 0, NULL);
+  }
+  
+  return Py_BuildValue("f", ret);
+}
+
+
+static PyObject * MeanShift_kl_py(MeanShift * self, PyObject * args)
+{
+ // Get the parameters - another mean shift object and an optional limit...
+  MeanShift * other;
+  float limit = 1e-16;
+  int sample_limit = -1;
+  if (!PyArg_ParseTuple(args, "O!|fi", &MeanShiftType, &other, &limit, &sample_limit)) return NULL;
+  
+ // Make sure the required data structures for self are ready...
+  if (self->spatial==NULL)
+  {
    self->spatial = Spatial_new(self->spatial_type, &self->dm, self->spatial_param); 
   }
   
- // Calculate the normalising term if needed...
   if (self->norm<0.0)
   {
    self->norm = calc_norm(&self->dm, self->kernel, self->config, MeanShift_weight(self));
   }
   
- // Calculate the probability...
-  float nll;
+ // Ditto for other...
+  if (other->spatial==NULL)
+  {
+   other->spatial = Spatial_new(other->spatial_type, &other->dm, self->spatial_param); 
+  }
+  
+  if (other->norm<0.0)
+  {
+   other->norm = calc_norm(&other->dm, other->kernel, other->config, MeanShift_weight(other));
+  }
+ 
+ // Calculate and return...
+  float ret;
   if (sample_limit>0)
   {
    PhiloxRNG rng;
    PhiloxRNG_init(&rng, (self->rng_link!=NULL)?self->rng_link->rng:self->rng);
  
-   nll = loo_nll(self->spatial, self->kernel, self->config, self->norm, self->quality, limit, sample_limit, &rng);
+   ret = kl_divergence(self->spatial, self->kernel, self->config, self->norm, self->quality, other->spatial, other->kernel, other->config, other->norm, other->quality, limit, sample_limit, &rng);
   }
   else
   {
-   nll = loo_nll(self->spatial, self->kernel, self->config, self->norm, self->quality, limit, 0, NULL);
+   ret = kl_divergence(self->spatial, self->kernel, self->config, self->norm, self->quality, other->spatial, other->kernel, other->config, other->norm, other->quality, limit, 0, NULL);
+  }
+  
+  return Py_BuildValue("f", ret);
+}
+
+
+
+static PyObject * MeanShift_coreset_py(MeanShift * self, PyObject * args)
+{
+ // Get the parameters - the tolerance and an optional sample count for the kl estimate...
+  float tolerance;
+  int sample_limit = 1024;
+  if (!PyArg_ParseTuple(args, "f|i", &tolerance, &sample_limit)) return NULL;
+  
+  if (tolerance<0.0)
+  {
+   PyErr_SetString(PyExc_RuntimeError, "coreset tolerance must not be negative");
+   return NULL;
+  }
+  
+ // Build the coreset, in the internal space...
+  Coreset * core = Coreset_new(&self->dm, self->kernel, self->config, tolerance);
+  if (core->count==0)
+  {
+   Coreset_delete(core);
+   PyErr_SetString(PyExc_RuntimeError, "no exemplars with a positive weight to build a coreset from");
+   return NULL;
+  }
+  
+ // Convert it to the external space, with a weight column on the end, undoing the weight scale as the new object copies it...
+  int feats = DataMatrix_features(&self->dm);
+  int ext_feats = DataMatrix_ext_features(&self->dm);
+  
+  npy_intp dim[2] = {core->count, ext_feats + 1};
+  PyArrayObject * data = (PyArrayObject*)PyArray_SimpleNew(2, dim, NPY_FLOAT32);
+  
+  int i, j;
+  for (i=0; i<core->count; i++)
+  {
+   memcpy(self->fv_int, core->fv + (size_t)i * feats, feats * sizeof(float));
+   float * ext = DataMatrix_to_ext(&self->dm, self->fv_int, self->fv_ext);
+   
+   for (j=0; j<ext_feats; j++) *(float*)PyArray_GETPTR2(data, i, j) = ext[j];
+   *(float*)PyArray_GETPTR2(data, i, ext_feats) = core->weight[i] / self->dm.weight_scale;
+  }
+  
+ // The conversion codes, so the new object sees the same internal space...
+  char * codes = (char*)malloc(self->dm.ops_conv + 1);
+  int code_len = 0;
+  if (self->dm.fv_conv!=NULL)
+  {
+   for (i=0; i<self->dm.ops_conv; i++) codes[code_len++] = self->dm.conv[i].conv->code;
+  }
+  codes[code_len] = 0;
+  
+ // Create the new object, giving it the data and then copying across everything else...
+  PyObject * ret = MeanShift_new_py(&MeanShiftType, NULL, NULL);
+  PyObject * res = NULL;
+  if (ret!=NULL) res = PyObject_CallMethod(ret, "set_data", "Osis", data, "df", ext_feats, codes);
+  if (res!=NULL) {Py_DECREF(res); res = PyObject_CallMethod(ret, "copy_all", "O", self);}
+  if (res!=NULL) {Py_DECREF(res); res = PyObject_CallMethod(ret, "copy_scale", "O", self);}
+  
+  free(codes);
+  Py_DECREF(data);
+  
+  if (res==NULL)
+  {
+   Coreset_delete(core);
+   Py_XDECREF(ret);
+   return NULL;
+  }
+  Py_DECREF(res);
+  
+ // Measure the kl divergence from the original to the coreset, with the kl method...
+  PyObject * kl = NULL;
+  if (sample_limit>=0)
+  {
+   kl = PyObject_CallMethod((PyObject*)self, "kl", "Ofi", ret, 1e-16, sample_limit);
+   if (kl==NULL)
+   {
+    Coreset_delete(core);
+    Py_DECREF(ret);
+    return NULL;
+   }
+  }
+  else
+  {
+   kl = Py_None;
+   Py_INCREF(kl);
+  }
+  
+ // The L1 bound is only reported for the Gaussian, where the constant is known...
+  PyObject * l1_bound;
+  if (self->kernel==&Gaussian) l1_bound = PyFloat_FromDouble(sqrt(2.0 / M_PI) * core->mean_shift);
+  else
+  {
+   l1_bound = Py_None;
+   Py_INCREF(l1_bound);
   }
+  
+ // Package up and return...
+  PyObject * info = Py_BuildValue("{sisfsfsNsN}", "exemplars", core->count, "mean_shift", core->mean_shift, "max_shift", core->max_shift, "l1_bound", l1_bound, "kl", kl);
+  Coreset_delete(core);
+  
+  return Py_BuildValue("(NN)", ret, info);
+}
+
+
+
+// Returns the given basins cache, creating it if needed and emptying it if it is out of date, or NULL if caching is off - as well as the generation the parameters that change where a trajectory goes are included, as they can be set at any time. Must not be called whilst other threads are using the cache...
+Basins * MeanShift_cache(MeanShift * self, Basins ** cache)
+{
+ if (self->cache_step<=0.0) return NULL;
  
- // Return it...
-  return Py_BuildValue("f", nll);
+ int feats = DataMatrix_features(&self->dm);
+ if ((*cache!=NULL)&&(((*cache)->dims!=feats)||((*cache)->step!=self->cache_step)))
+ {
+  Basins_delete(*cache);
+  *cache = NULL;
+ }
+ 
+ if (*cache==NULL)
+ {
+  *cache = Basins_new(feats, self->cache_step, 65536);
+  (*cache)->generation = ~self->generation; // Anything that won't match.
+ }
+ 
+ unsigned int key[4];
+ key[0] = self->generation;
+ memcpy(key + 1, &self->quality, sizeof(float));
+ memcpy(key + 2, &self->epsilon, sizeof(float));
+ key[3] = ((unsigned int)self->iter_cap) ^ (((unsigned int)self->merge_check_step) << 20);
+ philox(key);
+ 
+ Basins_sync(*cache, key[0]);
+ return *cache;
 }
 
 
 
-static PyObject * MeanShift_entropy_py(MeanShift * self, PyObject * args)
+static const int grid_max_cells = 1<<23; // Largest transform the grid is allowed to use - 8 million cells, which needs 256 meg whilst the grid is being built.
+
+// Returns the grid approximation if its switched on and supported, building it if needed, or NULL if prob should be used. Like the caches the grid is tagged with the generation, hashed with the parameters it depends on. The normalising constant must already be calculated...
+Grid * MeanShift_grid(MeanShift * self)
 {
- // Extract the limits from the parameters...
-  int sample_limit = -1;
-  if (!PyArg_ParseTuple(args, "|i", &sample_limit)) return NULL;
+ if (self->grid_step<=0.0) return NULL;
+ 
+ int feats = DataMatrix_features(&self->dm);
+ if (Grid_supported(self->kernel, feats)==0) return NULL;
+ 
+ unsigned int key[4];
+ key[0] = self->generation;
+ memcpy(key + 1, &self->quality, sizeof(float));
+ memcpy(key + 2, &self->grid_step, sizeof(float));
+ key[3] = 0;
+ philox(key);
+ 
+ if ((self->grid!=NULL)&&(self->grid->generation!=key[0]))
+ {
+  Grid_delete(self->grid);
+  self->grid = NULL;
+ }
+ 
+ if (self->grid==NULL)
+ {
+  float range = self->kernel->range(feats, self->config, self->quality);
+  self->grid = Grid_new(&self->dm, self->kernel, self->config, range, self->grid_step, self->norm, grid_max_cells);
+  if (self->grid!=NULL) self->grid->generation = key[0];
+ }
+ 
+ return self->grid;
+}
+
+
+
+// Support for the batch methods, which can split their rows between multiple threads. Each thread gets a Worker, which contains a view of the data matrix, a clone of the spatial and all of the temporary storage it needs, so nothing that gets written to is shared - the kernel, balls etc. are only read. Rows are handed out in chunks, under a lock...
+typedef struct Worker Worker;
+typedef struct Batch Batch;
+typedef struct MultBatch MultBatch;
+
+typedef void (*BatchRow)(Batch * batch, Worker * worker, int row);
+
+struct Worker
+{
+ Batch * batch;
+ 
+ DataMatrix dm; // View of the MeanShift objects data matrix.
+ Spatial spatial; // Clone of the MeanShift objects spatial, using the above view.
+ 
+ float * fv_ext; // Length of external feature vector.
+ float * fv_int; // Length of internal feature vector.
+ float * temp; // Length of internal feature vector.
+ Block * block; // Scratch for evaluating the kernel, reused for every row.
+ 
+ float * grad; // Only allocated for the manifold methods.
+ float * hess;
+ float * eigen_vec;
+ float * eigen_val;
+ 
+ DataMatrix * mult_dm; // Only allocated for mult_batch - a view and a spatial clone for every MeanShift object involved, the list of spatials for the current job, the cache for the Gibbs sampler and its two temporaries.
+ Spatial * mult_spatial;
+ Spatial * mult_terms;
+ MultCache mult_cache;
+ int * mult_index;
+ float * mult_prob;
+};
+
+struct Batch
+{
+ MeanShift * self;
+ 
+ BatchRow row; // Function called for each row.
+ int rows; // Number of rows to process.
+ int manifold; // Non-zero if the workers need the temporaries for subspace constrained mean shift.
+ 
+ PyArrayObject * in; // Input data matrix, NULL for methods that process the contained data matrix.
+ ToFloat atof; // Conversion for above.
+ PyArrayObject * out; // Output array.
+ 
+ float clamp; // Parameters for specific methods.
+ int degrees;
+ int always_hessian;
+ ClusterGuess * guess; // One per row, for parallel clustering, which does a run of exemplars starting at first per batch.
+ int first;
+ Basins * basins; // Cache of the basins of attraction shared by the threads, NULL if not in use.
+ MultBatch * mult; // Products to draw from, for mult_batch; NULL for everything else.
+ 
+ int next; // Next row to hand out.
+ pthread_mutex_t lock;
+};
+
+static const int batch_chunk = 16; // Number of rows handed to a worker at a time.
+static const int cluster_run = 256; // Exemplars per thread in each run of parallel clustering - only changes the speed, never the result.
+
+
+
+// The products that mult_batch draws from - every MeanShift object involved (each only once, so the workers clone each spatial once), the jobs as lists of indices into it, and where each jobs output goes. Every output row is an independent Gibbs chain, with its own block of the random number sequence, so the output does not depend on the number of threads...
+struct MultBatch
+{
+ int objects;
+ MeanShift ** object;
+ KernelConfig * config; // Aligned with term, so a range of it can be passed to mult.
+ int longest; // Most exemplars of any object.
+ int max_terms;
+ int max_feats; // Internal.
+ int max_feats_ext;
+ 
+ int jobs;
+ int * job_start; // Offset into term of each job, with an extra entry at the end.
+ int * term; // Index into object for each term of each job.
+ int * row_start; // Batch row each job starts at, with an extra entry at the end.
+ PyArrayObject ** out;
+ 
+ unsigned int rng[4]; // Row r uses this index plus r in the second most significant word.
+ int gibbs;
+ int mci;
+ int mh;
+ int fake;
+};
+
+
+
+void Worker_init(Worker * this, Batch * batch)
+{
+ MeanShift * self = batch->self;
+ this->batch = batch;
+ 
+ DataMatrix_view(&this->dm, &self->dm);
+ this->spatial = Spatial_clone(self->spatial, &this->dm);
+ 
+ int feats_int = DataMatrix_features(&this->dm);
+ int feats_ext = DataMatrix_ext_features(&this->dm);
+ if (batch->mult!=NULL)
+ {
+  feats_int = batch->mult->max_feats;
+  feats_ext = batch->mult->max_feats_ext;
+ }
+ 
+ this->fv_ext = (float*)malloc(feats_ext * sizeof(float));
+ this->fv_int = (float*)malloc(feats_int * sizeof(float));
+ this->temp = (float*)malloc(feats_int * sizeof(float));
+ this->block = Block_new(feats_int);
+ 
+ if (batch->manifold!=0)
+ {
+  this->grad = (float*)malloc(feats_int * sizeof(float));
+  this->hess = (float*)malloc(feats_int * feats_int * sizeof(float));
+  this->eigen_vec = (float*)malloc(feats_int * feats_int * sizeof(float));
+  this->eigen_val = (float*)malloc(feats_int * sizeof(float));
+ }
+ else
+ {
+  this->grad = NULL;
+  this->hess = NULL;
+  this->eigen_vec = NULL;
+  this->eigen_val = NULL;
+ }
+ 
+ if (batch->mult!=NULL)
+ {
+  MultBatch * mb = batch->mult;
+  this->mult_dm = (DataMatrix*)malloc(mb->objects * sizeof(DataMatrix));
+  this->mult_spatial = (Spatial*)malloc(mb->objects * sizeof(Spatial));
   
- // If spatial is null create it...
-  if (self->spatial==NULL)
+  int i;
+  for (i=0; i<mb->objects; i++)
   {
-   self->spatial = Spatial_new(self->spatial_type, &self->dm, self->spatial_param); 
+   DataMatrix_view(this->mult_dm + i, &mb->object[i]->dm);
+   this->mult_spatial[i] = Spatial_clone(mb->object[i]->spatial, this->mult_dm + i);
   }
   
- // Calculate the normalising term if needed...
-  if (self->norm<0.0)
+  this->mult_terms = (Spatial*)malloc(mb->max_terms * sizeof(Spatial));
+  
+  MultCache_new(&this->mult_cache);
+  this->mult_cache.gibbs_samples = mb->gibbs;
+  this->mult_cache.mci_samples = mb->mci;
+  this->mult_cache.mh_proposals = mb->mh;
+  
+  this->mult_index = (int*)malloc(mb->longest * sizeof(int));
+  this->mult_prob = (float*)malloc(mb->longest * sizeof(float));
+ }
+ else
+ {
+  this->mult_dm = NULL;
+  this->mult_spatial = NULL;
+  this->mult_terms = NULL;
+  this->mult_index = NULL;
+  this->mult_prob = NULL;
+ }
+}
+
+
+void Worker_deinit(Worker * this)
+{
+ if (this->mult_dm!=NULL)
+ {
+  MultBatch * mb = this->batch->mult;
+  int i;
+  for (i=0; i<mb->objects; i++)
   {
-   self->norm = calc_norm(&self->dm, self->kernel, self->config, MeanShift_weight(self));
+   Counters_add(Spatial_counters(mb->object[i]->spatial), Spatial_counters(this->mult_spatial[i]));
+   Spatial_delete(this->mult_spatial[i]);
+   DataMatrix_deinit(this->mult_dm + i);
   }
   
- // Calculate and return...
-  float ret;
-  if (sample_limit>0)
+  free(this->mult_spatial);
+  free(this->mult_dm);
+  free(this->mult_terms);
+  MultCache_delete(&this->mult_cache);
+  free(this->mult_index);
+  free(this->mult_prob);
+ }
+ 
+ free(this->eigen_val);
+ free(this->eigen_vec);
+ free(this->hess);
+ free(this->grad);
+ 
+ Block_delete(this->block);
+ free(this->temp);
+ free(this->fv_int);
+ free(this->fv_ext);
+ 
+ Counters_add(Spatial_counters(this->batch->self->spatial), Spatial_counters(this->spatial));
+ Spatial_delete(this->spatial);
+ DataMatrix_deinit(&this->dm);
+}
+
+
+void * Worker_run(void * ptr)
+{
+ Worker * this = (Worker*)ptr;
+ Batch * batch = this->batch;
+ 
+ while (1)
+ {
+  // Grab the next chunk of rows...
+   pthread_mutex_lock(&batch->lock);
+   int start = batch->next;
+   batch->next += batch_chunk;
+   pthread_mutex_unlock(&batch->lock);
+   
+   if (start>=batch->rows) break;
+   
+  // Process them...
+   int end = start + batch_chunk;
+   if (end>batch->rows) end = batch->rows;
+   
+   int i;
+   for (i=start; i<end; i++) batch->row(batch, this, i);
+ }
+ 
+ return NULL;
+}
+
+
+// Runs the batch with the given number of threads (0 or less means one per core), releasing the GIL whilst it works. The spatial must already exist, and anything else the row function needs (e.g. norm) must already be calculated...
+void Batch_run(Batch * this, int threads)
+{
+ if (threads<1) threads = sysconf(_SC_NPROCESSORS_ONLN);
+ if (threads>this->rows) threads = this->rows;
+ if (threads<1) threads = 1;
+ 
+ this->next = 0;
+ pthread_mutex_init(&this->lock, NULL);
+ 
+ Py_BEGIN_ALLOW_THREADS
+ 
+ // Setup a worker for each thread...
+  Worker * worker = (Worker*)malloc(threads * sizeof(Worker));
+  pthread_t * handle = (pthread_t*)malloc(threads * sizeof(pthread_t));
+  
+  int i;
+  for (i=0; i<threads; i++) Worker_init(worker + i, this);
+ 
+ // Start the extra threads, noting that a failure to create one just means the others do more work; this thread does its share...
+  int started = 1;
+  for (i=1; i<threads; i++)
   {
-   PhiloxRNG rng;
-   PhiloxRNG_init(&rng, (self->rng_link!=NULL)?self->rng_link->rng:self->rng);
+   if (pthread_create(handle + started, NULL, Worker_run, worker + started)!=0) break;
+   started += 1;
+  }
+  
+  Worker_run(worker);
+  
+ // Wait for them to finish...
+  for (i=1; i<started; i++) pthread_join(handle[i], NULL);
+  
+ // Clean up...
+  for (i=0; i<threads; i++) Worker_deinit(worker + i);
+  free(handle);
+  free(worker);
+  
+ Py_END_ALLOW_THREADS
+ 
+ pthread_mutex_destroy(&this->lock);
+}
+
+
+
+// The row functions for the various batch methods...
+void Batch_fetch(Batch * this, Worker * worker, int row)
+{
+ int feats_ext = DataMatrix_ext_features(&worker->dm);
+ 
+ int i;
+ for (i=0; i<feats_ext; i++)
+ {
+  worker->fv_ext[i] = this->atof(PyArray_GETPTR2(this->in, row, i));
+ }
+}
+
+
+void Batch_store(Batch * this, float * fv, int row)
+{
+ int feats_ext = PyArray_DIMS(this->out)[PyArray_NDIM(this->out)-1];
+ float * out = (float*)PyArray_DATA(this->out) + row * feats_ext;
+ 
+ int i;
+ for (i=0; i<feats_ext; i++) out[i] = fv[i];
+}
+
+
+void Batch_prob(Batch * this, Worker * worker, int row)
+{
+ MeanShift * self = this->self;
+ 
+ Batch_fetch(this, worker, row);
+ float * fv = DataMatrix_to_int(&worker->dm, worker->fv_ext, worker->fv_int);
+ 
+ float p = prob(worker->spatial, self->kernel, self->config, fv, worker->block, self->norm, self->quality);
+ 
+ *(float*)PyArray_GETPTR1(this->out, row) = (p>this->clamp) ? p : this->clamp;
+}
+
+
+void Batch_mode(Batch * this, Worker * worker, int row)
+{
+ MeanShift * self = this->self;
+ 
+ Batch_fetch(this, worker, row);
+ float * fv = DataMatrix_to_int(&worker->dm, worker->fv_ext, worker->fv_int);
+ 
+ mode(worker->spatial, self->kernel, self->config, fv, worker->temp, worker->block, self->quality, self->epsilon, self->iter_cap, this->basins);
+ 
+ fv = DataMatrix_to_ext(&worker->dm, fv, worker->fv_ext);
+ Batch_store(this, fv, row);
+}
+
+
+void Batch_mode_data(Batch * this, Worker * worker, int row)
+{
+ MeanShift * self = this->self;
+ int feats_int = DataMatrix_features(&worker->dm);
+ 
+ float * fv = DataMatrix_fv(&worker->dm, row, NULL);
+ int i;
+ for (i=0; i<feats_int; i++) worker->fv_int[i] = fv[i];
+ 
+ mode(worker->spatial, self->kernel, self->config, worker->fv_int, worker->temp, worker->block, self->quality, self->epsilon, self->iter_cap, this->basins);
+ 
+ fv = DataMatrix_to_ext(&worker->dm, worker->fv_int, worker->fv_ext);
+ Batch_store(this, fv, row);
+}
+
+
+void Batch_assign_cluster(Batch * this, Worker * worker, int row)
+{
+ MeanShift * self = this->self;
+ 
+ Batch_fetch(this, worker, row);
+ float * fv = DataMatrix_to_int(&worker->dm, worker->fv_ext, worker->fv_int);
+ 
+ int c = assign_cluster(worker->spatial, self->kernel, self->config, self->balls, fv, worker->temp, worker->block, self->quality, self->epsilon, self->iter_cap, self->merge_check_step, this->basins);
+ 
+ *(int*)PyArray_GETPTR1(this->out, row) = c;
+}
+
+
+void Batch_cluster(Batch * this, Worker * worker, int row)
+{
+ MeanShift * self = this->self;
+ 
+ cluster_speculate(worker->spatial, self->kernel, self->config, self->balls, (int*)PyArray_DATA(this->out), this->guess + row, this->first + row, worker->fv_int, worker->temp, worker->block, self->quality, self->epsilon, self->iter_cap, self->ident_dist, self->merge_check_step, this->basins);
+}
+
+
+void Batch_manifold(Batch * this, Worker * worker, int row)
+{
+ MeanShift * self = this->self;
+ 
+ Batch_fetch(this, worker, row);
+ float * fv = DataMatrix_to_int(&worker->dm, worker->fv_ext, worker->fv_int);
+ 
+ manifold(worker->spatial, this->degrees, fv, worker->grad, worker->hess, worker->eigen_val, worker->eigen_vec, self->quality, self->epsilon, self->iter_cap, this->always_hessian);
+ 
+ fv = DataMatrix_to_ext(&worker->dm, fv, worker->fv_ext);
+ Batch_store(this, fv, row);
+}
+
+
+void Batch_manifold_data(Batch * this, Worker * worker, int row)
+{
+ MeanShift * self = this->self;
+ int feats_int = DataMatrix_features(&worker->dm);
  
-   ret = entropy(self->spatial, self->kernel, self->config, self->norm, self->quality, sample_limit, &rng);
-  }
-  else
-  {
-   ret = entropy(self->spatial, self->kernel, self->config, self->norm, self->quality, 0, NULL);
-  }
-  
-  return Py_BuildValue("f", ret);
+ float * fv = DataMatrix_fv(&worker->dm, row, NULL);
+ int i;
+ for (i=0; i<feats_int; i++) worker->fv_int[i] = fv[i];
+ 
+ manifold(worker->spatial, this->degrees, worker->fv_int, worker->grad, worker->hess, worker->eigen_val, worker->eigen_vec, self->quality, self->epsilon, self->iter_cap, this->always_hessian);
+ 
+ fv = DataMatrix_to_ext(&worker->dm, worker->fv_int, worker->fv_ext);
+ Batch_store(this, fv, row);
 }
 
 
-static PyObject * MeanShift_kl_py(MeanShift * self, PyObject * args)
+
+void Batch_mult(Batch * this, Worker * worker, int row)
 {
- // Get the parameters - another mean shift object and an optional limit...
-  MeanShift * other;
-  float limit = 1e-16;
-  int sample_limit = -1;
-  if (!PyArg_ParseTuple(args, "O!|fi", &MeanShiftType, &other, &limit, &sample_limit)) return NULL;
-  
- // Make sure the required data structures for self are ready...
-  if (self->spatial==NULL)
+ MultBatch * mb = this->mult;
+ 
+ // Find the job the row belongs to...
+  int low = 0;
+  int high = mb->jobs - 1;
+  while (low<high)
   {
-   self->spatial = Spatial_new(self->spatial_type, &self->dm, self->spatial_param); 
+   int mid = (low + high + 1) / 2;
+   if (mb->row_start[mid]<=row) low = mid;
+                           else high = mid - 1;
   }
   
-  if (self->norm<0.0)
-  {
-   self->norm = calc_norm(&self->dm, self->kernel, self->config, MeanShift_weight(self));
-  }
+  int job = low;
+  int start = mb->job_start[job];
+  int terms = mb->job_start[job+1] - start;
   
- // Ditto for other...
-  if (other->spatial==NULL)
+  MeanShift * first = mb->object[mb->term[start]];
+  DataMatrix * dm = worker->mult_dm + mb->term[start];
+  
+ // Give the chain its own block of the random number sequence...
+  unsigned int index[4];
+  int i;
+  for (i=0; i<4; i++) index[i] = mb->rng[i];
+  
+  index[1] += (unsigned int)row;
+  if (index[1]<(unsigned int)row) index[0] += 1;
+  
+  PhiloxRNG rng;
+  PhiloxRNG_init(&rng, index);
+  
+ // Draw, with the same special case for a single term as mult...
+  float * fv;
+  if (terms==1)
   {
-   other->spatial = Spatial_new(other->spatial_type, &other->dm, self->spatial_param); 
+   if (mb->fake==0)
+   {
+    draw(dm, first->kernel, first->config, &rng, worker->fv_int);
+    fv = DataMatrix_to_ext(dm, worker->fv_int, worker->fv_ext);
+   }
+   else
+   {
+    int ind = DataMatrix_draw(dm, &rng);
+    fv = DataMatrix_ext_fv(dm, ind, NULL);
+   }
   }
-  
-  if (other->norm<0.0)
+  else
   {
-   other->norm = calc_norm(&other->dm, other->kernel, other->config, MeanShift_weight(other));
+   for (i=0; i<terms; i++) worker->mult_terms[i] = worker->mult_spatial[mb->term[start + i]];
+   worker->mult_cache.rng = &rng;
+   
+   mult(first->kernel, (first->config!=NULL) ? (mb->config + start) : NULL, terms, worker->mult_terms, worker->fv_int, &worker->mult_cache, worker->mult_index, worker->mult_prob, first->quality, mb->fake);
+   
+   int feats_int = DataMatrix_features(dm);
+   for (i=0; i<feats_int; i++) worker->fv_int[i] *= dm->mult[i];
+   
+   fv = DataMatrix_to_ext(dm, worker->fv_int, worker->fv_ext);
   }
- 
- // Calculate and return...
-  float ret;
-  if (sample_limit>0)
+  
+ // Store it in the jobs output...
+  PyArrayObject * out = mb->out[job];
+  int j = row - mb->row_start[job];
+  int feats_ext = DataMatrix_ext_features(dm);
+  
+  if (PyArray_DESCR(out)->elsize!=4)
   {
-   PhiloxRNG rng;
-   PhiloxRNG_init(&rng, (self->rng_link!=NULL)?self->rng_link->rng:self->rng);
- 
-   ret = kl_divergence(self->spatial, self->kernel, self->config, self->norm, self->quality, other->spatial, other->kernel, other->config, other->norm, other->quality, limit, sample_limit, &rng);
+   for (i=0; i<feats_ext; i++) *(double*)PyArray_GETPTR2(out, j, i) = fv[i];
   }
   else
   {
-   ret = kl_divergence(self->spatial, self->kernel, self->config, self->norm, self->quality, other->spatial, other->kernel, other->config, other->norm, other->quality, limit, 0, NULL);
+   for (i=0; i<feats_ext; i++) *(float*)PyArray_GETPTR2(out, j, i) = fv[i];
   }
-  
-  return Py_BuildValue("f", ret);
 }
 
 
-
 static PyObject * MeanShift_prob_py(MeanShift * self, PyObject * args)
 {
  // Get the argument - a feature vector... 
@@ -1307,13 +2956,7 @@ static PyObject * MeanShift_prob_py(MeanShift * self, PyObject * args)
    return NULL;
   }
   ToFloat atof = KindToFunc(PyArray_DESCR(start));
-  
- // If spatial is null create it...
-  if (self->spatial==NULL)
-  {
-   self->spatial = Spatial_new(self->spatial_type, &self->dm, self->spatial_param); 
-  }
-  
+    
  // Calculate the normalising term if needed...
   if (self->norm<0.0)
   {
@@ -1329,8 +2972,24 @@ static PyObject * MeanShift_prob_py(MeanShift * self, PyObject * args)
   
   float * fv = DataMatrix_to_int(&self->dm, self->fv_ext, self->fv_int);
   
- // Calculate the probability...
-  float p = prob(self->spatial, self->kernel, self->config, fv, self->norm, self->quality);
+ // Calculate the probability, using the grid if its on...
+  Grid * grid = MeanShift_grid(self);
+  float p;
+  if (grid!=NULL)
+  {
+   p = Grid_prob(grid, fv);
+  }
+  else
+  {
+   if (self->spatial==NULL)
+   {
+    self->spatial = Spatial_new(self->spatial_type, &self->dm, self->spatial_param); 
+   }
+   
+   Block * block = Block_new(DataMatrix_features(&self->dm));
+   p = prob(self->spatial, self->kernel, self->config, fv, block, self->norm, self->quality);
+   Block_delete(block);
+  }
  
  // Return the calculated probability...
   return Py_BuildValue("f", p);
@@ -1343,7 +3002,8 @@ static PyObject * MeanShift_probs_py(MeanShift * self, PyObject * args)
  // Get the argument - a data matrix... 
   PyArrayObject * start;
   float clamp = 0.0;
-  if (!PyArg_ParseTuple(args, "O!|f", &PyArray_Type, &start, &clamp)) return NULL;
+  int threads = 1;
+  if (!PyArg_ParseTuple(args, "O!|fi", &PyArray_Type, &start, &clamp, &threads)) return NULL;
 
  // Check the input is acceptable...
   npy_intp feats = DataMatrix_ext_features(&self->dm);
@@ -1353,12 +3013,6 @@ static PyObject * MeanShift_probs_py(MeanShift * self, PyObject * args)
    return NULL;
   }
   ToFloat atof = KindToFunc(PyArray_DESCR(start));
-
- // If spatial is null create it...
-  if (self->spatial==NULL)
-  {
-   self->spatial = Spatial_new(self->spatial_type, &self->dm, self->spatial_param); 
-  }
   
  // Calculate the normalising term if needed...
   if (self->norm<0.0)
@@ -1369,36 +3023,136 @@ static PyObject * MeanShift_probs_py(MeanShift * self, PyObject * args)
  // Create the output array... 
   PyArrayObject * out = (PyArrayObject*)PyArray_SimpleNew(1, PyArray_DIMS(start), NPY_FLOAT32);
   
-  
- // Run the algorithm...
-  int i;
-  for (i=0; i<PyArray_DIMS(start)[0]; i++)
+ // If the grid is on use it - its so fast that threads would not help...
+  Grid * grid = MeanShift_grid(self);
+  if (grid!=NULL)
   {
-   // Copy the feature vector into the temporary storage...
-    int j;
-    for (j=0; j<feats; j++)
+   npy_intp j;
+   for (j=0; j<PyArray_DIMS(start)[0]; j++)
+   {
+    int i;
+    for (i=0; i<feats; i++)
     {
-     self->fv_ext[j] = atof(PyArray_GETPTR2(start, i, j));
+     self->fv_ext[i] = atof(PyArray_GETPTR2(start, j, i));
     }
     
-   // Convert...
     float * fv = DataMatrix_to_int(&self->dm, self->fv_ext, self->fv_int);
+    float p = Grid_prob(grid, fv);
+    *(float*)PyArray_GETPTR1(out, j) = (p>clamp) ? p : clamp;
+   }
    
-   // Calculate the probability...
-    float p = prob(self->spatial, self->kernel, self->config, fv, self->norm, self->quality);
+   return (PyObject*)out;
+  }
+  
+ // If spatial is null create it...
+  if (self->spatial==NULL)
+  {
+   self->spatial = Spatial_new(self->spatial_type, &self->dm, self->spatial_param); 
+  }
+  
+ // Run the algorithm...
+  Batch batch;
+  batch.self = self;
+  batch.row = Batch_prob;
+  batch.rows = PyArray_DIMS(start)[0];
+  batch.manifold = 0;
+  batch.mult = NULL;
+  batch.guess = NULL;
+  batch.basins = NULL;
+  batch.in = start;
+  batch.atof = atof;
+  batch.out = out;
+  batch.clamp = clamp;
+  
+  Batch_run(&batch, threads);
+ 
+ // Return the probabilities...
+  return (PyObject*)out;
+}
+
+
+
+static PyObject * MeanShift_probs_dual_py(MeanShift * self, PyObject * args)
+{
+ // Get the arguments - a data matrix, tolerances and a clamp... 
+  PyArrayObject * start;
+  float rel_tol = 1e-2;
+  float abs_tol = 0.0;
+  float clamp = 0.0;
+  if (!PyArg_ParseTuple(args, "O!|fff", &PyArray_Type, &start, &rel_tol, &abs_tol, &clamp)) return NULL;
+
+ // Check the input is acceptable...
+  npy_intp feats = DataMatrix_ext_features(&self->dm);
+  if ((PyArray_NDIM(start)!=2)||(PyArray_DIMS(start)[1]!=feats))
+  {
+   PyErr_SetString(PyExc_RuntimeError, "input matrix must be 2D with the same length as the number of features in the second dimension");
+   return NULL;
+  }
+  ToFloat atof = KindToFunc(PyArray_DESCR(start));
+  
+ // No queries means no work - don't build a kd tree over nothing...
+  if (PyArray_DIMS(start)[0]==0)
+  {
+   return PyArray_SimpleNew(1, PyArray_DIMS(start), NPY_FLOAT32);
+  }
+
+ // If spatial is null create it...
+  if (self->spatial==NULL)
+  {
+   self->spatial = Spatial_new(self->spatial_type, &self->dm, self->spatial_param); 
+  }
+  
+ // Calculate the normalising term if needed...
+  if (self->norm<0.0)
+  {
+   self->norm = calc_norm(&self->dm, self->kernel, self->config, MeanShift_weight(self));
+  }
+  
+ // Convert the queries into internal space, and build a kd tree over them...
+  npy_intp dims[2];
+  dims[0] = PyArray_DIMS(start)[0];
+  dims[1] = DataMatrix_features(&self->dm);
+  PyArrayObject * query = (PyArrayObject*)PyArray_SimpleNew(2, dims, NPY_FLOAT32);
+  
+  int i, j;
+  for (i=0; i<dims[0]; i++)
+  {
+   for (j=0; j<feats; j++)
+   {
+    self->fv_ext[j] = atof(PyArray_GETPTR2(start, i, j));
+   }
    
-   // Store it...
-    if (p>clamp)
-    {
-     *(float*)PyArray_GETPTR1(out, i) = p;
-    }
-    else
-    {
-     *(float*)PyArray_GETPTR1(out, i) = clamp;
-    }
+   float * fv = DataMatrix_to_int(&self->dm, self->fv_ext, self->fv_int);
+   for (j=0; j<dims[1]; j++)
+   {
+    *(float*)PyArray_GETPTR2(query, i, j) = fv[j];
+   }
+  }
+  
+  DimType dt[2] = {DIM_DATA, DIM_FEATURE};
+  DataMatrix query_dm;
+  DataMatrix_init(&query_dm);
+  DataMatrix_set(&query_dm, query, dt, -1, NULL);
+  
+  Spatial query_spatial = Spatial_new(&KDTreeType, &query_dm, self->spatial_param);
+  
+ // Create the output array and run the algorithm... 
+  PyArrayObject * out = (PyArrayObject*)PyArray_SimpleNew(1, PyArray_DIMS(start), NPY_FLOAT32);
+  
+  probs_dual(self->spatial, self->kernel, self->config, query_spatial, (float*)PyArray_DATA(out), self->norm, self->quality, abs_tol, rel_tol);
+  
+  for (i=0; i<dims[0]; i++)
+  {
+   float * p = (float*)PyArray_GETPTR1(out, i);
+   if (*p<clamp) *p = clamp;
   }
+  
+ // Clean up...
+  Spatial_delete(query_spatial);
+  DataMatrix_deinit(&query_dm);
+  Py_DECREF(query);
  
- // Return the assigned clusters...
+ // Return the probabilities...
   return (PyObject*)out;
 }
 
@@ -1432,70 +3186,117 @@ static PyObject * MeanShift_draw_py(MeanShift * self, PyObject * args)
 
 
 
+static const int draw_chunk = 256; // Number of draws made by each call to the bulk draw.
+
 static PyObject * MeanShift_draws_py(MeanShift * self, PyObject * args)
 {
- // Get the argument - how many to output... 
+ // Get the arguments - how many to output and if the indices of the exemplars are wanted...
   npy_intp shape[2];
-  if (!PyArg_ParseTuple(args, "n", &shape[0])) return NULL;
-  
+  PyObject * want_index = Py_False;
+  if (!PyArg_ParseTuple(args, "n|O", &shape[0], &want_index)) return NULL;
+
+  if (PyBool_Check(want_index)==0)
+  {
+   PyErr_SetString(PyExc_RuntimeError, "Parameter indicating if to return the exemplar indices should be boolean");
+   return NULL;
+  }
+
  // Setup the rng...
   PhiloxRNG rng;
   PhiloxRNG_init(&rng, (self->rng_link!=NULL)?self->rng_link->rng:self->rng);
 
- // Create the return array...
+ // Create the return arrays...
   shape[1] = DataMatrix_ext_features(&self->dm);
   PyArrayObject * ret = (PyArrayObject*)PyArray_SimpleNew(2, shape, NPY_FLOAT32);
-  
- // Fill in the return matrix...
-  int j;
-  for (j=0; j<shape[0]; j++)
+  PyArrayObject * index = (PyArrayObject*)PyArray_SimpleNew(1, shape, NPY_INT32);
+
+ // Fill in the return matrix, a chunk at a time so the bulk draw can be used without a temporary the size of the output...
+  int feats = DataMatrix_features(&self->dm);
+  float * block = (float*)malloc(draw_chunk * feats * sizeof(float));
+
+  npy_intp j;
+  for (j=0; j<shape[0]; j+=draw_chunk)
   {
-   draw(&self->dm, self->kernel, self->config, &rng, self->fv_int);
-   float * fv = DataMatrix_to_ext(&self->dm, self->fv_int, self->fv_ext);
-   
-   int i;
-   for (i=0; i<shape[1]; i++)
+   int count = ((shape[0]-j)<draw_chunk) ? (shape[0]-j) : draw_chunk;
+   draws(&self->dm, self->kernel, self->config, &rng, count, (int*)PyArray_GETPTR1(index, j), block);
+
+   int k;
+   for (k=0; k<count; k++)
    {
-    *(float*)PyArray_GETPTR2(ret, j, i) = fv[i];
+    float * fv = DataMatrix_to_ext(&self->dm, block + k * feats, self->fv_ext);
+
+    int i;
+    for (i=0; i<shape[1]; i++)
+    {
+     *(float*)PyArray_GETPTR2(ret, j+k, i) = fv[i];
+    }
    }
   }
-  
- // Return the draw...
-  return (PyObject*)ret;
+
+  free(block);
+
+ // Return the draws, with the indices if requested...
+  if (want_index==Py_True)
+  {
+   return Py_BuildValue("(N,N)", ret, index);
+  }
+  else
+  {
+   Py_DECREF(index);
+   return (PyObject*)ret;
+  }
 }
 
 
 
 static PyObject * MeanShift_bootstrap_py(MeanShift * self, PyObject * args)
 {
- // Get the arguments - how many to output... 
+ // Get the arguments - how many to output and if the indices of the exemplars are wanted...
   npy_intp shape[2];
-  if (!PyArg_ParseTuple(args, "n", &shape[0])) return NULL;
-  
- // Create the return array...
+  PyObject * want_index = Py_False;
+  if (!PyArg_ParseTuple(args, "n|O", &shape[0], &want_index)) return NULL;
+
+  if (PyBool_Check(want_index)==0)
+  {
+   PyErr_SetString(PyExc_RuntimeError, "Parameter indicating if to return the exemplar indices should be boolean");
+   return NULL;
+  }
+
+ // Create the return arrays...
   shape[1] = DataMatrix_features(&self->dm);
   PyArrayObject * ret = (PyArrayObject*)PyArray_SimpleNew(2, shape, NPY_FLOAT32);
- 
+  PyArrayObject * index = (PyArrayObject*)PyArray_SimpleNew(1, shape, NPY_INT32);
+
  // Prepare the rng...
   PhiloxRNG rng;
   PhiloxRNG_init(&rng, (self->rng_link!=NULL)?self->rng_link->rng:self->rng);
-  
- // Fill in the return matrix...
-  int j;
+
+ // Draw all of the indices in one go, then fill in the return matrix...
+  int * ind = (int*)PyArray_DATA(index);
+  DataMatrix_draws(&self->dm, &rng, shape[0], ind);
+
+  npy_intp j;
   for (j=0; j<shape[0]; j++)
   {
-   int ind = DataMatrix_draw(&self->dm, &rng);
-   float * fv = DataMatrix_ext_fv(&self->dm, ind, NULL);
-   
+   float * fv = DataMatrix_ext_fv(&self->dm, ind[j], NULL);
+
    int i;
    for (i=0; i<shape[1]; i++)
    {
     *(float*)PyArray_GETPTR2(ret, j, i) = fv[i];
    }
   }
-  
- // Return the draw...
-  return (PyObject*)ret;
+
+ // Return the draws, with the indices if requested...
+  if (want_index==Py_True)
+  {
+   return Py_BuildValue("(N,N)", ret, index);
+  }
+  else
+  {
+   Py_DECREF(index);
+   return (PyObject*)ret;
+  }
 }
 
 
@@ -1536,9 +3337,11 @@ static PyObject * MeanShift_mode_py(MeanShift * self, PyObject * args)
  // Run the algorithm; we need some temporary storage...
   int feats_int = DataMatrix_features(&self->dm);
   float * temp = (float*)malloc(feats_int * sizeof(float));
+  Block * block = Block_new(feats_int);
   
-  mode(self->spatial, self->kernel, self->config, fv, temp, self->quality, self->epsilon, self->iter_cap);
+  mode(self->spatial, self->kernel, self->config, fv, temp, block, self->quality, self->epsilon, self->iter_cap, MeanShift_cache(self, &self->mode_cache));
   
+  Block_delete(block);
   free(temp);
   
  // Convert back and write into the output...
@@ -1559,58 +3362,45 @@ static PyObject * MeanShift_modes_py(MeanShift * self, PyObject * args)
 {
  // Get the argument - a data matrix... 
   PyArrayObject * start;
-  if (!PyArg_ParseTuple(args, "O!", &PyArray_Type, &start)) return NULL;
+  int threads = 1;
+  if (!PyArg_ParseTuple(args, "O!|i", &PyArray_Type, &start, &threads)) return NULL;
 
  // Check the input is acceptable...
-  npy_intp dims[2];
-  dims[0] = PyArray_DIMS(start)[0];
-  dims[1] = DataMatrix_ext_features(&self->dm);
-  
-  if ((PyArray_NDIM(start)!=2)||(PyArray_DIMS(start)[1]!=dims[1]))
-  {
-   PyErr_SetString(PyExc_RuntimeError, "input matrix must be 2D with the same length as the number of features in the second dimension");
-   return NULL;
-  }
-  ToFloat atof = KindToFunc(PyArray_DESCR(start));
-  
- // If spatial is null create it...
-  if (self->spatial==NULL)
-  {
-   self->spatial = Spatial_new(self->spatial_type, &self->dm, self->spatial_param); 
-  }
-
- // Create an output matrix...  
-  PyArrayObject * ret = (PyArrayObject*)PyArray_SimpleNew(2, dims, NPY_FLOAT32);
-  
- // Calculate each mode in turn, including conversion both ways...
-  int feats_int = DataMatrix_features(&self->dm);
-  float * temp = (float*)malloc(feats_int * sizeof(float));
-  
-  int j;
-  for (j=0; j<dims[0]; j++)
-  {
-   // Extratc data and convert to internal format...
-    int i;
-    for (i=0; i<dims[1]; i++)
-    {
-     self->fv_ext[i] = atof(PyArray_GETPTR2(start, j, i));
-    }
-  
-    float * fv = DataMatrix_to_int(&self->dm, self->fv_ext, self->fv_int);
+  npy_intp dims[2];
+  dims[0] = PyArray_DIMS(start)[0];
+  dims[1] = DataMatrix_ext_features(&self->dm);
   
-   // Find the mode...
-    mode(self->spatial, self->kernel, self->config, fv, temp, self->quality, self->epsilon, self->iter_cap);
-   
-   // Convert back and write out...
-    fv = DataMatrix_to_ext(&self->dm, fv, self->fv_ext);
+  if ((PyArray_NDIM(start)!=2)||(PyArray_DIMS(start)[1]!=dims[1]))
+  {
+   PyErr_SetString(PyExc_RuntimeError, "input matrix must be 2D with the same length as the number of features in the second dimension");
+   return NULL;
+  }
+  ToFloat atof = KindToFunc(PyArray_DESCR(start));
   
-    for (i=0; i<dims[1]; i++)
-    {
-     *(float*)PyArray_GETPTR2(ret, j, i) = fv[i];
-    }
+ // If spatial is null create it...
+  if (self->spatial==NULL)
+  {
+   self->spatial = Spatial_new(self->spatial_type, &self->dm, self->spatial_param); 
   }
+
+ // Create an output matrix...  
+  PyArrayObject * ret = (PyArrayObject*)PyArray_SimpleNew(2, dims, NPY_FLOAT32);
   
-  free(temp); 
+ // Calculate each mode, including conversion both ways...
+  Batch batch;
+  batch.self = self;
+  batch.row = Batch_mode;
+  batch.rows = dims[0];
+  batch.manifold = 0;
+  batch.mult = NULL;
+  batch.guess = NULL;
+  batch.basins = NULL;
+  batch.in = start;
+  batch.atof = atof;
+  batch.out = ret;
+  
+  batch.basins = MeanShift_cache(self, &self->mode_cache);
+  Batch_run(&batch, threads);
   
  // Return the matrix of modes...
   return (PyObject*)ret;
@@ -1620,6 +3410,10 @@ static PyObject * MeanShift_modes_py(MeanShift * self, PyObject * args)
 
 static PyObject * MeanShift_modes_data_py(MeanShift * self, PyObject * args)
 {
+ // Get the optional thread count...
+  int threads = 1;
+  if (!PyArg_ParseTuple(args, "|i", &threads)) return NULL;
+  
  // If spatial is null create it...
   if (self->spatial==NULL)
   {
@@ -1652,37 +3446,22 @@ static PyObject * MeanShift_modes_data_py(MeanShift * self, PyObject * args)
  // Create the output matrix...
   PyArrayObject * ret = (PyArrayObject*)PyArray_SimpleNew(nd, dims, NPY_FLOAT32);
  
- // Iterate and do each entry in turn...
-  int feats_int = DataMatrix_features(&self->dm);
-  float * temp = (float*)malloc(feats_int * sizeof(float));
-  
-  float * out = (float*)PyArray_DATA(ret);
-  int loc = 0;
-  
-  while (loc<DataMatrix_exemplars(&self->dm))
-  {
-   // Get the relevent feature vector...
-    float * fv = DataMatrix_fv(&self->dm, loc, NULL);
-    for (i=0; i<feats_int; i++) self->fv_int[i] = fv[i];
-   
-   // Converge mean shift...
-    mode(self->spatial, self->kernel, self->config, self->fv_int, temp, self->quality, self->epsilon, self->iter_cap);
-    
-   // Undo conversion and copy into out...
-    fv = DataMatrix_to_ext(&self->dm, self->fv_int, self->fv_ext);
-  
-    for (i=0; i<dims[nd-1]; i++)
-    {
-     out[i] = fv[i];
-    }
-    
-   // Move to next position, detecting when we are done... 
-    loc += 1;
-    out += dims[nd-1];
-  }
+ // Converge every exemplar...
+  Batch batch;
+  batch.self = self;
+  batch.row = Batch_mode_data;
+  batch.rows = DataMatrix_exemplars(&self->dm);
+  batch.manifold = 0;
+  batch.mult = NULL;
+  batch.guess = NULL;
+  batch.basins = NULL;
+  batch.in = NULL;
+  batch.out = ret;
+  
+  batch.basins = MeanShift_cache(self, &self->mode_cache);
+  Batch_run(&batch, threads);
  
  // Clean up...
-  free(temp);
   free(dims);
  
  // Return...
@@ -1693,6 +3472,10 @@ static PyObject * MeanShift_modes_data_py(MeanShift * self, PyObject * args)
 
 static PyObject * MeanShift_cluster_py(MeanShift * self, PyObject * args)
 {
+ // Get the optional argument - the number of threads...
+  int threads = 1;
+  if (!PyArg_ParseTuple(args, "|i", &threads)) return NULL;
+  
  // If spatial is null create it...
   if (self->spatial==NULL)
   {
@@ -1703,6 +3486,7 @@ static PyObject * MeanShift_cluster_py(MeanShift * self, PyObject * args)
   int feats_int = DataMatrix_features(&self->dm);
   if (self->balls!=NULL) Balls_delete(self->balls);
   self->balls = Balls_new(self->balls_type, feats_int, self->merge_range);
+  self->generation += 1;
 
  // Work out the output matrix size...
   int nd = 0;
@@ -1728,8 +3512,49 @@ static PyObject * MeanShift_cluster_py(MeanShift * self, PyObject * args)
  // Create the output matrix...
   PyArrayObject * index = (PyArrayObject*)PyArray_SimpleNew(nd, dims, NPY_INT32);
  
- // Do the work...
-  cluster(self->spatial, self->kernel, self->config, self->balls, (int*)PyArray_DATA(index), self->quality, self->epsilon, self->iter_cap, self->ident_dist, self->merge_range, self->merge_check_step);
+ // Do the work - serially, or in runs of exemplars that the threads converge in parallel, only reading the balls and basins, then committed in exemplar order, which gives exactly the same result...
+  if (threads==1)
+  {
+   cluster(self->spatial, self->kernel, self->config, self->balls, (int*)PyArray_DATA(index), self->quality, self->epsilon, self->iter_cap, self->ident_dist, self->merge_range, self->merge_check_step, MeanShift_cache(self, &self->cluster_cache));
+  }
+  else
+  {
+   int exemplars = DataMatrix_exemplars(&self->dm);
+   int * label = (int*)PyArray_DATA(index);
+   for (i=0; i<exemplars; i++) label[i] = -1;
+   
+   Batch batch;
+   batch.self = self;
+   batch.row = Batch_cluster;
+   batch.rows = exemplars;
+   batch.manifold = 0;
+   batch.mult = NULL;
+   batch.in = NULL;
+   batch.out = index;
+   batch.basins = MeanShift_cache(self, &self->cluster_cache);
+   
+   int run = cluster_run * ((threads<1) ? sysconf(_SC_NPROCESSORS_ONLN) : threads);
+   if (run>exemplars) run = exemplars;
+   
+   batch.guess = (ClusterGuess*)malloc(run * sizeof(ClusterGuess));
+   for (i=0; i<run; i++) ClusterGuess_init(batch.guess + i, feats_int);
+   
+   for (batch.first=0; batch.first<exemplars; batch.first+=run)
+   {
+    batch.rows = exemplars - batch.first;
+    if (batch.rows>run) batch.rows = run;
+    
+    Batch_run(&batch, threads);
+    
+    for (i=0; i<batch.rows; i++)
+    {
+     cluster_commit(self->spatial, self->kernel, self->config, self->balls, label, batch.guess + i, self->fv_int, self->epsilon, self->merge_range, self->merge_check_step, batch.basins);
+    }
+   }
+   
+   for (i=0; i<run; i++) ClusterGuess_deinit(batch.guess + i);
+   free(batch.guess);
+  }
  
  // Extract the modes, which happen to be the centers of the balls...
   dims[0] = Balls_count(self->balls);
@@ -1805,9 +3630,11 @@ static PyObject * MeanShift_assign_cluster_py(MeanShift * self, PyObject * args)
 
  // Run the algorithm...
   float * temp = (float*)malloc(DataMatrix_features(&self->dm) * sizeof(float));
+  Block * block = Block_new(DataMatrix_features(&self->dm));
   
-  int cluster = assign_cluster(self->spatial, self->kernel, self->config, self->balls, fv, temp, self->quality, self->epsilon, self->iter_cap, self->merge_check_step);
+  int cluster = assign_cluster(self->spatial, self->kernel, self->config, self->balls, fv, temp, block, self->quality, self->epsilon, self->iter_cap, self->merge_check_step, MeanShift_cache(self, &self->cluster_cache));
   
+  Block_delete(block);
   free(temp);
  
  // Return the assigned cluster...
@@ -1820,7 +3647,8 @@ static PyObject * MeanShift_assign_clusters_py(MeanShift * self, PyObject * args
 {
  // Get the argument - a feature vector... 
   PyArrayObject * start;
-  if (!PyArg_ParseTuple(args, "O!", &PyArray_Type, &start)) return NULL;
+  int threads = 1;
+  if (!PyArg_ParseTuple(args, "O!|i", &PyArray_Type, &start, &threads)) return NULL;
   
  // Check the input is acceptable...
   npy_intp feats_ext = DataMatrix_ext_features(&self->dm);
@@ -1844,34 +3672,24 @@ static PyObject * MeanShift_assign_clusters_py(MeanShift * self, PyObject * args
    self->spatial = Spatial_new(self->spatial_type, &self->dm, self->spatial_param); 
   }
   
- // Create a temporary array of floats...
-  float * temp = (float*)malloc(DataMatrix_features(&self->dm) * sizeof(float));
-
  // Create the output array... 
   PyArrayObject * cluster = (PyArrayObject*)PyArray_SimpleNew(1, PyArray_DIMS(start), NPY_INT32);
   
  // Run the algorithm...
-  int j;
-  for (j=0; j<PyArray_DIMS(start)[0]; j++)
-  {
-   // Fetch and convert the feature vector...
-    int i;
-    for (i=0; i<feats_ext; i++)
-    {
-     self->fv_ext[i] = atof(PyArray_GETPTR2(start, j, i));
-    }
-    
-    float * fv = DataMatrix_to_int(&self->dm, self->fv_ext, self->fv_int);
-   
-   // Run it...
-    int c = assign_cluster(self->spatial, self->kernel, self->config, self->balls, fv, temp, self->quality, self->epsilon, self->iter_cap, self->merge_check_step);
-   
-   // Store the result...
-    *(int*)PyArray_GETPTR1(cluster, j) = c;
-  }
-  
- // Clean up...
-  free(temp);
+  Batch batch;
+  batch.self = self;
+  batch.row = Batch_assign_cluster;
+  batch.rows = PyArray_DIMS(start)[0];
+  batch.manifold = 0;
+  batch.mult = NULL;
+  batch.guess = NULL;
+  batch.basins = NULL;
+  batch.in = start;
+  batch.atof = atof;
+  batch.out = cluster;
+  
+  batch.basins = MeanShift_cache(self, &self->cluster_cache);
+  Batch_run(&batch, threads);
  
  // Return the assigned clusters...
   return (PyObject*)cluster;
@@ -1909,6 +3727,7 @@ static PyObject * MeanShift_cluster_on_py(MeanShift * self, PyObject * args)
  // Go through and converge each exemplar in turn...
   int feats_int = DataMatrix_features(&self->dm);
   float * temp = (float*)malloc(feats_int * sizeof(float));
+  Block * block = Block_new(feats_int);
   
   int j, i;
   for (j=0; j<exemplars; j++)
@@ -1922,7 +3741,7 @@ static PyObject * MeanShift_cluster_on_py(MeanShift * self, PyObject * args)
     float * fv = DataMatrix_to_int(&self->dm, self->fv_ext, self->fv_int);
     
    // Process...
-    *(int*)PyArray_GETPTR1(index, j) = mode_merge(self->spatial, self->kernel, self->config, balls, fv, temp, self->quality, self->epsilon, self->iter_cap, self->merge_range, self->merge_check_step);
+    *(int*)PyArray_GETPTR1(index, j) = mode_merge(self->spatial, self->kernel, self->config, balls, fv, temp, block, self->quality, self->epsilon, self->iter_cap, self->merge_range, self->merge_check_step);
   }
   
  // Extract the modes, which are the centers of the balls...
@@ -1952,6 +3771,7 @@ static PyObject * MeanShift_cluster_on_py(MeanShift * self, PyObject * args)
   }
   
  // Clean up...
+  Block_delete(block);
   free(temp);
   Balls_delete(balls);
   
@@ -2037,7 +3857,8 @@ static PyObject * MeanShift_manifolds_py(MeanShift * self, PyObject * args)
   PyArrayObject * start;
   int degrees;
   PyObject * always_hessian = Py_True;
-  if (!PyArg_ParseTuple(args, "O!i|O", &PyArray_Type, &start, &degrees, &always_hessian)) return NULL;
+  int threads = 1;
+  if (!PyArg_ParseTuple(args, "O!i|Oi", &PyArray_Type, &start, &degrees, &always_hessian, &threads)) return NULL;
 
   if (PyBool_Check(always_hessian)==0)
   {
@@ -2066,41 +3887,22 @@ static PyObject * MeanShift_manifolds_py(MeanShift * self, PyObject * args)
  // Create an output matrix...  
   PyArrayObject * ret = (PyArrayObject*)PyArray_SimpleNew(2, dims, NPY_FLOAT32);
   
- // Calculate each mode in turn, including undo any scale changes...
-  int feats_int = DataMatrix_features(&self->dm);
-  
-  float * grad = (float*)malloc(feats_int * sizeof(float));
-  float * hess = (float*)malloc(feats_int * feats_int * sizeof(float));
-  float * eigen_vec = (float*)malloc(feats_int * feats_int * sizeof(float));
-  float * eigen_val = (float*)malloc(feats_int * sizeof(float));
-  
-  int j, i;
-  for (j=0; j<dims[0]; j++)
-  {
-   // Obtain and convert the feature vector...
-    for (i=0; i<dims[1]; i++)
-    {
-     self->fv_ext[i] = atof(PyArray_GETPTR2(start, j, i));
-    }
-    
-    float * fv =  DataMatrix_to_int(&self->dm, self->fv_ext, self->fv_int);
-   
-   // Find convergance point...
-    manifold(self->spatial, degrees, fv, grad, hess, eigen_val, eigen_vec, self->quality, self->epsilon, self->iter_cap, (always_hessian==Py_False) ? 0 : 1);
-    
-   // Convert back and store...
-    fv = DataMatrix_to_ext(&self->dm, fv, self->fv_ext);
-   
-    for (i=0; i<dims[1]; i++)
-    {
-     *(float*)PyArray_GETPTR2(ret, j, i) = fv[i]; 
-    }
-  }
-  
-  free(eigen_val);
-  free(eigen_vec);
-  free(hess);
-  free(grad);
+ // Project each feature vector, including undoing any scale changes...
+  Batch batch;
+  batch.self = self;
+  batch.row = Batch_manifold;
+  batch.rows = dims[0];
+  batch.manifold = 1;
+  batch.mult = NULL;
+  batch.guess = NULL;
+  batch.basins = NULL;
+  batch.in = start;
+  batch.atof = atof;
+  batch.out = ret;
+  batch.degrees = degrees;
+  batch.always_hessian = (always_hessian==Py_False) ? 0 : 1;
+  
+  Batch_run(&batch, threads);
   
  // Return the matrix of modes...
   return (PyObject*)ret;
@@ -2113,7 +3915,8 @@ static PyObject * MeanShift_manifolds_data_py(MeanShift * self, PyObject * args)
  // Get the argument - a data matrix... 
   int degrees;
   PyObject * always_hessian = Py_True;
-  if (!PyArg_ParseTuple(args, "i|O", &degrees, &always_hessian)) return NULL;
+  int threads = 1;
+  if (!PyArg_ParseTuple(args, "i|Oi", &degrees, &always_hessian, &threads)) return NULL;
  
   if (PyBool_Check(always_hessian)==0)
   {
@@ -2153,39 +3956,23 @@ static PyObject * MeanShift_manifolds_data_py(MeanShift * self, PyObject * args)
  // Create the output matrix...
   PyArrayObject * ret = (PyArrayObject*)PyArray_SimpleNew(nd, dims, NPY_FLOAT32);
  
- // Iterate and do each entry in turn...
-  int feats_int = DataMatrix_features(&self->dm);
-  
-  float * grad = (float*)malloc(feats_int * sizeof(float));
-  float * hess = (float*)malloc(feats_int * feats_int * sizeof(float));
-  float * eigen_vec = (float*)malloc(feats_int * feats_int * sizeof(float));
-  float * eigen_val = (float*)malloc(feats_int * sizeof(float));
-  
-  float * out = (float*)PyArray_DATA(ret);
-  int loc = 0;
-  while (loc<DataMatrix_exemplars(&self->dm))
-  {
-   // Obtain the relevant feature vector in internal space...
-    float * fv = DataMatrix_fv(&self->dm, loc, NULL);
-    for (i=0; i<feats_int; i++) self->fv_int[i] = fv[i];
-    
-   // Converge mean shift...
-    manifold(self->spatial, degrees, self->fv_int, grad, hess, eigen_val, eigen_vec, self->quality, self->epsilon, self->iter_cap, (always_hessian==Py_False) ? 0 : 1);
-    
-   // Convert to external space and store in output...
-    fv = DataMatrix_to_ext(&self->dm, self->fv_int, self->fv_ext);
-    for (i=0; i<dims[nd-1]; i++) out[i] = fv[i];
-
-   // Move to next position, detecting when we are done... 
-    loc += 1;
-    out += dims[nd-1];
-  }
+ // Project every exemplar...
+  Batch batch;
+  batch.self = self;
+  batch.row = Batch_manifold_data;
+  batch.rows = DataMatrix_exemplars(&self->dm);
+  batch.manifold = 1;
+  batch.mult = NULL;
+  batch.guess = NULL;
+  batch.basins = NULL;
+  batch.in = NULL;
+  batch.out = ret;
+  batch.degrees = degrees;
+  batch.always_hessian = (always_hessian==Py_False) ? 0 : 1;
+  
+  Batch_run(&batch, threads);
  
  // Clean up...
-  free(eigen_val);
-  free(eigen_vec);
-  free(hess);
-  free(grad);
   free(dims);
  
  // Return...
@@ -2447,6 +4234,258 @@ static PyObject * MeanShift_mult_py(MeanShift * self, PyObject * args, PyObject
 
 
 
+static PyObject * MeanShift_mult_batch_py(MeanShift * self, PyObject * args, PyObject * kw)
+{
+ // Handle the parameters...
+  PyObject * jobs;
+  PyObject * outputs;
+
+  int gibbs = 16;
+  int mci = 64;
+  int mh = 8;
+  int fake = 0;
+  int threads = 1;
+
+  static char * kw_list[] = {"jobs", "outputs", "gibbs", "mci", "mh", "fake", "threads", NULL};
+  if (!PyArg_ParseTupleAndKeywords(args, kw, "OO|iiiii", kw_list, &jobs, &outputs, &gibbs, &mci, &mh, &fake, &threads)) return NULL;
+
+ // Verify the simple parameters...
+  if ((PySequence_Check(jobs)==0)||(PySequence_Check(outputs)==0))
+  {
+   PyErr_SetString(PyExc_RuntimeError, "The jobs and outputs must both impliment the sequence protocol, e.g. be lists, tuples, or equivalent.");
+   return NULL;
+  }
+
+  if (PySequence_Size(jobs)!=PySequence_Size(outputs))
+  {
+   PyErr_SetString(PyExc_RuntimeError, "Need an output array for every job.");
+   return NULL;
+  }
+
+  if (gibbs<1)
+  {
+   PyErr_SetString(PyExc_RuntimeError, "gibbs sampling count must be positive");
+   return NULL;
+  }
+
+  if (mci<1)
+  {
+   PyErr_SetString(PyExc_RuntimeError, "monte carlo integration sampling count must be positive");
+   return NULL;
+  }
+
+  if (mh<1)
+  {
+   PyErr_SetString(PyExc_RuntimeError, "Metropolis Hastings proposal count must be positive");
+   return NULL;
+  }
+
+  if ((fake<0)||(fake>2))
+  {
+   PyErr_SetString(PyExc_RuntimeError, "fake parameter must be 0, 1 or 2");
+   return NULL;
+  }
+
+ // Count the terms, so everything can be allocated in one go...
+  MultBatch mb;
+  mb.jobs = PySequence_Size(jobs);
+
+  if (mb.jobs<1)
+  {
+   PyErr_SetString(PyExc_RuntimeError, "Need at least one job.");
+   return NULL;
+  }
+
+  int total = 0;
+  int j;
+  for (j=0; j<mb.jobs; j++)
+  {
+   PyObject * job = PySequence_GetItem(jobs, j);
+   int terms = (PySequence_Check(job)!=0) ? PySequence_Size(job) : -1;
+   Py_DECREF(job);
+
+   if (terms<1)
+   {
+    PyErr_SetString(PyExc_RuntimeError, "Every job must be a non-empty sequence of MeanShift objects to multiply.");
+    return NULL;
+   }
+
+   total += terms;
+  }
+
+  mb.object = (MeanShift**)malloc(total * sizeof(MeanShift*));
+  mb.config = (KernelConfig*)malloc(total * sizeof(KernelConfig));
+  mb.job_start = (int*)malloc((mb.jobs+1) * sizeof(int));
+  mb.term = (int*)malloc(total * sizeof(int));
+  mb.row_start = (int*)malloc((mb.jobs+1) * sizeof(int));
+  mb.out = (PyArrayObject**)malloc(mb.jobs * sizeof(PyArrayObject*));
+
+  mb.objects = 0;
+  mb.longest = 0;
+  mb.max_terms = 0;
+  mb.max_feats = 0;
+  mb.max_feats_ext = 0;
+
+  mb.gibbs = gibbs;
+  mb.mci = mci;
+  mb.mh = mh;
+  mb.fake = fake;
+
+ // Go through and fill in the jobs, checking everything as we go - the MeanShift objects and output arrays are kept alive by the sequences, so borrowing them is safe...
+  const char * error = NULL;
+  int pos = 0;
+  mb.job_start[0] = 0;
+  mb.row_start[0] = 0;
+
+  for (j=0; (j<mb.jobs)&&(error==NULL); j++)
+  {
+   PyObject * job = PySequence_GetItem(jobs, j);
+   int terms = PySequence_Size(job);
+   if (terms>mb.max_terms) mb.max_terms = terms;
+
+   int t;
+   for (t=0; t<terms; t++)
+   {
+    PyObject * item = PySequence_GetItem(job, t);
+    Py_DECREF(item);
+
+    if (PyObject_IsInstance(item, (PyObject*)&MeanShiftType)!=1)
+    {
+     error = "Job contains an entity that is not a MeanShift object";
+     break;
+    }
+
+    MeanShift * targ = (MeanShift*)item;
+    if (DataMatrix_exemplars(&targ->dm)==0)
+    {
+     error = "Item in a job has no exemplars in its KDE";
+     break;
+    }
+
+    if ((t!=0)&&(DataMatrix_features(&targ->dm)!=DataMatrix_features(&mb.object[mb.term[mb.job_start[j]]]->dm)))
+    {
+     error = "All the KDEs in a job must have the same number of internal features (dimensions)";
+     break;
+    }
+
+    // Find it in the object list, adding it if its new...
+     int oi;
+     for (oi=0; oi<mb.objects; oi++)
+     {
+      if (mb.object[oi]==targ) break;
+     }
+
+     if (oi==mb.objects)
+     {
+      mb.object[oi] = targ;
+      mb.objects += 1;
+
+      if (DataMatrix_exemplars(&targ->dm)>mb.longest) mb.longest = DataMatrix_exemplars(&targ->dm);
+      if (DataMatrix_features(&targ->dm)>mb.max_feats) mb.max_feats = DataMatrix_features(&targ->dm);
+      if (DataMatrix_ext_features(&targ->dm)>mb.max_feats_ext) mb.max_feats_ext = DataMatrix_ext_features(&targ->dm);
+     }
+
+     mb.term[pos] = oi;
+     mb.config[pos] = targ->config;
+     pos += 1;
+   }
+   Py_DECREF(job);
+   if (error!=NULL) break;
+
+   mb.job_start[j+1] = pos;
+
+   // The output array...
+    PyObject * out = PySequence_GetItem(outputs, j);
+    Py_DECREF(out);
+
+    if (PyArray_Check(out)==0)
+    {
+     error = "Every output must be a numpy array";
+     break;
+    }
+
+    mb.out[j] = (PyArrayObject*)out;
+
+    if (PyArray_NDIM(mb.out[j])!=2)
+    {
+     error = "Output arrays must have two dimensions";
+     break;
+    }
+
+    if (PyArray_DIMS(mb.out[j])[1]!=DataMatrix_ext_features(&mb.object[mb.term[mb.job_start[j]]]->dm))
+    {
+     error = "Output arrays must have the same number of columns as the KDEs of their job have features";
+     break;
+    }
+
+    if ((PyArray_DESCR(mb.out[j])->kind!='f')||((PyArray_DESCR(mb.out[j])->elsize!=4)&&(PyArray_DESCR(mb.out[j])->elsize!=8)))
+    {
+     error = "Output arrays must be of type float or double";
+     break;
+    }
+
+    mb.row_start[j+1] = mb.row_start[j] + PyArray_DIMS(mb.out[j])[0];
+  }
+
+  if (error!=NULL)
+  {
+   PyErr_SetString(PyExc_RuntimeError, error);
+
+   free(mb.out);
+   free(mb.row_start);
+   free(mb.term);
+   free(mb.job_start);
+   free(mb.config);
+   free(mb.object);
+   return NULL;
+  }
+
+ // Make sure every object has a spatial, as the workers clone them...
+  int i;
+  for (i=0; i<mb.objects; i++)
+  {
+   MeanShift * targ = mb.object[i];
+   if (targ->spatial==NULL)
+   {
+    targ->spatial = Spatial_new(targ->spatial_type, &targ->dm, mb.object[0]->spatial_param);
+   }
+  }
+
+ // The random number generator belongs to the first object of the first job, as for mult - each row gets its own block, and the index is moved past them all at the end...
+  self = mb.object[0];
+  unsigned int * rng = (self->rng_link!=NULL) ? self->rng_link->rng : self->rng;
+  for (i=0; i<4; i++) mb.rng[i] = rng[i];
+
+ // Run the chains...
+  Batch batch;
+  batch.self = self;
+  batch.row = Batch_mult;
+  batch.rows = mb.row_start[mb.jobs];
+  batch.manifold = 0;
+  batch.mult = &mb;
+  batch.guess = NULL;
+  batch.basins = NULL;
+
+  if (batch.rows>0) Batch_run(&batch, threads);
+
+  unsigned int rows = (unsigned int)batch.rows;
+  rng[1] += rows;
+  if (rng[1]<rows) rng[0] += 1;
+
+ // Clean up and return None...
+  free(mb.out);
+  free(mb.row_start);
+  free(mb.term);
+  free(mb.job_start);
+  free(mb.config);
+  free(mb.object);
+
+  Py_INCREF(Py_None);
+  return Py_None;
+}
+
+
+
 static PyObject * MeanShift_sizeof_py(MeanShift * self, PyObject * args)
 {
  size_t mem = sizeof(MeanShift) - sizeof(DataMatrix); // The DataMatrix has its own size method.
@@ -2462,6 +4501,9 @@ static PyObject * MeanShift_sizeof_py(MeanShift * self, PyObject * args)
  
  if (self->spatial!=NULL) mem += Spatial_byte_size(self->spatial);
  if (self->balls!=NULL) mem += Balls_byte_size(self->balls);
+ if (self->mode_cache!=NULL) mem += Basins_byte_size(self->mode_cache);
+ if (self->cluster_cache!=NULL) mem += Basins_byte_size(self->cluster_cache);
+ if (self->grid!=NULL) mem += Grid_byte_size(self->grid);
  
  if (self->fv_int!=NULL) mem += dims * sizeof(float);
  if (self->fv_ext!=NULL) mem += DataMatrix_ext_features(&self->dm) * sizeof(float);
@@ -2493,9 +4535,52 @@ static PyObject * MeanShift_memory_py(MeanShift * self, PyObject * args)
  size_t balls_mem = 0;
  if (self->balls!=NULL) balls_mem += Balls_byte_size(self->balls);
  
- size_t total_mem = self_mem + (size_t)ceil(kernel_mem / (float)ref_count) + dm_mem + data_mem + spatial_mem + balls_mem;
+ size_t cache_mem = 0;
+ if (self->mode_cache!=NULL) cache_mem += Basins_byte_size(self->mode_cache);
+ if (self->cluster_cache!=NULL) cache_mem += Basins_byte_size(self->cluster_cache);
+ 
+ size_t grid_mem = 0;
+ if (self->grid!=NULL) grid_mem += Grid_byte_size(self->grid);
+ 
+ size_t total_mem = self_mem + (size_t)ceil(kernel_mem / (float)ref_count) + dm_mem + data_mem + spatial_mem + balls_mem + cache_mem + grid_mem;
   
- return Py_BuildValue("{snsnsisnsnsnsnsn}", "data", data_mem, "kernel", kernel_mem, "kernel_ref_count", ref_count, "dm", dm_mem, "spatial", spatial_mem, "balls", balls_mem, "self", self_mem, "total", total_mem);
+ return Py_BuildValue("{snsnsisnsnsnsnsnsnsn}", "data", data_mem, "kernel", kernel_mem, "kernel_ref_count", ref_count, "dm", dm_mem, "spatial", spatial_mem, "balls", balls_mem, "cache", cache_mem, "grid", grid_mem, "self", self_mem, "total", total_mem);
+}
+
+
+
+static PyObject * MeanShift_counters_py(MeanShift * self, PyObject * args)
+{
+ // Handle the optional reset parameter...
+  PyObject * reset = NULL;
+  if (!PyArg_ParseTuple(args, "|O", &reset)) return NULL;
+ 
+ // Sum the counters of the deleted indices with those of the live one...
+  Counters total = self->counters;
+  if (self->spatial!=NULL) Counters_add(&total, Spatial_counters(self->spatial));
+ 
+ // Averages, that are 0 when there is nothing to average over...
+  double per_query = (total.queries>0) ? (1.0 / total.queries) : 0.0;
+  double per_mode = (total.modes>0) ? (1.0 / total.modes) : 0.0;
+  
+#ifndef MS_NO_COUNTERS
+  PyObject * enabled = Py_True;
+#else
+  PyObject * enabled = Py_False;
+#endif
+ 
+ // Build the dictionary...
+  PyObject * ret = Py_BuildValue("{sOsLsLsLsLsLsLsLsLsLsdsdsdsdsdsd}", "enabled", enabled, "queries", total.queries, "candidates", total.candidates, "nodes", total.nodes, "pruned", total.pruned, "kernel_evals", total.kernel_evals, "modes", total.modes, "iterations", total.iterations, "iter_cap_hits", total.iter_cap_hits, "ball_hits", total.ball_hits, "candidates_per_query", total.candidates * per_query, "nodes_per_query", total.nodes * per_query, "pruned_per_query", total.pruned * per_query, "iterations_per_mode", total.iterations * per_mode, "iter_cap_rate", total.iter_cap_hits * per_mode, "ball_hit_rate", total.ball_hits * per_mode);
+  if (ret==NULL) return NULL;
+ 
+ // Reset if requested...
+  if ((reset!=NULL)&&(PyObject_IsTrue(reset)))
+  {
+   Counters_zero(&self->counters);
+   if (self->spatial!=NULL) Counters_zero(Spatial_counters(self->spatial));
+  }
+ 
+ return ret;
 }
 
 
@@ -2560,6 +4645,8 @@ static PyMemberDef MeanShift_members[] =
  {"ident_dist", T_FLOAT, offsetof(MeanShift, ident_dist), 0, "If two exemplars are found at any point to have a distance less than this from each other whilst clustering it is assumed they will go to the same destination, saving computation."},
  {"merge_range", T_FLOAT, offsetof(MeanShift, merge_range), 0, "Controls how close two mean shift locations have to be to be merged in the clustering method."},
  {"merge_check_step", T_INT, offsetof(MeanShift, merge_check_step), 0, "When clustering this controls how many mean shift iterations it does between checking for convergance - simply a tradeoff between wasting time doing mean shift when it has already converged and doing proximity checks for convergance. Should only affect runtime."},
+ {"cache_step", T_FLOAT, offsetof(MeanShift, cache_step), 0, "Size of the grid cells of the basin of attraction caches used by mode, modes, modes_data, cluster, assign_cluster and assign_clusters, in the internal (scaled) space - 0, the default, switches them off. When on every cell a trajectory passes through is recorded with where it went, and later trajectories stop as soon as they enter a recorded cell, which makes repeated queries against the same model (e.g. streaming data) much faster. Larger values are faster but more likely to send points near the edge of a basin to the wrong mode; something like a tenth to a quarter of the kernel size is reasonable. The caches empty themselves when the model or the parameters change."},
+ {"grid_step", T_FLOAT, offsetof(MeanShift, grid_step), 0, "Size of the grid cells, in the internal (scaled) space, of the binned approximation that prob and probs use when this is positive - 0, the default, switches it off. Only supported for 1-3 dimensions and the radial kernels (uniform, triangular, epanechnikov, cosine, gaussian, cauchy, logistic); otherwise, or if the grid would be unreasonably large, the normal calculation is quietly used. The data is linearly binned, convolved with the kernel via the FFT and the grid then interpolated, so once built (on first use, and again whenever the model or quality changes) evaluation is constant time regardless of the number of exemplars. For the gaussian kernel the absolute error is at most d s^2 h / 4, where d is the dimensionality, s the step and h the height of a single kernel holding all the weight; for the other continuous kernels it is at most 2 sqrt(d) s L h, where L is the Lipschitz constant of the kernel (2 for epanechnikov); the uniform kernel gets no pointwise guarantee as its edge is blurred over sqrt(d) s. The kernel is cut off at its range, as for probs_dual. Something like 0.1 is a good starting point."},
  {"rng0", T_UINT, offsetof(MeanShift, rng[0]), 0, "Lets you set the random number generators position index - defaults to 0. Position 0 - the highest 32 bits."},
  {"rng1", T_UINT, offsetof(MeanShift, rng[1]), 0, "Lets you set the random number generators position index - defaults to 0. Position 1."},
  {"rng2", T_UINT, offsetof(MeanShift, rng[2]), 0, "Lets you set the random number generators position index - defaults to 0. Position 2."},
@@ -2589,6 +4676,7 @@ static PyMethodDef MeanShift_methods[] =
  {"get_balls", (PyCFunction)MeanShift_get_balls_py, METH_NOARGS, "Returns the current ball indexing structure, as a string."},
  {"set_balls", (PyCFunction)MeanShift_set_balls_py, METH_VARARGS, "Sets the current ball indexing structure, as identified by a string."},
  
+ {"fisher_cache", (PyCFunction)MeanShift_fisher_cache_py, METH_NOARGS | METH_STATIC, "A static method that reports on the tables shared by all Fisher and MirrorFisher kernels in the process - returns a list with a dictionary per table: {'dims' : Dimension count of the table., 'alpha' : Concentration the table is for, or None for the per dimension count normaliser tables used when multiplying distributions (these cover all concentrations up to where the Gaussian approximation takes over, and are interpolated)., 'entries' : Number of values stored in the table, including the padding either end of the normaliser tables that cubic interpolation needs., 'bytes' : Memory consumed., 'ref_count' : How many kernel configurations are sharing the table; None for the normaliser tables, which last as long as the module., 'error' : Measured accuracy - for normaliser tables the maximum absolute error of the log normaliser, for concentration tables the maximum error, in units of the dot product with the mean direction, of the interpolated inverse cumulative distribution used for drawing.}. Tables are built lazily, so a table only appears once something has needed it."},
  {"info", (PyCFunction)MeanShift_info_py, METH_VARARGS | METH_STATIC, "A static method that is given the name of a kernel, spatial or ball. It then returns a human readable description of that entity."},
  {"info_config", (PyCFunction)MeanShift_info_config_py, METH_VARARGS | METH_STATIC, "Given the name of a kernel this returns None if the kernel does not require any configuration, or a string describing how to configure it if it does."},
  
@@ -2602,6 +4690,17 @@ static PyMethodDef MeanShift_methods[] =
  {"get_dm", (PyCFunction)MeanShift_get_dm_py, METH_NOARGS, "Returns the current data matrix, which will be some kind of numpy ndarray."},
  {"get_dim", (PyCFunction)MeanShift_get_dim_py, METH_NOARGS, "Returns the string that gives the meaning of each dimension, as matched to the number of dimensions in the data matrix."},
  {"get_weight_dim", (PyCFunction)MeanShift_get_weight_dim_py, METH_NOARGS, "Returns the feature vector index that provides the weight of each sample, or None if there is not one and they are all fixed to 1."},
+ {"set_materialise", (PyCFunction)MeanShift_set_materialise_py, METH_VARARGS, "Given a boolean this switches materialisation of the data matrix on or off (defaults to off). When on every feature vector is converted and scaled once, in a single pass, into a contiguous float32 matrix, with a column of weights, and all further access reads from that rather than going through the numpy array. This can be a lot faster, especially for large data sets with conversion or awkward indexing, at the cost of a copy of the data. Instead of True you can give the name of a compact format, to store the copy in less memory (and read less of it for every query) at the cost of some accuracy, which is in the internal (converted and scaled) space: 'float32' (same as True), 'float16' (half precision, 2 bytes per feature, relative error at most 2^-11), 'uint16' (2 bytes per feature) or 'uint8' (1 byte per feature) - the last two quantise each feature uniformly between its minimum and maximum, so the error is at most half the range divided by 65535 or 255 respectively. With the compact formats the weights are only stored if the data is weighted, and the spatial index is rebuilt, so it matches the values the kernels see. Use 'uint8' with care - a range of 25 kernel widths gives an error of a twentieth of a kernel width. The setting survives set_data, set_scale and reset, which rebuild it as required."},
+ {"get_materialise", (PyCFunction)MeanShift_get_materialise_py, METH_NOARGS, "Returns True if the data matrix is materialised, False otherwise."},
+ {"get_materialise_format", (PyCFunction)MeanShift_get_materialise_format_py, METH_NOARGS, "Returns the format of the materialised data matrix, as passed to set_materialise, as a string - 'float32', 'float16', 'uint16' or 'uint8' - or None if it is not materialised."},
+ 
+ {"append", (PyCFunction)MeanShift_append_py, METH_VARARGS, "Appends exemplars to the data matrix, for streaming data in. Requires that set_data has already been called, with a data matrix where the first dimension is the only data dimension and there are no dual dimensions ('df' being typical) - this defines the layout, the type and any weight index and conversion. Takes a numpy array (or anything that can be converted into one) with the same shape as the data matrix apart from the first dimension, or a single exemplar without the first dimension. On the first call the data is copied into an internal buffer, which grows as required, and get_dm then returns a view of the live part of it. If a window has been set (see set_window) the oldest exemplars are evicted to keep the size at the window. The spatial indexing structure is updated rather than rebuilt if it supports it (kd_stream is designed for this; brute_force also works), which makes the cost per call logarithmic rather than linear. Any clustering is lost, as with set_data."},
+ {"set_window", (PyCFunction)MeanShift_set_window_py, METH_VARARGS, "Sets the sliding window size used by append - after each append the oldest exemplars are evicted until no more than this many remain. 0, the default, means no limit. Only takes effect on the next append."},
+ {"get_window", (PyCFunction)MeanShift_get_window_py, METH_NOARGS, "Returns the sliding window size used by append, 0 for no limit."},
+ 
+ {"save", (PyCFunction)MeanShift_save_py, METH_VARARGS, "Saves the model to the given filename, as a single flat file - the data (as float32, in 'df' format with any weight as the last column), its materialised version (converted and scaled), the scale, the kernel, the parameters, the kd tree (if that is the spatial type, built first if required) and the clusters (if cluster has been called). The rng state is not saved, and a data matrix with dual dimensions can not be saved. The file is specific to the machine architecture."},
+ {"load", (PyCFunction)MeanShift_load_py, METH_VARARGS, "Loads a model written by save from the given filename, replacing everything in this object. The file is memory mapped read only and used directly, without copying - the data matrix (get_dm returns a read only view of the file), the materialised data and the kd tree - so loading is fast regardless of size, and multiple processes that load the same file share the memory. Every offset in the file is checked against its size, and the kd tree is checked before use, so a corrupt file raises an error rather than crashing. The object is left materialised. Anything that changes the data (set_scale, append etc.) works as normal, by making private copies."},
+ {"save_layout", (PyCFunction)MeanShift_save_layout_py, METH_NOARGS | METH_STATIC, "A static method that describes the header of the files written by save, for tools that need to inspect or patch them - returns a dictionary where 'header' is the size of the header in bytes, and every other key is a section of the file (kernel, data, scale, mat, mat_weight, indices, arena, balls_data), or arena_size or size, giving the byte position within the header of the 64 bit integer that holds its offset (or size). Specific to the machine architecture, as the file is."},
  
  {"fetch_dm", (PyCFunction)MeanShift_fetch_dm_py, METH_NOARGS, "Returns a new numpy ndarray, of float32 type to be indexed [exemplar, feature], regardless of what was provided to the set_data method. Basically a predicatable version of get_dm that hides weirdness. Note that the order is the same as if you were to use the numpy flatten() method on the data matrix, if you extracted one feature at a time first."},
  {"fetch_weight", (PyCFunction)MeanShift_fetch_weight_py, METH_NOARGS, "Returns a new numpy ndarray, of float32 type indexed by [exemplar] - each entry will be the weight assigned to the given exemplar, noting that if no weights are given then its just going to be a vector of ones. Partner to fetch_dm."},
@@ -2620,34 +4719,41 @@ static PyMethodDef MeanShift_methods[] =
  {"scale_silverman", (PyCFunction)MeanShift_scale_silverman_py, METH_NOARGS, "Sets the scale for the current data using Silverman's rule of thumb, generalised to multidimensional data (Multidimensional version often attributed to Wand & Jones.). Note that this is assuming you are using Gaussian kernels and that the samples have been drawn from a Gaussian - if these asumptions are valid you should probably just fit a Gaussian in the first place, if they are not you should not use this method. Basically, do not use!"},
  {"scale_scott", (PyCFunction)MeanShift_scale_scott_py, METH_NOARGS, "Alternative to scale_silverman - assumptions are very similar and it is hence similarly crap - would recomend against this, though maybe prefered to Silverman."},
  {"loo_nll", (PyCFunction)MeanShift_loo_nll_py, METH_VARARGS, "Calculate the negative log liklihood of the model where it leaves out the sample whos probability is being calculated and then muliplies together the probability of all samples calculated independently. This can be used for model comparison, to see which is better out of several configurations, be that kernel size, kernel type etc. Takes two optional parameters: First, the lower bound on probability, to avoid outliers causing problems - defaults to 1e-16. Second, a limit on how many exemplars to use, rather than the default of using all of them (a negative value) - allows for an even more approximate calculation in considerably less time. The exemplars are drawn with uniform probability and replacement."},
+ {"loo_nll_scales", (PyCFunction)MeanShift_loo_nll_scales_py, METH_VARARGS, "Multi-bandwidth version of loo_nll - given a 2D array of candidate scales, indexed [candidate, feature], returns an array of the loo_nll of each candidate, calculated in a single pass over the data rather than one per candidate (much faster). Has the same two optional parameters as loo_nll, the lower bound on probability and the limit on how many exemplars to use, followed by an optional callback for reporting progress, called as callback(step, candidates) for every step from 0 to candidates-1 as the pass over the data progresses. Only makes sense for kernels where the scale is an inverse bandwidth, so the directional and composite kernels raise a RuntimeError, as do scales that are not positive and finite."},
+ {"loo_nll_search", (PyCFunction)MeanShift_loo_nll_search_py, METH_VARARGS, "Searches for the scale that minimises loo_nll, along the path between two scales, low and high, which is linear in log space. Each pass evaluates a number of candidates evenly spaced across the current bracket, in a single pass over the data, then shrinks the bracket to the neighbours of the best. Parameters are low, high, then optionally the number of candidates per pass (defaults to 16), the number of passes (defaults to 3), the two optional parameters of loo_nll and a progress callback, called as callback(step, candidates * passes) for every step in turn, as for loo_nll_scales. Returns a tuple of (best scale, its loo_nll); does not change the scale."},
  
  {"entropy", (PyCFunction)MeanShift_entropy_py, METH_VARARGS, "Calculates and returns an approximation of the entropy of the distribution represented by this object. As it uses the samples contained within its accuracy will improve with the number of them, much like for the rest of the system. Uses the natural logarithm, so the return is measured in nats. Has one optional parameter - a limit on how many exemplars to use, which will make it take a bootstrap draw from the exemplars and calculate the entropy from that, rather using all exemplars. This makes it more noisy, but can save a lot of computation."},
+ {"coreset", (PyCFunction)MeanShift_coreset_py, METH_VARARGS, "Compresses the density estimate into a weighted coreset, for when there are far more exemplars than needed - queries against the coreset scale with its size rather than the size of the original data. The first parameter is the tolerance, in units of the kernel bandwidth (i.e. in the internal space, after scaling): exemplars are merged by recursively splitting them kd tree style until every exemplar in a cell is within the tolerance of the cells weighted mean, which then replaces them, carrying their total weight. So no exemplar moves further than the tolerance - 0.1 to 0.3 is typical. Returns a tuple of (new MeanShift object, dictionary) - the new object has the same kernel, scale and other settings as this one, with a data matrix of the coreset exemplars (in the external representation, with the same conversion codes) plus a weight column at the end. The dictionary contains {'exemplars' : Coreset size., 'mean_shift' : Weighted mean distance the exemplars moved, in bandwidth units., 'max_shift' : Largest distance any exemplar moved., 'l1_bound' : For the Gaussian kernel a bound on the L1 distance between the original and compressed density estimates (sqrt(2/pi) mean_shift), None for other kernels., 'kl' : Estimate of the kl divergence from this estimate to the coreset, as calculated by the kl method.}. The optional second parameter is passed to kl as its sample count - defaults to 1024; 0 uses every exemplar, negative skips the kl calculation, leaving it None. Directional kernels have the cell means projected back onto the sphere."},
  {"kl", (PyCFunction)MeanShift_kl_py, METH_VARARGS, "Calculates and returns an approximation of the kullback leibler divergance, of the first parameter from self - D(self||arg1). In other words, it returns the average number of extra nats for encoding draws from p if you encode them optimally under the assumption they come from the density estimate of the mean shift object given as the first parameter. Uses the samples within self and solves using them as a sample from the distribution - consequntially the constraint the the KL-divergance be positive is broken by this estimate and you can get negative values out. What to do about this is left to the user. An optional second parameter provides a clamp on how low probability calculations for arg1 values are allowed to get, to avoid divide by zero - it defaults to 1e-16. An optional third parameter switches it from using all exemplars in its estiamte to using a bootstrap draw of the given size instead - saves time at the expense of more noise in the estimate."},
  
- {"prob", (PyCFunction)MeanShift_prob_py, METH_VARARGS, "Given a feature vector returns its probability, as calculated by the kernel density estimate that is defined by the data and kernel. Be warned that the return value can be zero."},
- {"probs", (PyCFunction)MeanShift_probs_py, METH_VARARGS, "Given a data matrix returns an array (1D) containing the probability of each feature, as calculated by the kernel density estimate that is defined by the data and kernel. Be warned that the return values can include zeros, but you can provide an optional second parameter which will clamp no output value to be lower than it."},
+ {"prob", (PyCFunction)MeanShift_prob_py, METH_VARARGS, "Given a feature vector returns its probability, as calculated by the kernel density estimate that is defined by the data and kernel. Be warned that the return value can be zero. Uses the binned approximation if grid_step is set."},
+ {"probs", (PyCFunction)MeanShift_probs_py, METH_VARARGS, "Given a data matrix returns an array (1D) containing the probability of each feature, as calculated by the kernel density estimate that is defined by the data and kernel. Be warned that the return values can include zeros, but you can provide an optional second parameter which will clamp no output value to be lower than it. An optional third parameter is the number of threads to use - defaults to 1, 0 means one per core; the GIL is released whilst it runs. If grid_step is set the binned approximation is used instead, which ignores the thread count."},
+ 
+ {"probs_dual", (PyCFunction)MeanShift_probs_dual_py, METH_VARARGS, "Same as probs, except it uses a dual tree algorithm - a kd tree is built over the given data matrix and traversed against the kd tree of the data, such that groups of feature vectors can be evaluated against groups of exemplars at once, approximating when the kernel bounds are tight enough. Much faster when evaluating lots of feature vectors, but approximate - parameters are (data matrix, relative tolerance, absolute tolerance, clamp), where each output is within abs_tol + rel_tol * its true value. The true value is that returned by probs - the same exemplars are included, so with zero tolerance the two match up to rounding. Tolerances default to 1e-2 and 0; clamp to 0. Only works with the radial kernels (uniform, triangular, epanechnikov, cosine, gaussian, cauchy, logistic) and the kd_tree spatial - for anything else it quietly falls back to the same calculation as probs."},
  
  {"draw", (PyCFunction)MeanShift_draw_py, METH_NOARGS, "Allows you to draw from the distribution represented by the kernel density estimate. Returns a vector and makes use of the internal RNG."},
- {"draws", (PyCFunction)MeanShift_draws_py, METH_VARARGS, "Allows you to draw from the distribution represented by the kernel density estimate. Same as draw except it returns a matrix - you provide a single argument of how many draws to make. Returns an array, <# draws>X<# features> and makes use of the internal RNG."},
- {"bootstrap", (PyCFunction)MeanShift_bootstrap_py, METH_VARARGS, "Does a bootstrap draw from the samples - essentially the same as draws but assuming a Dirac delta function for the kernel. You provide the number of draws; it returns an array, <# draws>X<# features>. Makes use of the contained Philox RNG."},
+ {"draws", (PyCFunction)MeanShift_draws_py, METH_VARARGS, "Allows you to draw from the distribution represented by the kernel density estimate. Same as draw except it returns a matrix - you provide a single argument of how many draws to make. Returns an array, <# draws>X<# features> and makes use of the internal RNG. An optional second parameter, if True, makes it return a tuple of (draws, indices), where indices is a 1D array of the exemplar each draw was centred on - useful for tracking particles."},
+ {"bootstrap", (PyCFunction)MeanShift_bootstrap_py, METH_VARARGS, "Does a bootstrap draw from the samples - essentially the same as draws but assuming a Dirac delta function for the kernel. You provide the number of draws; it returns an array, <# draws>X<# features>. Makes use of the contained Philox RNG. An optional second parameter, if True, makes it return a tuple of (draws, indices), where indices is a 1D array of the exemplar each draw is a copy of."},
  
  {"mode", (PyCFunction)MeanShift_mode_py, METH_VARARGS, "Given a feature vector returns its mode as calculated using mean shift - essentially the maxima in the kernel density estimate to which you converge by climbing the gradient."},
- {"modes", (PyCFunction)MeanShift_modes_py, METH_VARARGS, "Given a data matrix [exemplar, feature] returns a matrix of the same size, where each feature has been replaced by its mode, as calculated using mean shift."},
- {"modes_data", (PyCFunction)MeanShift_modes_data_py, METH_NOARGS, "Runs mean shift on the contained data set, returning a feature vector for each data point. The return value will be indexed in the same way as the provided data matrix, but without the feature dimensions, with an extra dimension at the end to index features. Note that the resulting output will contain a lot of effective duplication, making this a very inefficient method - your better off using the cluster method."},
+ {"modes", (PyCFunction)MeanShift_modes_py, METH_VARARGS, "Given a data matrix [exemplar, feature] returns a matrix of the same size, where each feature has been replaced by its mode, as calculated using mean shift. An optional second parameter is the number of threads to use - defaults to 1, 0 means one per core; the GIL is released whilst it runs."},
+ {"modes_data", (PyCFunction)MeanShift_modes_data_py, METH_VARARGS, "Runs mean shift on the contained data set, returning a feature vector for each data point. The return value will be indexed in the same way as the provided data matrix, but without the feature dimensions, with an extra dimension at the end to index features. Note that the resulting output will contain a lot of effective duplication, making this a very inefficient method - your better off using the cluster method. An optional parameter is the number of threads to use - defaults to 1, 0 means one per core; the GIL is released whilst it runs."},
  
- {"cluster", (PyCFunction)MeanShift_cluster_py, METH_NOARGS, "Clusters the exemplars provided by the data matrix - returns a two tuple (data matrix of all the modes in the dataset, indexed [mode, feature], A matrix of integers, indicating which mode each one has been assigned to by indexing the mode array. Indexing of this array is identical to the provided data matrix, with any feature dimensions removed.). The clustering is replaced each time this is called - do not expect cluster indices to remain consistant after calling this."},
+ {"cluster", (PyCFunction)MeanShift_cluster_py, METH_VARARGS, "Clusters the exemplars provided by the data matrix - returns a two tuple (data matrix of all the modes in the dataset, indexed [mode, feature], A matrix of integers, indicating which mode each one has been assigned to by indexing the mode array. Indexing of this array is identical to the provided data matrix, with any feature dimensions removed.). The clustering is replaced each time this is called - do not expect cluster indices to remain consistant after calling this. An optional parameter is the number of threads to use - defaults to 1, 0 means one per core; the GIL is released whilst it runs. With more than one thread runs of exemplars are converged in parallel, against the modes found by earlier runs, then each is replayed in exemplar order against all of the modes found so far, to find where the single threaded version would have stopped - the result is identical whatever the number of threads."},
  {"assign_cluster", (PyCFunction)MeanShift_assign_cluster_py, METH_VARARGS, "After the cluster method has been called this can be called with a single feature vector. It will then return the index of the cluster to which it has been assigned, noting that this will map to the mode array returned by the cluster method. In the event it does not map to a pre-existing cluster it will return a negative integer - this usually means it is so far from the provided data that the kernel does not include any samples."},
- {"assign_clusters", (PyCFunction)MeanShift_assign_clusters_py, METH_VARARGS, "After the cluster method has been called this can be called with a data matrix. It will then return the indices of the clusters to which each feature vector has been assigned, as a 1D numpy array, noting that this will map to the mode array returned by the cluster method. In the event any entry does not map to a pre-existing cluster it will return a negative integer for it - this usually means it is so far from the provided data that the kernel does not include any samples."},
+ {"assign_clusters", (PyCFunction)MeanShift_assign_clusters_py, METH_VARARGS, "After the cluster method has been called this can be called with a data matrix. It will then return the indices of the clusters to which each feature vector has been assigned, as a 1D numpy array, noting that this will map to the mode array returned by the cluster method. In the event any entry does not map to a pre-existing cluster it will return a negative integer for it - this usually means it is so far from the provided data that the kernel does not include any samples. An optional second parameter is the number of threads to use - defaults to 1, 0 means one per core; the GIL is released whilst it runs."},
  {"cluster_on", (PyCFunction)MeanShift_cluster_on_py, METH_VARARGS, "Acts like cluster, but instead of clustering the contained data it clusters the exemplars provided as a data matrix (only parameter) on the surface of the contained data. This can be thought of as calling the modes method on the provided data matrix and then merging modes that are sufficiently close together to obtain a set of clusters. It returns the same output as cluster, specifically a two tuple: (data matrix of all the modes on the dataset that are represented within the given exemplars, indexed [mode, feature], A matrix of integers, matching the number of provided exemplars, indicating which mode they landed in.). Note that if a provided exemplar is too far away from the given data it will form a cluster where it started; the provided exemplars only interact via cluster merging and are not included in the KDE for which modes are being found. Mode numbers will not match anything else, either other calls to this or calls to cluster."},
  
  {"manifold", (PyCFunction)MeanShift_manifold_py, METH_VARARGS, "Given a feature vector and the dimensionality of the manifold projects the feature vector onto the manfold using subspace constrained mean shift. Returns an array with the same shape as the input. A further optional boolean parameter allows you to enable calculation of the hessain for every iteration (The default, True, correct algorithm), or only do it once at the start (False, incorrect but works for clean data.)."},
- {"manifolds", (PyCFunction)MeanShift_manifolds_py, METH_VARARGS, "Given a data matrix [exemplar, feature] and the dimensionality of the manifold projects the feature vectors onto the manfold using subspace constrained mean shift. Returns a data matrix with the same shape as the input. A further optional boolean parameter allows you to enable calculation of the hessain for every iteration (The default, True, correct algorithm), or only do it once at the start (False, incorrect but works for clean data.)."},
- {"manifolds_data", (PyCFunction)MeanShift_manifolds_data_py, METH_VARARGS, "Given the dimensionality of the manifold projects the feature vectors that are defining the density estimate onto the manfold using subspace constrained mean shift. The return value will be indexed in the same way as the provided data matrix, but without the feature dimensions, with an extra dimension at the end to index features. A further optional boolean parameter allows you to enable calculation of the hessain for every iteration (The default, True, correct algorithm), or only do it once at the start (False, incorrect but works for clean data.)."},
+ {"manifolds", (PyCFunction)MeanShift_manifolds_py, METH_VARARGS, "Given a data matrix [exemplar, feature] and the dimensionality of the manifold projects the feature vectors onto the manfold using subspace constrained mean shift. Returns a data matrix with the same shape as the input. A further optional boolean parameter allows you to enable calculation of the hessain for every iteration (The default, True, correct algorithm), or only do it once at the start (False, incorrect but works for clean data.). After that an optional number of threads to use - defaults to 1, 0 means one per core; the GIL is released whilst it runs."},
+ {"manifolds_data", (PyCFunction)MeanShift_manifolds_data_py, METH_VARARGS, "Given the dimensionality of the manifold projects the feature vectors that are defining the density estimate onto the manfold using subspace constrained mean shift. The return value will be indexed in the same way as the provided data matrix, but without the feature dimensions, with an extra dimension at the end to index features. A further optional boolean parameter allows you to enable calculation of the hessain for every iteration (The default, True, correct algorithm), or only do it once at the start (False, incorrect but works for clean data.). After that an optional number of threads to use - defaults to 1, 0 means one per core; the GIL is released whilst it runs."},
  
  {"mult", (PyCFunction)MeanShift_mult_py, METH_KEYWORDS | METH_VARARGS | METH_STATIC, "A static method that allows you to multiply a bunch of kernel density estimates, and draw some samples from the resulting distribution, outputing the samples into an array. The first input must be a list of MeanShift objects (At least of length 1, though if length 1 it just resamples the input), the second a numpy array for the output - it must be 2D and have the same number of columns as all the MeanShift objects have features/dims; must be float or double. Its row count is how many samples will be drawn from the distribution implied by multiplying the KDEs together. Note that the first object in the MeanShift object list gets to set the kernel - it is assumed that all further objects have the same kernel, and if thats not the case expect problems. Note that this is same structure - different scales and the same kernel with different parameters (e.g. different concentration parameter for a Fisher) is fine. Further to the first two inputs dictionary parameters it allows parameters to be set by name: {'gibbs': Number of Gibbs samples to do, noting its multiplied by the length of the multiplication list and is the number of complete passes through the state, 'mci': Number of samples to do if it has to do monte carlo integration, 'mh': Number of Metropolis-Hastings steps it will do if it has to, multiplied by the length of the multiplicand list, 'fake': Allows you to request an incorrect-but-useful result - the default of 0 is the correct output, 1 is a mode from the Gibbs sampled mixture component instead of a draw, whilst 2 is the average position of the components that made up the selected mixture component.}. Note that this method makes extensive use of the built in rng."},
+ {"mult_batch", (PyCFunction)MeanShift_mult_batch_py, METH_KEYWORDS | METH_VARARGS | METH_STATIC, "A static method that does many mult calls in one go, optionally using several threads, so a whole sweep of belief propagation can be done without returning to Python. The first input is a list of jobs, each a list of MeanShift objects to multiply together with the same requirements as the multiplicand list of mult; the second is a list of output arrays, one per job, each with the same requirements as the output of mult, its row count being how many draws to make from that jobs product. The same MeanShift object can appear in several jobs, but as with mult not twice in the same job. Takes the same keyword parameters as mult ('gibbs', 'mci', 'mh' and 'fake'), plus 'threads', the number of threads to use - defaults to 1, 0 means one per core; the GIL is released whilst it runs. Every output row is an independent Gibbs chain with its own block of the random number sequence, taken from the first MeanShift object of the first job, so the results do not depend on the thread count (they do not match mult, which runs everything from one sequence)."},
  
  {"__sizeof__", (PyCFunction)MeanShift_sizeof_py, METH_NOARGS, "Returns the number of bytes used the complete object. This is a non-trivial calculation, as data can be shared etc. - all the data that it definitely owns is included, as is the byte count for the numpy array that it contains a pointer to. If the kernel type includes a chache that is shared between objects it amortises it - divides the number of bytes by how many objects are using it and rounds up. This set of asusmptions means that if each MeanShoft object has its own numpy array and you sum them all up for a running program then the result is probably reasonable; in other situations it may not be. Also note that it counts all the caches etc. - many of these are not initalised until first used, or resized at various times, so size can vary a lot as you use an object."},
- {"memory", (PyCFunction)MeanShift_memory_py, METH_NOARGS, "Does the same thing as __sizeof__, except it returns a dictionary that breaks down all the byte counts that sum together to create the final value, as well as the final value. Output is {'data' : Size of contained data matrix, 'kernel' : Size of any data from the kernel (for most kernels this is 0), 'kernel_ref_count' : Data from the kernel can be shared between multiple instances - this is that count so you can amortise it if that makes sense, 'dm' : Size of data matrix information without the actual data matrix!, 'spatial' : Size of the spatial data structure, 'balls' : Size of the balls structure, 'self' : Size of just the object without all the stuff its holding pointers to, includes some internal caches, 'total' : Final output, what __sizeof__ returns.}"},
+ {"counters", (PyCFunction)MeanShift_counters_py, METH_VARARGS, "Returns a dictionary of counters of the work done by queries since the object was created (or the counters were last reset), for tuning quality, epsilon and spatial_param against real traffic. Contains 'queries' : Number of range searches of the spatial index, 'candidates' : Exemplars returned by those searches, 'nodes' : Tree nodes visited (0 for brute_force), 'pruned' : Tree nodes skipped because they were out of range, 'kernel_evals' : Kernel evaluations made by the mean shift and probability code, 'modes' : Mean shift convergences run, by any method, 'iterations' : Total iterations of those convergences, 'iter_cap_hits' : Convergences that stopped because they hit iter_cap rather than converging to epsilon, 'ball_hits' : Convergences cut short because they landed in an existing cluster (or a cached basin of attraction), plus the averages 'candidates_per_query', 'nodes_per_query', 'pruned_per_query', 'iterations_per_mode', 'iter_cap_rate' and 'ball_hit_rate'. The counts are cumulative over rebuilds of the spatial index and include the work of every thread of the batch methods. 'enabled' is False if the module was compiled with MS_NO_COUNTERS, in which case everything is zero. Takes one optional parameter - if True the counters are reset to zero after being read."},
+ {"memory", (PyCFunction)MeanShift_memory_py, METH_NOARGS, "Does the same thing as __sizeof__, except it returns a dictionary that breaks down all the byte counts that sum together to create the final value, as well as the final value. Output is {'data' : Size of contained data matrix, 'kernel' : Size of any data from the kernel (for most kernels this is 0), 'kernel_ref_count' : Data from the kernel can be shared between multiple instances - this is that count so you can amortise it if that makes sense, 'dm' : Size of data matrix information without the actual data matrix!, 'spatial' : Size of the spatial data structure, 'balls' : Size of the balls structure, 'cache' : Size of the basin of attraction caches, 'grid' : Size of the binned approximation used by probs, 'self' : Size of just the object without all the stuff its holding pointers to, includes some internal caches, 'total' : Final output, what __sizeof__ returns.}"},
  
  {NULL}
 };
@@ -2716,7 +4822,7 @@ static PyMethodDef ms_c_methods[] =
 
 PyMODINIT_FUNC initms_c(void)
 {
- PyObject * mod = Py_InitModule3("ms_c", ms_c_methods, "Primarily provides a mean shift implementation, but also includes kernel density estimation and subspace constrained mean shift using the same object, such that they are all using the same underlying density estimate. Includes multiple spatial indexing schemes and kernel types, including support for directional data. Clustering is supported, with a choice of cluster intersection tests, as well as the ability to interpret exemplar indexing dimensions of the data matrix as extra features, so it can handle the traditional image segmentation scenario efficiently. Exemplars can also be weighted. There is extensive support for particle filters as well, including multiplication of distributions for non-parametric belief propagation. Note that this module is not multithread safe - use multiprocessing instead.");
+ PyObject * mod = Py_InitModule3("ms_c", ms_c_methods, "Primarily provides a mean shift implementation, but also includes kernel density estimation and subspace constrained mean shift using the same object, such that they are all using the same underlying density estimate. Includes multiple spatial indexing schemes and kernel types, including support for directional data. Clustering is supported, with a choice of cluster intersection tests, as well as the ability to interpret exemplar indexing dimensions of the data matrix as extra features, so it can handle the traditional image segmentation scenario efficiently. Exemplars can also be weighted. There is extensive support for particle filters as well, including multiplication of distributions for non-parametric belief propagation. Note that this module is not multithread safe - the batch methods (probs, modes, modes_data, assign_clusters, manifolds and manifolds_data) can use multiple threads internally, and release the GIL whilst doing so, but a MeanShift object must not be used or modified by another thread whilst one of them is running.");
  
  import_array();
  
@@ -2728,4 +4834,7 @@ PyMODINIT_FUNC initms_c(void)
  // Fun little hack - there is some memory in a global pointer, so we add a capsule object to the module for no other purpose than to make sure it gets free-ed via the capsule destructor when the module is put down...
   PyObject * bessel_death = PyCapsule_New("Ignore me", NULL, FreeBesselMemory);
   PyModule_AddObject(mod, "__bessel_death", bessel_death);
+  
+  PyObject * fisher_cache_death = PyCapsule_New("Ignore me", NULL, FreeFisherCache);
+  PyModule_AddObject(mod, "__fisher_cache_death", fisher_cache_death);
 }
@@ -20,6 +20,9 @@
 #include <numpy/arrayobject.h>
 
 #include "mean_shift.h"
+#include "grid.h"
+#include "fisher_cache.h"
+#include "coreset.h"
 
 
 
@@ -70,6 +73,27 @@ struct MeanShift
  // Two temporaries, to save on mallocs...
   float * fv_int; // length matches that of internal data matrix, after conversion.
   float * fv_ext; // length matches that of external data matrix.
+  
+ // The format the data matrix should be materialised in, a MatType - MAT_NONE (zero) if it should not be. Kept here as set_data replaces the data matrix...
+  int materialise;
+  
+ // For streaming - the buffer that append writes into, with the data matrix being a view of the live part starting at buffer_start, plus the sliding window size (0 for none)...
+  PyArrayObject * buffer;
+  int buffer_start;
+  int window;
+  
+ // Optional caches of the basins of attraction, one for mode (positions) and one for assign_cluster (ball indices) - cache_step is the size of the cells in the internal space, with 0 switching them off. generation is incremented whenever the density estimate or the balls change, so the caches know when to empty themselves...
+  float cache_step;
+  unsigned int generation;
+  Basins * mode_cache;
+  Basins * cluster_cache;
+  
+ // Optional binned approximation used by prob and probs, for low dimensional data - grid_step is the size of the grid cells in the internal space, with 0 switching it off. Built when first needed, and rebuilt when the generation or parameters change...
+  float grid_step;
+  Grid * grid;
+  
+ // Work counters (see spatial.h) accumulated from spatial indices that have since been deleted - the live spatial holds the rest, with the workers of the batch methods folding theirs into it when they finish...
+  Counters counters;
 };
 
 
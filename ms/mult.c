@@ -11,8 +11,9 @@
 #include "mult.h"
 
 #include "kernels.h"
+#include "mean_shift.h"
 #include "philox.h"
-#include "bessel.h"
+#include "fisher_cache.h"
 
 #include <stdlib.h>
 
@@ -32,6 +33,10 @@ void MultCache_new(MultCache * self)
  self->fv = NULL;
  self->scale = NULL;
  
+ self->max_configs = 0;
+ self->used_configs = 0;
+ self->configs = NULL;
+ 
  self->rng = NULL;
  
  self->gibbs_samples = 1;
@@ -50,6 +55,8 @@ void MultCache_delete(MultCache * self)
  free(self->scaled);
  free(self->fv);
  free(self->scale);
+ 
+ free(self->configs);
 }
 
 
@@ -76,6 +83,25 @@ void MultCache_ensure(MultCache * self, int dims, int terms)
 }
 
 
+KernelConfig * MultCache_push_configs(MultCache * self, int count, int reserve)
+{
+ if ((self->used_configs==0)&&(self->max_configs<reserve))
+ {
+  self->max_configs = reserve;
+  self->configs = (KernelConfig*)realloc(self->configs, self->max_configs * sizeof(KernelConfig));
+ }
+ 
+ KernelConfig * ret = self->configs + self->used_configs;
+ self->used_configs += count;
+ return ret;
+}
+
+void MultCache_pop_configs(MultCache * self, int count)
+{
+ self->used_configs -= count;
+}
+
+
 
 float mult_area_mci(const Kernel * kernel, KernelConfig * config, int dims, int terms, const float ** fv, const float ** scale, MultCache * cache)
 {
@@ -226,10 +252,7 @@ float mult_area_fisher(FisherConfig ** config, int dims, int terms, const float
    }
    else
    {
-    exp_me -= mult_conc;
-    exp_me -= (0.5 * dims - 1) * log(mult_conc);
-    exp_me += (0.5 * dims) * log(2 * M_PI);
-    exp_me += LogModBesselFirst(dims-2, mult_conc, 1e-6, 1024); 
+    exp_me -= mult_conc + FisherNorm_log_norm(dims, mult_conc); // Table lookup.
    }
 
   // Now loop through and divide by each Fisher terms normalisation in turn... 
@@ -295,10 +318,7 @@ float mult_area_mirror_fisher(FisherConfig ** config, int dims, int terms, const
      else
      {
       // Value of the normalised distribution...
-       exp_me -= mult_conc;
-       exp_me -= (0.5 * dims - 1) * log(mult_conc);
-       exp_me += (0.5 * dims) * log(2 * M_PI);
-       exp_me += LogModBesselFirst(dims-2, mult_conc, 1e-6, 1024);
+       exp_me -= mult_conc + FisherNorm_log_norm(dims, mult_conc); // Table lookup.
      }
     
     // Now loop through and divide by each Fisher terms normalisation in turn...
@@ -478,10 +498,16 @@ void mult(const Kernel * kernel, KernelConfig * config, int terms, Spatial * spa
   int i;
   int samples = cache->gibbs_samples * terms;
   
-  float range = 2.0 * kernel->range(dims, (config!=NULL)?config[0]:NULL, quality);
+  int t;
+  float range = 0.0;
+  for (t=0; t<terms; t++)
+  {
+   float r = spatial_range(spatials[t], kernel, (config!=NULL)?config[t]:NULL, quality);
+   if (r>range) range = r;
+  }
+  range *= 2.0;
   
  // Store the scales into the cache...
-  int t;
   for (t=0; t<terms; t++)
   {
    cache->scale[t] = Spatial_dm(spatials[t])->mult;
@@ -44,6 +44,11 @@ struct MultCache
   const float ** fv;
   const float ** scale;
  
+ // Stack of per term configuration arrays, which composite kernels fill in for their children - kept here rather than in the kernel configuration so each thread has its own...
+  int max_configs;
+  int used_configs;
+  KernelConfig * configs;
+ 
  // Random number generator...
   PhiloxRNG * rng;
  
@@ -61,6 +66,10 @@ void MultCache_delete(MultCache * self);
 // Makes sure it has enough cache for the given size, re-allocating it if need be...
 void MultCache_ensure(MultCache * self, int dims, int terms);
 
+// Claims count entries from the configuration stack, to be handed back with pop once done. reserve is how many entries the caller and anything it calls will claim in total - the stack is only resized when it is empty, as resizing would move the arrays of any callers further up...
+KernelConfig * MultCache_push_configs(MultCache * self, int count, int reserve);
+void MultCache_pop_configs(MultCache * self, int count);
+
 
 
 // Uses monte carlo integration to approximate the area under the multiplication of several exemplars with associated kernel - effectivly the weight to use if you multiply these mixtures components together and put them into a mixture model with other ones...
@@ -19,8 +19,8 @@ from distutils.core import Extension
 
 
 
-depends = ['philox.h', 'bessel.h', 'eigen.h', 'mult.h', 'kernels.h', 'convert.h', 'data_matrix.h', 'spatial.h', 'balls.h', 'mean_shift.h', 'ms_c.h']
-code = ['philox.c', 'bessel.c', 'eigen.c', 'mult.c', 'kernels.c', 'convert.c', 'data_matrix.c', 'spatial.c', 'balls.c',  'mean_shift.c', 'ms_c.c']
+depends = ['philox.h', 'bessel.h', 'fisher_cache.h', 'eigen.h', 'mult.h', 'simd.h', 'kernels.h', 'convert.h', 'data_matrix.h', 'spatial.h', 'balls.h', 'basins.h', 'mean_shift.h', 'grid.h', 'coreset.h', 'ms_c.h']
+code = ['philox.c', 'bessel.c', 'fisher_cache.c', 'eigen.c', 'mult.c', 'simd.c', 'kernels.c', 'convert.c', 'data_matrix.c', 'spatial.c', 'balls.c', 'basins.c', 'mean_shift.c', 'grid.c', 'coreset.c', 'ms_c.c']
 
 ext = Extension('ms_c', code, depends=depends)
 
@@ -0,0 +1,454 @@
+// Copyright 2013 Tom SF Haines
+
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except in compliance with the License. You may obtain a copy of the License at
+
+//   http://www.apache.org/licenses/LICENSE-2.0
+
+// Unless required by applicable law or agreed to in writing, software distributed under the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the License for the specific language governing permissions and limitations under the License.
+
+
+
+#include "simd.h"
+
+#include <math.h>
+#include <pthread.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SIMD_X86
+#include <immintrin.h>
+#endif
+
+
+
+// The set of implimentations for one instruction set - selected once, on first use...
+typedef struct SimdOps SimdOps;
+
+struct SimdOps
+{
+ const char * name;
+
+ void (*uniform)(int count, const float * dist_sqr, float * weight);
+ void (*triangular)(int count, const float * dist_sqr, float * weight);
+ void (*epanechnikov)(int count, const float * dist_sqr, float * weight);
+ void (*gaussian)(int count, const float * dist_sqr, float * weight);
+ void (*cauchy)(int count, const float * dist_sqr, float * weight);
+ void (*fisher)(int count, const float * dist_sqr, float * weight, float alpha, float log_norm, int approx);
+};
+
+
+
+// Plain C versions, which match the weight methods of the kernels exactly - also used for the tail of a block by the vectorised versions...
+void Plain_uniform(int count, const float * dist_sqr, float * weight)
+{
+ int i;
+ for (i=0; i<count; i++)
+ {
+  if (dist_sqr[i]>1.0) weight[i] = 0.0;
+ }
+}
+
+void Plain_triangular(int count, const float * dist_sqr, float * weight)
+{
+ int i;
+ for (i=0; i<count; i++)
+ {
+  if (dist_sqr[i]>1.0) weight[i] = 0.0;
+  else weight[i] *= 1.0 - sqrt(dist_sqr[i]);
+ }
+}
+
+void Plain_epanechnikov(int count, const float * dist_sqr, float * weight)
+{
+ int i;
+ for (i=0; i<count; i++)
+ {
+  if (dist_sqr[i]>1.0) weight[i] = 0.0;
+  else weight[i] *= 1.0 - dist_sqr[i];
+ }
+}
+
+void Plain_gaussian(int count, const float * dist_sqr, float * weight)
+{
+ int i;
+ for (i=0; i<count; i++) weight[i] *= exp(-0.5 * dist_sqr[i]);
+}
+
+void Plain_cauchy(int count, const float * dist_sqr, float * weight)
+{
+ int i;
+ for (i=0; i<count; i++) weight[i] *= 1.0 / (1.0 + dist_sqr[i]);
+}
+
+void Plain_fisher(int count, const float * dist_sqr, float * weight, float alpha, float log_norm, int approx)
+{
+ int i;
+ for (i=0; i<count; i++)
+ {
+  float cos_ang = 1.0 - 0.5*dist_sqr[i]; // Law of cosines, as in Fisher_weight.
+
+  if (approx)
+  {
+   if (cos_ang>0.0) weight[i] *= exp(-0.5 * alpha * (1.0 - cos_ang*cos_ang) + log_norm);
+   else weight[i] = 0.0;
+  }
+  else
+  {
+   weight[i] *= exp(alpha * cos_ang + log_norm);
+  }
+ }
+}
+
+
+static const SimdOps PlainOps =
+{
+ "none",
+ Plain_uniform,
+ Plain_triangular,
+ Plain_epanechnikov,
+ Plain_gaussian,
+ Plain_cauchy,
+ Plain_fisher,
+};
+
+
+
+#ifdef SIMD_X86
+
+// AVX2 versions, 8 at a time. exp is calculated by splitting into a power of two and a remainder in [-ln(2)/2, ln(2)/2], with a polynomial for the remainder - relative error is around 2e-7. Input is clamped to the range where the result is a normal float...
+__attribute__((target("avx2,fma"))) static inline __m256 Avx2_exp(__m256 x)
+{
+ x = _mm256_min_ps(x, _mm256_set1_ps(88.0f));
+ x = _mm256_max_ps(x, _mm256_set1_ps(-87.0f));
+
+ __m256 n = _mm256_round_ps(_mm256_mul_ps(x, _mm256_set1_ps(1.44269504f)), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+ __m256 r = _mm256_fnmadd_ps(n, _mm256_set1_ps(0.693359375f), x);
+ r = _mm256_fnmadd_ps(n, _mm256_set1_ps(-2.12194440e-4f), r);
+
+ __m256 p = _mm256_set1_ps(1.0f/720.0f);
+ p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(1.0f/120.0f));
+ p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(1.0f/24.0f));
+ p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(1.0f/6.0f));
+ p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(0.5f));
+ p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(1.0f));
+ p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(1.0f));
+
+ __m256i e = _mm256_slli_epi32(_mm256_add_epi32(_mm256_cvtps_epi32(n), _mm256_set1_epi32(127)), 23);
+ return _mm256_mul_ps(p, _mm256_castsi256_ps(e));
+}
+
+
+__attribute__((target("avx2,fma"))) void Avx2_uniform(int count, const float * dist_sqr, float * weight)
+{
+ int i;
+ __m256 one = _mm256_set1_ps(1.0f);
+ for (i=0; i+8<=count; i+=8)
+ {
+  __m256 d = _mm256_loadu_ps(dist_sqr + i);
+  __m256 w = _mm256_loadu_ps(weight + i);
+  w = _mm256_and_ps(w, _mm256_cmp_ps(d, one, _CMP_LE_OQ));
+  _mm256_storeu_ps(weight + i, w);
+ }
+ Plain_uniform(count - i, dist_sqr + i, weight + i);
+}
+
+__attribute__((target("avx2,fma"))) void Avx2_triangular(int count, const float * dist_sqr, float * weight)
+{
+ int i;
+ __m256 one = _mm256_set1_ps(1.0f);
+ for (i=0; i+8<=count; i+=8)
+ {
+  __m256 d = _mm256_loadu_ps(dist_sqr + i);
+  __m256 w = _mm256_loadu_ps(weight + i);
+  __m256 inside = _mm256_cmp_ps(d, one, _CMP_LE_OQ);
+  w = _mm256_mul_ps(w, _mm256_sub_ps(one, _mm256_sqrt_ps(_mm256_and_ps(d, inside))));
+  _mm256_storeu_ps(weight + i, _mm256_and_ps(w, inside));
+ }
+ Plain_triangular(count - i, dist_sqr + i, weight + i);
+}
+
+__attribute__((target("avx2,fma"))) void Avx2_epanechnikov(int count, const float * dist_sqr, float * weight)
+{
+ int i;
+ __m256 one = _mm256_set1_ps(1.0f);
+ for (i=0; i+8<=count; i+=8)
+ {
+  __m256 d = _mm256_loadu_ps(dist_sqr + i);
+  __m256 w = _mm256_loadu_ps(weight + i);
+  __m256 inside = _mm256_cmp_ps(d, one, _CMP_LE_OQ);
+  w = _mm256_mul_ps(w, _mm256_sub_ps(one, d));
+  _mm256_storeu_ps(weight + i, _mm256_and_ps(w, inside));
+ }
+ Plain_epanechnikov(count - i, dist_sqr + i, weight + i);
+}
+
+__attribute__((target("avx2,fma"))) void Avx2_gaussian(int count, const float * dist_sqr, float * weight)
+{
+ int i;
+ __m256 half = _mm256_set1_ps(-0.5f);
+ for (i=0; i+8<=count; i+=8)
+ {
+  __m256 d = _mm256_loadu_ps(dist_sqr + i);
+  __m256 w = _mm256_loadu_ps(weight + i);
+  w = _mm256_mul_ps(w, Avx2_exp(_mm256_mul_ps(d, half)));
+  _mm256_storeu_ps(weight + i, w);
+ }
+ Plain_gaussian(count - i, dist_sqr + i, weight + i);
+}
+
+__attribute__((target("avx2,fma"))) void Avx2_cauchy(int count, const float * dist_sqr, float * weight)
+{
+ int i;
+ __m256 one = _mm256_set1_ps(1.0f);
+ for (i=0; i+8<=count; i+=8)
+ {
+  __m256 d = _mm256_loadu_ps(dist_sqr + i);
+  __m256 w = _mm256_loadu_ps(weight + i);
+  w = _mm256_div_ps(w, _mm256_add_ps(one, d));
+  _mm256_storeu_ps(weight + i, w);
+ }
+ Plain_cauchy(count - i, dist_sqr + i, weight + i);
+}
+
+__attribute__((target("avx2,fma"))) void Avx2_fisher(int count, const float * dist_sqr, float * weight, float alpha, float log_norm, int approx)
+{
+ int i;
+ __m256 one = _mm256_set1_ps(1.0f);
+ __m256 half = _mm256_set1_ps(0.5f);
+ __m256 va = _mm256_set1_ps(alpha);
+ __m256 vha = _mm256_set1_ps(-0.5f * alpha);
+ __m256 vn = _mm256_set1_ps(log_norm);
+
+ for (i=0; i+8<=count; i+=8)
+ {
+  __m256 d = _mm256_loadu_ps(dist_sqr + i);
+  __m256 w = _mm256_loadu_ps(weight + i);
+  __m256 cos_ang = _mm256_fnmadd_ps(half, d, one);
+
+  if (approx)
+  {
+   __m256 sin_sqr = _mm256_fnmadd_ps(cos_ang, cos_ang, one);
+   w = _mm256_mul_ps(w, Avx2_exp(_mm256_fmadd_ps(vha, sin_sqr, vn)));
+   w = _mm256_and_ps(w, _mm256_cmp_ps(cos_ang, _mm256_setzero_ps(), _CMP_GT_OQ));
+  }
+  else
+  {
+   w = _mm256_mul_ps(w, Avx2_exp(_mm256_fmadd_ps(va, cos_ang, vn)));
+  }
+
+  _mm256_storeu_ps(weight + i, w);
+ }
+ Plain_fisher(count - i, dist_sqr + i, weight + i, alpha, log_norm, approx);
+}
+
+
+static const SimdOps Avx2Ops =
+{
+ "avx2",
+ Avx2_uniform,
+ Avx2_triangular,
+ Avx2_epanechnikov,
+ Avx2_gaussian,
+ Avx2_cauchy,
+ Avx2_fisher,
+};
+
+
+
+// AVX-512 versions, 16 at a time - same approach as the AVX2 versions...
+__attribute__((target("avx512f"))) static inline __m512 Avx512_exp(__m512 x)
+{
+ x = _mm512_min_ps(x, _mm512_set1_ps(88.0f));
+ x = _mm512_max_ps(x, _mm512_set1_ps(-87.0f));
+
+ __m512 n = _mm512_roundscale_ps(_mm512_mul_ps(x, _mm512_set1_ps(1.44269504f)), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+ __m512 r = _mm512_fnmadd_ps(n, _mm512_set1_ps(0.693359375f), x);
+ r = _mm512_fnmadd_ps(n, _mm512_set1_ps(-2.12194440e-4f), r);
+
+ __m512 p = _mm512_set1_ps(1.0f/720.0f);
+ p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(1.0f/120.0f));
+ p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(1.0f/24.0f));
+ p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(1.0f/6.0f));
+ p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(0.5f));
+ p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(1.0f));
+ p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(1.0f));
+
+ return _mm512_scalef_ps(p, n);
+}
+
+
+__attribute__((target("avx512f"))) void Avx512_uniform(int count, const float * dist_sqr, float * weight)
+{
+ int i;
+ __m512 one = _mm512_set1_ps(1.0f);
+ for (i=0; i+16<=count; i+=16)
+ {
+  __m512 d = _mm512_loadu_ps(dist_sqr + i);
+  __m512 w = _mm512_loadu_ps(weight + i);
+  w = _mm512_maskz_mov_ps(_mm512_cmp_ps_mask(d, one, _CMP_LE_OQ), w);
+  _mm512_storeu_ps(weight + i, w);
+ }
+ Plain_uniform(count - i, dist_sqr + i, weight + i);
+}
+
+__attribute__((target("avx512f"))) void Avx512_triangular(int count, const float * dist_sqr, float * weight)
+{
+ int i;
+ __m512 one = _mm512_set1_ps(1.0f);
+ for (i=0; i+16<=count; i+=16)
+ {
+  __m512 d = _mm512_loadu_ps(dist_sqr + i);
+  __m512 w = _mm512_loadu_ps(weight + i);
+  __mmask16 inside = _mm512_cmp_ps_mask(d, one, _CMP_LE_OQ);
+  w = _mm512_maskz_mul_ps(inside, w, _mm512_sub_ps(one, _mm512_sqrt_ps(_mm512_maskz_mov_ps(inside, d))));
+  _mm512_storeu_ps(weight + i, w);
+ }
+ Plain_triangular(count - i, dist_sqr + i, weight + i);
+}
+
+__attribute__((target("avx512f"))) void Avx512_epanechnikov(int count, const float * dist_sqr, float * weight)
+{
+ int i;
+ __m512 one = _mm512_set1_ps(1.0f);
+ for (i=0; i+16<=count; i+=16)
+ {
+  __m512 d = _mm512_loadu_ps(dist_sqr + i);
+  __m512 w = _mm512_loadu_ps(weight + i);
+  __mmask16 inside = _mm512_cmp_ps_mask(d, one, _CMP_LE_OQ);
+  w = _mm512_maskz_mul_ps(inside, w, _mm512_sub_ps(one, d));
+  _mm512_storeu_ps(weight + i, w);
+ }
+ Plain_epanechnikov(count - i, dist_sqr + i, weight + i);
+}
+
+__attribute__((target("avx512f"))) void Avx512_gaussian(int count, const float * dist_sqr, float * weight)
+{
+ int i;
+ __m512 half = _mm512_set1_ps(-0.5f);
+ for (i=0; i+16<=count; i+=16)
+ {
+  __m512 d = _mm512_loadu_ps(dist_sqr + i);
+  __m512 w = _mm512_loadu_ps(weight + i);
+  w = _mm512_mul_ps(w, Avx512_exp(_mm512_mul_ps(d, half)));
+  _mm512_storeu_ps(weight + i, w);
+ }
+ Plain_gaussian(count - i, dist_sqr + i, weight + i);
+}
+
+__attribute__((target("avx512f"))) void Avx512_cauchy(int count, const float * dist_sqr, float * weight)
+{
+ int i;
+ __m512 one = _mm512_set1_ps(1.0f);
+ for (i=0; i+16<=count; i+=16)
+ {
+  __m512 d = _mm512_loadu_ps(dist_sqr + i);
+  __m512 w = _mm512_loadu_ps(weight + i);
+  w = _mm512_div_ps(w, _mm512_add_ps(one, d));
+  _mm512_storeu_ps(weight + i, w);
+ }
+ Plain_cauchy(count - i, dist_sqr + i, weight + i);
+}
+
+__attribute__((target("avx512f"))) void Avx512_fisher(int count, const float * dist_sqr, float * weight, float alpha, float log_norm, int approx)
+{
+ int i;
+ __m512 one = _mm512_set1_ps(1.0f);
+ __m512 half = _mm512_set1_ps(0.5f);
+ __m512 va = _mm512_set1_ps(alpha);
+ __m512 vha = _mm512_set1_ps(-0.5f * alpha);
+ __m512 vn = _mm512_set1_ps(log_norm);
+
+ for (i=0; i+16<=count; i+=16)
+ {
+  __m512 d = _mm512_loadu_ps(dist_sqr + i);
+  __m512 w = _mm512_loadu_ps(weight + i);
+  __m512 cos_ang = _mm512_fnmadd_ps(half, d, one);
+
+  if (approx)
+  {
+   __m512 sin_sqr = _mm512_fnmadd_ps(cos_ang, cos_ang, one);
+   __mmask16 front = _mm512_cmp_ps_mask(cos_ang, _mm512_setzero_ps(), _CMP_GT_OQ);
+   w = _mm512_maskz_mul_ps(front, w, Avx512_exp(_mm512_fmadd_ps(vha, sin_sqr, vn)));
+  }
+  else
+  {
+   w = _mm512_mul_ps(w, Avx512_exp(_mm512_fmadd_ps(va, cos_ang, vn)));
+  }
+
+  _mm512_storeu_ps(weight + i, w);
+ }
+ Plain_fisher(count - i, dist_sqr + i, weight + i, alpha, log_norm, approx);
+}
+
+
+static const SimdOps Avx512Ops =
+{
+ "avx512",
+ Avx512_uniform,
+ Avx512_triangular,
+ Avx512_epanechnikov,
+ Avx512_gaussian,
+ Avx512_cauchy,
+ Avx512_fisher,
+};
+
+#endif
+
+
+
+// Selection of the implimentation, done once...
+static const SimdOps * simd_ops = &PlainOps;
+static pthread_once_t simd_once = PTHREAD_ONCE_INIT;
+
+void Simd_select(void)
+{
+ #ifdef SIMD_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f")) simd_ops = &Avx512Ops;
+  else if (__builtin_cpu_supports("avx2")&&__builtin_cpu_supports("fma")) simd_ops = &Avx2Ops;
+ #endif
+}
+
+static inline const SimdOps * Simd_ops(void)
+{
+ pthread_once(&simd_once, Simd_select);
+ return simd_ops;
+}
+
+
+
+void Simd_uniform(int count, const float * dist_sqr, float * weight)
+{
+ Simd_ops()->uniform(count, dist_sqr, weight);
+}
+
+void Simd_triangular(int count, const float * dist_sqr, float * weight)
+{
+ Simd_ops()->triangular(count, dist_sqr, weight);
+}
+
+void Simd_epanechnikov(int count, const float * dist_sqr, float * weight)
+{
+ Simd_ops()->epanechnikov(count, dist_sqr, weight);
+}
+
+void Simd_gaussian(int count, const float * dist_sqr, float * weight)
+{
+ Simd_ops()->gaussian(count, dist_sqr, weight);
+}
+
+void Simd_cauchy(int count, const float * dist_sqr, float * weight)
+{
+ Simd_ops()->cauchy(count, dist_sqr, weight);
+}
+
+void Simd_fisher(int count, const float * dist_sqr, float * weight, float alpha, float log_norm, int approx)
+{
+ Simd_ops()->fisher(count, dist_sqr, weight, alpha, log_norm, approx);
+}
+
+
+
+const char * Simd_level(void)
+{
+ return Simd_ops()->name;
+}
@@ -0,0 +1,32 @@
+#ifndef SIMD_H
+#define SIMD_H
+
+// Copyright 2013 Tom SF Haines
+
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except in compliance with the License. You may obtain a copy of the License at
+
+//   http://www.apache.org/licenses/LICENSE-2.0
+
+// Unless required by applicable law or agreed to in writing, software distributed under the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the License for the specific language governing permissions and limitations under the License.
+
+
+
+// Vectorised profiles of the radial kernels, for evaluating kernels on blocks of exemplars at once. Each takes count squared distances (already scaled for a kernel size of 1) and multiplies the matching weights by the kernel profile, without normalisation, so the results match the weight method of the matching kernel. Uses AVX-512 or AVX2 if the cpu supports it, as detected on first use, with plain C otherwise...
+
+void Simd_uniform(int count, const float * dist_sqr, float * weight);
+void Simd_triangular(int count, const float * dist_sqr, float * weight);
+void Simd_epanechnikov(int count, const float * dist_sqr, float * weight);
+void Simd_gaussian(int count, const float * dist_sqr, float * weight);
+void Simd_cauchy(int count, const float * dist_sqr, float * weight);
+
+// The von-Mises Fisher kernel, where the squared distance is between unit vectors. approx is non-zero to use the Gaussian approximation of the Fisher kernel, as used for high concentrations...
+void Simd_fisher(int count, const float * dist_sqr, float * weight, float alpha, float log_norm, int approx);
+
+
+
+// Returns the instruction set in use - "avx512", "avx2" or "none"...
+const char * Simd_level(void);
+
+
+
+#endif
@@ -11,13 +11,39 @@
 #include "spatial.h"
 
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+
+
+// The counters...
+void Counters_zero(Counters * this)
+{
+ memset(this, 0, sizeof(Counters));
+}
+
+void Counters_add(Counters * this, const Counters * other)
+{
+ this->queries += other->queries;
+ this->candidates += other->candidates;
+ this->nodes += other->nodes;
+ this->pruned += other->pruned;
+ this->kernel_evals += other->kernel_evals;
+ this->modes += other->modes;
+ this->iterations += other->iterations;
+ this->iter_cap_hits += other->iter_cap_hits;
+ this->ball_hits += other->ball_hits;
+}
 
 
 
 // The conveniance methods that handle all Spatial objects...
 Spatial Spatial_new(const SpatialType * type, DataMatrix * dm, float param)
 {
- return type->init(dm, param);
+ Spatial ret = type->init(dm, param);
+ Counters_zero(Spatial_counters(ret));
+ return ret;
 }
 
 void Spatial_delete(Spatial this)
@@ -27,6 +53,35 @@ void Spatial_delete(Spatial this)
 }
 
 
+Spatial Spatial_clone(Spatial this, DataMatrix * dm)
+{
+ const SpatialType * type = *(const SpatialType**)this;
+ Spatial ret = type->clone(this, dm);
+ Counters_zero(Spatial_counters(ret));
+ return ret;
+}
+
+
+int Spatial_shift(Spatial this, int evicted)
+{
+ const SpatialType * type = *(const SpatialType**)this;
+ if (type->shift==NULL) return 0;
+ 
+ type->shift(this, evicted);
+ return 1;
+}
+
+
+int Spatial_images(Spatial this, int states, SpatialImageNext next, void * config)
+{
+ const SpatialType * type = *(const SpatialType**)this;
+ if (type->images==NULL) return 0;
+ 
+ type->images(this, states, next, config);
+ return 1;
+}
+
+
 const SpatialType * Spatial_type(Spatial this)
 {
  return *(const SpatialType**)this;
@@ -42,13 +97,16 @@ DataMatrix * Spatial_dm(Spatial this)
 void Spatial_start(Spatial this, const float * centre, float range)
 {
  const SpatialType * type = *(const SpatialType**)this;
+ COUNT(Spatial_counters(this), queries, 1);
  type->start(this, centre, range);
 }
 
 int Spatial_next(Spatial this)
 {
  const SpatialType * type = *(const SpatialType**)this;
- return type->next(this); 
+ int ret = type->next(this);
+ COUNT(Spatial_counters(this), candidates, (ret>=0));
+ return ret;
 }
 
 size_t Spatial_byte_size(Spatial this)
@@ -57,6 +115,11 @@ size_t Spatial_byte_size(Spatial this)
  return type->byte_size(this);
 }
 
+Counters * Spatial_counters(Spatial this)
+{
+ return &((SpatialHead*)this)->counters;
+}
+
 
 
 // Implimentation of the brute force spatial indexer...
@@ -65,6 +128,7 @@ typedef struct BruteForce BruteForce;
 struct BruteForce
 {
  const SpatialType * type;
+ Counters counters; // Must follow type - see SpatialHead.
  
  DataMatrix * dm;
  
@@ -91,6 +155,18 @@ void BruteForce_delete(Spatial this)
 }
 
 
+Spatial BruteForce_clone(Spatial self, DataMatrix * dm)
+{
+ return BruteForce_new(dm, 0.0);
+}
+
+
+void BruteForce_shift(Spatial self, int evicted)
+{
+ // Nothing to do - it always asks the data matrix how many exemplars there are...
+}
+
+
 DataMatrix * BruteForce_dm(Spatial self)
 {
  BruteForce * this = (BruteForce*)self;
@@ -137,6 +213,9 @@ const SpatialType BruteForceType =
  "Does nothing - for every calculation all items in the data matrix will be considered. Only crazy people use this.",
  BruteForce_new,
  BruteForce_delete,
+ BruteForce_clone,
+ BruteForce_shift,
+ NULL,
  BruteForce_dm,
  BruteForce_start,
  BruteForce_next,
@@ -151,6 +230,7 @@ typedef struct IterDual IterDual;
 struct IterDual
 {
  const SpatialType * type;
+ Counters counters; // Must follow type - see SpatialHead.
  
  DataMatrix * dm;
  
@@ -212,6 +292,12 @@ void IterDual_delete(Spatial self)
 }
 
 
+Spatial IterDual_clone(Spatial self, DataMatrix * dm)
+{
+ return IterDual_new(dm, 0.0);
+}
+
+
 DataMatrix * IterDual_dm(Spatial self)
 {
  IterDual * this = (IterDual*)self;
@@ -302,6 +388,9 @@ const SpatialType IterDualType =
  "Limits the values to consider by using the dual dimensions in the data matrix, as for each of them a search range can be calculated to include all within the bound. Within the region defined its brute force however - if the dual dimensions don't limit the data enough it might make more sense to use a different structure. If there are no dual dimensions it ends up equivalent to brute force. Its typical use is when doing mean shift on images.",
  IterDual_new,
  IterDual_delete,
+ IterDual_clone,
+ NULL,
+ NULL,
  IterDual_dm,
  IterDual_start,
  IterDual_next,
@@ -311,98 +400,158 @@ const SpatialType IterDualType =
 
 
 // Implimentation of the KD-tree spatial indexer...
-typedef struct PosFeat PosFeat;
-struct PosFeat
-{
- int pos;
- float feat;
-};
 
-int sort_pos_feat(const void * lhs, const void * rhs)
+typedef struct KDTree KDTree;
+struct KDTree
 {
- const PosFeat * l = (PosFeat*)lhs;
- const PosFeat * r = (PosFeat*)rhs;
+ const SpatialType * type;
+ Counters counters; // Must follow type - see SpatialHead.
  
- if (l->feat < r->feat) return -1;
- if (l->feat > r->feat) return 1;
- return 0;
-}
+ DataMatrix * dm;
+ 
+ int * indices; // All the indices - the nodes of the KD tree just have to store ranges into this, as we rearrange them during construction - allows for some fun optimisation tricks.
+ KDNode * root; // Root of the tree - also the start of the arena all the nodes live in.
+ int nodes; // Number of nodes the arena has space for.
+ int shared; // Non-zero if indices and root are not owned by this object - it is a clone of another KDTree, or mapped from a file.
+ 
+ KDNode * targ; // For when iterating - allways a node we are searching.
+ int offset; // Offset of iterating.
+ 
+ const float * centre; // Bounding box of current iterations.
+ float range;
+};
 
 
 
-typedef struct KDNode KDNode;
-struct KDNode
+// Construction state, shared by all threads building the tree - the feature vectors are extracted once, into a contiguous array (or the materialised one is used), so the build never touches the DataMatrix and subtrees can be built in parallel. Nodes are placed in a single arena, in depth first order, at positions that can be calculated in advance, so threads never have to coordinate...
+typedef struct KDBuild KDBuild;
+struct KDBuild
 {
- KDNode * parent;
- KDNode * child_low;
- KDNode * child_high;
+ int feats;
+ const float * fv; // exemplars x feats.
+ const float * weight; // exemplars.
  
- int low; // Range of values the tree covers in the indices array.
- int high; // Exclusive.
- 
- float range[0]; // 2* number of features, with the low range indexed for feature i as range[i*2], and the high range [i*2+1].
+ int * indices;
+ char * arena;
+ size_t node_size;
+ float min_size;
 };
 
+static const int kd_leaf_size = 8; // Nodes with fewer exemplars than this are not split.
+static const int kd_parallel_size = 65536; // Nodes with at least this many exemplars build their children in parallel, if threads are available.
 
 
-typedef struct KDTree KDTree;
-struct KDTree
+
+// Calculates the number of nodes in a fully split tree over count exemplars, for count and count+1 - the arena size. Only two sizes ever occur at each level, as the split is always at the median, hence doing both at once...
+void KDTree_node_count(int count, int * out, int * out_plus)
 {
- const SpatialType * type;
- 
- DataMatrix * dm;
+ if (count<kd_leaf_size)
+ {
+  *out = 1;
+  *out_plus = (count+1<kd_leaf_size) ? 1 : 3;
+  return;
+ }
  
- int * indices; // All the indices - the nodes of the KD tree just have to store ranges into this, as we rearrange them during construction - allows for some fun optimisation tricks.
- KDNode * root; // Root of the tree.
+ int half_a, half_b;
+ KDTree_node_count(count/2, &half_a, &half_b);
  
- KDNode * targ; // For when iterating - allways a node we are searching.
- int offset; // Offset of iterating.
+ if ((count%2)==0)
+ {
+  *out = 1 + 2 * half_a;
+  *out_plus = 1 + half_a + half_b;
+ }
+ else
+ {
+  *out = 1 + half_a + half_b;
+  *out_plus = 1 + 2 * half_b;
+ }
+}
+
+
+// Quick select - rearranges indices so that item nth is in its sorted position, with everything before less than or equal and everything after greater than or equal, in linear time...
+void KDTree_select(int * indices, int count, int nth, const float * fv, int feats, int feat)
+{
+ int low = 0;
+ int high = count - 1;
  
- const float * centre; // Bounding box of current iterations.
- float range;
+ while (high>low)
+ {
+  // Median of three for the pivot...
+   float a = fv[(size_t)indices[low] * feats + feat];
+   float b = fv[(size_t)indices[low + (high-low)/2] * feats + feat];
+   float c = fv[(size_t)indices[high] * feats + feat];
+   
+   float pivot = b;
+   if ((a<b)==(b<c)) pivot = b;
+   else if ((b<a)==(a<c)) pivot = a;
+   else pivot = c;
+  
+  // Hoare partition...
+   int i = low;
+   int j = high;
+   while (i<=j)
+   {
+    while (fv[(size_t)indices[i] * feats + feat]<pivot) i += 1;
+    while (fv[(size_t)indices[j] * feats + feat]>pivot) j -= 1;
+    
+    if (i<=j)
+    {
+     int temp = indices[i];
+     indices[i] = indices[j];
+     indices[j] = temp;
+     i += 1;
+     j -= 1;
+    }
+   }
+   
+  // Continue with the side containing nth, or stop if it landed in the middle, where everything equals the pivot...
+   if (nth<=j) high = j;
+   else if (nth>=i) low = i;
+   else break;
+ }
+}
+
+
+
+void KDNode_build(KDBuild * build, size_t slot, int low, int high, int depth, int threads);
+
+typedef struct KDBuildJob KDBuildJob;
+struct KDBuildJob
+{
+ KDBuild * build;
+ size_t slot;
+ int low;
+ int high;
+ int depth;
+ int threads;
 };
 
+void * KDNode_build_thread(void * ptr)
+{
+ KDBuildJob * job = (KDBuildJob*)ptr;
+ KDNode_build(job->build, job->slot, job->low, job->high, job->depth, job->threads);
+ return NULL;
+}
 
 
-KDNode * KDNode_new(DataMatrix * dm, int * indices, int low, int high, int depth, PosFeat * scratch, float min_size)
+// Builds the node at the given arena slot; on entry its range must contain a (possibly loose) bounding box for the exemplars it covers, which will be replaced by the tight box, calculated bottom up, when done. threads is how many threads this subtree can use...
+void KDNode_build(KDBuild * build, size_t slot, int low, int high, int depth, int threads)
 {
- KDNode * this = (KDNode*)malloc(sizeof(KDNode) + dm->feats * 2 * sizeof(float));
+ int feats = build->feats;
+ KDNode * this = (KDNode*)(build->arena + slot * build->node_size);
+ int i, j;
  
  // Basic initialisation...
-  this->parent = NULL;
-  this->child_low = NULL;
-  this->child_high = NULL;
+  this->parent = 0;
+  this->child_low = 0;
+  this->child_high = 0;
   this->low = low;
   this->high = high;
   
- // Calculate the range...
-  float * fv = DataMatrix_fv(dm, indices[low], NULL);
-  int i;
-  for (i=0; i<dm->feats; i++)
-  {
-   this->range[i*2] = fv[i]; 
-   this->range[i*2+1] = fv[i];
-  }
-  
-  for (i=low+1; i<high; i++)
-  {
-   fv = DataMatrix_fv(dm, indices[i], NULL);
-   int j;
-   for (j=0; j<dm->feats; j++)
-   {
-    if (this->range[j*2]>fv[j]) this->range[j*2] = fv[j];
-    if (this->range[j*2+1]<fv[j]) this->range[j*2+1] = fv[j];
-   }
-  }
-  
- // Decide if we are going to divide further or not...
-  if (depth>64) return this;
-  if ((high-low)<8) return this;
- 
- // Choose a division direction - the one with the largest range; possible condition for leaving as well...
+ // Decide if we are going to divide further or not, choosing a division direction - the one with the largest range - as we go...
   int split_feat = 0;
-  float split_range = this->range[split_feat*2+1] - this->range[split_feat*2];
-  for (i=1; i<dm->feats; i++)
+  float split_range = this->range[1] - this->range[0];
+  for (i=1; i<feats; i++)
   {
    float range = this->range[i*2+1] - this->range[i*2];
    if (range>split_range)
@@ -411,59 +560,137 @@ KDNode * KDNode_new(DataMatrix * dm, int * indices, int low, int high, int depth
     split_range = range;
    }
   }
-  if (split_range<min_size) return this;
   
- // Sort the indices by the feature...
-  for (i=low; i<high; i++)
+  if ((depth>64)||((high-low)<kd_leaf_size)||(split_range<build->min_size))
   {
-   scratch[i-low].pos = indices[i];
-   scratch[i-low].feat = DataMatrix_fv(dm, indices[i], NULL)[split_feat];
+   // Leaf - calculate the tight bounding box and weight directly...
+    this->weight = 0.0;
+    for (i=0; i<feats; i++)
+    {
+     this->range[i*2] = (high>low) ? build->fv[(size_t)build->indices[low] * feats + i] : 0.0;
+     this->range[i*2+1] = this->range[i*2];
+    }
+    
+    for (i=low; i<high; i++)
+    {
+     const float * fv = build->fv + (size_t)build->indices[i] * feats;
+     this->weight += build->weight[build->indices[i]];
+     
+     for (j=0; j<feats; j++)
+     {
+      if (this->range[j*2]>fv[j]) this->range[j*2] = fv[j];
+      if (this->range[j*2+1]<fv[j]) this->range[j*2+1] = fv[j];
+     }
+    }
+    
+   return;
   }
   
-  qsort(scratch, high-low, sizeof(PosFeat), sort_pos_feat);
+ // Partition the indices around the median of the split feature...
+  int half = (low + high) / 2;
+  KDTree_select(build->indices + low, high - low, half - low, build->fv, feats, split_feat);
+  float split = build->fv[(size_t)build->indices[half] * feats + split_feat];
+  
+ // Setup the children, with loose bounding boxes from this node and the split...
+  int size_low, size_plus;
+  KDTree_node_count(half - low, &size_low, &size_plus);
   
-  for (i=low; i<high; i++)
+  KDNode * child_low = (KDNode*)(build->arena + (slot + 1) * build->node_size);
+  KDNode * child_high = (KDNode*)(build->arena + (slot + 1 + size_low) * build->node_size);
+  
+  for (i=0; i<feats*2; i++)
   {
-   indices[i] = scratch[i-low].pos; 
+   child_low->range[i] = this->range[i];
+   child_high->range[i] = this->range[i];
   }
+  child_low->range[split_feat*2+1] = split;
+  child_high->range[split_feat*2] = split;
   
- // Do the split...
-  int half = (low + high) / 2;
-  this->child_low = KDNode_new(dm, indices, low, half, depth+1, scratch, min_size);
-  this->child_high = KDNode_new(dm, indices, half, high, depth+1, scratch, min_size);
+ // Build them, in parallel if its big enough and we have threads to spare...
+  int spawned = 0;
+  pthread_t handle;
+  KDBuildJob job;
   
- // Assign parents...
-  this->child_low->parent = this;
-  this->child_high->parent = this;
- 
- // Return...
-  return this;
+  if ((threads>1)&&((high-low)>=kd_parallel_size))
+  {
+   job.build = build;
+   job.slot = slot + 1;
+   job.low = low;
+   job.high = half;
+   job.depth = depth + 1;
+   job.threads = threads / 2;
+   
+   if (pthread_create(&handle, NULL, KDNode_build_thread, &job)==0) spawned = 1;
+  }
+  
+  if (spawned==0) KDNode_build(build, slot + 1, low, half, depth+1, 1);
+  KDNode_build(build, slot + 1 + size_low, half, high, depth+1, (spawned!=0) ? (threads - threads/2) : 1);
+  
+  if (spawned!=0) pthread_join(handle, NULL);
+  
+ // Link up the family, then the tight bounding box and weight, from the children...
+  this->child_low = (char*)child_low - (char*)this;
+  this->child_high = (char*)child_high - (char*)this;
+  child_low->parent = (char*)this - (char*)child_low;
+  child_high->parent = (char*)this - (char*)child_high;
+  
+  this->weight = child_low->weight + child_high->weight;
+  
+  for (i=0; i<feats; i++)
+  {
+   this->range[i*2] = child_low->range[i*2];
+   if (child_high->range[i*2]<this->range[i*2]) this->range[i*2] = child_high->range[i*2];
+   
+   this->range[i*2+1] = child_low->range[i*2+1];
+   if (child_high->range[i*2+1]>this->range[i*2+1]) this->range[i*2+1] = child_high->range[i*2+1];
+  }
 }
 
 
-void KDNode_delete(KDNode * this)
+
+KDNode * KDNode_parent(KDNode * this)
 {
- if (this->child_low!=NULL) KDNode_delete(this->child_low);
- if (this->child_high!=NULL) KDNode_delete(this->child_high);
- free(this);
+ if (this->parent==0) return NULL;
+ return (KDNode*)((char*)this + this->parent);
+}
+
+
+KDNode * KDNode_child_low(KDNode * this)
+{
+ if (this->child_low==0) return NULL;
+ return (KDNode*)((char*)this + this->child_low);
 }
 
 
-KDNode * KDNode_next_down(KDNode * this, DataMatrix * dm, const float * centre, float range)
+KDNode * KDNode_child_high(KDNode * this)
+{
+ if (this->child_high==0) return NULL;
+ return (KDNode*)((char*)this + this->child_high);
+}
+
+
+
+KDNode * KDNode_next_down(KDNode * this, DataMatrix * dm, const float * centre, float range, Counters * counters)
 {
  int i;
+ COUNT(counters, nodes, 1);
+ 
  // If its a miss return null - we are not going this way...
   int within = 1;
+  int feats = DataMatrix_features(dm);
   
-  for (i=0; i<dm->feats; i++)
+  for (i=0; i<feats; i++)
   {
    float req_low  = centre[i] - range;
    float req_high = centre[i] + range;
    float bb_low = this->range[i*2];
    float bb_high = this->range[i*2+1];
    
-   if (req_high<bb_low) return NULL;
-   if (req_low>bb_high) return NULL;
+   if ((req_high<bb_low)||(req_low>bb_high))
+   {
+    COUNT(counters, pruned, 1);
+    return NULL;
+   }
    
    if (req_low>bb_low) within = 0;
    if (req_high<bb_high) within = 0;
@@ -473,25 +700,25 @@ KDNode * KDNode_next_down(KDNode * this, DataMatrix * dm, const float * centre,
   if (within!=0) return this;
  
  // If it has no children return it - we have got as close to the split line as we can...
-  if (this->child_low==NULL) return this;
+  if (this->child_low==0) return this;
  
  // Check each child in turn...
-  KDNode * ret = KDNode_next_down(this->child_low, dm, centre, range);
+  KDNode * ret = KDNode_next_down(KDNode_child_low(this), dm, centre, range, counters);
   if (ret!=NULL) return ret;
-  return KDNode_next_down(this->child_high, dm, centre, range);
+  return KDNode_next_down(KDNode_child_high(this), dm, centre, range, counters);
 }
 
 
-KDNode * KDNode_next_up(KDNode * this, DataMatrix * dm, const float * centre, float range)
+KDNode * KDNode_next_up(KDNode * this, DataMatrix * dm, const float * centre, float range, Counters * counters)
 {
- while (this->parent!=NULL)
+ while (this->parent!=0)
  {
   KDNode * child = this;
-  this = this->parent;
+  this = KDNode_parent(this);
   
-  if (this->child_low==child)
+  if (KDNode_child_low(this)==child)
   {
-   KDNode * ret = KDNode_next_down(this->child_high, dm, centre, range);
+   KDNode * ret = KDNode_next_down(KDNode_child_high(this), dm, centre, range, counters);
    if (ret!=NULL) return ret;
   }
  }
@@ -500,17 +727,94 @@ KDNode * KDNode_next_up(KDNode * this, DataMatrix * dm, const float * centre, fl
 }
 
 
-int KDNode_count(KDNode * this)
+// Builds a kd tree over the exemplars [start, start+count) of the data matrix, writing their indices into indices in tree order and returning the root, which is also the arena all of the nodes live in, so a single free deletes it; nodes is set to how many nodes the arena has space for...
+KDNode * KDTree_build(DataMatrix * dm, int start, int count, int * indices, int * nodes, float min_size)
 {
- int ret = 1;
- if (this->child_low!=NULL)  ret += KDNode_count(this->child_low);
- if (this->child_high!=NULL) ret += KDNode_count(this->child_high);
-
- return ret;
+ int feats = DataMatrix_features(dm);
+ int i;
+ for (i=0; i<count; i++) indices[i] = i;
+ 
+ // Get the feature vectors into a contiguous block, unless the data matrix has already done so - the compact materialised formats get decoded, so the bounding boxes are of the values the kernel actually sees...
+  float * extract = NULL;
+  KDBuild build;
+  build.feats = feats;
+  
+  if (dm->mat!=NULL)
+  {
+   build.fv = dm->mat + (size_t)start * feats;
+   build.weight = dm->mat_weight + start;
+  }
+  else
+  {
+   extract = (float*)malloc((size_t)count * (feats + 1) * sizeof(float));
+   float * weight = extract + (size_t)count * feats;
+   
+   for (i=0; i<count; i++)
+   {
+    float * fv = DataMatrix_fv(dm, start + i, weight + i);
+    memcpy(extract + (size_t)i * feats, fv, feats * sizeof(float));
+   }
+   
+   build.fv = extract;
+   build.weight = weight;
+  }
+  
+ // Create the arena, big enough for a fully split tree...
+  int dummy;
+  KDTree_node_count(count, nodes, &dummy);
+  
+  build.indices = indices;
+  build.node_size = sizeof(KDNode) + feats * 2 * sizeof(float);
+  build.node_size = ((build.node_size + sizeof(void*) - 1) / sizeof(void*)) * sizeof(void*);
+  build.arena = (char*)malloc(*nodes * build.node_size);
+  memset(build.arena, 0, *nodes * build.node_size); // Not all of it gets used, and there is padding - zero it so saving the arena never writes junk.
+  build.min_size = min_size;
+  
+ // Root gets a tight bounding box, then build the tree, with as many threads as there are cores...
+  KDNode * root = (KDNode*)build.arena;
+  for (i=0; i<feats; i++)
+  {
+   root->range[i*2] = 0.0;
+   root->range[i*2+1] = 0.0;
+  }
+  
+  if (count!=0)
+  {
+   for (i=0; i<feats; i++)
+   {
+    root->range[i*2] = build.fv[i];
+    root->range[i*2+1] = build.fv[i];
+   }
+   
+   int j;
+   for (j=1; j<count; j++)
+   {
+    const float * fv = build.fv + (size_t)j * feats;
+    for (i=0; i<feats; i++)
+    {
+     if (root->range[i*2]>fv[i]) root->range[i*2] = fv[i];
+     if (root->range[i*2+1]<fv[i]) root->range[i*2+1] = fv[i];
+    }
+   }
+  }
+  
+  int threads = sysconf(_SC_NPROCESSORS_ONLN);
+  if (threads<1) threads = 1;
+  
+  KDNode_build(&build, 0, 0, count, 0, threads);
+  
+  free(extract);
+  
+ // Indices are relative to start during the build - fix that...
+  if (start!=0)
+  {
+   for (i=0; i<count; i++) indices[i] += start;
+  }
+  
+ return root;
 }
 
 
-
 Spatial KDTree_new(DataMatrix * dm, float param)
 {
  KDTree * this = (KDTree*)malloc(sizeof(KDTree));
@@ -519,13 +823,9 @@ Spatial KDTree_new(DataMatrix * dm, float param)
  this->dm = dm;
  
  this->indices = (int*)malloc(this->dm->exemplars * sizeof(int));
- int i;
- for (i=0; i<this->dm->exemplars; i++) this->indices[i] = i;
- 
- PosFeat * scratch = (PosFeat*)malloc(this->dm->exemplars * sizeof(PosFeat));
- this->root = KDNode_new(this->dm, this->indices, 0, this->dm->exemplars, 0, scratch, param);
- free(scratch);
+ this->root = KDTree_build(this->dm, 0, this->dm->exemplars, this->indices, &this->nodes, param);
  
+ this->shared = 0;
  this->targ = NULL;
  
  return this;
@@ -536,13 +836,35 @@ void KDTree_delete(Spatial self)
 {
  KDTree * this = (KDTree*)self;
  
- free(this->indices);
- KDNode_delete(this->root);
+ if (this->shared==0)
+ {
+  free(this->indices);
+  free(this->root);
+ }
  
  free(this);
 }
 
 
+Spatial KDTree_clone(Spatial self, DataMatrix * dm)
+{
+ KDTree * this = (KDTree*)self;
+ KDTree * ret = (KDTree*)malloc(sizeof(KDTree));
+ 
+ ret->type = &KDTreeType;
+ ret->dm = dm;
+ 
+ ret->indices = this->indices;
+ ret->root = this->root;
+ ret->nodes = this->nodes;
+ ret->shared = 1;
+ 
+ ret->targ = NULL;
+ 
+ return ret;
+}
+
+
 DataMatrix * KDTree_dm(Spatial self)
 {
  KDTree * this = (KDTree*)self;
@@ -554,7 +876,7 @@ void KDTree_start(Spatial self, const float * centre, float range)
 {
  KDTree * this = (KDTree*)self;
  
- this->targ = KDNode_next_down(this->root, this->dm, centre, range);
+ this->targ = (this->root->high>this->root->low) ? KDNode_next_down(this->root, this->dm, centre, range, &this->counters) : NULL;
  this->offset = 0;
  this->centre = centre;
  this->range = range;
@@ -573,7 +895,7 @@ int KDTree_next(Spatial self)
   this->offset += 1;
   if ((this->offset+this->targ->low)>=this->targ->high)
   {
-   this->targ = KDNode_next_up(this->targ, this->dm, this->centre, this->range);
+   this->targ = KDNode_next_up(this->targ, this->dm, this->centre, this->range, &this->counters);
    this->offset = 0;
   }
  
@@ -583,14 +905,101 @@ int KDTree_next(Spatial self)
 
 
 
+KDNode * KDTree_root(Spatial self)
+{
+ KDTree * this = (KDTree*)self;
+ return this->root;
+}
+
+
+const int * KDTree_indices(Spatial self)
+{
+ KDTree * this = (KDTree*)self;
+ return this->indices;
+}
+
+
+
+size_t KDTree_arena_size(Spatial self)
+{
+ KDTree * this = (KDTree*)self;
+ 
+ size_t node_mem = sizeof(KDNode) + DataMatrix_features(this->dm) * 2 * sizeof(float);
+ node_mem = ((node_mem + sizeof(void*) - 1) / sizeof(void*)) * sizeof(void*);
+ 
+ return node_mem * this->nodes;
+}
+
+
+Spatial KDTree_map(DataMatrix * dm, int * indices, KDNode * root, size_t arena_size)
+{
+ KDTree * this = (KDTree*)malloc(sizeof(KDTree));
+ 
+ this->type = &KDTreeType;
+ Counters_zero(&this->counters);
+ this->dm = dm;
+ 
+ size_t node_mem = sizeof(KDNode) + DataMatrix_features(this->dm) * 2 * sizeof(float);
+ node_mem = ((node_mem + sizeof(void*) - 1) / sizeof(void*)) * sizeof(void*);
+ 
+ this->indices = indices;
+ this->root = root;
+ this->nodes = arena_size / node_mem;
+ this->shared = 1;
+ 
+ this->targ = NULL;
+ 
+ return this;
+}
+
+
+
 size_t KDTree_byte_size(Spatial self)
 {
  KDTree * this = (KDTree*)self;
+ return sizeof(KDTree) + this->dm->exemplars * sizeof(int) + KDTree_arena_size(self);
+}
+
+
+int KDTree_link_valid(ptrdiff_t link, size_t pos, size_t node_mem, size_t nodes, int child)
+{
+ if (link==0) return 1;
+ if ((child!=0) ? (link<0) : (link>0)) return 0;
+ if ((link % (ptrdiff_t)node_mem)!=0) return 0;
+ 
+ ptrdiff_t target = (ptrdiff_t)pos + link / (ptrdiff_t)node_mem;
+ return (target>=0)&&(target<(ptrdiff_t)nodes);
+}
+
+
+int KDTree_valid(int feats, int exemplars, const int * indices, const KDNode * root, size_t arena_size)
+{
+ size_t node_mem = sizeof(KDNode) + feats * 2 * sizeof(float);
+ node_mem = ((node_mem + sizeof(void*) - 1) / sizeof(void*)) * sizeof(void*);
+ 
+ if ((arena_size<node_mem)||((arena_size % node_mem)!=0)) return 0;
+ size_t nodes = arena_size / node_mem;
+ 
+ int i;
+ for (i=0; i<exemplars; i++)
+ {
+  if ((indices[i]<0)||(indices[i]>=exemplars)) return 0;
+ }
  
- size_t node_mem = sizeof(KDNode) + this->dm->feats * 2 * sizeof(float);
- node_mem *= KDNode_count(this->root);
+ size_t n;
+ for (n=0; n<nodes; n++)
+ {
+  const KDNode * node = (const KDNode*)((const char*)root + n * node_mem);
+  
+  if ((node->low<0)||(node->high<node->low)||(node->high>exemplars)) return 0;
+  if ((node->child_low==0)!=(node->child_high==0)) return 0;
+  
+  if (KDTree_link_valid(node->parent, n, node_mem, nodes, 0)==0) return 0;
+  if (KDTree_link_valid(node->child_low, n, node_mem, nodes, 1)==0) return 0;
+  if (KDTree_link_valid(node->child_high, n, node_mem, nodes, 1)==0) return 0;
+ }
  
- return sizeof(KDTree) + this->dm->exemplars * sizeof(int) + node_mem;
+ return root->parent==0;
 }
 
 
@@ -601,6 +1010,9 @@ const SpatialType KDTreeType =
  "A standard kd-tree on the feature vectors - best choice if the data has no dual dimensions.",
  KDTree_new,
  KDTree_delete,
+ KDTree_clone,
+ NULL,
+ NULL,
  KDTree_dm,
  KDTree_start,
  KDTree_next,
@@ -609,12 +1021,713 @@ const SpatialType KDTreeType =
 
 
 
+// Implimentation of the streaming kd tree - a set of kd trees, each over a contiguous run of exemplars...
+typedef struct KDBlock KDBlock;
+struct KDBlock
+{
+ int first; // Exemplar index of the first exemplar in the block, in the current data matrix - negative once its start has been evicted, as every shift moves it down.
+ int count; // Number of exemplars in the block, including evicted ones.
+ 
+ int * indices; // Offsets from first, in tree order - relative, so a shift only has to change first.
+ KDNode * root; // Also the arena, so freeing it frees the tree.
+ int nodes; // Size of the arena.
+};
+
+
+typedef struct KDStream KDStream;
+struct KDStream
+{
+ const SpatialType * type;
+ Counters counters; // Must follow type - see SpatialHead.
+ 
+ DataMatrix * dm;
+ float min_size;
+ 
+ int blocks; // Number of blocks, oldest first.
+ int capacity; // Size of block array.
+ KDBlock * block;
+ int shared; // Non-zero if this is a clone, in which case the blocks belong to another KDStream.
+ 
+ int targ_block; // For when iterating - the block being searched.
+ KDNode * targ; // Node being searched.
+ int offset; // Offset of iterating.
+ 
+ const float * centre; // Bounding box of current iterations.
+ float range;
+};
+
+
+
+// (Re)builds the given block to cover the given exemplars, which must all be in the data matrix...
+void KDBlock_build(KDStream * this, KDBlock * block, int first, int count)
+{
+ block->first = first;
+ block->count = count;
+ block->indices = (int*)malloc(count * sizeof(int));
+ block->root = KDTree_build(this->dm, first, count, block->indices, &block->nodes, this->min_size);
+ 
+ int i;
+ for (i=0; i<count; i++) block->indices[i] -= first;
+}
+
+
+void KDBlock_free(KDBlock * block)
+{
+ free(block->indices);
+ free(block->root);
+}
+
+
+
+// Drops evicted blocks, rebuilds blocks that are mostly evicted, then merges neighbours until every block is more than twice the size of the one after it...
+void KDStream_balance(KDStream * this)
+{
+ int i;
+ 
+ // Eviction - as it is oldest first only the first few blocks can be affected...
+  while ((this->blocks>0)&&((this->block[0].first + this->block[0].count)<=0))
+  {
+   KDBlock_free(this->block);
+   this->blocks -= 1;
+   memmove(this->block, this->block + 1, this->blocks * sizeof(KDBlock));
+  }
+  
+  if (this->blocks>0)
+  {
+   KDBlock * block = this->block;
+   int evicted = -block->first;
+   if ((evicted*2)>block->count)
+   {
+    int end = block->first + block->count;
+    KDBlock_free(block);
+    KDBlock_build(this, block, 0, end);
+   }
+  }
+  
+ // Merge, newest first...
+  i = this->blocks - 2;
+  while (i>=0)
+  {
+   KDBlock * older = this->block + i;
+   KDBlock * newer = this->block + i + 1;
+   
+   int first = (older->first>0) ? older->first : 0;
+   int live = older->first + older->count - first;
+   
+   if (live<=(2*newer->count))
+   {
+    int end = newer->first + newer->count;
+    KDBlock_free(older);
+    KDBlock_free(newer);
+    KDBlock_build(this, older, first, end - first);
+    
+    this->blocks -= 1;
+    memmove(this->block + i + 1, this->block + i + 2, (this->blocks - i - 1) * sizeof(KDBlock));
+    
+    // Merging can break the rule with the block before, so check it again...
+     if (i>=this->blocks-1) i = this->blocks - 2;
+   }
+   else i -= 1;
+  }
+}
+
+
+Spatial KDStream_new(DataMatrix * dm, float param)
+{
+ KDStream * this = (KDStream*)malloc(sizeof(KDStream));
+ 
+ this->type = &KDStreamType;
+ this->dm = dm;
+ this->min_size = param;
+ 
+ this->blocks = 0;
+ this->capacity = 8;
+ this->block = (KDBlock*)malloc(this->capacity * sizeof(KDBlock));
+ this->shared = 0;
+ 
+ if (this->dm->exemplars!=0)
+ {
+  KDBlock_build(this, this->block, 0, this->dm->exemplars);
+  this->blocks = 1;
+ }
+ 
+ this->targ = NULL;
+ 
+ return this;
+}
+
+
+void KDStream_delete(Spatial self)
+{
+ KDStream * this = (KDStream*)self;
+ 
+ if (this->shared==0)
+ {
+  int i;
+  for (i=0; i<this->blocks; i++) KDBlock_free(this->block + i);
+  free(this->block);
+ }
+ 
+ free(this);
+}
+
+
+Spatial KDStream_clone(Spatial self, DataMatrix * dm)
+{
+ KDStream * this = (KDStream*)self;
+ KDStream * ret = (KDStream*)malloc(sizeof(KDStream));
+ 
+ *ret = *this;
+ ret->dm = dm;
+ ret->shared = 1;
+ ret->targ = NULL;
+ 
+ return ret;
+}
+
+
+void KDStream_shift(Spatial self, int evicted)
+{
+ KDStream * this = (KDStream*)self;
+ 
+ // Move every block down - this evicts the exemplars, which now have negative indices. Positions are relative to the current data matrix, rather than counting up forever, so a long stream can not overflow them...
+  int i;
+  for (i=0; i<this->blocks; i++) this->block[i].first -= evicted;
+  
+ // Add a block for any new exemplars...
+  int end = (this->blocks>0) ? (this->block[this->blocks-1].first + this->block[this->blocks-1].count) : 0;
+  if (end<0) end = 0; // Everything was evicted.
+  int count = this->dm->exemplars - end;
+  
+  if (count>0)
+  {
+   if (this->blocks==this->capacity)
+   {
+    this->capacity *= 2;
+    this->block = (KDBlock*)realloc(this->block, this->capacity * sizeof(KDBlock));
+   }
+   
+   KDBlock_build(this, this->block + this->blocks, end, count);
+   this->blocks += 1;
+  }
+  
+ // Lazy rebalancing...
+  KDStream_balance(this);
+}
+
+
+DataMatrix * KDStream_dm(Spatial self)
+{
+ KDStream * this = (KDStream*)self;
+ return this->dm;
+}
+
+
+void KDStream_start(Spatial self, const float * centre, float range)
+{
+ KDStream * this = (KDStream*)self;
+ 
+ this->centre = centre;
+ this->range = range;
+ this->offset = 0;
+ this->targ = NULL;
+ 
+ for (this->targ_block=0; this->targ_block<this->blocks; this->targ_block++)
+ {
+  this->targ = KDNode_next_down(this->block[this->targ_block].root, this->dm, centre, range, &this->counters);
+  if (this->targ!=NULL) break;
+ }
+}
+
+
+int KDStream_next(Spatial self)
+{
+ KDStream * this = (KDStream*)self;
+ 
+ while (this->targ!=NULL)
+ {
+  // Get the exemplar index...
+   KDBlock * block = this->block + this->targ_block;
+   int ei = block->first + block->indices[this->targ->low + this->offset];
+  
+  // Move to the next position, which can involve moving to the next block...
+   this->offset += 1;
+   if ((this->offset+this->targ->low)>=this->targ->high)
+   {
+    this->targ = KDNode_next_up(this->targ, this->dm, this->centre, this->range, &this->counters);
+    this->offset = 0;
+    
+    while ((this->targ==NULL)&&((this->targ_block+1)<this->blocks))
+    {
+     this->targ_block += 1;
+     this->targ = KDNode_next_down(this->block[this->targ_block].root, this->dm, this->centre, this->range, &this->counters);
+    }
+   }
+   
+  // Return it as an exemplar index, unless it has been evicted...
+   if (ei>=0) return ei;
+ }
+ 
+ return -1;
+}
+
+
+size_t KDStream_byte_size(Spatial self)
+{
+ KDStream * this = (KDStream*)self;
+ 
+ size_t node_mem = sizeof(KDNode) + DataMatrix_features(this->dm) * 2 * sizeof(float);
+ node_mem = ((node_mem + sizeof(void*) - 1) / sizeof(void*)) * sizeof(void*);
+ 
+ size_t ret = sizeof(KDStream) + this->capacity * sizeof(KDBlock);
+ int i;
+ for (i=0; i<this->blocks; i++)
+ {
+  ret += this->block[i].count * sizeof(int) + this->block[i].nodes * node_mem;
+ }
+ 
+ return ret;
+}
+
+
+
+const SpatialType KDStreamType =
+{
+ "kd_stream",
+ "A kd tree that can be updated as data is appended and evicted, without a full rebuild - use with append, otherwise the same as kd_tree but a little slower.",
+ KDStream_new,
+ KDStream_delete,
+ KDStream_clone,
+ KDStream_shift,
+ NULL,
+ KDStream_dm,
+ KDStream_start,
+ KDStream_next,
+ KDStream_byte_size,
+};
+
+
+
+// Implimentation of the ball tree - nodes live in a single arena, in depth first order, as for the kd tree...
+typedef struct BallNode BallNode;
+struct BallNode
+{
+ int child_low; // Arena slots of the children - 0 for a leaf, as that is where the root lives.
+ int child_high;
+ 
+ int low; // Range of values the node covers in the indices array.
+ int high; // Exclusive.
+ 
+ float radius; // Every exemplar in the node is within this distance of the centre.
+ float centre[0]; // Number of features.
+};
+
+
+typedef struct BallTree BallTree;
+struct BallTree
+{
+ const SpatialType * type;
+ Counters counters; // Must follow type - see SpatialHead.
+ 
+ DataMatrix * dm;
+ 
+ int * indices; // Exemplar indices, in tree order.
+ char * arena; // All of the nodes, root first.
+ size_t node_size;
+ int nodes; // Number of nodes the arena has space for.
+ int shared; // Non-zero if this is a clone, in which case indices and arena belong to another BallTree.
+ 
+ int states; // Number of images of each query - 1 if there is no symmetry.
+ SpatialImageNext next;
+ void * config;
+ 
+ float * image; // states x features - the images of the current query.
+ int image_capacity; // In rows.
+ float range;
+ 
+ int stack[72]; // Slots of nodes still to be checked when iterating; depth is capped at 64, so this can not overflow.
+ int depth;
+ BallNode * targ; // Leaf being iterated, NULL when done.
+ int offset;
+};
+
+
+// Construction state...
+typedef struct BallBuild BallBuild;
+struct BallBuild
+{
+ int feats;
+ const float * fv; // exemplars x feats.
+ float * proj; // exemplars - projections onto the split direction, indexed by exemplar.
+ 
+ int * indices;
+ char * arena;
+ size_t node_size;
+ float min_size;
+};
+
+
+void BallNode_build(BallBuild * build, int slot, int low, int high, int depth)
+{
+ int feats = build->feats;
+ BallNode * this = (BallNode*)(build->arena + (size_t)slot * build->node_size);
+ int i, j;
+ 
+ // Basic initialisation...
+  this->child_low = 0;
+  this->child_high = 0;
+  this->low = low;
+  this->high = high;
+ 
+ // Centre is the mean, radius the distance to the furthest exemplar, which is also remembered as one end of the split direction...
+  for (j=0; j<feats; j++) this->centre[j] = 0.0;
+  for (i=low; i<high; i++)
+  {
+   const float * fv = build->fv + (size_t)build->indices[i] * feats;
+   for (j=0; j<feats; j++) this->centre[j] += fv[j];
+  }
+  if (high>low)
+  {
+   for (j=0; j<feats; j++) this->centre[j] /= high - low;
+  }
+  
+  float radius_sqr = 0.0;
+  const float * far_a = NULL;
+  for (i=low; i<high; i++)
+  {
+   const float * fv = build->fv + (size_t)build->indices[i] * feats;
+   float dist_sqr = 0.0;
+   for (j=0; j<feats; j++) dist_sqr += (fv[j] - this->centre[j]) * (fv[j] - this->centre[j]);
+   
+   if ((far_a==NULL)||(dist_sqr>radius_sqr))
+   {
+    radius_sqr = dist_sqr;
+    far_a = fv;
+   }
+  }
+  this->radius = sqrt(radius_sqr);
+ 
+ // Decide if we are going to divide further or not...
+  if ((depth>=64)||((high-low)<kd_leaf_size)||(this->radius<build->min_size)) return;
+ 
+ // Split direction is from the exemplar furthest from the centre to the exemplar furthest from it...
+  const float * far_b = far_a;
+  float best = 0.0;
+  for (i=low; i<high; i++)
+  {
+   const float * fv = build->fv + (size_t)build->indices[i] * feats;
+   float dist_sqr = 0.0;
+   for (j=0; j<feats; j++) dist_sqr += (fv[j] - far_a[j]) * (fv[j] - far_a[j]);
+   
+   if (dist_sqr>best)
+   {
+    best = dist_sqr;
+    far_b = fv;
+   }
+  }
+  
+  if (far_b==far_a) return; // Everything is in the same place.
+  
+  for (i=low; i<high; i++)
+  {
+   int ind = build->indices[i];
+   const float * fv = build->fv + (size_t)ind * feats;
+   
+   float dot = 0.0;
+   for (j=0; j<feats; j++) dot += fv[j] * (far_b[j] - far_a[j]);
+   build->proj[ind] = dot;
+  }
+ 
+ // Partition the indices around the median projection, then build the children, placed as they would be in a kd tree...
+  int half = (low + high) / 2;
+  KDTree_select(build->indices + low, high - low, half - low, build->proj, 1, 0);
+  
+  int size_low, size_plus;
+  KDTree_node_count(half - low, &size_low, &size_plus);
+  
+  this->child_low = slot + 1;
+  this->child_high = slot + 1 + size_low;
+  
+  BallNode_build(build, this->child_low, low, half, depth+1);
+  BallNode_build(build, this->child_high, half, high, depth+1);
+}
+
+
+Spatial BallTree_new(DataMatrix * dm, float param)
+{
+ BallTree * this = (BallTree*)malloc(sizeof(BallTree));
+ 
+ this->type = &BallTreeType;
+ this->dm = dm;
+ 
+ int exemplars = DataMatrix_exemplars(dm);
+ int feats = DataMatrix_features(dm);
+ int i;
+ 
+ // Get the feature vectors into a contiguous block, unless the data matrix has already done so...
+  float * extract = NULL;
+  BallBuild build;
+  build.feats = feats;
+  
+  if (dm->mat!=NULL)
+  {
+   build.fv = dm->mat;
+  }
+  else
+  {
+   extract = (float*)malloc((size_t)exemplars * feats * sizeof(float));
+   for (i=0; i<exemplars; i++)
+   {
+    float * fv = DataMatrix_fv(dm, i, NULL);
+    memcpy(extract + (size_t)i * feats, fv, feats * sizeof(float));
+   }
+   build.fv = extract;
+  }
+  
+ // Create the arena, which has the same size as that of a kd tree, as nodes are split in the same way...
+  int dummy;
+  KDTree_node_count(exemplars, &this->nodes, &dummy);
+  
+  this->node_size = sizeof(BallNode) + feats * sizeof(float);
+  this->node_size = ((this->node_size + sizeof(void*) - 1) / sizeof(void*)) * sizeof(void*);
+  this->arena = (char*)malloc(this->nodes * this->node_size);
+  
+  this->indices = (int*)malloc(exemplars * sizeof(int));
+  for (i=0; i<exemplars; i++) this->indices[i] = i;
+  
+ // Build...
+  build.proj = (float*)malloc(exemplars * sizeof(float));
+  build.indices = this->indices;
+  build.arena = this->arena;
+  build.node_size = this->node_size;
+  build.min_size = param;
+  
+  BallNode_build(&build, 0, 0, exemplars, 0);
+  
+  free(build.proj);
+  free(extract);
+  
+ // Iteration state...
+  this->shared = 0;
+  
+  this->states = 1;
+  this->next = NULL;
+  this->config = NULL;
+  
+  this->image = NULL;
+  this->image_capacity = 0;
+  
+  this->targ = NULL;
+ 
+ return this;
+}
+
+
+void BallTree_delete(Spatial self)
+{
+ BallTree * this = (BallTree*)self;
+ 
+ if (this->shared==0)
+ {
+  free(this->indices);
+  free(this->arena);
+ }
+ 
+ free(this->image);
+ free(this);
+}
+
+
+Spatial BallTree_clone(Spatial self, DataMatrix * dm)
+{
+ BallTree * this = (BallTree*)self;
+ BallTree * ret = (BallTree*)malloc(sizeof(BallTree));
+ 
+ ret->type = &BallTreeType;
+ ret->dm = dm;
+ 
+ ret->indices = this->indices;
+ ret->arena = this->arena;
+ ret->node_size = this->node_size;
+ ret->nodes = this->nodes;
+ ret->shared = 1;
+ 
+ ret->states = this->states;
+ ret->next = this->next;
+ ret->config = this->config;
+ 
+ ret->image = NULL;
+ ret->image_capacity = 0;
+ 
+ ret->targ = NULL;
+ 
+ return ret;
+}
+
+
+void BallTree_images(Spatial self, int states, SpatialImageNext next, void * config)
+{
+ BallTree * this = (BallTree*)self;
+ 
+ this->states = (states>1) ? states : 1;
+ this->next = next;
+ this->config = config;
+}
+
+
+DataMatrix * BallTree_dm(Spatial self)
+{
+ BallTree * this = (BallTree*)self;
+ return this->dm;
+}
+
+
+// Returns non-zero if the node intersects the hyper-cube around any of the images...
+int BallTree_visit(BallTree * this, BallNode * node)
+{
+ int feats = DataMatrix_features(this->dm);
+ float limit = node->radius * node->radius;
+ int s, i;
+ 
+ for (s=0; s<this->states; s++)
+ {
+  const float * centre = this->image + (size_t)s * feats;
+  
+  float dist_sqr = 0.0;
+  for (i=0; i<feats; i++)
+  {
+   float gap = fabs(node->centre[i] - centre[i]) - this->range;
+   if (gap>0.0)
+   {
+    dist_sqr += gap * gap;
+    if (dist_sqr>limit) break;
+   }
+  }
+  
+  if (dist_sqr<=limit) return 1;
+ }
+ 
+ return 0;
+}
+
+
+// Moves targ to the next leaf that needs to be iterated, by working through the stack...
+void BallTree_advance(BallTree * this)
+{
+ this->targ = NULL;
+ this->offset = 0;
+ 
+ while (this->depth>0)
+ {
+  this->depth -= 1;
+  BallNode * node = (BallNode*)(this->arena + (size_t)this->stack[this->depth] * this->node_size);
+  
+  if (node->high==node->low) continue;
+  COUNT(&this->counters, nodes, 1);
+  if (BallTree_visit(this, node)==0)
+  {
+   COUNT(&this->counters, pruned, 1);
+   continue;
+  }
+  
+  if (node->child_low==0)
+  {
+   this->targ = node;
+   return;
+  }
+  
+  this->stack[this->depth] = node->child_high;
+  this->stack[this->depth+1] = node->child_low;
+  this->depth += 2;
+ }
+}
+
+
+void BallTree_start(Spatial self, const float * centre, float range)
+{
+ BallTree * this = (BallTree*)self;
+ int feats = DataMatrix_features(this->dm);
+ int s;
+ 
+ // Generate the images of the centre...
+  if (this->image_capacity<this->states)
+  {
+   this->image_capacity = this->states;
+   this->image = (float*)realloc(this->image, (size_t)this->image_capacity * feats * sizeof(float));
+  }
+  
+  memcpy(this->image, centre, feats * sizeof(float));
+  for (s=1; s<this->states; s++)
+  {
+   float * image = this->image + (size_t)s * feats;
+   memcpy(image, image - feats, feats * sizeof(float));
+   this->next(feats, this->config, s-1, image);
+  }
+  
+  this->range = range;
+ 
+ // Start at the root...
+  this->stack[0] = 0;
+  this->depth = 1;
+  BallTree_advance(this);
+}
+
+
+int BallTree_next(Spatial self)
+{
+ BallTree * this = (BallTree*)self;
+ if (this->targ==NULL) return -1;
+ 
+ int ret = this->indices[this->targ->low + this->offset];
+ 
+ this->offset += 1;
+ if ((this->offset+this->targ->low)>=this->targ->high)
+ {
+  BallTree_advance(this);
+ }
+ 
+ return ret;
+}
+
+
+
+size_t BallTree_byte_size(Spatial self)
+{
+ BallTree * this = (BallTree*)self;
+ 
+ size_t ret = sizeof(BallTree) + (size_t)this->image_capacity * DataMatrix_features(this->dm) * sizeof(float);
+ if (this->shared==0) ret += this->dm->exemplars * sizeof(int) + this->nodes * this->node_size;
+ 
+ return ret;
+}
+
+
+
+const SpatialType BallTreeType =
+{
+ "ball_tree",
+ "A metric ball tree - nodes are bounded by hyper-spheres, rather than boxes. Use it for directional data, as with the fisher and mirror_fisher kernels, including in a composite kernel, where it prunes far better than a kd tree; for the mirror_fisher kernel it searches around both directions, so only has to cover the range around the nearest.",
+ BallTree_new,
+ BallTree_delete,
+ BallTree_clone,
+ NULL,
+ BallTree_images,
+ BallTree_dm,
+ BallTree_start,
+ BallTree_next,
+ BallTree_byte_size,
+};
+
+
+
 // List of spatial indexing methods provide by the system...
 const SpatialType * ListSpatial[] =
 {
  &BruteForceType,
  &IterDualType,
  &KDTreeType,
+ &KDStreamType,
+ &BallTreeType,
  NULL
 };
 
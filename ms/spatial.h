@@ -28,6 +28,18 @@ typedef void * Spatial;
 typedef Spatial (*SpatialNew)(DataMatrix * dm, float param);
 typedef void (*SpatialDelete)(Spatial this);
 
+// Creates a new spatial object that shares the index of this one, but with its own iteration state and using the given data matrix (typically a view of the original, see DataMatrix_view) - allows multiple threads to search the same index at the same time. Delete it as normal, but before the spatial it was cloned from...
+typedef Spatial (*SpatialClone)(Spatial this, DataMatrix * dm);
+
+// Optional (can be NULL) - for when the data matrix has been shifted (see DataMatrix_shift), with evicted exemplars removed from the start and new ones appended to the end; updates the index to match. If not provided the index has to be rebuilt from scratch instead...
+typedef void (*SpatialShift)(Spatial this, int evicted);
+
+// Signature of a function that moves a feature vector to the next of a cycle of equivalent feature vectors - matches KernelNext, and is provided with a KernelConfig as config...
+typedef void (*SpatialImageNext)(int dims, void * config, int state, float * fv);
+
+// Optional (can be NULL) - tells the index that each query has states-1 other images, obtained by calling next repeatedly, and that it should return everything in range of any of them (each exemplar once) from subsequent calls to start. This is how symmetries such as those of the MirrorFisher kernel are handled, as the kernel then only needs a range around the nearest image. states of 1 switches it off; the caller must call it again before config becomes invalid...
+typedef void (*SpatialImages)(Spatial this, int states, SpatialImageNext next, void * config);
+
 // Returns the data matrix it is a spatial structure for (Note that it does not own this data matrix - user must delete it when done.)...
 typedef DataMatrix * (*SpatialDM)(Spatial this);
 
@@ -52,6 +64,9 @@ struct SpatialType
  
  SpatialNew init;
  SpatialDelete deinit;
+ SpatialClone clone;
+ SpatialShift shift;
+ SpatialImages images;
  
  SpatialDM dm;
  
@@ -63,9 +78,51 @@ struct SpatialType
 
 
 
-// Define access functions for the spatial objects - they all assume the first entry in the structure pointed to by Spatial is a pointer to its type structure. These just match up with the function pointer typedefs...
+// Counters of the work done by queries, for tuning quality, epsilon and spatial_param against real traffic - every spatial object contains one, which is updated by the spatial itself (queries, candidates, nodes) and by the mean shift code that uses it (everything else). They are plain increments of the spatial's own copy, which is never shared between threads (each thread has a clone), so the overhead is negligible; they can be compiled out entirely by defining MS_NO_COUNTERS, in which case they stay at zero...
+typedef struct Counters Counters;
+
+struct Counters
+{
+ long long queries; // Calls to Spatial_start.
+ long long candidates; // Exemplars returned by Spatial_next.
+ long long nodes; // Tree nodes visited, for the tree based indices.
+ long long pruned; // Tree nodes discarded because their bound was out of range.
+ long long kernel_evals; // Kernel evaluations, which is candidates minus any skipped exemplars.
+ long long modes; // Mean shift convergences run, by any method (mode, cluster, assign_cluster, manifold etc.).
+ long long iterations; // Total mean shift iterations - divide by modes for the average.
+ long long iter_cap_hits; // Convergences that stopped because they hit iter_cap rather than epsilon.
+ long long ball_hits; // Convergences that stopped early because they landed in an existing merge ball (or, for mode, cluster and assign_cluster when a basin cache is in use, a cached basin).
+};
+
+void Counters_zero(Counters * this);
+void Counters_add(Counters * this, const Counters * other);
+
+#ifndef MS_NO_COUNTERS
+#define COUNT(counters, field, amount) ((counters)->field += (amount))
+#else
+#define COUNT(counters, field, amount)
+#endif
+
+
+
+// Define access functions for the spatial objects - they all assume the first entry in the structure pointed to by Spatial is a pointer to its type structure, followed by its Counters (see SpatialHead). These just match up with the function pointer typedefs...
+typedef struct SpatialHead SpatialHead;
+
+struct SpatialHead
+{
+ const SpatialType * type;
+ Counters counters;
+};
+
 Spatial Spatial_new(const SpatialType * type, DataMatrix * dm, float param);
 void Spatial_delete(Spatial this);
+Spatial Spatial_clone(Spatial this, DataMatrix * dm);
+
+// Returns non-zero on success, zero if the type does not support shifting, in which case you need to delete it and create a new one...
+int Spatial_shift(Spatial this, int evicted);
+
+// Returns non-zero if the type supports images, zero if it does not, in which case the range passed to start must be large enough to cover them all...
+int Spatial_images(Spatial this, int states, SpatialImageNext next, void * config);
 
 const SpatialType * Spatial_type(Spatial this);
 DataMatrix * Spatial_dm(Spatial this);
@@ -75,6 +132,9 @@ int Spatial_next(Spatial this);
 
 size_t Spatial_byte_size(Spatial this);
 
+// Returns the counters of the spatial (see above)...
+Counters * Spatial_counters(Spatial this);
+
 
 
 // The various spatial index implimentations provided by this module...
@@ -85,9 +145,50 @@ extern const SpatialType BruteForceType;
 // This makes use of dual dimensions in the data matrix, and just brute forces within the range; often however the dual dimensions can cut down the amount of data that needs processing rather drammatically. Note that if there are no dual dimensions it ends up equivalent to brute forcing...
 extern const SpatialType IterDualType;
 
-// A classic - the binary kd tree...
+// A classic - the binary kd tree. Construction splits at the median using selection rather than sorting, calculates bounding boxes bottom up, puts all nodes in a single allocation and builds large subtrees in parallel...
 extern const SpatialType KDTreeType;
 
+// Access to the internals of a kd tree, for algorithms that want to walk it themselves, such as the dual tree evaluation - only valid if the spatial is of KDTreeType. Each node covers a range of the indices array, which gives the exemplar indices, has its bounding box and the total weight of the exemplars it contains. Links between nodes are stored as byte offsets from the node, so a tree can be saved and mapped back in at any address - use the below functions to follow them; leaf nodes have NULL children...
+typedef struct KDNode KDNode;
+
+struct KDNode
+{
+ ptrdiff_t parent; // Offsets, in bytes, from this node - 0 if there is no such node.
+ ptrdiff_t child_low;
+ ptrdiff_t child_high;
+ 
+ int low; // Range of values the tree covers in the indices array.
+ int high; // Exclusive.
+ 
+ float weight; // Total weight of the exemplars within the node.
+ 
+ float range[0]; // 2* number of features, with the low range indexed for feature i as range[i*2], and the high range [i*2+1].
+};
+
+KDNode * KDNode_parent(KDNode * this);
+KDNode * KDNode_child_low(KDNode * this);
+KDNode * KDNode_child_high(KDNode * this);
+
+KDNode * KDTree_root(Spatial this);
+const int * KDTree_indices(Spatial this);
+
+// For saving a kd tree and loading it back in - the nodes all live in a single block of memory, starting at the root, of the returned size in bytes. map creates a kd tree from the indices and the nodes, in the same format, without copying them - it does not take ownership, so they must remain valid until the kd tree has been deleted...
+size_t KDTree_arena_size(Spatial this);
+Spatial KDTree_map(DataMatrix * dm, int * indices, KDNode * root, size_t arena_size);
+
+// Checks a kd tree that has come from an untrusted source, such as a file, before it is given to KDTree_map - returns non-zero if every index is a valid exemplar, every node covers a valid range of the indices and every link lands on a node within the arena (children after their parent, so it can't loop). Unused space at the end of the arena is allowed, as long as it is zeroed...
+int KDTree_valid(int feats, int exemplars, const int * indices, const KDNode * root, size_t arena_size);
+
+
+
+// A kd tree that supports the data matrix being shifted, as happens when streaming data in with a sliding window. Exemplars are held in a set of kd trees, oldest first, each covering a contiguous run of exemplars and each more than twice the size of the next - new exemplars get their own tree, which is merged with its neighbours whenever that rule is broken, so each exemplar is rebuilt a logarithmic number of times. Evicted exemplars are skipped when iterating, and a tree is only rebuilt once more than half of it has been evicted...
+extern const SpatialType KDStreamType;
+
+
+
+// A metric ball tree - each node has a centre and a radius that contains all of its exemplars, and is split by projecting onto the line between two distant exemplars. Bounds Euclidean distance directly, which for unit vectors is monotonic with the angle between them, so unlike the axis aligned boxes of the kd tree it stays tight for directional data, as used by the Fisher and MirrorFisher kernels, including when they are part of a Composite kernel. Supports images, so the antipodal symmetry of the MirrorFisher kernel can be pruned as well...
+extern const SpatialType BallTreeType;
+
 
 
 // List of all spatial indexing types known to the system - for automatic detection...
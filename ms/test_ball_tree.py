@@ -0,0 +1,55 @@
+#! /usr/bin/env python
+
+# Copyright 2013 Tom SF Haines
+
+# Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except in compliance with the License. You may obtain a copy of the License at
+
+#   http://www.apache.org/licenses/LICENSE-2.0
+
+# Unless required by applicable law or agreed to in writing, software distributed under the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the License for the specific language governing permissions and limitations under the License.
+
+import time
+import numpy
+import numpy.random
+
+from ms import MeanShift
+
+
+
+# Create a pose data set - positions with a rotation, as a unit quaternion, where the sign of the quaternion is random...
+quantity = 50000
+
+def poses(count):
+  pos = numpy.random.multivariate_normal([0.0, 0.0, 0.0], 4.0*numpy.eye(3), count)
+  rot = numpy.random.normal(size=(count, 4))
+  rot /= numpy.sqrt(numpy.square(rot).sum(axis=1))[:,numpy.newaxis]
+  return numpy.concatenate((pos, rot), axis=1)
+
+data = poses(quantity)
+query = poses(1000)
+
+
+
+# Compare against the kd tree for a few kernels, on just the rotation and on the entire pose - the answers should match closely (they differ in what gets cut off by the range) and the ball tree should be much faster for mirror_fisher, as the kd tree can not prune it at all...
+kernels = [('fisher', 3, 'fisher(256.0)'),
+           ('mirror_fisher', 3, 'mirror_fisher(256.0)'),
+           ('composite fisher', 0, 'composite(3:gaussian,4:fisher(64.0))'),
+           ('composite mirror_fisher', 0, 'composite(3:gaussian,4:mirror_fisher(64.0))')]
+
+for name, first, kernel in kernels:
+  ans = dict()
+  for spatial in ['kd_tree', 'ball_tree']:
+    ms = MeanShift()
+    ms.set_data(data[:,first:], 'df')
+    ms.set_kernel(kernel)
+    ms.set_spatial(spatial)
+    ms.probs(query[:1,first:]) # Builds the spatial, so it is not timed.
+
+    start = time.time()
+    ans[spatial] = ms.probs(query[:,first:])
+    end = time.time()
+
+    print '%s, %s: %.3fs' % (name, spatial, end - start)
+
+  print '%s: max relative difference = %f' % (name, (numpy.fabs(ans['kd_tree'] - ans['ball_tree']) / ans['kd_tree'].max()).max())
+  print
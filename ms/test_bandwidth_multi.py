@@ -0,0 +1,59 @@
+#! /usr/bin/env python
+
+# Copyright 2013 Tom SF Haines
+
+# Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except in compliance with the License. You may obtain a copy of the License at
+
+#   http://www.apache.org/licenses/LICENSE-2.0
+
+# Unless required by applicable law or agreed to in writing, software distributed under the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the License for the specific language governing permissions and limitations under the License.
+
+import time
+import numpy
+import numpy.random
+
+from ms import MeanShift
+
+
+
+# Two blobs, with different spreads in each dimension...
+samples = 4000
+data = numpy.random.normal(size=(samples, 2)) * numpy.array([1.0, 0.5])
+data[:samples//2,0] += 4.0
+
+
+
+# Compare loo_nll_scales, which does every scale in one pass, against calling loo_nll for each scale in turn...
+for kernel in ['epanechnikov', 'cosine', 'gaussian']:
+  ms = MeanShift()
+  ms.set_data(data, 'df')
+  ms.set_kernel(kernel)
+  ms.set_spatial('kd_tree')
+
+  steps = 32
+  low = numpy.array([0.5, 1.0])
+  high = numpy.array([8.0, 16.0])
+  scales = numpy.exp(numpy.log(low)[numpy.newaxis,:] + numpy.linspace(0.0, 1.0, steps)[:,numpy.newaxis] * numpy.log(high / low)[numpy.newaxis,:])
+
+  start = time.time()
+  single = numpy.empty(steps)
+  for i in xrange(steps):
+    ms.set_scale(scales[i,:])
+    single[i] = ms.loo_nll()
+  end = time.time()
+  print '%s: loo_nll per scale: %.3fs' % (kernel, end - start)
+
+  start = time.time()
+  ms.set_scale(low)
+  multi = ms.loo_nll_scales(scales)
+  end = time.time()
+  print '%s: loo_nll_scales: %.3fs' % (kernel, end - start)
+
+  print '%s: max relative difference = %f (gaussian differs due to the range cut off)' % (kernel, (numpy.fabs(single - multi) / numpy.fabs(single)).max())
+
+  # The search should find a scale at least as good as the best of the sweep...
+  start = time.time()
+  score = ms.scale_loo_nll_search(low, high)
+  end = time.time()
+  print '%s: search: %.3fs, found %s with %f; best of sweep %s with %f' % (kernel, end - start, str(ms.get_scale()), score, str(scales[numpy.argmin(multi),:]), multi.min())
+  print
@@ -0,0 +1,90 @@
+#! /usr/bin/env python
+
+# Copyright 2013 Tom SF Haines
+
+# Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except in compliance with the License. You may obtain a copy of the License at
+
+#   http://www.apache.org/licenses/LICENSE-2.0
+
+# Unless required by applicable law or agreed to in writing, software distributed under the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the License for the specific language governing permissions and limitations under the License.
+
+import time
+import numpy
+import numpy.random
+
+from ms import MeanShift
+
+
+
+# Some clusters to model...
+centres = numpy.random.random((8, 3)) * 8.0
+
+def sample(count):
+  ret = centres[numpy.random.randint(centres.shape[0], size=count), :]
+  ret += numpy.random.normal(scale=0.7, size=ret.shape)
+  return ret.astype(numpy.float32)
+
+
+
+# Create the model and cluster it...
+ms = MeanShift()
+ms.set_data(sample(6000), 'df')
+ms.set_kernel('gaussian')
+ms.set_spatial('kd_tree')
+
+modes, _ = ms.cluster()
+print 'Found %i modes' % modes.shape[0]
+
+
+
+# Generate a stream of batches from the same distribution...
+stream = [sample(4000) for _ in xrange(5)]
+
+
+
+# Assign the stream with the cache off to get the reference answer, and then with it on at several cell sizes...
+for step in [0.0, 0.05, 0.1, 0.25]:
+  ms.cache_step = step
+
+  start = time.time()
+  assigned = [ms.assign_clusters(batch) for batch in stream]
+  end = time.time()
+
+  if step==0.0:
+    reference = assigned
+    print 'cache off: assign_clusters = %.3fs' % (end - start)
+  else:
+    differ = sum([(a!=r).sum() for a, r in zip(assigned, reference)])
+    print 'cache_step = %.2f: assign_clusters = %.3fs, %i of %i differ, cache = %i bytes' % (step, end - start, differ, 5 * 4000, ms.memory()['cache'])
+print
+
+
+
+# Same again for modes...
+for step in [0.0, 0.05, 0.1, 0.25]:
+  ms.cache_step = step
+
+  start = time.time()
+  found = [ms.modes(batch) for batch in stream]
+  end = time.time()
+
+  if step==0.0:
+    reference = found
+    print 'cache off: modes = %.3fs' % (end - start)
+  else:
+    wrong = sum([(numpy.sqrt(numpy.square(f - r).sum(axis=1))>0.1).sum() for f, r in zip(found, reference)])
+    print 'cache_step = %.2f: modes = %.3fs, %i of %i more than 0.1 from the reference' % (step, end - start, wrong, 5 * 4000)
+print
+
+
+
+# Changing the kernel must empty the cache - check the answers match a fresh model...
+ms.cache_step = 0.1
+ms.assign_clusters(stream[0])
+ms.set_kernel('epanechnikov')
+modes, _ = ms.cluster()
+cached = ms.assign_clusters(stream[1])
+
+ms.cache_step = 0.0
+fresh = ms.assign_clusters(stream[1])
+print 'After changing the kernel: %i of %i differ' % ((cached!=fresh).sum(), 4000)
@@ -0,0 +1,59 @@
+#! /usr/bin/env python
+
+# Copyright 2013 Tom SF Haines
+
+# Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except in compliance with the License. You may obtain a copy of the License at
+
+#   http://www.apache.org/licenses/LICENSE-2.0
+
+# Unless required by applicable law or agreed to in writing, software distributed under the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the License for the specific language governing permissions and limitations under the License.
+
+import time
+import numpy
+import numpy.random
+
+from ms import MeanShift
+
+
+
+# Create an image to segment - blocks of colour with noise, as an image index dual dimension plus colour...
+height = 480
+width = 640
+
+image = numpy.empty((height, width, 3), dtype=numpy.float32)
+for y in xrange(height):
+  for x in xrange(width):
+    region = (x // 128) + 5 * (y // 120)
+    image[y, x, :] = [(region%3) * 4.0, (region%4) * 4.0, (region%5) * 4.0]
+image += numpy.random.normal(scale=0.3, size=image.shape)
+
+
+
+# Setup the mean shift object...
+ms = MeanShift()
+ms.set_data(image, 'bbf')
+ms.set_kernel('gaussian')
+ms.set_spatial('kd_tree')
+ms.set_scale(numpy.array([1.0/8.0, 1.0/8.0, 1.0, 1.0, 1.0]))
+
+
+
+# Cluster with 1, 2 and one thread per core - the threaded version replays each exemplar in order against the modes found so far, so the modes and the assignment should be identical, not just agree, with and without the cache of basins...
+for cache_step in [0.0, 0.25]:
+  for ident_dist in [0.0, 0.3]:
+    ms.cache_step = cache_step
+    ms.ident_dist = ident_dist
+    
+    start = time.time()
+    modes_single, seg_single = ms.cluster(1)
+    print 'cache_step = %.2f, ident_dist = %.1f: single = %.3fs (%i modes)' % (cache_step, ident_dist, time.time() - start, modes_single.shape[0])
+    
+    for threads in [2, 0]:
+      start = time.time()
+      modes_multi, seg_multi = ms.cluster(threads)
+      print '  threads = %i: %.3fs (%i modes)' % (threads, time.time() - start, modes_multi.shape[0])
+      
+      assert(modes_multi.shape==modes_single.shape)
+      assert((modes_multi==modes_single).all())
+      assert((seg_multi==seg_single).all())
+    print
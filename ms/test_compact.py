@@ -0,0 +1,63 @@
+#! /usr/bin/env python
+
+# Copyright 2013 Tom SF Haines
+
+# Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except in compliance with the License. You may obtain a copy of the License at
+
+#   http://www.apache.org/licenses/LICENSE-2.0
+
+# Unless required by applicable law or agreed to in writing, software distributed under the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the License for the specific language governing permissions and limitations under the License.
+
+import time
+import numpy
+import numpy.random
+
+from ms import MeanShift
+
+
+
+# Two blobs in 4D, with a query set that covers them...
+data = numpy.random.normal(scale=3.0, size=(200000, 4))
+data[::2,:] += 5.0
+
+query = numpy.random.normal(loc=2.5, scale=4.0, size=(5000, 4))
+
+
+
+# Go through the formats, comparing probabilities and memory usage to the data matrix without materialisation...
+ms = MeanShift()
+ms.set_data(data, 'df')
+ms.set_kernel('gaussian')
+ms.set_spatial('kd_tree')
+ms.scale_silverman()
+
+start = time.time()
+exact = ms.probs(query)
+end = time.time()
+print 'not materialised: probs = %.1f us per query' % (1e6 * (end - start) / query.shape[0])
+
+for fmt in ['float32', 'float16', 'uint16', 'uint8']:
+  ms.set_materialise(fmt)
+  assert(ms.get_materialise_format()==fmt)
+
+  start = time.time()
+  p = ms.probs(query)
+  end = time.time()
+
+  error = numpy.fabs(p - exact).max() / exact.max()
+  print '%s: probs = %.1f us per query, max error relative to peak = %.2e, dm = %i bytes' % (fmt, 1e6 * (end - start) / query.shape[0], error, ms.memory()['dm'])
+
+ms.set_materialise(False)
+assert(ms.get_materialise_format()==None)
+print
+
+
+
+# Mean shift to the modes from a few points - uint8 should land within a fraction of a kernel of the exact answer...
+ms.set_materialise('float32')
+modes = ms.modes(query[:100,:])
+
+for fmt in ['float16', 'uint16', 'uint8']:
+  ms.set_materialise(fmt)
+  m = ms.modes(query[:100,:])
+  print '%s: max mode difference = %.2e' % (fmt, numpy.fabs(m - modes).max())
@@ -0,0 +1,63 @@
+#! /usr/bin/env python
+
+# Copyright 2013 Tom SF Haines
+
+# Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except in compliance with the License. You may obtain a copy of the License at
+
+#   http://www.apache.org/licenses/LICENSE-2.0
+
+# Unless required by applicable law or agreed to in writing, software distributed under the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the License for the specific language governing permissions and limitations under the License.
+
+import time
+import numpy
+import numpy.random
+
+from ms import MeanShift
+
+
+
+# Position plus orientation, as quaternions, which is the case the specialised composite kernels are aimed at - compares the specialised version to the generic version, which is forced by adding an extra dimension that is always zero with a uniform kernel on it (so it just multiplies the probability by the normaliser of the 1D uniform kernel, 0.5)...
+samples = 20000
+
+pos = numpy.random.normal(scale=2.0, size=(samples, 3))
+rot = numpy.random.normal(size=(samples, 4))
+rot[:,0] += 2.0 * (pos[:,0]>0.0)
+rot /= numpy.sqrt(numpy.square(rot).sum(axis=1))[:,numpy.newaxis]
+
+data = numpy.concatenate((pos, rot, numpy.zeros((samples, 1))), axis=1)
+query = data[:1000,:].copy()
+query[:,:3] += numpy.random.normal(scale=0.2, size=(1000, 3))
+
+
+
+for direction in ['fisher(32.0)', 'fisher(512.0)', 'mirror_fisher(32.0)', 'mirror_fisher(512.0)']:
+  ms_fused = MeanShift()
+  ms_fused.set_data(data[:,:7], 'df')
+  ms_fused.set_kernel('composite(3:gaussian,4:%s)' % direction)
+  ms_fused.set_spatial('kd_tree')
+  ms_fused.set_scale(numpy.array([2.0, 2.0, 2.0, 1.0, 1.0, 1.0, 1.0]))
+  ms_fused.quality = 1.0
+
+  ms_generic = MeanShift()
+  ms_generic.set_data(data, 'df')
+  ms_generic.set_kernel('composite(3:gaussian,4:%s,1:uniform)' % direction)
+  ms_generic.set_spatial('kd_tree')
+  ms_generic.set_scale(numpy.array([2.0, 2.0, 2.0, 1.0, 1.0, 1.0, 1.0, 1.0]))
+  ms_generic.quality = 1.0
+
+  start = time.time()
+  p_fused = ms_fused.probs(query[:,:7])
+  mid = time.time()
+  p_generic = ms_generic.probs(query) / 0.5
+  end = time.time()
+
+  error = numpy.fabs(p_fused - p_generic).max() / p_generic.max()
+  print '%s: specialised = %.1f us per query, generic = %.1f us per query, max error relative to peak = %.2e' % (direction, 1e6 * (mid - start) / query.shape[0], 1e6 * (end - mid) / query.shape[0], error)
+
+  start = time.time()
+  m_fused = ms_fused.modes(query[:100,:7])
+  mid = time.time()
+  m_generic = ms_generic.modes(query[:100,:])
+  end = time.time()
+
+  print '  modes: specialised = %.2fs, generic = %.2fs, max difference = %.2e' % (mid - start, end - mid, numpy.fabs(m_fused - m_generic[:,:7]).max())
@@ -0,0 +1,91 @@
+#! /usr/bin/env python
+
+# Copyright 2013 Tom SF Haines
+
+# Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except in compliance with the License. You may obtain a copy of the License at
+
+#   http://www.apache.org/licenses/LICENSE-2.0
+
+# Unless required by applicable law or agreed to in writing, software distributed under the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the License for the specific language governing permissions and limitations under the License.
+
+import time
+import numpy
+import numpy.random
+
+from ms import MeanShift
+
+
+
+# Lots of exemplars in 3D, two blobs - compress with a range of tolerances and compare probabilities, speed and the reported error...
+data = numpy.random.normal(scale=3.0, size=(2000000, 3))
+data[::2,:] += 5.0
+
+query = numpy.random.normal(loc=2.5, scale=4.0, size=(2000, 3))
+
+ms = MeanShift()
+ms.set_data(data, 'df')
+ms.set_kernel('gaussian')
+ms.set_spatial('kd_tree')
+ms.set_scale(numpy.ones(3))
+ms.quality = 1.0
+
+start = time.time()
+exact = ms.probs(query)
+end = time.time()
+print 'original: %i exemplars, probs = %.1f us per query' % (ms.exemplars(), 1e6 * (end - start) / query.shape[0])
+
+for tolerance in [0.1, 0.2, 0.4]:
+  start = time.time()
+  core, info = ms.coreset(tolerance)
+  end = time.time()
+
+  assert(info['max_shift'] <= tolerance * 1.001)
+  assert(numpy.fabs(core.weight() - ms.weight()) < 1e-3 * ms.weight())
+
+  mid = time.time()
+  p = core.probs(query)
+  fin = time.time()
+
+  error = numpy.fabs(p - exact).max() / exact.max()
+  print 'tolerance %.1f: %i exemplars, build = %.2fs, probs = %.1f us per query, max error relative to peak = %.2e' % (tolerance, info['exemplars'], end - start, 1e6 * (fin - mid) / query.shape[0], error)
+  print '  mean shift = %.3f, max shift = %.3f, l1 bound = %.2e, kl = %.2e' % (info['mean_shift'], info['max_shift'], info['l1_bound'], info['kl'])
+print
+
+
+
+# Directional data, with a conversion code - the coreset lives in the same external space and keeps the exemplars on the sphere...
+angles = numpy.random.vonmises(0.5, 4.0, size=(200000, 1))
+
+ms = MeanShift()
+ms.set_data(angles, 'df', None, 'A')
+ms.set_kernel('fisher(64.0)')
+ms.quality = 1.0
+
+core, info = ms.coreset(0.05)
+query = numpy.linspace(-numpy.pi, numpy.pi, 360).reshape((-1, 1))
+
+exact = ms.probs(query)
+p = core.probs(query)
+print 'fisher on angles: %i exemplars from %i, max error relative to peak = %.2e, kl = %.2e' % (info['exemplars'], ms.exemplars(), numpy.fabs(p - exact).max() / exact.max(), info['kl'])
+
+
+
+# Antipodal pairs, q and -q, so cells can have a mean of zero length that the directional kernels can not project - these must be split, never emitted as nan...
+q = numpy.random.normal(size=(5000, 3))
+q /= numpy.sqrt(numpy.square(q).sum(axis=1))[:,numpy.newaxis]
+pairs = numpy.concatenate((q, -q), axis=0)
+
+for kernel, data, tolerance in [('mirror_fisher(16.0)', pairs, 0.1), ('mirror_fisher(16.0)', pairs, 4.0), ('fisher(4.0)', numpy.array([[0.0, 0.0, 1.0], [0.0, 0.0, -1.0]]), 4.0)]:
+  ms = MeanShift()
+  ms.set_data(data, 'df')
+  ms.set_kernel(kernel)
+  ms.quality = 1.0
+  
+  core, info = ms.coreset(tolerance, -1)
+  dm = core.get_dm()
+  
+  assert(numpy.isfinite(dm).all())
+  assert(numpy.fabs(numpy.sqrt(numpy.square(dm[:,:3]).sum(axis=1)) - 1.0).max() < 1e-3)
+  assert(numpy.fabs(core.weight() - ms.weight()) < 1e-3 * ms.weight())
+  assert(info['max_shift'] <= tolerance * 1.001)
+  print '%s on antipodal pairs, tolerance %.1f: %i exemplars from %i, all finite' % (kernel, tolerance, info['exemplars'], ms.exemplars())
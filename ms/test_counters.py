@@ -0,0 +1,86 @@
+#! /usr/bin/env python
+
+# Copyright 2013 Tom SF Haines
+
+# Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except in compliance with the License. You may obtain a copy of the License at
+
+#   http://www.apache.org/licenses/LICENSE-2.0
+
+# Unless required by applicable law or agreed to in writing, software distributed under the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the License for the specific language governing permissions and limitations under the License.
+
+import numpy
+import numpy.random
+
+from ms import MeanShift
+
+
+
+# Two blobs in 2D - cluster them with each spatial index and print the work counters, to show how much the trees prune...
+data = numpy.random.normal(size=(4000, 2))
+data[::2,:] += 6.0
+
+for spatial in MeanShift.spatials():
+  ms = MeanShift()
+  ms.set_data(data, 'df')
+  ms.set_kernel('gaussian')
+  ms.set_spatial(spatial)
+  ms.scale_silverman()
+
+  modes, assignment = ms.cluster()
+  c = ms.counters(True)
+
+  if c['enabled']:
+    assert(c['modes']>0 and c['queries']>0)
+    assert(c['kernel_evals']<=c['candidates'])
+    assert(c['ball_hits']<=c['modes'] and c['iter_cap_hits']<=c['modes'])
+
+  print '%s: %i clusters' % (spatial, modes.shape[0])
+  print '  %i queries, %.1f candidates per query, %.1f nodes per query, %.1f pruned per query' % (c['queries'], c['candidates_per_query'], c['nodes_per_query'], c['pruned_per_query'])
+  print '  %i convergences, %.2f iterations each, iter cap rate %.3f, ball hit rate %.3f' % (c['modes'], c['iterations_per_mode'], c['iter_cap_rate'], c['ball_hit_rate'])
+
+  # The reset must have happened...
+  assert(ms.counters()['queries']==0)
+print
+
+
+
+# A tiny iteration cap, with multiple threads - every convergence should hit the cap, and the work of all threads should be counted...
+ms = MeanShift()
+ms.set_data(data, 'df')
+ms.set_kernel('gaussian')
+ms.set_spatial('kd_tree')
+ms.scale_silverman()
+ms.epsilon = 1e-12
+ms.iter_cap = 2
+
+ms.modes(data[:500,:], 0)
+c = ms.counters()
+print 'capped: %i convergences, %i hit the cap, %i iterations' % (c['modes'], c['iter_cap_hits'], c['iterations'])
+if c['enabled']:
+  assert(c['modes']==500)
+  assert(c['iterations']==1000)
+
+
+
+# Counters survive the spatial index being rebuilt, as happens when the data changes...
+before = ms.counters()['queries']
+ms.set_scale(numpy.ones(2))
+ms.prob(data[0,:])
+print 'queries after a rebuild: %i (was %i)' % (ms.counters()['queries'], before)
+if c['enabled']:
+  assert(ms.counters()['queries']>before)
+
+
+
+# The probability code counts its kernel evaluations too - the dual tree version with zero tolerance evaluates exactly what probs does, and loo_nll_scales evaluates every candidate...
+ms.counters(True)
+ms.probs(data[:200,:])
+single = ms.counters(True)['kernel_evals']
+ms.probs_dual(data[:200,:], 0.0, 0.0)
+dual = ms.counters(True)['kernel_evals']
+ms.loo_nll_scales(numpy.array([[0.5, 0.5], [1.0, 1.0]]), 1e-16, 100)
+loo = ms.counters(True)['kernel_evals']
+print 'kernel evaluations: probs %i, probs_dual %i, loo_nll_scales %i' % (single, dual, loo)
+if c['enabled']:
+  assert(single>0 and dual==single)
+  assert(loo>0)
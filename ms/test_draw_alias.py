@@ -0,0 +1,62 @@
+#! /usr/bin/env python
+
+# Copyright 2014 Tom SF Haines
+
+# Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except in compliance with the License. You may obtain a copy of the License at
+
+#   http://www.apache.org/licenses/LICENSE-2.0
+
+# Unless required by applicable law or agreed to in writing, software distributed under the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the License for the specific language governing permissions and limitations under the License.
+
+import time
+import numpy
+import numpy.random
+
+from ms import MeanShift
+
+
+
+# Weighted data set, with a wide range of weights including zeros...
+exemplars = 10000
+data = numpy.empty((exemplars, 3), dtype=numpy.float32)
+data[:,0] = numpy.arange(exemplars)
+data[:,1] = numpy.random.random(exemplars)
+data[:,2] = numpy.random.exponential(size=exemplars)
+data[numpy.random.random(exemplars)<0.2, 2] = 0.0
+
+ms = MeanShift()
+ms.set_data(data, 'df', 2)
+ms.set_kernel('gaussian')
+ms.set_scale(numpy.array([10.0, 10.0]))
+
+
+
+# Bootstrap draw, with indices, and check the frequency each exemplar is drawn at against its weight...
+draws = 4000000
+
+start = time.time()
+boot, index = ms.bootstrap(draws, True)
+end = time.time()
+print 'bootstrap of %i: %.3fs' % (draws, end - start)
+
+assert((boot[:,0]==index).all())
+
+count = numpy.bincount(index, minlength=exemplars)
+expected = draws * data[:,2] / data[:,2].sum()
+
+print 'zero weight exemplars drawn = %i' % count[expected==0.0].sum()
+use = expected>50.0
+print 'max z-score = %.2f (should be about 4)' % (numpy.fabs(count[use] - expected[use]) / numpy.sqrt(expected[use])).max()
+print
+
+
+
+# Kernel draws with indices - the draws should be close to the exemplar they claim to be centred on...
+start = time.time()
+draw, index = ms.draws(draws, True)
+end = time.time()
+print 'draws of %i: %.3fs' % (draws, end - start)
+
+offset = draw - data[index,:2]
+print 'offset sd = %.3f, %.3f (should be about 0.1)' % tuple(offset.std(axis=0))
+print 'zero weight exemplars drawn = %i' % (data[index,2]==0.0).sum()
@@ -0,0 +1,77 @@
+#! /usr/bin/env python
+
+# Copyright 2013 Tom SF Haines
+
+# Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except in compliance with the License. You may obtain a copy of the License at
+
+#   http://www.apache.org/licenses/LICENSE-2.0
+
+# Unless required by applicable law or agreed to in writing, software distributed under the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the License for the specific language governing permissions and limitations under the License.
+
+import time
+import numpy
+import numpy.random
+
+from ms import MeanShift
+
+
+
+# Lots of MeanShift objects with the same Fisher kernel, as in belief propagation - they should all share one table...
+data = numpy.random.normal(size=(1000, 3))
+data[:,0] += 2.0
+data /= numpy.sqrt(numpy.square(data).sum(axis=1))[:,numpy.newaxis]
+
+start = time.time()
+objs = []
+for i in xrange(50):
+  ms = MeanShift()
+  ms.set_data(data, 'df')
+  ms.set_kernel('fisher(24.0)')
+  objs.append(ms)
+end = time.time()
+print 'Created 50 objects with fisher(24.0) in %.3fs' % (end - start)
+
+tables = [t for t in MeanShift.fisher_cache() if t['alpha']!=None]
+assert(len(tables)==1)
+assert(tables[0]['ref_count']==50)
+print 'Shared table: dims = %i, entries = %i, bytes = %i, ref_count = %i, inverse cdf error = %.2e' % (tables[0]['dims'], tables[0]['entries'], tables[0]['bytes'], tables[0]['ref_count'], tables[0]['error'])
+print
+
+
+
+# Multiplication uses the per dimension normaliser table - time some draws and report its accuracy...
+out = numpy.empty((200, 3), dtype=numpy.float32)
+
+start = time.time()
+MeanShift.mult(objs[:4], out)
+end = time.time()
+print 'mult of 4 fisher(24.0) KDEs: %.1f ms per draw' % (1e3 * (end - start) / out.shape[0])
+
+for t in MeanShift.fisher_cache():
+  if t['alpha']==None:
+    print 'Normaliser table: dims = %i, entries = %i, bytes = %i, max log normaliser error = %.2e' % (t['dims'], t['entries'], t['bytes'], t['error'])
+print
+
+
+
+# Check the normaliser is right, by integrating the kernel numerically over the sphere in 3D, where it is easy to do...
+theta = numpy.linspace(0.0, numpy.pi, 2001)
+weight = numpy.sin(theta) * 2.0 * numpy.pi * (theta[1] - theta[0])
+
+for alpha in [0.5, 8.0, 64.0, 200.0]:
+  ms = MeanShift()
+  ms.set_data(numpy.array([[1.0, 0.0, 0.0]]), 'df')
+  ms.set_kernel('fisher(%f)' % alpha)
+
+  points = numpy.concatenate((numpy.cos(theta)[:,numpy.newaxis], numpy.sin(theta)[:,numpy.newaxis], numpy.zeros((theta.shape[0], 1))), axis=1)
+  integral = (ms.probs(points) * weight).sum()
+  print 'fisher(%.1f): integral over sphere = %.6f' % (alpha, integral)
+
+
+
+# Releasing the objects releases the shared table...
+del objs
+del ms
+assert(len([t for t in MeanShift.fisher_cache() if t['alpha']==24.0])==0)
+print
+print 'Tables released'
@@ -0,0 +1,66 @@
+#! /usr/bin/env python
+
+# Copyright 2013 Tom SF Haines
+
+# Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except in compliance with the License. You may obtain a copy of the License at
+
+#   http://www.apache.org/licenses/LICENSE-2.0
+
+# Unless required by applicable law or agreed to in writing, software distributed under the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the License for the specific language governing permissions and limitations under the License.
+
+import time
+import numpy
+import numpy.random
+
+from ms import MeanShift
+
+
+
+# Compare probs with and without the binned grid approximation, for 1, 2 and 3 dimensions and the three kernels it is most likely to be used with, checking the error against the documented bound...
+for dims in [1, 2, 3]:
+  data = numpy.random.normal(scale=4.0, size=(100000, dims))
+  data[::2,:] += 6.0
+
+  query = numpy.random.normal(loc=3.0, scale=5.0, size=(200000, dims))
+
+  for kernel in ['gaussian', 'epanechnikov', 'uniform']:
+    ms = MeanShift()
+    ms.set_data(data, 'df')
+    ms.set_kernel(kernel)
+    ms.set_spatial('kd_tree')
+    ms.quality = 1.0
+
+    start = time.time()
+    exact = ms.probs(query[:2000,:])
+    end = time.time()
+    print '%iD %s: probs = %.1f us per query' % (dims, kernel, 1e6 * (end - start) / 2000)
+
+    # Height of a single kernel holding all the weight, to scale the error bound...
+    single = MeanShift()
+    single.set_data(numpy.zeros((1, dims)), 'df')
+    single.set_kernel(kernel)
+    height = single.prob(numpy.zeros(dims))
+
+    for step in [0.4, 0.2, 0.1]:
+      ms.grid_step = step
+
+      start = time.time()
+      ms.probs(query[:1,:]) # Builds the grid.
+      mid = time.time()
+      approx = ms.probs(query)
+      end = time.time()
+
+      if ms.memory()['grid']==0:
+        print '  step %.1f: too large, fell back to the exact calculation' % step
+        continue
+
+      error = numpy.fabs(approx[:2000] - exact).max()
+      if kernel=='gaussian':
+        bound = '%.2e' % (dims * step**2 * height / 4.0)
+      elif kernel=='epanechnikov':
+        bound = '%.2e' % (2.0 * numpy.sqrt(dims) * step * 2.0 * height)
+      else:
+        bound = 'none'
+
+      print '  step %.1f: build = %.3fs, probs = %.3f us per query, max error = %.2e (bound %s), grid = %i bytes' % (step, mid - start, 1e6 * (end - mid) / query.shape[0], error, bound, ms.memory()['grid'])
+  print
@@ -0,0 +1,74 @@
+#! /usr/bin/env python
+
+# Copyright 2013 Tom SF Haines
+
+# Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except in compliance with the License. You may obtain a copy of the License at
+
+#   http://www.apache.org/licenses/LICENSE-2.0
+
+# Unless required by applicable law or agreed to in writing, software distributed under the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the License for the specific language governing permissions and limitations under the License.
+
+import numpy
+import numpy.random
+
+from ms import MeanShift
+
+
+
+# Checks that materialising the data matrix as float32 changes nothing - the fetched rows are the same values, just read in place...
+numpy.random.seed(0)
+
+data = numpy.random.normal(scale=2.0, size=(2000, 4))
+data[::2,:] += 4.0
+data = numpy.append(data, numpy.random.uniform(0.5, 2.0, size=(data.shape[0], 1)), axis=1)
+
+query = numpy.random.normal(loc=2.0, scale=3.0, size=(200, 4))
+
+
+
+def close(a, b, tol = 1e-5):
+  return numpy.all(numpy.fabs(a - b) <= tol * (1.0 + numpy.fabs(b)))
+
+
+
+for spatial in ['kd_tree', 'iter_dual', 'brute_force']:
+  for kernel in ['gaussian', 'epanechnikov', 'cauchy']:
+    ms = MeanShift()
+    ms.set_data(data, 'df', 4)
+    ms.set_kernel(kernel)
+    ms.set_spatial(spatial)
+    ms.set_scale(numpy.array([0.8, 1.2, 0.9, 1.1]))
+    
+    p = ms.prob(query[0,:])
+    ps = ms.probs(query)
+    modes = ms.modes(query[:50,:])
+    
+    ms.set_materialise(True)
+    assert(ms.get_materialise())
+    
+    assert(close(ms.prob(query[0,:]), p))
+    assert(close(ms.probs(query), ps))
+    assert(close(ms.modes(query[:50,:]), modes, 1e-4))
+    
+    ms.set_materialise(False)
+    assert(not ms.get_materialise())
+    
+    assert(close(ms.probs(query), ps))
+    
+    print '%s, %s: prob, probs and modes match with materialise on and off' % (spatial, kernel)
+
+
+
+# Manifold converges using the unit Gaussian - check it too, as it used to edit the fetched rows...
+ms = MeanShift()
+ms.set_data(data, 'df', 4)
+ms.set_kernel('gaussian')
+ms.set_spatial('kd_tree')
+ms.scale_silverman()
+
+lines = ms.manifolds(query[:20,:], 1)
+ms.set_materialise(True)
+assert(close(ms.manifolds(query[:20,:], 1), lines, 1e-4))
+assert(close(ms.manifolds(query[:20,:], 1), lines, 1e-4))
+
+print 'manifolds match with materialise on and off'
@@ -0,0 +1,79 @@
+#! /usr/bin/env python
+
+# Copyright 2013 Tom SF Haines
+
+# Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except in compliance with the License. You may obtain a copy of the License at
+
+#   http://www.apache.org/licenses/LICENSE-2.0
+
+# Unless required by applicable law or agreed to in writing, software distributed under the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the License for the specific language governing permissions and limitations under the License.
+
+import time
+import numpy
+import numpy.random
+
+from ms import MeanShift
+
+
+
+# A chain of nodes, as in belief propagation, where each node has a message from the left and one from the right - the messages are Gaussian blobs with different means...
+nodes = 16
+samples = 500
+
+messages = []
+for i in xrange(nodes + 1):
+  ms = MeanShift()
+  ms.set_data(numpy.random.normal(loc=float(i), size=(samples, 2)), 'df')
+  ms.set_kernel('gaussian')
+  ms.set_spatial('kd_tree')
+  ms.scale_silverman()
+  messages.append(ms)
+
+# The product at node i is message i times message i+1 times a prior at the origin...
+prior = MeanShift()
+prior.set_data(numpy.random.normal(scale=4.0, size=(samples, 2)), 'df')
+prior.set_kernel('gaussian')
+prior.set_spatial('kd_tree')
+prior.scale_silverman()
+
+jobs = [[messages[i], messages[i+1], prior] for i in xrange(nodes)]
+
+
+
+# Do the sweep with a mult call per node...
+draws = 200
+
+start = time.time()
+single = [numpy.empty((draws, 2), dtype=numpy.float32) for _ in xrange(nodes)]
+for job, out in zip(jobs, single):
+  MeanShift.mult(job, out)
+end = time.time()
+print 'mult per node: %.3fs' % (end - start)
+
+
+
+# And in one go, with several thread counts - the output should not depend on the thread count...
+outputs = []
+for threads in [1, 2, 0]:
+  messages[0].rng0 = 0
+  messages[0].rng1 = 0
+  messages[0].rng2 = 0
+  messages[0].rng3 = 0
+
+  start = time.time()
+  out = [numpy.empty((draws, 2), dtype=numpy.float32) for _ in xrange(nodes)]
+  MeanShift.mult_batch(jobs, out, threads=threads)
+  end = time.time()
+  print 'mult_batch with %i threads: %.3fs' % (threads, end - start)
+
+  outputs.append(out)
+
+for out in outputs[1:]:
+  print 'Identical to single threaded: %s' % str(all([(a==b).all() for a, b in zip(outputs[0], out)]))
+print
+
+
+
+# The two approaches should agree on the distribution - compare means...
+for i in xrange(0, nodes, 4):
+  print 'node %i: mean of mult = %s, mean of mult_batch = %s' % (i, str(single[i].mean(axis=0)), str(outputs[0][i].mean(axis=0)))
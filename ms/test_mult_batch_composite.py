@@ -0,0 +1,65 @@
+#! /usr/bin/env python
+
+# Copyright 2013 Tom SF Haines
+
+# Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except in compliance with the License. You may obtain a copy of the License at
+
+#   http://www.apache.org/licenses/LICENSE-2.0
+
+# Unless required by applicable law or agreed to in writing, software distributed under the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the License for the specific language governing permissions and limitations under the License.
+
+import numpy
+import numpy.random
+
+from ms import MeanShift
+
+
+
+# mult_batch with composite kernels, where the threads share the kernel configurations of the MeanShift objects - every object appears in several jobs so the workers are multiplying the same configurations at the same time. Covers the specialised (gaussian plus fisher) composite, the generic one and a composite nested inside a composite...
+objects = 8
+samples = 200
+draws = 256
+
+kernels = [('composite(2:gaussian,3:fisher(16.0))', 5), ('composite(2:gaussian,3:fisher(16.0),1:logistic)', 6), ('composite(2:composite(1:gaussian,1:logistic),3:mirror_fisher(16.0))', 5)]
+
+
+
+for kernel, dims in kernels:
+  mss = []
+  for i in xrange(objects):
+    pos = numpy.random.normal(loc=0.25 * i, size=(samples, 2))
+    rot = numpy.random.normal(size=(samples, 3))
+    rot[:,0] += 3.0
+    rot /= numpy.sqrt(numpy.square(rot).sum(axis=1))[:,numpy.newaxis]
+    data = numpy.concatenate((pos, rot, numpy.random.normal(size=(samples, dims-5))), axis=1)
+    
+    ms = MeanShift()
+    ms.set_data(data, 'df')
+    ms.set_kernel(kernel)
+    ms.set_spatial('kd_tree')
+    ms.set_scale(numpy.ones(dims))
+    mss.append(ms)
+  
+  # Overlapping jobs - every object is in three of them...
+  jobs = [[mss[i], mss[(i+1)%objects], mss[(i+2)%objects]] for i in xrange(objects)]
+  
+  outputs = []
+  for threads in [1, 2, 4]:
+    mss[0].rng0 = 0
+    mss[0].rng1 = 0
+    mss[0].rng2 = 0
+    mss[0].rng3 = 0
+    
+    out = [numpy.empty((draws, dims), dtype=numpy.float32) for _ in xrange(len(jobs))]
+    MeanShift.mult_batch(jobs, out, threads=threads)
+    outputs.append(out)
+  
+  for out in outputs:
+    for o in out:
+      assert(numpy.isfinite(o).all())
+      assert(numpy.fabs(numpy.sqrt(numpy.square(o[:,2:5]).sum(axis=1)) - 1.0).max() < 1e-3)
+  
+  for out in outputs[1:]:
+    assert(all([(a==b).all() for a, b in zip(outputs[0], out)]))
+  
+  print '%s: %i threads agree' % (kernel, len(outputs))
@@ -0,0 +1,75 @@
+#! /usr/bin/env python
+
+# Copyright 2013 Tom SF Haines
+
+# Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except in compliance with the License. You may obtain a copy of the License at
+
+#   http://www.apache.org/licenses/LICENSE-2.0
+
+# Unless required by applicable law or agreed to in writing, software distributed under the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the License for the specific language governing permissions and limitations under the License.
+
+import time
+import numpy
+import numpy.random
+
+from ms import MeanShift
+
+
+
+# Checks probs_dual against probs - every output must be within abs_tol + rel_tol * p of the true value (plus a little for float rounding)...
+numpy.random.seed(0)
+
+data = numpy.random.normal(scale=2.0, size=(20000, 3))
+data[::2,:] += 4.0
+data = numpy.append(data, numpy.random.uniform(0.5, 2.0, size=(data.shape[0], 1)), axis=1)
+
+query = numpy.random.normal(loc=2.0, scale=3.0, size=(5000, 3))
+
+
+
+def check(ms, rel_tol, abs_tol):
+  start = time.time()
+  p = ms.probs(query)
+  mid = time.time()
+  pd = ms.probs_dual(query, rel_tol, abs_tol)
+  end = time.time()
+  
+  assert(pd.shape==p.shape)
+  err = numpy.fabs(pd - p)
+  assert(numpy.all(err <= abs_tol + rel_tol * p + 1e-4 * (1e-3 + p)))
+  
+  return err.max(), mid - start, end - mid
+
+
+
+for kernel in ['uniform', 'triangular', 'epanechnikov', 'cosine', 'gaussian', 'cauchy', 'logistic']:
+  ms = MeanShift()
+  ms.set_data(data, 'df', 3)
+  ms.set_kernel(kernel)
+  ms.set_spatial('kd_tree')
+  ms.scale_silverman()
+  
+  for rel_tol, abs_tol in [(0.0, 0.0), (1e-2, 0.0), (0.0, 1e-3), (5e-2, 1e-2)]:
+    err, t_probs, t_dual = check(ms, rel_tol, abs_tol)
+    print '%s, rel_tol = %.0e, abs_tol = %.0e: max error = %.2e; probs = %.3fs, probs_dual = %.3fs' % (kernel, rel_tol, abs_tol, err, t_probs, t_dual)
+
+
+
+# The fallback path, for when the spatial is not a kd tree, must match exactly...
+ms = MeanShift()
+ms.set_data(data, 'df', 3)
+ms.set_kernel('gaussian')
+ms.set_spatial('ball_tree')
+ms.scale_silverman()
+
+err, _, _ = check(ms, 0.0, 0.0)
+assert(err==0.0)
+print 'ball_tree fallback: max error = %.2e' % err
+
+
+
+# No queries should give an empty answer...
+ms.set_spatial('kd_tree')
+empty = ms.probs_dual(numpy.zeros((0, 3)))
+assert(empty.shape==(0,))
+print 'empty query: ok'
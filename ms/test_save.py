@@ -0,0 +1,90 @@
+#! /usr/bin/env python
+
+# Copyright 2013 Tom SF Haines
+
+# Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except in compliance with the License. You may obtain a copy of the License at
+
+#   http://www.apache.org/licenses/LICENSE-2.0
+
+# Unless required by applicable law or agreed to in writing, software distributed under the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the License for the specific language governing permissions and limitations under the License.
+
+import os
+import time
+import tempfile
+import numpy
+import numpy.random
+
+from ms import MeanShift
+
+
+
+# Create a weighted data set - a mixture of Gaussians...
+means = [[3.0,2.0,4.0], [2.0,-1.0,8.0], [5.0,-1.0,8.0], [0.0,0.0,4.0]]
+quantity = 5000
+
+data = numpy.concatenate(map(lambda m: numpy.random.multivariate_normal(m, 0.5*numpy.eye(3), quantity), means), axis=0)
+weight = numpy.random.uniform(0.5, 1.5, data.shape[0])
+query = numpy.random.multivariate_normal([2.5, 0.0, 6.0], 4.0*numpy.eye(3), 1000)
+
+
+
+# Setup the mean shift object, cluster, then save it...
+ms = MeanShift()
+ms.set_data(numpy.concatenate((data, weight[:,numpy.newaxis]), axis=1), 'df', 3)
+ms.set_kernel('gaussian')
+ms.set_spatial('kd_tree')
+ms.set_scale(numpy.array([2.0, 2.0, 2.0]))
+ms.cluster()
+
+fn = os.path.join(tempfile.gettempdir(), 'test_save.ms')
+
+start = time.time()
+ms.save(fn)
+end = time.time()
+print 'save: %.3fs, file size = %.1f meg' % (end - start, os.path.getsize(fn) / (1024.0*1024.0))
+
+
+
+# Load it back in and check every answer matches...
+start = time.time()
+ms2 = MeanShift()
+ms2.load(fn)
+end = time.time()
+print 'load: %.3fs' % (end - start)
+
+tests = [('probs', lambda m: m.probs(query)),
+         ('modes', lambda m: m.modes(query)),
+         ('assign_clusters', lambda m: m.assign_clusters(query))]
+
+for name, func in tests:
+  print '%s: max difference = %f' % (name, numpy.fabs(func(ms) - func(ms2)).max())
+
+
+
+# A corrupt file must be rejected, not crash - point the data section past the end of the file, finding where its offset is stored from the layout of the header...
+f = open(fn, 'r+b')
+f.seek(MeanShift.save_layout()['data'])
+f.write(numpy.array([os.path.getsize(fn)], dtype=numpy.int64).tostring())
+f.close()
+
+try:
+  MeanShift().load(fn)
+  assert(False)
+except RuntimeError, e:
+  print 'corrupt file rejected: %s' % e
+
+os.remove(fn)
+
+
+
+# Dual dimensions can not be represented in the file, so saving them is an error...
+ms3 = MeanShift()
+ms3.set_data(numpy.random.normal(size=(20, 30)), 'bb')
+
+try:
+  ms3.save(fn)
+  assert(False)
+except RuntimeError, e:
+  print 'dual dimensions rejected: %s' % e
+
+if os.path.exists(fn): os.remove(fn)
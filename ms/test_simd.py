@@ -0,0 +1,74 @@
+#! /usr/bin/env python
+
+# Copyright 2013 Tom SF Haines
+
+# Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except in compliance with the License. You may obtain a copy of the License at
+
+#   http://www.apache.org/licenses/LICENSE-2.0
+
+# Unless required by applicable law or agreed to in writing, software distributed under the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the License for the specific language governing permissions and limitations under the License.
+
+import time
+import math
+import numpy
+import numpy.random
+
+from ms import MeanShift
+
+
+
+# Checks the block evaluation of the kernels, which is vectorised when the cpu supports it, against a direct numpy calculation of the Gaussian kernel density estimate...
+data = numpy.random.normal(size=(20000, 4))
+query = numpy.random.normal(size=(2000, 4))
+scale = numpy.array([3.0, 3.0, 2.0, 4.0])
+
+ms = MeanShift()
+ms.set_data(data, 'df')
+ms.set_kernel('gaussian')
+ms.set_scale(scale)
+ms.quality = 1.0
+
+start = time.time()
+probs = ms.probs(query)
+end = time.time()
+print 'gaussian probs: %.3fs' % (end - start)
+
+norm = numpy.prod(scale) / (math.pow(2.0 * numpy.pi, 0.5 * data.shape[1]) * data.shape[0])
+true = numpy.empty(query.shape[0])
+for i in xrange(query.shape[0]):
+  delta = (data - query[i,:][numpy.newaxis,:]) * scale[numpy.newaxis,:]
+  true[i] = norm * numpy.exp(-0.5 * numpy.square(delta).sum(axis=1)).sum()
+
+print 'gaussian: max relative difference = %f' % (numpy.fabs(probs - true) / true.max()).max()
+print
+
+
+
+# For the other kernels with a vectorised version compare the kd tree against brute force, for both probabilities and modes, to check nothing is lost when blocks are only partially filled...
+for kernel in ['uniform', 'triangular', 'epanechnikov', 'cauchy', 'fisher(32.0)']:
+  ans = dict()
+
+  if kernel.startswith('fisher'):
+    d = data / numpy.sqrt(numpy.square(data).sum(axis=1))[:,numpy.newaxis]
+    q = query / numpy.sqrt(numpy.square(query).sum(axis=1))[:,numpy.newaxis]
+  else:
+    d = data
+    q = query
+
+  for spatial in ['brute_force', 'kd_tree']:
+    ms = MeanShift()
+    ms.set_data(d, 'df')
+    if not kernel.startswith('fisher'): ms.set_scale(scale)
+    ms.set_kernel(kernel)
+    ms.set_spatial(spatial)
+
+    start = time.time()
+    ans[spatial] = (ms.probs(q), ms.modes(q[:100,:]))
+    end = time.time()
+
+    print '%s, %s: %.3fs' % (kernel, spatial, end - start)
+
+  bf = ans['brute_force']
+  kd = ans['kd_tree']
+  print '%s: max relative prob difference = %f, max mode difference = %f' % (kernel, (numpy.fabs(bf[0] - kd[0]) / bf[0].max()).max(), numpy.fabs(bf[1] - kd[1]).max())
+  print
@@ -0,0 +1,74 @@
+#! /usr/bin/env python
+
+# Copyright 2013 Tom SF Haines
+
+# Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except in compliance with the License. You may obtain a copy of the License at
+
+#   http://www.apache.org/licenses/LICENSE-2.0
+
+# Unless required by applicable law or agreed to in writing, software distributed under the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the License for the specific language governing permissions and limitations under the License.
+
+import time
+import numpy
+import numpy.random
+
+from ms import MeanShift
+
+
+
+# Create a stream of data, which drifts over time...
+length = 50000
+window = 5000
+drift = numpy.linspace(0.0, 10.0, length)
+
+stream = numpy.random.normal(size=(length, 2))
+stream[:,0] += drift
+stream = stream.astype(numpy.float32)
+
+query = numpy.random.normal(size=(200, 2)) * 3.0 + 5.0
+
+
+
+# Feed it into a mean shift object with a sliding window, in small chunks, checking against one built from scratch every so often...
+ms = MeanShift()
+ms.set_data(stream[:10], 'df')
+ms.set_kernel('epanechnikov')
+ms.set_spatial('kd_stream')
+ms.set_window(window)
+
+worst = 0.0
+start = time.time()
+for pos in xrange(10, length, 50):
+  ms.append(stream[pos:pos+50])
+  ms.prob(query[0])
+  
+  if (pos % 5000)==10:
+    end = pos + 50
+    ref = MeanShift()
+    ref.set_data(stream[max(0, end-window):end], 'df')
+    ref.set_kernel('epanechnikov')
+    ref.set_spatial('brute_force')
+    
+    worst = max(worst, numpy.fabs(ms.probs(query) - ref.probs(query)).max())
+
+end = time.time()
+
+print 'exemplars = %i (window = %i)' % (len(ms), window)
+print 'max difference from rebuilding = %f' % worst
+print 'time = %.3fs' % (end - start)
+
+
+
+# Appending must keep the data matrix in the type it was given, byte order included...
+swapped = stream[:100].astype(numpy.dtype(numpy.float32).newbyteorder())
+
+ms = MeanShift()
+ms.set_data(swapped[:10], 'df')
+ms.set_window(60)
+ms.append(swapped[10:50])
+ms.append(swapped[50:100])
+
+dm = ms.get_dm()
+assert(dm.dtype==swapped.dtype)
+assert(numpy.all(dm==stream[40:100]))
+print 'non-native byte order survives append'
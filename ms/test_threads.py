@@ -0,0 +1,53 @@
+#! /usr/bin/env python
+
+# Copyright 2013 Tom SF Haines
+
+# Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except in compliance with the License. You may obtain a copy of the License at
+
+#   http://www.apache.org/licenses/LICENSE-2.0
+
+# Unless required by applicable law or agreed to in writing, software distributed under the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the License for the specific language governing permissions and limitations under the License.
+
+import time
+import numpy
+import numpy.random
+
+from ms import MeanShift
+
+
+
+# Create a data set - a mixture of Gaussians...
+means = [[3.0,2.0,4.0], [2.0,-1.0,8.0], [5.0,-1.0,8.0], [0.0,0.0,4.0]]
+quantity = 5000
+
+data = numpy.concatenate(map(lambda m: numpy.random.multivariate_normal(m, 0.5*numpy.eye(3), quantity), means), axis=0)
+query = numpy.random.multivariate_normal([2.5, 0.0, 6.0], 4.0*numpy.eye(3), 20000)
+
+
+
+# Setup the mean shift object...
+ms = MeanShift()
+ms.set_data(data, 'df')
+ms.set_kernel('gaussian')
+ms.set_spatial('kd_tree')
+ms.set_scale(numpy.array([2.0, 2.0, 2.0]))
+
+
+
+# Run each batch method single threaded and with one thread per core - the answers should be identical...
+ms.cluster()
+
+tests = [('probs', lambda t: ms.probs(query, 0.0, t)),
+         ('modes', lambda t: ms.modes(query[:2000,:], t)),
+         ('modes_data', lambda t: ms.modes_data(t)),
+         ('assign_clusters', lambda t: ms.assign_clusters(query[:2000,:], t)),
+         ('manifolds', lambda t: ms.manifolds(query[:500,:], 1, True, t))]
+
+for name, func in tests:
+  start = time.time()
+  single = func(1)
+  mid = time.time()
+  multi = func(0)
+  end = time.time()
+  
+  print '%s: max difference = %f; time single = %.3fs, multi = %.3fs' % (name, numpy.fabs(single - multi).max(), mid - start, end - mid)